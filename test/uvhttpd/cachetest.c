@@ -0,0 +1,421 @@
+// regression tests of uv_httpd_cache: loads, coalesced misses, eviction, and requests of peers.
+// usage: cachetest
+// prints each case, exits with 1 if any fails.
+//
+// the loader answers `v:<key>` padded to `value_len` at once, UV_ENOENT for `missing`, and keeps
+// keys starting with `defer` until the case finishes them. the peer is a unix socket accepting
+// connections and never answering. requests of peers are in-memory connections of a server
+// calling `uv_httpd_cache_serve`. built with a peer timeout of 1000 ms, see the Makefile.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <signal.h>
+#include <unistd.h>
+#endif
+#include "uv_httpd.h"
+#include "uv_httpd_mem.h"
+#include "uv_httpd_cache.h"
+#include "mybuf.h"
+
+#define SELF_PATH "/tmp/cachetest-self.sock" // never asked
+#define PEER_PATH "/tmp/cachetest-peer.sock"
+#define GUARD_TIMEOUT 3000 // ms, a case without a value or response fails
+#define DEFERRED 4
+
+#define NOT_FOUND "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n"
+
+// the value of a get
+typedef struct {
+	int done;
+	int status;
+	char value[512];
+	size_t len;
+}result_t;
+
+static uv_loop_t* loop;
+static uv_httpd_server_t* server;
+static uv_httpd_cache_t* served; // of `server`
+static uv_pipe_t peer;
+static uv_pipe_t* peer_conns[16];
+static int npeer_conns;
+static uv_timer_t guard;
+static int timed_out;
+static size_t value_len; // of loaded values, at least `v:<key>`
+static int loads; // loader calls
+static uv_httpd_cache_load_t* deferred[DEFERRED];
+static int ndeferred;
+static int failures;
+
+
+/*************************** helper functions ****************/
+
+static void check(int ok, const char* what) {
+	printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+	if (!ok) failures++;
+}
+
+static void loader(uv_httpd_cache_t* cache, uv_httpd_cache_load_t* load, const char* key, size_t len) {
+	char value[512];
+	size_t n;
+
+	loads++;
+	if (len >= 5 && 0 == memcmp(key, "defer", 5) && ndeferred < DEFERRED) {
+		deferred[ndeferred++] = load;
+		return;
+	}
+	if (len == 7 && 0 == memcmp(key, "missing", 7)) {
+		uv_httpd_cache_loaded(load, UV_ENOENT, NULL, 0);
+		return;
+	}
+	n = (size_t)snprintf(value, sizeof(value), "v:%.*s", (int)len, key);
+	if (n >= sizeof(value)) n = sizeof(value) - 1;
+	if (value_len > n && value_len <= sizeof(value)) {
+		memset(value + n, '.', value_len - n);
+		n = value_len;
+	}
+	uv_httpd_cache_loaded(load, 0, value, n);
+}
+
+// finish the deferred load of `key` by its value
+static void finish_deferred(const char* key) {
+	char value[64];
+	int i;
+	snprintf(value, sizeof(value), "v:%s", key);
+	for (i = 0; i < ndeferred; i++) {
+		if (deferred[i]) {
+			uv_httpd_cache_load_t* load = deferred[i];
+			deferred[i] = NULL;
+			uv_httpd_cache_loaded(load, 0, value, strlen(value));
+			return;
+		}
+	}
+}
+
+static void on_value(void* data, int status, const char* value, size_t len) {
+	result_t* r = data;
+	r->done = 1;
+	r->status = status;
+	r->len = len < sizeof(r->value) ? len : sizeof(r->value);
+	if (value) memcpy(r->value, value, r->len);
+}
+
+static int value_is(const result_t* r, const char* value) {
+	return r->done && r->status == 0 && r->len == strlen(value) && 0 == memcmp(r->value, value, r->len);
+}
+
+static void get(uv_httpd_cache_t* cache, const char* key, result_t* r) {
+	int status;
+	memset(r, 0, sizeof(*r));
+	status = uv_httpd_cache_get(cache, key, strlen(key), on_value, r);
+	if (status) {
+		r->done = 1;
+		r->status = status;
+	}
+}
+
+static void on_guard(uv_timer_t* timer) {
+	timed_out = 1;
+}
+
+// run the loop until `r` is done, or GUARD_TIMEOUT
+static void wait_value(result_t* r) {
+	timed_out = 0;
+	uv_timer_start(&guard, on_guard, GUARD_TIMEOUT, 0);
+	while (!r->done && !timed_out) {
+		uv_run(loop, UV_RUN_ONCE);
+	}
+	uv_timer_stop(&guard);
+}
+
+static void on_request(uv_httpd_server_t* s, uv_httpd_client_t* client, uv_httpd_request_t* req) {
+	if (!uv_httpd_cache_serve(served, client, req)) {
+		uv_httpd_write_response(client, NOT_FOUND, sizeof(NOT_FOUND) - 1);
+	}
+}
+
+// status of the response to `request` of a peer, 0 if none in GUARD_TIMEOUT, its body in `body`
+static int send_request(const char* request, mybuf_t* body) {
+	uv_httpd_mem_t* mem;
+	mybuf_t* out;
+	int status = 0;
+
+	body->size = 0;
+	if (uv_httpd_mem_create(&mem, server)) return 0;
+	out = uv_httpd_mem_output(mem);
+	timed_out = 0;
+	uv_timer_start(&guard, on_guard, GUARD_TIMEOUT, 0);
+	uv_httpd_mem_feed(mem, request, strlen(request), 0);
+	while (!timed_out) {
+		const char* end, * cl;
+		if (!mybuf_append(out, "", 1)) out->size--;
+		end = out->size ? strstr(out->buf, "\r\n\r\n") : NULL;
+		if (end) {
+			size_t head = end + 4 - out->buf;
+			cl = strstr(out->buf, "Content-Length: ");
+			if (cl && out->size >= head + strtoul(cl + 16, NULL, 10)) {
+				status = atoi(out->buf + 9);
+				mybuf_append(body, out->buf + head, out->size - head);
+				break;
+			}
+		}
+		uv_run(loop, UV_RUN_ONCE);
+	}
+	uv_timer_stop(&guard);
+	uv_httpd_mem_free(mem);
+	return status;
+}
+
+static int body_is(const mybuf_t* body, const char* expected) {
+	return body->size == strlen(expected) && 0 == memcmp(body->buf, expected, body->size);
+}
+
+static void on_peer_alloc(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
+	static char slab[4096];
+	buf->base = slab;
+	buf->len = sizeof(slab);
+}
+
+static void on_peer_closed(uv_handle_t* handle) {
+	free(handle);
+}
+
+// requests are read and never answered
+static void on_peer_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
+	int i;
+	if (nread >= 0) return;
+	for (i = 0; i < npeer_conns; i++) {
+		if (peer_conns[i] == (uv_pipe_t*)stream) peer_conns[i] = NULL;
+	}
+	uv_close((uv_handle_t*)stream, on_peer_closed);
+}
+
+static void on_peer_connection(uv_stream_t* listener, int status) {
+	uv_pipe_t* conn;
+	if (status) return;
+	conn = malloc(sizeof(*conn));
+	uv_pipe_init(loop, conn, 0);
+	if (uv_accept(listener, (uv_stream_t*)conn) || npeer_conns == (int)(sizeof(peer_conns) / sizeof(peer_conns[0]))) {
+		uv_close((uv_handle_t*)conn, on_peer_closed);
+		return;
+	}
+	peer_conns[npeer_conns++] = conn;
+	uv_read_start((uv_stream_t*)conn, on_peer_alloc, on_peer_read);
+}
+
+// a cache of this instance and the silent peer
+static uv_httpd_cache_t* sharded_cache(void) {
+	uv_httpd_cache_t* cache;
+	if (uv_httpd_cache_create(&cache, loop, 100000, loader, NULL)) return NULL;
+	if (uv_httpd_cache_add_peer(cache, SELF_PATH, 1) || uv_httpd_cache_add_peer(cache, PEER_PATH, 0)) {
+		uv_httpd_cache_free(cache);
+		return NULL;
+	}
+	return cache;
+}
+
+// the first key of `cache` from `k<from>` owned by the peer, return its number
+static int peer_key(uv_httpd_cache_t* cache, int from, char* key, size_t size) {
+	int i;
+	for (i = from; i < from + 1000; i++) {
+		snprintf(key, size, "k%d", i);
+		if (uv_httpd_cache_owner(cache, key, strlen(key))) break;
+	}
+	return i;
+}
+
+// close `cache` and run the loop until its requests to peers are cancelled
+static void close_cache(uv_httpd_cache_t* cache) {
+	uv_httpd_cache_close(cache);
+	uv_run(loop, UV_RUN_NOWAIT);
+	uv_httpd_cache_free(cache);
+}
+
+
+/*************************** cases ****************/
+
+static void local_loads(void) {
+	uv_httpd_cache_t* cache;
+	uv_httpd_cache_stats_t stats;
+	result_t a, b, c;
+	char key[UV_HTTPD_CACHE_MAX_KEY + 2];
+
+	uv_httpd_cache_create(&cache, loop, 100000, loader, NULL);
+	loads = 0;
+	get(cache, "a", &a);
+	get(cache, "a", &b);
+	uv_httpd_cache_stats(cache, &stats);
+	check(value_is(&a, "v:a") && value_is(&b, "v:a") && loads == 1, "a key is loaded once, then found");
+	check(stats.misses == 1 && stats.hits == 1 && stats.entries == 1 && stats.bytes == 4,
+		  "a miss, a hit, the key and value in bytes");
+
+	get(cache, "missing", &a);
+	get(cache, "missing", &b);
+	check(a.done && a.status == UV_ENOENT && b.status == UV_ENOENT && loads == 3, "a failed load is not cached");
+
+	memset(key, 'k', sizeof(key) - 1);
+	key[sizeof(key) - 1] = '\0';
+	get(cache, key, &c);
+	check(c.status == UV_E2BIG && loads == 3, "a key over UV_HTTPD_CACHE_MAX_KEY is UV_E2BIG");
+	close_cache(cache);
+}
+
+static void coalesced(void) {
+	uv_httpd_cache_t* cache;
+	uv_httpd_cache_stats_t stats;
+	result_t a, b, c;
+
+	uv_httpd_cache_create(&cache, loop, 100000, loader, NULL);
+	loads = 0;
+	ndeferred = 0;
+	get(cache, "defer1", &a);
+	get(cache, "defer1", &b);
+	check(!a.done && !b.done && loads == 1, "a second miss waits for the load in progress");
+	finish_deferred("defer1");
+	get(cache, "defer1", &c);
+	uv_httpd_cache_stats(cache, &stats);
+	check(value_is(&a, "v:defer1") && value_is(&b, "v:defer1") && value_is(&c, "v:defer1"),
+		  "both get the value, then it is cached");
+	check(stats.coalesced == 1 && stats.misses == 1 && stats.hits == 1 && loads == 1, "one load of three gets");
+	close_cache(cache);
+}
+
+static void eviction(void) {
+	uv_httpd_cache_t* cache;
+	uv_httpd_cache_stats_t stats;
+	result_t r;
+	char key[16];
+	int i;
+
+	// keys of 2 bytes and values of 98, 10 fit
+	uv_httpd_cache_create(&cache, loop, 1000, loader, NULL);
+	value_len = 98;
+	for (i = 0; i < 10; i++) {
+		snprintf(key, sizeof(key), "k%d", i);
+		get(cache, key, &r);
+	}
+	get(cache, "k0", &r);
+	loads = 0;
+	get(cache, "kA", &r);
+	get(cache, "k0", &r);
+	get(cache, "k1", &r);
+	uv_httpd_cache_stats(cache, &stats);
+	check(loads == 2 && stats.evicted == 2 && stats.entries == 10 && stats.bytes == 1000,
+		  "the least recently used is evicted first");
+
+	value_len = 300;
+	loads = 0;
+	get(cache, "big", &r);
+	get(cache, "big", &r);
+	check(loads == 2 && r.len == 300, "a value over a quarter of the size is not cached");
+	value_len = 0;
+	close_cache(cache);
+}
+
+static void serve(void) {
+	mybuf_t body;
+	int status;
+
+	mybuf_init(&body);
+	uv_httpd_cache_create(&served, loop, 100000, loader, NULL);
+	loads = 0;
+	status = send_request("GET /_cache/a%20b HTTP/1.1\r\nHost: x\r\n\r\n", &body);
+	check(status == 200 && body_is(&body, "v:a b"), "GET /_cache/<key> is answered by the decoded key's value");
+	status = send_request("GET /_cache/a%20b HTTP/1.1\r\nHost: x\r\n\r\n", &body);
+	check(status == 200 && body_is(&body, "v:a b") && loads == 1, "and from the cache");
+	status = send_request("GET /_cache/missing HTTP/1.1\r\nHost: x\r\n\r\n", &body);
+	check(status == 404, "a key failing with UV_ENOENT is 404");
+	status = send_request("POST /_cache/a HTTP/1.1\r\nHost: x\r\nContent-Length: 0\r\n\r\n", &body);
+	check(status == 405, "other methods are 405");
+	status = send_request("GET /cache/a HTTP/1.1\r\nHost: x\r\n\r\n", &body);
+	check(status == 404 && loads == 2, "other paths are left to the application");
+	close_cache(served);
+	served = NULL;
+	mybuf_clear(&body);
+}
+
+static void silent_peer(void) {
+	uv_httpd_cache_t* cache = sharded_cache();
+	uv_httpd_cache_stats_t stats;
+	result_t a, b;
+	char key[16], request[128], value[32];
+	const char* owner;
+	mybuf_t body;
+	uint64_t start, ms;
+	int status, i;
+
+	if (!cache) {
+		check(0, "a cache with a peer");
+		return;
+	}
+	mybuf_init(&body);
+	i = peer_key(cache, 0, key, sizeof(key));
+	snprintf(value, sizeof(value), "v:%s", key);
+	owner = uv_httpd_cache_owner(cache, key, strlen(key));
+	check(owner && 0 == strcmp(owner, PEER_PATH), "keys are owned by the peer or this instance");
+
+	loads = 0;
+	start = uv_hrtime();
+	get(cache, key, &a);
+	check(!a.done && loads == 0, "a key of the peer is asked from it");
+
+	// a peer asks this instance for the key while it asks the peer, e.g. their membership differs
+	served = cache;
+	snprintf(request, sizeof(request), "GET /_cache/%s HTTP/1.1\r\nHost: x\r\n\r\n", key);
+	status = send_request(request, &body);
+	ms = (uv_hrtime() - start) / 1000000;
+	check(status == 200 && body_is(&body, value) && loads == 1 && !a.done,
+		  "a request of a peer is loaded here, not coalesced with the get asking the peer");
+	check(ms < UV_HTTPD_CACHE_PEER_TIMEOUT, "before the peer timeout");
+
+	wait_value(&a);
+	ms = (uv_hrtime() - start) / 1000000;
+	uv_httpd_cache_stats(cache, &stats);
+	check(value_is(&a, value) && stats.remote == 1 && stats.remote_failed == 1 && loads == 2,
+		  "the silent peer is given up, the key loaded here");
+	check(ms >= UV_HTTPD_CACHE_PEER_TIMEOUT && ms < GUARD_TIMEOUT, "after the peer timeout");
+
+	peer_key(cache, i + 1, key, sizeof(key));
+	get(cache, key, &b);
+	check(!b.done, "another key of the peer is asked from it");
+	close_cache(cache);
+	check(b.done && b.status == UV_ECANCELED, "close cancels the requests to peers");
+	served = NULL;
+	mybuf_clear(&body);
+}
+
+int main(int argc, char** argv) {
+	int i, r;
+
+#ifndef _WIN32
+	signal(SIGPIPE, SIG_IGN);
+	unlink(PEER_PATH);
+#endif
+	loop = uv_default_loop();
+	uv_timer_init(loop, &guard);
+	uv_pipe_init(loop, &peer, 0);
+	r = uv_pipe_bind(&peer, PEER_PATH);
+	if (!r) r = uv_listen((uv_stream_t*)&peer, 16, on_peer_connection);
+	if (!r) r = uv_httpd_create(&server, loop, on_request);
+	if (r) {
+		fprintf(stderr, "%d %s\n", r, uv_err_name(r));
+		return 1;
+	}
+
+	local_loads();
+	coalesced();
+	eviction();
+	serve();
+	silent_peer();
+
+	for (i = 0; i < npeer_conns; i++) {
+		if (peer_conns[i]) uv_close((uv_handle_t*)peer_conns[i], on_peer_closed);
+	}
+	uv_close((uv_handle_t*)&peer, NULL);
+	uv_close((uv_handle_t*)&guard, NULL);
+	uv_httpd_stop(server);
+	uv_run(loop, UV_RUN_DEFAULT);
+	uv_httpd_free(server);
+	return failures ? 1 : 0;
+}
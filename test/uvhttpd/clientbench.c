@@ -0,0 +1,275 @@
+// benchmark of uv_http_client against a running server, e.g. `uvhttpd -l 8000`.
+// usage: clientbench [-n requests] [-c connections] [-d depth] [-u url] [-m client|curl]
+//   -n: requests, default is 100000
+//   -c: connections, default is 1
+//   -d: requests in flight per connection, pipelined by uv_http_client, default is 1
+//   -u: url, default is http://127.0.0.1:8000/api/ping
+//   -m: uv_http_client, or libcurl multi driven by the same loop if built with -DWITH_CURL -lcurl.
+//       libcurl doesn't pipeline, it runs connections * depth transfers on `connections` connections
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/resource.h>
+#endif
+#include "uv_http_client.h"
+#ifdef WITH_CURL
+#include <curl/curl.h>
+#endif
+
+static uv_loop_t* loop;
+static size_t total = 100000, started, done, failed;
+static uint64_t body_bytes;
+static const char* url = "http://127.0.0.1:8000/api/ping";
+
+static double cpu_seconds(void) {
+#ifndef _WIN32
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+#else
+	return 0;
+#endif
+}
+
+
+/*************************** uv_http_client ****************/
+
+static void client_next(uv_http_client_t* client);
+
+static void on_client_body(uv_http_client_req_t* req, const char* at, size_t len) {
+	body_bytes += len;
+}
+
+static void on_client_done(uv_http_client_req_t* req, int status) {
+	uv_http_client_t* client = uv_http_client_req_data(req);
+	if (status) {
+		if (failed++ == 0) fprintf(stderr, "request failed: %s\n", uv_err_name(status));
+	}
+	if (++done == total) {
+		uv_stop(loop);
+		return;
+	}
+	client_next(client);
+}
+
+static void client_next(uv_http_client_t* client) {
+	uv_http_client_options_t opts;
+	int r;
+
+	if (started == total) return;
+	memset(&opts, 0, sizeof(opts));
+	opts.method = HTTP_GET;
+	opts.url = url;
+	opts.on_body = on_client_body;
+	opts.on_done = on_client_done;
+	opts.data = client;
+	r = uv_http_client_request(client, &opts, NULL);
+	if (r) {
+		fprintf(stderr, "uv_http_client_request: %s\n", uv_err_name(r));
+		exit(1);
+	}
+	started++;
+}
+
+static void run_client(int connections, int depth) {
+	uv_http_client_t* client;
+	uv_http_client_stats_t* s;
+	int r = uv_http_client_create(&client, loop);
+	if (r) {
+		fprintf(stderr, "uv_http_client_create: %s\n", uv_err_name(r));
+		exit(1);
+	}
+	client->max_connections = connections;
+	client->pipeline = depth;
+	for (int i = 0; i < connections * depth; i++) {
+		client_next(client);
+	}
+	uv_run(loop, UV_RUN_DEFAULT);
+	s = &client->stats;
+	printf("connections %llu, reused %llu, pipelined %llu, retried %llu\n",
+		   (unsigned long long)s->connections, (unsigned long long)s->reused,
+		   (unsigned long long)s->pipelined, (unsigned long long)s->retried);
+	uv_http_client_close(client);
+	uv_run(loop, UV_RUN_DEFAULT);
+	uv_http_client_free(client);
+}
+
+
+/*************************** libcurl multi ****************/
+
+#ifdef WITH_CURL
+
+typedef struct {
+	uv_poll_t poll;
+	curl_socket_t fd;
+}curl_socket_ctx_t;
+
+static CURLM* multi;
+static uv_timer_t curl_timer;
+static struct curl_slist* curl_headers;
+
+static size_t on_curl_write(char* ptr, size_t size, size_t nmemb, void* userdata) {
+	body_bytes += size * nmemb;
+	return size * nmemb;
+}
+
+static void curl_start(CURL* easy) {
+	if (!easy) {
+		easy = curl_easy_init();
+		curl_easy_setopt(easy, CURLOPT_URL, url);
+		curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, on_curl_write);
+		// uvhttpd keeps the connection only if asked
+		curl_easy_setopt(easy, CURLOPT_HTTPHEADER, curl_headers);
+	}
+	curl_multi_add_handle(multi, easy);
+	started++;
+}
+
+static void curl_check_done(void) {
+	CURLMsg* msg;
+	int pending;
+	while ((msg = curl_multi_info_read(multi, &pending))) {
+		CURL* easy;
+		if (msg->msg != CURLMSG_DONE) continue;
+		easy = msg->easy_handle;
+		if (msg->data.result != CURLE_OK) {
+			if (failed++ == 0) fprintf(stderr, "request failed: %s\n", curl_easy_strerror(msg->data.result));
+		}
+		curl_multi_remove_handle(multi, easy);
+		if (++done == total) {
+			uv_stop(loop);
+		}
+		if (started < total) {
+			curl_start(easy);
+		} else {
+			curl_easy_cleanup(easy);
+		}
+	}
+}
+
+static void on_curl_poll(uv_poll_t* poll, int status, int events) {
+	curl_socket_ctx_t* ctx = (curl_socket_ctx_t*)poll;
+	int flags = 0, running;
+	if (status < 0) flags = CURL_CSELECT_ERR;
+	if (events & UV_READABLE) flags |= CURL_CSELECT_IN;
+	if (events & UV_WRITABLE) flags |= CURL_CSELECT_OUT;
+	curl_multi_socket_action(multi, ctx->fd, flags, &running);
+	curl_check_done();
+}
+
+static void on_curl_timer(uv_timer_t* timer) {
+	int running;
+	curl_multi_socket_action(multi, CURL_SOCKET_TIMEOUT, 0, &running);
+	curl_check_done();
+}
+
+static void on_poll_closed(uv_handle_t* handle) {
+	free(handle);
+}
+
+static int on_curl_socket(CURL* easy, curl_socket_t fd, int action, void* userp, void* socketp) {
+	curl_socket_ctx_t* ctx = socketp;
+	int events = 0;
+
+	if (action == CURL_POLL_REMOVE) {
+		if (ctx) {
+			uv_poll_stop(&ctx->poll);
+			uv_close((uv_handle_t*)&ctx->poll, on_poll_closed);
+			curl_multi_assign(multi, fd, NULL);
+		}
+		return 0;
+	}
+	if (!ctx) {
+		ctx = malloc(sizeof(*ctx));
+		ctx->fd = fd;
+		uv_poll_init_socket(loop, &ctx->poll, fd);
+		curl_multi_assign(multi, fd, ctx);
+	}
+	if (action & CURL_POLL_IN) events |= UV_READABLE;
+	if (action & CURL_POLL_OUT) events |= UV_WRITABLE;
+	uv_poll_start(&ctx->poll, events, on_curl_poll);
+	return 0;
+}
+
+static int on_curl_timeout(CURLM* m, long timeout_ms, void* userp) {
+	if (timeout_ms < 0) {
+		uv_timer_stop(&curl_timer);
+	} else {
+		uv_timer_start(&curl_timer, on_curl_timer, (uint64_t)timeout_ms, 0);
+	}
+	return 0;
+}
+
+static void run_curl(int connections, int depth) {
+	curl_global_init(CURL_GLOBAL_DEFAULT);
+	multi = curl_multi_init();
+	curl_headers = curl_slist_append(NULL, "Connection: keep-alive");
+	uv_timer_init(loop, &curl_timer);
+	curl_multi_setopt(multi, CURLMOPT_SOCKETFUNCTION, on_curl_socket);
+	curl_multi_setopt(multi, CURLMOPT_TIMERFUNCTION, on_curl_timeout);
+	curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)connections);
+	for (int i = 0; i < connections * depth && started < total; i++) {
+		curl_start(NULL);
+	}
+	uv_run(loop, UV_RUN_DEFAULT);
+	curl_multi_cleanup(multi);
+	curl_slist_free_all(curl_headers);
+	uv_close((uv_handle_t*)&curl_timer, NULL);
+	uv_run(loop, UV_RUN_DEFAULT);
+	curl_global_cleanup();
+}
+
+#endif
+
+
+int main(int argc, char** argv) {
+	int connections = 1, depth = 1, i;
+	const char* mode = "client";
+	uint64_t start;
+	double cpu, secs;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			total = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+			connections = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+			depth = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc) {
+			url = argv[++i];
+		} else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+			mode = argv[++i];
+		}
+	}
+	if (connections < 1) connections = 1;
+	if (depth < 1) depth = 1;
+	if (total == 0) return 0;
+
+#ifndef _WIN32
+	// writes to a connection the server closed fail with EPIPE instead
+	signal(SIGPIPE, SIG_IGN);
+#endif
+	loop = uv_default_loop();
+	cpu = cpu_seconds();
+	start = uv_hrtime();
+	if (strcmp(mode, "curl") == 0) {
+#ifdef WITH_CURL
+		run_curl(connections, depth);
+#else
+		fprintf(stderr, "built without -DWITH_CURL\n");
+		return 1;
+#endif
+	} else {
+		run_client(connections, depth);
+	}
+	secs = (uv_hrtime() - start) / 1e9;
+	cpu = cpu_seconds() - cpu;
+
+	printf("%s: %zu requests, %zu failed, %llu body bytes, %.2f s\n", mode, done, failed,
+		   (unsigned long long)body_bytes, secs);
+	printf("%.0f requests/s, %.2f us cpu/request\n", done / secs, cpu * 1e6 / done);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,310 @@
+// regression tests of uv_http_client against a uv_httpd server on the same loop.
+// usage: clienttest
+// prints each case, exits with 1 if any fails.
+//
+// the server listens on loopback and on a unix socket, it answers `ok` to every request except:
+//   /echo: the request body and its X-Test header
+//   /chunked: a chunked body
+//   /missing: 404
+//   /hang: never answered
+//   /drop on a connection that answered a request already: closed unanswered, a stale pooled one
+// built with a client timeout of 1000 ms, see the Makefile.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <signal.h>
+#include <unistd.h>
+#endif
+#include "uv_httpd.h"
+#include "uv_http_client.h"
+#include "mybuf.h"
+
+#define PORT 18953
+#define BASE_URL "http://127.0.0.1:18953"
+#define PIPE_PATH "/tmp/clienttest.sock"
+#define PIPE_URL "http+unix://%2Ftmp%2Fclienttest.sock"
+#define GUARD_TIMEOUT 3000 // ms, a case without a response fails
+#define REQUESTS 4
+
+#define OK_RESPONSE \
+	"HTTP/1.1 200 OK\r\n" \
+	"Content-Type: text/plain\r\n" \
+	"Content-Length: 3\r\n" \
+	"\r\n" \
+	"ok\n"
+
+#define CHUNKED_RESPONSE \
+	"HTTP/1.1 200 OK\r\n" \
+	"Content-Type: text/plain\r\n" \
+	"Transfer-Encoding: chunked\r\n" \
+	"\r\n" \
+	"3\r\nabc\r\n" \
+	"3\r\ndef\r\n" \
+	"0\r\n\r\n"
+
+#define NOT_FOUND "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n"
+
+// the response of a request
+typedef struct {
+	int done;
+	int status; // of on_done
+	int code; // HTTP status
+	int has_content_length;
+	mybuf_t body;
+}result_t;
+
+static uv_loop_t* loop;
+static uv_httpd_server_t* server;
+static uv_http_client_t* client;
+static uv_timer_t guard;
+static int timed_out;
+static int failures;
+
+
+/*************************** server ****************/
+
+static void on_hang_abort(uv_httpd_client_t* c) {
+}
+
+static void on_request(uv_httpd_server_t* s, uv_httpd_client_t* c, uv_httpd_request_t* req) {
+	// requests answered on the connection
+	intptr_t answered = (intptr_t)uv_httpd_client_get_data(c);
+	const char* path = req->base + req->url.offset;
+	size_t len = req->url.len;
+
+	if (0 == string0_ncmp("/drop", path, len) && answered) {
+		uv_httpd_abort(c);
+		return;
+	}
+	uv_httpd_client_set_data(c, (void*)(answered + 1));
+	if (0 == string0_ncmp("/echo", path, len)) {
+		const uv_httpd_string_t* test = uv_httpd_header(req, "X-Test");
+		mybuf_t res;
+		mybuf_init(&res);
+		mybuf_cat_printf(&res, "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\n\r\n%.*s %.*s",
+						 req->body.len + 1 + (test ? test->len : 0), (int)req->body.len, req->base + req->body.offset,
+						 test ? (int)test->len : 0, test ? req->base + test->offset : "");
+		uv_httpd_write_response(c, res.buf, res.size);
+		mybuf_clear(&res);
+	} else if (0 == string0_ncmp("/chunked", path, len)) {
+		uv_httpd_write_response(c, CHUNKED_RESPONSE, sizeof(CHUNKED_RESPONSE) - 1);
+	} else if (0 == string0_ncmp("/missing", path, len)) {
+		uv_httpd_write_response(c, NOT_FOUND, sizeof(NOT_FOUND) - 1);
+	} else if (0 == string0_ncmp("/hang", path, len)) {
+		uv_httpd_defer_response(c, on_hang_abort);
+	} else {
+		uv_httpd_write_response(c, OK_RESPONSE, sizeof(OK_RESPONSE) - 1);
+	}
+}
+
+
+/*************************** helper functions ****************/
+
+static void check(int ok, const char* what) {
+	printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+	if (!ok) failures++;
+}
+
+static int on_headers(uv_http_client_req_t* req, const uv_http_client_res_t* res) {
+	result_t* r = uv_http_client_req_data(req);
+	r->code = res->status;
+	r->has_content_length = res->has_content_length;
+	return 0;
+}
+
+static void on_body(uv_http_client_req_t* req, const char* at, size_t len) {
+	result_t* r = uv_http_client_req_data(req);
+	mybuf_append(&r->body, at, len);
+}
+
+static void on_done(uv_http_client_req_t* req, int status) {
+	result_t* r = uv_http_client_req_data(req);
+	r->done = 1;
+	r->status = status;
+}
+
+static void on_guard(uv_timer_t* timer) {
+	timed_out = 1;
+}
+
+// start a request of `url`, `r` is done at once if it fails to start
+static void start(llhttp_method_t method, const char* url, const char* headers, const char* body, result_t* r) {
+	uv_http_client_options_t opts;
+	int status;
+
+	memset(r, 0, sizeof(*r));
+	mybuf_init(&r->body);
+	memset(&opts, 0, sizeof(opts));
+	opts.method = method;
+	opts.url = url;
+	opts.headers = headers;
+	opts.body = body;
+	opts.body_len = body ? strlen(body) : 0;
+	opts.on_headers = on_headers;
+	opts.on_body = on_body;
+	opts.on_done = on_done;
+	opts.data = r;
+	status = uv_http_client_request(client, &opts, NULL);
+	if (status) {
+		r->done = 1;
+		r->status = status;
+	}
+}
+
+// run the loop until `n` results are done, or GUARD_TIMEOUT
+static void wait_all(result_t* r, int n) {
+	int i = 0;
+	timed_out = 0;
+	uv_timer_start(&guard, on_guard, GUARD_TIMEOUT, 0);
+	while (!timed_out) {
+		while (i < n && r[i].done) i++;
+		if (i == n) break;
+		uv_run(loop, UV_RUN_ONCE);
+	}
+	uv_timer_stop(&guard);
+}
+
+static void request(llhttp_method_t method, const char* url, const char* headers, const char* body, result_t* r) {
+	start(method, url, headers, body, r);
+	wait_all(r, 1);
+}
+
+// answered by `code` and `body`
+static int response_is(result_t* r, int code, const char* body) {
+	int ok = r->done && r->status == 0 && r->code == code
+		&& r->body.size == strlen(body) && 0 == memcmp(r->body.buf, body, r->body.size);
+	mybuf_clear(&r->body);
+	return ok;
+}
+
+
+/*************************** cases ****************/
+
+static void keep_alive(void) {
+	result_t a, b;
+
+	request(HTTP_GET, BASE_URL "/", NULL, NULL, &a);
+	request(HTTP_GET, BASE_URL "/a?b=c", NULL, NULL, &b);
+	check(response_is(&a, 200, "ok\n") && a.has_content_length && response_is(&b, 200, "ok\n"), "GET is answered");
+	check(client->stats.connections == 1 && client->stats.reused == 1 && client->stats.requests == 2,
+		  "the second one on the pooled connection");
+}
+
+static void bodies(void) {
+	result_t r;
+
+	request(HTTP_POST, BASE_URL "/echo", "X-Test: 1\r\n", "hello", &r);
+	check(response_is(&r, 200, "hello 1"), "POST sends its body and extra headers");
+	request(HTTP_GET, BASE_URL "/chunked", NULL, NULL, &r);
+	check(!r.has_content_length && response_is(&r, 200, "abcdef"), "a chunked body is streamed without the framing");
+	request(HTTP_GET, BASE_URL "/missing", NULL, NULL, &r);
+	check(response_is(&r, 404, ""), "a 404 is a complete response");
+}
+
+static void urls(void) {
+	result_t r;
+
+	request(HTTP_GET, PIPE_URL "/", NULL, NULL, &r);
+	check(response_is(&r, 200, "ok\n"), "http+unix:// reaches the unix socket");
+	start(HTTP_GET, "ftp://127.0.0.1/", NULL, NULL, &r);
+	check(r.done && r.status == UV_EINVAL, "other schemes are UV_EINVAL");
+	start(HTTP_GET, "http://127.0.0.1:99999/", NULL, NULL, &r);
+	check(r.done && r.status == UV_EINVAL, "a bad port is UV_EINVAL");
+}
+
+static void pipelining(void) {
+	result_t r[REQUESTS];
+	uv_http_client_stats_t before = client->stats;
+	char headers[REQUESTS][32], body[8];
+	int i, ok = 1;
+
+	client->max_connections = 1;
+	client->pipeline = REQUESTS;
+	for (i = 0; i < REQUESTS; i++) {
+		snprintf(headers[i], sizeof(headers[i]), "X-Test: %d\r\n", i);
+		start(HTTP_GET, BASE_URL "/echo", headers[i], NULL, &r[i]);
+	}
+	wait_all(r, REQUESTS);
+	for (i = 0; i < REQUESTS; i++) {
+		snprintf(body, sizeof(body), " %d", i);
+		ok &= response_is(&r[i], 200, body);
+	}
+	check(ok, "GETs at once on one connection are answered in order");
+	check(client->stats.pipelined - before.pipelined == REQUESTS - 1 && client->stats.connections == before.connections,
+		  "pipelined up to `pipeline` deep");
+	client->max_connections = UV_HTTP_CLIENT_MAX_CONNECTIONS;
+	client->pipeline = UV_HTTP_CLIENT_PIPELINE;
+}
+
+static void stale_connection(void) {
+	uv_http_client_stats_t before = client->stats;
+	result_t r;
+
+	request(HTTP_GET, BASE_URL "/drop", NULL, NULL, &r);
+	check(response_is(&r, 200, "ok\n") && client->stats.retried - before.retried == 1,
+		  "GET on a stale pooled connection is sent again");
+	check(client->stats.connections - before.connections == 1, "on a new connection");
+
+	request(HTTP_POST, BASE_URL "/drop", NULL, "x", &r);
+	check(r.done && r.status == UV_ECONNRESET && client->stats.retried - before.retried == 1,
+		  "POST on a stale pooled connection fails, never sent twice");
+	mybuf_clear(&r.body);
+}
+
+static void timeout(void) {
+	uint64_t start_ns = uv_hrtime(), ms;
+	result_t r;
+
+	request(HTTP_GET, BASE_URL "/hang", NULL, NULL, &r);
+	ms = (uv_hrtime() - start_ns) / 1000000;
+	check(r.done && r.status == UV_ETIMEDOUT, "a request never answered is UV_ETIMEDOUT");
+	check(ms >= UV_HTTP_CLIENT_TIMEOUT && ms < GUARD_TIMEOUT, "after the timeout");
+	mybuf_clear(&r.body);
+}
+
+static void closing(void) {
+	result_t r;
+
+	start(HTTP_GET, BASE_URL "/hang", NULL, NULL, &r);
+	uv_run(loop, UV_RUN_NOWAIT);
+	uv_http_client_close(client);
+	wait_all(&r, 1);
+	check(r.done && r.status == UV_ECANCELED, "close cancels the requests in flight");
+	mybuf_clear(&r.body);
+}
+
+int main(int argc, char** argv) {
+	int r;
+
+#ifndef _WIN32
+	signal(SIGPIPE, SIG_IGN);
+	unlink(PIPE_PATH);
+#endif
+	loop = uv_default_loop();
+	uv_timer_init(loop, &guard);
+	r = uv_httpd_create(&server, loop, on_request);
+	if (!r) r = uv_httpd_listen(server, "127.0.0.1", PORT);
+	if (!r) r = uv_httpd_listen_pipe(server, PIPE_PATH);
+	if (!r) r = uv_http_client_create(&client, loop);
+	if (r) {
+		fprintf(stderr, "%d %s\n", r, uv_err_name(r));
+		return 1;
+	}
+
+	keep_alive();
+	bodies();
+	urls();
+	pipelining();
+	stale_connection();
+	timeout();
+	closing();
+
+	uv_close((uv_handle_t*)&guard, NULL);
+	uv_httpd_stop(server);
+	uv_run(loop, UV_RUN_DEFAULT);
+	uv_http_client_free(client);
+	uv_httpd_free(server);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,278 @@
+// cost of uv_httpd_co.hpp against plain callbacks.
+// usage: cobench [-n requests] [-h hops] [-w works] [-r rounds]
+//   -n: requests, default is 1000000
+//   -h: steps of a handler before it responds, default is 4.
+//       a callback step allocates its context and calls the next one,
+//       a coroutine step awaits a nested task
+//   -w: chains of 4 uv_queue_work hops, run by callbacks and by coroutines, default is 20000
+//   -r: rounds, the modes are interleaved and the best of each is reported, default is 5
+//
+// requests are fed to an in-memory connection like membench, answered by:
+//   sync:  a plain `on_request`, the response written before it returns
+//   defer: `uv_httpd_defer_response` and callback steps
+//   co:    `uv_httpd_co::on_request` and task steps
+// then the steps alone, and chains of uv_queue_work.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "uv_httpd_co.hpp"
+#include "uv_httpd_mem.h"
+#include "mybuf.h"
+
+#define RESPONSE \
+  "HTTP/1.1 200 OK\r\n" \
+  "Content-Type: text/plain\r\n" \
+  "Content-Length: 12\r\n" \
+  "\r\n" \
+  "hello world\n"
+
+#define WORK_HOPS 4
+
+static const char request_text[] =
+	"GET /api/ping HTTP/1.1\r\n"
+	"Host: 127.0.0.1:8000\r\n"
+	"User-Agent: curl/7.88.1\r\n"
+	"Accept: */*\r\n"
+	"Connection: keep-alive\r\n"
+	"\r\n";
+
+static int hops = 4;
+static volatile unsigned sink;
+
+
+/*************************** sync ****************/
+
+static void on_request_sync(uv_httpd_server_t* server, uv_httpd_client_t* client, uv_httpd_request_t* req) {
+	uv_httpd_write_response(client, (char*)RESPONSE, sizeof(RESPONSE) - 1);
+}
+
+
+/*************************** callbacks ****************/
+
+struct step_ctx {
+	uv_httpd_client_t* client;
+	int left;
+	void (*next)(struct step_ctx* ctx);
+};
+
+static void step(step_ctx* ctx) {
+	sink = sink + ctx->left;
+	if (ctx->left-- > 0) {
+		// a callback chain carries its state to the next hop in a new context
+		step_ctx* next = (step_ctx*)malloc(sizeof(*next));
+		*next = *ctx;
+		free(ctx);
+		next->next(next);
+		return;
+	}
+	uv_httpd_write_response(ctx->client, (char*)RESPONSE, sizeof(RESPONSE) - 1);
+	uv_httpd_response_done(ctx->client);
+	free(ctx);
+}
+
+static void on_abort_defer(uv_httpd_client_t* client) {
+}
+
+static void on_request_defer(uv_httpd_server_t* server, uv_httpd_client_t* client, uv_httpd_request_t* req) {
+	step_ctx* ctx = (step_ctx*)malloc(sizeof(*ctx));
+	uv_httpd_defer_response(client, on_abort_defer);
+	ctx->client = client;
+	ctx->left = hops;
+	ctx->next = step;
+	step(ctx);
+}
+
+
+/*************************** coroutines ****************/
+
+static uv_httpd_co::task<int> co_step(int left) {
+	sink = sink + left;
+	if (left > 0) co_return co_await co_step(left - 1) + 1;
+	co_return 0;
+}
+
+static uv_httpd_co::task<void> co_handler(uv_httpd_co::request& r) {
+	if (hops) co_await co_step(hops - 1);
+	r.respond((char*)RESPONSE, sizeof(RESPONSE) - 1);
+}
+
+
+/*************************** requests ****************/
+
+static double bench_requests(on_request_t on_request, size_t n) {
+	uv_httpd_server_t* server;
+	uv_httpd_mem_t* mem;
+	mybuf_t* output;
+	uint64_t start, ns;
+	int r = uv_httpd_create(&server, uv_default_loop(), on_request);
+	if (!r) r = uv_httpd_mem_create(&mem, server);
+	if (r) {
+		fprintf(stderr, "%d %s\n", r, uv_err_name(r));
+		exit(1);
+	}
+	output = uv_httpd_mem_output(mem);
+	start = 0;
+	// a tenth to warm up caches and pools
+	for (size_t i = 0; i < n + n / 10; i++) {
+		if (i == n / 10) start = uv_hrtime();
+		if (uv_httpd_mem_feed(mem, request_text, sizeof(request_text) - 1, 0) != sizeof(request_text) - 1
+			|| output->size != sizeof(RESPONSE) - 1) {
+			fprintf(stderr, "request not answered\n");
+			exit(1);
+		}
+		output->size = 0;
+	}
+	ns = uv_hrtime() - start;
+	uv_httpd_mem_free(mem);
+	uv_httpd_stop(server);
+	uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+	uv_httpd_free(server);
+	return (double)ns / n;
+}
+
+
+/*************************** steps only ****************/
+
+static void step_only(step_ctx* ctx) {
+	sink = sink + ctx->left;
+	if (ctx->left-- > 0) {
+		step_ctx* next = (step_ctx*)malloc(sizeof(*next));
+		*next = *ctx;
+		free(ctx);
+		next->next(next);
+		return;
+	}
+	free(ctx);
+}
+
+// `hops` + 1 frames with the detached root, as many as the callback contexts
+static uv_httpd_co::task<void> co_step_only(int left) {
+	sink = sink + left;
+	if (left > 0) co_await co_step_only(left - 1);
+}
+
+// ns per chain of `hops` steps, without the request
+static double bench_steps(int co, size_t n) {
+	uint64_t start = uv_hrtime();
+	for (size_t i = 0; i < n; i++) {
+		if (co) {
+			uv_httpd_co::spawn(co_step_only(hops - 1));
+		} else {
+			step_ctx* ctx = (step_ctx*)malloc(sizeof(*ctx));
+			ctx->client = NULL;
+			ctx->left = hops;
+			ctx->next = step_only;
+			step_only(ctx);
+		}
+	}
+	return (double)(uv_hrtime() - start) / n;
+}
+
+
+/*************************** uv_queue_work ****************/
+
+static size_t works_left;
+
+struct work_ctx {
+	uv_work_t req;
+	int left;
+};
+
+static void on_work(uv_work_t* req) {
+	sink = sink + 1;
+}
+
+static void work_chain_start();
+
+static void on_after_work(uv_work_t* req, int status) {
+	work_ctx* ctx = (work_ctx*)req->data;
+	if (--ctx->left > 0) {
+		work_ctx* next = (work_ctx*)malloc(sizeof(*next));
+		next->left = ctx->left;
+		next->req.data = next;
+		free(ctx);
+		uv_queue_work(uv_default_loop(), &next->req, on_work, on_after_work);
+		return;
+	}
+	free(ctx);
+	work_chain_start();
+}
+
+static void work_chain_start() {
+	work_ctx* ctx;
+	if (works_left == 0) return;
+	works_left--;
+	ctx = (work_ctx*)malloc(sizeof(*ctx));
+	ctx->left = WORK_HOPS;
+	ctx->req.data = ctx;
+	uv_queue_work(uv_default_loop(), &ctx->req, on_work, on_after_work);
+}
+
+static uv_httpd_co::task<void> co_work_chains() {
+	while (works_left) {
+		works_left--;
+		for (int i = 0; i < WORK_HOPS; i++) {
+			co_await uv_httpd_co::queue_work(uv_default_loop(), [] { sink = sink + 1; });
+		}
+	}
+}
+
+static double bench_works(int co, size_t n) {
+	uint64_t start = uv_hrtime();
+	works_left = n;
+	if (co) {
+		uv_httpd_co::spawn(co_work_chains());
+	} else {
+		work_chain_start();
+	}
+	uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+	return (double)(uv_hrtime() - start) / (n * WORK_HOPS);
+}
+
+
+static void keep_min(double* best, double v) {
+	if (*best == 0 || v < *best) *best = v;
+}
+
+int main(int argc, char** argv) {
+	size_t n = 1000000, works = 20000;
+	int rounds = 5;
+	double sync = 0, defer = 0, co = 0, steps_cb = 0, steps_co = 0, work_cb = 0, work_co = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			n = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-h") == 0 && i + 1 < argc) {
+			hops = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+			works = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			rounds = atoi(argv[++i]);
+		}
+	}
+	if (n == 0) n = 1;
+	if (hops < 0) hops = 0;
+	if (rounds < 1) rounds = 1;
+
+	for (int i = 0; i < rounds; i++) {
+		keep_min(&sync, bench_requests(on_request_sync, n));
+		keep_min(&defer, bench_requests(on_request_defer, n));
+		keep_min(&co, bench_requests(uv_httpd_co::on_request<co_handler>, n));
+		keep_min(&steps_cb, bench_steps(0, n));
+		keep_min(&steps_co, bench_steps(1, n));
+		if (works) {
+			keep_min(&work_cb, bench_works(0, works));
+			keep_min(&work_co, bench_works(1, works));
+		}
+	}
+	printf("requests, %d hops: sync %.1f ns, defer %.1f ns, co %.1f ns (%+.1f%% of defer)\n",
+		   hops, sync, defer, co, (co - defer) * 100 / defer);
+	printf("%d hops without requests: callbacks %.1f ns, co %.1f ns (%+.1f%%)\n",
+		   hops, steps_cb, steps_co, (steps_co - steps_cb) * 100 / steps_cb);
+	if (works) {
+		printf("uv_queue_work hops: callbacks %.0f ns, co %.0f ns (%+.1f%%)\n",
+			   work_cb, work_co, (work_co - work_cb) * 100 / work_cb);
+	}
+	return 0;
+}
@@ -0,0 +1,315 @@
+// replay a corpus of raw requests through the llhttp callbacks of uv_httpd,
+// over an in-memory connection, see uv_httpd_mem.h.
+// usage: corpusbench [-t ms] [-f fragment] [-o baseline.json] [-c baseline.json] [-r percent] file...
+//   each file holds one or more pipelined keep-alive requests, e.g. corpus/*.http
+//   -t: minimum time per file, default is 1000ms
+//   -f: bytes per read, default is 0 for as much as `on_alloc` gives
+//   -o: write the results as a JSON baseline
+//   -c: compare with a baseline, exit 2 if a file is slower by more than `-r` percent
+//   -r: regression threshold, default is 10, raise it on noisy machines
+// allocations are counted if linked with `-Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc`
+// and WRAP_MALLOC defined, as `make corpusbench` does.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "uv_httpd.h"
+#include "uv_httpd_mem.h"
+#include "mybuf.h"
+
+#define RESPONSE \
+  "HTTP/1.1 200 OK\r\n" \
+  "Content-Type: text/plain\r\n" \
+  "Content-Length: 12\r\n" \
+  "\r\n" \
+  "hello world\n"
+
+typedef struct {
+	char name[64]; // file name without directory and extension
+	size_t bytes; // of the file
+	uint64_t requests; // in the file
+	uint64_t passes;
+	double ns_per_request;
+	double mb_per_s;
+	double allocs_per_request; // -1 if not counted
+}result_t;
+
+static uint64_t answered;
+
+#ifdef WRAP_MALLOC
+static uint64_t allocs;
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* p, size_t size);
+
+void* __wrap_malloc(size_t size) {
+	allocs++;
+	return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size) {
+	allocs++;
+	return __real_calloc(n, size);
+}
+
+void* __wrap_realloc(void* p, size_t size) {
+	allocs++;
+	return __real_realloc(p, size);
+}
+#endif
+
+static void on_request(uv_httpd_server_t* server, uv_httpd_client_t* client, uv_httpd_request_t* req) {
+	answered++;
+	uv_httpd_write_response(client, RESPONSE, sizeof(RESPONSE) - 1);
+}
+
+// return NULL if failed
+static const char* map_file(const char* path, size_t* len) {
+#ifdef _WIN32
+	HANDLE f, m;
+	LARGE_INTEGER size;
+	const char* p = NULL;
+	f = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (f == INVALID_HANDLE_VALUE) return NULL;
+	if (GetFileSizeEx(f, &size) && size.QuadPart > 0) {
+		m = CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (m) {
+			p = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(m);
+		}
+		*len = (size_t)size.QuadPart;
+	}
+	CloseHandle(f);
+	return p;
+#else
+	struct stat st;
+	void* p = MAP_FAILED;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return NULL;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		*len = (size_t)st.st_size;
+	}
+	close(fd);
+	return p == MAP_FAILED ? NULL : p;
+#endif
+}
+
+static void unmap_file(const char* p, size_t len) {
+#ifdef _WIN32
+	UnmapViewOfFile(p);
+#else
+	munmap((void*)p, len);
+#endif
+}
+
+static void set_name(result_t* res, const char* path) {
+	const char* base = path, * p;
+	size_t len;
+	for (p = path; *p; p++) {
+		if (*p == '/' || *p == '\\') base = p + 1;
+	}
+	p = strrchr(base, '.');
+	len = p ? (size_t)(p - base) : strlen(base);
+	if (len >= sizeof(res->name)) len = sizeof(res->name) - 1;
+	memcpy(res->name, base, len);
+	res->name[len] = '\0';
+}
+
+// feed the whole corpus once, return requests answered or -1 if the connection failed
+static int64_t pass(uv_httpd_mem_t* mem, const char* data, size_t len, size_t fragment) {
+	uint64_t before = answered;
+	if (uv_httpd_mem_feed(mem, data, len, fragment) != len || uv_httpd_mem_closed(mem)) {
+		return -1;
+	}
+	uv_httpd_mem_output(mem)->size = 0;
+	return (int64_t)(answered - before);
+}
+
+// return 0 for success
+static int run_file(uv_httpd_server_t* server, const char* path, uint64_t min_ns, size_t fragment, result_t* res) {
+	uv_httpd_mem_t* mem;
+	size_t len = 0;
+	const char* data = map_file(path, &len);
+	uint64_t start, ns, allocs_before = 0;
+	int64_t n;
+	int r = -1;
+
+	memset(res, 0, sizeof(*res));
+	set_name(res, path);
+	if (!data) {
+		fprintf(stderr, "%s: cannot map\n", path);
+		return -1;
+	}
+	if (uv_httpd_mem_create(&mem, server)) {
+		unmap_file(data, len);
+		return -1;
+	}
+	res->bytes = len;
+	// counts the requests, and warms up caches and buffers
+	n = pass(mem, data, len, fragment);
+	if (n <= 0) {
+		fprintf(stderr, "%s: not all requests answered, a parse error or `Connection: close`?\n", path);
+		goto done;
+	}
+	res->requests = (uint64_t)n;
+#ifdef WRAP_MALLOC
+	allocs_before = allocs;
+#endif
+	start = uv_hrtime();
+	do {
+		if (pass(mem, data, len, fragment) != n) {
+			fprintf(stderr, "%s: answered differently on replay\n", path);
+			goto done;
+		}
+		res->passes++;
+		ns = uv_hrtime() - start;
+	} while (ns < min_ns);
+	res->ns_per_request = (double)ns / (res->passes * res->requests);
+	res->mb_per_s = (double)res->passes * len / (1024 * 1024) / (ns / 1e9);
+#ifdef WRAP_MALLOC
+	res->allocs_per_request = (double)(allocs - allocs_before) / (res->passes * res->requests);
+#else
+	res->allocs_per_request = -1;
+	(void)allocs_before;
+#endif
+	r = 0;
+
+done:
+	uv_httpd_mem_free(mem);
+	unmap_file(data, len);
+	return r;
+}
+
+static int write_baseline(const char* path, const result_t* results, int n) {
+	int i;
+	FILE* f = fopen(path, "w");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	fprintf(f, "{\"results\":[\n");
+	for (i = 0; i < n; i++) {
+		// one result per line, read back by `read_baseline`
+		fprintf(f, "{\"name\":\"%s\",\"bytes\":%zu,\"requests\":%llu,\"ns_per_request\":%.1f,"
+				"\"mb_per_s\":%.1f,\"allocs_per_request\":%.2f}%s\n",
+				results[i].name, results[i].bytes, (unsigned long long)results[i].requests,
+				results[i].ns_per_request, results[i].mb_per_s, results[i].allocs_per_request,
+				i + 1 < n ? "," : "");
+	}
+	fprintf(f, "]}\n");
+	fclose(f);
+	return 0;
+}
+
+// ns/request of `name` in a baseline written by `write_baseline`, 0 if not found
+static double read_baseline(const char* baseline, const char* name, double* allocs) {
+	char key[96];
+	const char* p, * a;
+	snprintf(key, sizeof(key), "{\"name\":\"%s\",", name);
+	p = strstr(baseline, key);
+	if (!p || !(p = strstr(p, "\"ns_per_request\":"))) return 0;
+	if ((a = strstr(p, "\"allocs_per_request\":"))) {
+		*allocs = atof(a + 21);
+	}
+	return atof(p + 17);
+}
+
+// return 0 if nothing regressed
+static int compare(const char* path, const result_t* results, int n, double threshold) {
+	mybuf_t baseline;
+	char chunk[4096];
+	size_t len;
+	int i, regressed = 0;
+	FILE* f = fopen(path, "rb");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	mybuf_init(&baseline);
+	while ((len = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+		mybuf_append(&baseline, chunk, len);
+	}
+	fclose(f);
+	mybuf_append(&baseline, "", 1);
+
+	printf("\n%-16s %12s %12s %8s %14s\n", "compared", "baseline ns", "ns", "change", "allocs");
+	for (i = 0; i < n; i++) {
+		double allocs = -1, ns = read_baseline(baseline.buf, results[i].name, &allocs);
+		if (ns <= 0) {
+			printf("%-16s %12s %12.1f\n", results[i].name, "-", results[i].ns_per_request);
+			continue;
+		}
+		printf("%-16s %12.1f %12.1f %+7.1f%% %6.2f -> %.2f%s\n", results[i].name, ns, results[i].ns_per_request,
+			   (results[i].ns_per_request / ns - 1) * 100, allocs, results[i].allocs_per_request,
+			   results[i].ns_per_request > ns * threshold ? "  REGRESSED" : "");
+		if (results[i].ns_per_request > ns * threshold) regressed = 1;
+	}
+	mybuf_clear(&baseline);
+	return regressed;
+}
+
+int main(int argc, char** argv) {
+	uint64_t min_ms = 1000;
+	size_t fragment = 0;
+	double percent = 10;
+	const char* out = NULL, * cmp = NULL;
+	result_t* results;
+	uv_httpd_server_t* server;
+	int i, n = 0, r;
+
+	results = calloc(argc, sizeof(result_t));
+	if (!results) return 1;
+	r = uv_httpd_create(&server, uv_default_loop(), on_request);
+	if (r) {
+		fprintf(stderr, "%d %s\n", r, uv_err_name(r));
+		return 1;
+	}
+
+	printf("%-16s %8s %8s %10s %12s %10s %12s\n", "file", "bytes", "requests", "passes", "ns/request", "MB/s", "allocs/req");
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			min_ms = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			fragment = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			out = argv[++i];
+		} else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+			cmp = argv[++i];
+		} else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			percent = atof(argv[++i]);
+		} else if (run_file(server, argv[i], min_ms * 1000000, fragment, &results[n]) == 0) {
+			result_t* res = &results[n++];
+			printf("%-16s %8zu %8llu %10llu %12.1f %10.1f %12.2f\n", res->name, res->bytes,
+				   (unsigned long long)res->requests, (unsigned long long)res->passes,
+				   res->ns_per_request, res->mb_per_s, res->allocs_per_request);
+		} else {
+			return 1;
+		}
+		// closed connections are freed by the loop
+		uv_run(uv_default_loop(), UV_RUN_NOWAIT);
+	}
+
+	r = 0;
+	if (out && write_baseline(out, results, n)) {
+		r = 1;
+	}
+	if (cmp) {
+		int c = compare(cmp, results, n, 1 + percent / 100);
+		if (c < 0) r = 1;
+		else if (c > 0) r = 2;
+	}
+	uv_httpd_stop(server);
+	uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+	uv_httpd_free(server);
+	free(results);
+	return r;
+}
@@ -0,0 +1,168 @@
+// cost and ratio of response compression over in-memory connections, no sockets.
+// usage: gzipbench [-n requests] [-s size] [-f file]
+//   -n: requests of each kind, default is 2000
+//   -s: body bytes, default is 100000
+//   -f: body text, repeated up to `size`, default is uv_httpd.c
+//
+// the same cacheable text response is answered as is, deflated on every request with the
+// cache disabled, and from the cache of compressed bodies. bodies of UV_HTTPD_GZIP_POOL_SIZE
+// or more are deflated on the threadpool, the loop runs until each response is complete.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "uv_httpd.h"
+#include "uv_httpd_mem.h"
+#include "uv_httpd_gzip.h"
+#include "mybuf.h"
+
+static mybuf_t response;
+
+static const char* identity_request =
+	"GET /static/app.txt HTTP/1.1\r\n"
+	"Host: 127.0.0.1:8000\r\n"
+	"Connection: keep-alive\r\n"
+	"\r\n";
+
+static const char* gzip_request =
+	"GET /static/app.txt HTTP/1.1\r\n"
+	"Host: 127.0.0.1:8000\r\n"
+	"Accept-Encoding: gzip, deflate\r\n"
+	"Connection: keep-alive\r\n"
+	"\r\n";
+
+static void on_request(uv_httpd_server_t* server, uv_httpd_client_t* client, uv_httpd_request_t* req) {
+	uv_httpd_write_response(client, response.buf, response.size);
+}
+
+// `size` bytes of `path` repeated
+static int load_body(mybuf_t* body, const char* path, size_t size) {
+	char buf[65536];
+	size_t len;
+	FILE* f = fopen(path, "rb");
+	if (!f) return -1;
+	len = fread(buf, 1, sizeof(buf), f);
+	fclose(f);
+	if (len == 0) return -1;
+	while (body->size < size) {
+		size_t n = size - body->size < len ? size - body->size : len;
+		if (mybuf_append(body, buf, n)) return -1;
+	}
+	return 0;
+}
+
+// body bytes of the complete response at the start of `out`, -1 if not complete yet
+static long response_body(mybuf_t* out) {
+	const char* end, * cl;
+	size_t head;
+	if (mybuf_append(out, "", 1)) return -1;
+	out->size--;
+	end = strstr(out->buf, "\r\n\r\n");
+	cl = strstr(out->buf, "Content-Length: ");
+	if (!end || !cl || cl > end) return -1;
+	head = end + 4 - out->buf;
+	if (out->size < head + strtoul(cl + 16, NULL, 10)) return -1;
+	return (long)(out->size - head);
+}
+
+// answer `n` requests one at a time, return ns or 0 if one is not answered
+static uint64_t run(uv_httpd_mem_t* mem, const char* request, size_t n, long* body) {
+	mybuf_t* out = uv_httpd_mem_output(mem);
+	uint64_t start = uv_hrtime();
+	size_t i;
+	for (i = 0; i < n; i++) {
+		uv_httpd_mem_feed(mem, request, strlen(request), 0);
+		while ((*body = response_body(out)) < 0) {
+			if (uv_httpd_mem_closed(mem) || !uv_loop_alive(uv_default_loop())) return 0;
+			uv_run(uv_default_loop(), UV_RUN_ONCE);
+		}
+		out->size = 0;
+	}
+	return uv_hrtime() - start;
+}
+
+static void report(const char* kind, size_t n, uint64_t ns, long body) {
+	printf("%-22s %8.0f req/s %8.1f us/request, body %ld bytes\n", kind, n / (ns / 1e9), ns / 1e3 / n, body);
+}
+
+int main(int argc, char** argv) {
+	size_t n = 2000, size = 100000;
+	const char* path = "uv_httpd.c";
+	uv_httpd_server_t* server;
+	uv_httpd_gzip_t* cold, * cached;
+	uv_httpd_gzip_stats_t stats;
+	uv_httpd_mem_t* mem;
+	mybuf_t body;
+	uint64_t ns;
+	long out;
+	int i, r;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			n = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			size = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			path = argv[++i];
+		}
+	}
+	if (n == 0) n = 1;
+
+	mybuf_init(&body);
+	mybuf_init(&response);
+	if (load_body(&body, path, size)) {
+		fprintf(stderr, "can not read %s\n", path);
+		return 1;
+	}
+	mybuf_cat_printf(&response, "HTTP/1.1 200 OK\r\n"
+					 "Content-Type: text/plain\r\n"
+					 "ETag: \"app-1\"\r\n"
+					 "Content-Length: %zu\r\n"
+					 "\r\n", body.size);
+	mybuf_append(&response, body.buf, body.size);
+
+	r = uv_httpd_create(&server, uv_default_loop(), on_request);
+	if (!r) r = uv_httpd_gzip_create(&cold, uv_default_loop(), UV_HTTPD_GZIP_LEVEL, 0);
+	if (!r) r = uv_httpd_gzip_create(&cached, uv_default_loop(), UV_HTTPD_GZIP_LEVEL, UV_HTTPD_GZIP_CACHE_SIZE);
+	if (!r) r = uv_httpd_mem_create(&mem, server);
+	if (r) {
+		fprintf(stderr, "%d %s\n", r, uv_err_name(r));
+		return 1;
+	}
+	printf("%s, %zu bytes, level %d\n", path, body.size, UV_HTTPD_GZIP_LEVEL);
+
+	server->gzip = cold;
+	ns = run(mem, identity_request, n, &out);
+	if (ns) report("identity", n, ns, out);
+
+	if (ns) ns = run(mem, gzip_request, n, &out);
+	if (ns) {
+		report("gzip, no cache", n, ns, out);
+		uv_httpd_gzip_stats(cold, &stats);
+		printf("%-22s %8.1f ms/MB deflated, %.1f%% of body bytes saved\n", "",
+			   stats.deflate_ns / 1e6 / (stats.deflated / 1e6), 100.0 * (stats.bytes_in - stats.bytes_out) / stats.bytes_in);
+	}
+
+	server->gzip = cached;
+	if (ns) ns = run(mem, gzip_request, n, &out);
+	if (ns) {
+		report("gzip, cached", n, ns, out);
+		uv_httpd_gzip_stats(cached, &stats);
+		printf("%-22s %8llu hits, %llu misses\n", "",
+			   (unsigned long long)stats.cache_hits, (unsigned long long)stats.cache_misses);
+	}
+	if (!ns) {
+		fprintf(stderr, "requests not answered\n");
+	}
+
+	uv_httpd_mem_free(mem);
+	uv_httpd_stop(server);
+	uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+	server->gzip = NULL;
+	uv_httpd_gzip_free(cold);
+	uv_httpd_gzip_free(cached);
+	uv_httpd_free(server);
+	mybuf_clear(&body);
+	mybuf_clear(&response);
+	return ns ? 0 : 1;
+}
@@ -0,0 +1,325 @@
+// regression tests of h2 flow control, request framing and shutdown over in-memory connections, no sockets.
+// usage: h2test
+// prints each case, exits with 1 on the first failure.
+//
+// negative window: the peer lowers SETTINGS_INITIAL_WINDOW_SIZE below what a stream has sent,
+// the stream must wait for a WINDOW_UPDATE of its own and not hold up the other streams.
+// content-length: a malformed one, or DATA longer or shorter than it, resets the stream
+// with PROTOCOL_ERROR and the request is not served.
+// goaway: a GOAWAY of the peer closes the connection once its open streams are done.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "uv_httpd.h"
+#include "uv_httpd_h2.h"
+#include "uv_httpd_mem.h"
+#include "mybuf.h"
+
+#define FRAME_DATA 0x0
+#define FRAME_HEADERS 0x1
+#define FRAME_RST_STREAM 0x3
+#define FRAME_SETTINGS 0x4
+#define FRAME_GOAWAY 0x7
+#define FRAME_WINDOW_UPDATE 0x8
+#define FLAG_END_STREAM 0x1
+#define FLAG_END_HEADERS 0x4
+#define SETTINGS_INITIAL_WINDOW_SIZE 4
+#define H2_PROTOCOL_ERROR 1
+#define MAX_FRAME 16384
+#define STREAMS 16 // stream ids tracked by `exchange`
+
+typedef struct {
+	size_t data[STREAMS]; // DATA bytes by stream id
+	int ended[STREAMS]; // END_STREAM seen by stream id
+	uint32_t reset[STREAMS]; // error code of RST_STREAM + 1 by stream id
+	int headers; // HEADERS frames
+	int goaway;
+}frames_t;
+
+static uv_httpd_server_t* server;
+static uv_httpd_mem_t* mem;
+static mybuf_t echoed[STREAMS]; // DATA payload by stream id
+static int failures;
+
+
+/*************************** helper functions ****************/
+
+static void on_request(uv_httpd_server_t* server, uv_httpd_client_t* client, uv_httpd_request_t* req) {
+	mybuf_t buf;
+	mybuf_init(&buf);
+	mybuf_cat_printf(&buf, "HTTP/1.1 200 OK\r\n"
+					 "Content-Type: application/octet-stream\r\n"
+					 "Content-Length: %zu\r\n\r\n", req->body.len);
+	mybuf_append(&buf, req->base + req->body.offset, req->body.len);
+	uv_httpd_write_response(client, buf.buf, buf.size);
+	mybuf_clear(&buf);
+}
+
+static void frame(mybuf_t* out, int type, int flags, uint32_t id, const void* payload, size_t len) {
+	char header[9];
+	header[0] = (char)(len >> 16);
+	header[1] = (char)(len >> 8);
+	header[2] = (char)len;
+	header[3] = (char)type;
+	header[4] = (char)flags;
+	header[5] = (char)(id >> 24);
+	header[6] = (char)(id >> 16);
+	header[7] = (char)(id >> 8);
+	header[8] = (char)id;
+	mybuf_append(out, header, 9);
+	if (len) mybuf_append(out, payload, len);
+}
+
+static void put32(uint8_t* p, uint32_t v) {
+	p[0] = (uint8_t)(v >> 24);
+	p[1] = (uint8_t)(v >> 16);
+	p[2] = (uint8_t)(v >> 8);
+	p[3] = (uint8_t)v;
+}
+
+static void settings_window(mybuf_t* out, uint32_t window) {
+	uint8_t payload[6] = { 0, SETTINGS_INITIAL_WINDOW_SIZE };
+	put32(payload + 2, window);
+	frame(out, FRAME_SETTINGS, 0, 0, payload, sizeof(payload));
+}
+
+static void window_update(mybuf_t* out, uint32_t id, uint32_t increment) {
+	uint8_t payload[4];
+	put32(payload, increment);
+	frame(out, FRAME_WINDOW_UPDATE, 0, id, payload, sizeof(payload));
+}
+
+// literal header fields without indexing, new names
+static void header(mybuf_t* block, const char* name, const char* value) {
+	char n = (char)strlen(name), v = (char)strlen(value);
+	mybuf_append(block, "\0", 1);
+	mybuf_append(block, &n, 1);
+	mybuf_append(block, name, n);
+	mybuf_append(block, &v, 1);
+	mybuf_append(block, value, v);
+}
+
+// HEADERS of POST /api/echo on stream `id`, without content-length if `cl` is NULL
+static void post_headers(mybuf_t* out, uint32_t id, const char* cl) {
+	mybuf_t block;
+
+	mybuf_init(&block);
+	header(&block, ":method", "POST");
+	header(&block, ":scheme", "http");
+	header(&block, ":authority", "127.0.0.1");
+	header(&block, ":path", "/api/echo");
+	if (cl) header(&block, "content-length", cl);
+	frame(out, FRAME_HEADERS, FLAG_END_HEADERS, id, block.buf, block.size);
+	mybuf_clear(&block);
+}
+
+// DATA of `len` bytes of body from `off`, END_STREAM on the last frame if `end`
+static void post_data(mybuf_t* out, uint32_t id, size_t off, size_t len, int end) {
+	char chunk[MAX_FRAME];
+	size_t n, i;
+
+	for (len += off; off < len; off += n) {
+		n = len - off < MAX_FRAME ? len - off : MAX_FRAME;
+		for (i = 0; i < n; i++) {
+			chunk[i] = (char)('a' + (off + i) % 26);
+		}
+		frame(out, FRAME_DATA, end && off + n == len ? FLAG_END_STREAM : 0, id, chunk, n);
+	}
+}
+
+// POST /api/echo on stream `id` with `len` bytes of body
+static void post(mybuf_t* out, uint32_t id, size_t len) {
+	char cl[24];
+	snprintf(cl, sizeof(cl), "%zu", len);
+	post_headers(out, id, cl);
+	post_data(out, id, 0, len, 1);
+}
+
+// feed `in`, then count the frames written since the last call
+static void exchange(mybuf_t* in, frames_t* f) {
+	mybuf_t* output = uv_httpd_mem_output(mem);
+	const uint8_t* p;
+	size_t off = 0;
+
+	memset(f, 0, sizeof(*f));
+	uv_httpd_mem_feed(mem, in->buf, in->size, 0);
+	in->size = 0;
+	while (off + 9 <= output->size) {
+		size_t len;
+		uint32_t id;
+		p = (const uint8_t*)output->buf + off;
+		len = (size_t)p[0] << 16 | p[1] << 8 | p[2];
+		id = ((uint32_t)p[5] << 24 | p[6] << 16 | p[7] << 8 | p[8]) & 0x7fffffff;
+		if (off + 9 + len > output->size) break;
+		if (p[3] == FRAME_DATA && id < STREAMS) {
+			f->data[id] += len;
+			if (p[4] & FLAG_END_STREAM) f->ended[id] = 1;
+			mybuf_append(&echoed[id], (const char*)p + 9, len);
+		} else if (p[3] == FRAME_HEADERS) {
+			f->headers++;
+		} else if (p[3] == FRAME_RST_STREAM && id < STREAMS && len == 4) {
+			f->reset[id] = ((uint32_t)p[9] << 24 | p[10] << 16 | p[11] << 8 | p[12]) + 1;
+		} else if (p[3] == FRAME_GOAWAY) {
+			f->goaway = 1;
+		}
+		off += 9 + len;
+	}
+	output->size = 0;
+}
+
+// a new connection, the preface and SETTINGS are in `in`
+static void reconnect(mybuf_t* in) {
+	frames_t f;
+	uv_httpd_mem_free(mem);
+	uv_run(uv_default_loop(), UV_RUN_NOWAIT);
+	if (uv_httpd_mem_create(&mem, server)) {
+		fprintf(stderr, "uv_httpd_mem_create failed\n");
+		exit(1);
+	}
+	mybuf_append(in, UV_HTTPD_H2_PREFACE, UV_HTTPD_H2_PREFACE_LEN);
+	settings_window(in, 65535);
+	exchange(in, &f);
+}
+
+static void check(int ok, const char* what) {
+	printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+	if (!ok) failures++;
+}
+
+static int echoed_intact(uint32_t id, size_t len) {
+	size_t i;
+	if (echoed[id].size != len) return 0;
+	for (i = 0; i < len; i++) {
+		if (echoed[id].buf[i] != (char)('a' + i % 26)) return 0;
+	}
+	return 1;
+}
+
+
+/*************************** cases ****************/
+
+static void negative_window(void) {
+	mybuf_t in;
+	frames_t f;
+
+	mybuf_init(&in);
+	mybuf_append(&in, UV_HTTPD_H2_PREFACE, UV_HTTPD_H2_PREFACE_LEN);
+	settings_window(&in, 100000);
+	post(&in, 1, 100000);
+	exchange(&in, &f);
+	check(f.data[1] == 65535 && !f.ended[1], "stream 1 sends up to the connection window");
+
+	// 34465 bytes sent beyond the new initial window, the stream window is -65535
+	settings_window(&in, 0);
+	window_update(&in, 0, 1000);
+	exchange(&in, &f);
+	check(!uv_httpd_mem_closed(mem) && !f.goaway, "connection open after SETTINGS lowers the window");
+	check(f.data[1] == 0, "stream 1 waits while its window is negative");
+
+	// opened with a window of 0, not held up by stream 1
+	post(&in, 3, 500);
+	window_update(&in, 3, 500);
+	exchange(&in, &f);
+	check(f.data[1] == 0, "stream 1 still waits");
+	check(f.data[3] == 500 && f.ended[3] && echoed_intact(3, 500), "stream 3 sends past stream 1");
+
+	window_update(&in, 1, 100000);
+	window_update(&in, 0, 34000);
+	exchange(&in, &f);
+	check(f.data[1] == 34465 && f.ended[1] && echoed_intact(1, 100000), "stream 1 ends after its WINDOW_UPDATE");
+	mybuf_clear(&in);
+}
+
+static void content_length(void) {
+	mybuf_t in;
+	frames_t f;
+
+	mybuf_init(&in);
+	reconnect(&in);
+	post_headers(&in, 1, "1x");
+	post_data(&in, 1, 0, 2, 1);
+	post_headers(&in, 3, "99999999999999999999");
+	post_data(&in, 3, 0, 2, 1);
+	post_headers(&in, 5, "-1");
+	post_data(&in, 5, 0, 2, 1);
+	exchange(&in, &f);
+	check(f.reset[1] == H2_PROTOCOL_ERROR + 1 && f.reset[3] == H2_PROTOCOL_ERROR + 1
+		  && f.reset[5] == H2_PROTOCOL_ERROR + 1 && f.headers == 0, "malformed content-length resets the stream");
+
+	post_headers(&in, 7, "10");
+	post_data(&in, 7, 0, 11, 0);
+	exchange(&in, &f);
+	check(f.reset[7] == H2_PROTOCOL_ERROR + 1 && f.headers == 0, "DATA longer than content-length resets the stream");
+
+	post_headers(&in, 9, "10");
+	post_data(&in, 9, 0, 9, 1);
+	exchange(&in, &f);
+	check(f.reset[9] == H2_PROTOCOL_ERROR + 1 && f.headers == 0, "DATA shorter than content-length resets the stream");
+
+	post(&in, 11, 5);
+	post(&in, 13, 10);
+	exchange(&in, &f);
+	check(!uv_httpd_mem_closed(mem) && !f.goaway && f.headers == 2, "the connection serves the next requests");
+	mybuf_clear(&in);
+}
+
+static void goaway(void) {
+	uint8_t payload[8] = { 0 };
+	mybuf_t in;
+	frames_t f;
+
+	mybuf_init(&in);
+	reconnect(&in);
+	frame(&in, FRAME_GOAWAY, 0, 0, payload, sizeof(payload));
+	exchange(&in, &f);
+	uv_run(uv_default_loop(), UV_RUN_NOWAIT);
+	check(uv_httpd_mem_closed(mem), "GOAWAY without open streams closes the connection");
+
+	reconnect(&in);
+	post_headers(&in, 1, "10");
+	post_data(&in, 1, 0, 4, 0);
+	frame(&in, FRAME_GOAWAY, 0, 0, payload, sizeof(payload));
+	exchange(&in, &f);
+	uv_run(uv_default_loop(), UV_RUN_NOWAIT);
+	check(!uv_httpd_mem_closed(mem), "GOAWAY keeps the connection while a stream is open");
+
+	post(&in, 3, 10);
+	echoed[1].size = 0;
+	post_data(&in, 1, 4, 6, 1);
+	exchange(&in, &f);
+	uv_run(uv_default_loop(), UV_RUN_NOWAIT);
+	check(f.headers == 1 && f.ended[1] && f.data[3] == 0, "the open stream is served, a new one is not");
+	check(uv_httpd_mem_closed(mem), "and the connection is closed after it");
+	mybuf_clear(&in);
+}
+
+int main(int argc, char** argv) {
+	int i, r;
+
+	for (i = 0; i < STREAMS; i++) {
+		mybuf_init(&echoed[i]);
+	}
+	r = uv_httpd_create(&server, uv_default_loop(), on_request);
+	if (!r) {
+		server->h2c = 1;
+		r = uv_httpd_mem_create(&mem, server);
+	}
+	if (r) {
+		fprintf(stderr, "%d %s\n", r, uv_err_name(r));
+		return 1;
+	}
+
+	negative_window();
+	content_length();
+	goaway();
+
+	uv_httpd_mem_free(mem);
+	uv_httpd_stop(server);
+	uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+	uv_httpd_free(server);
+	for (i = 0; i < STREAMS; i++) {
+		mybuf_clear(&echoed[i]);
+	}
+	return failures ? 1 : 0;
+}
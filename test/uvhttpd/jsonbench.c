@@ -0,0 +1,255 @@
+// benchmark of mybuf_json against mybuf_cat_printf on typical API payloads.
+// usage: jsonbench [-n iterations] [-r rounds]
+//   -n: payloads of each kind per round, default is 200000
+//   -r: rounds, printf and mybuf_json are interleaved and the best of each is reported, default is 5
+//
+// payloads:
+//   stats:   a flat object of 16 counters and 4 doubles, like /api/stats
+//   records: an array of 20 records with ids, names, emails, flags, scores and tags,
+//            one string in ten needs escaping
+//   logs:    an array of 20 messages of about 200 bytes
+// the printf path escapes strings byte by byte and writes doubles with "%.17g",
+// the shortest format that always reads back the same double.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "uv.h"
+#include "mybuf.h"
+#include "mybuf_json.h"
+
+#define RECORDS 20
+#define TAGS 3
+
+typedef struct {
+	int64_t id;
+	const char* name;
+	const char* email;
+	int active;
+	double score;
+	const char* tags[TAGS];
+}record_t;
+
+static uint64_t counters[16];
+static double gauges[4];
+static record_t records[RECORDS];
+static char* messages[RECORDS];
+static volatile size_t sink;
+
+static const char* counter_names[16] = {
+	"connections", "active", "requests", "limited", "rejected", "memory", "responses", "bytes_in",
+	"bytes_out", "deflated", "cache_hits", "cache_misses", "cache_entries", "cache_bytes", "handshakes", "resumed",
+};
+static const char* gauge_names[4] = { "busy_ms", "idle_ms", "lag_max_ms", "deflate_ms" };
+
+static void init_payloads(void) {
+	static const char* names[] = { "Alice Zhang", "Bob \"the builder\"", "Carol O'Neil", "Dave\tSmith", "Eve Li" };
+	static const char* tags[] = { "admin", "beta", "eu-west", "paid", "trial", "new\nline" };
+	static char emails[RECORDS][32];
+	int i, j;
+
+	for (i = 0; i < 16; i++) counters[i] = (uint64_t)(i + 1) * 1234567 + (i << 20);
+	for (i = 0; i < 4; i++) gauges[i] = (i + 1) * 1234.567891 / 7;
+	for (i = 0; i < RECORDS; i++) {
+		record_t* r = &records[i];
+		r->id = 100000 + i * 37;
+		r->name = names[i % 5];
+		snprintf(emails[i], sizeof(emails[i]), "user%d@example.com", i);
+		r->email = emails[i];
+		r->active = i % 3 != 0;
+		r->score = i * 0.25 + 0.1;
+		for (j = 0; j < TAGS; j++) r->tags[j] = tags[(i + j) % 6];
+
+		messages[i] = malloc(201);
+		for (j = 0; j < 200; j++) messages[i][j] = "abcdefghijklmnopqrstuvwxyz 0123456789"[(i * 7 + j) % 37];
+		messages[i][200] = 0;
+		if (i % 10 == 0) messages[i][100] = '"';
+	}
+}
+
+
+/*************************** printf ****************/
+
+static void printf_string(mybuf_t* buf, const char* s) {
+	mybuf_append(buf, "\"", 1);
+	for (; *s; s++) {
+		unsigned char c = (unsigned char)*s;
+		if (c == '"' || c == '\\') {
+			mybuf_cat_printf(buf, "\\%c", c);
+		} else if (c == '\n') {
+			mybuf_append(buf, "\\n", 2);
+		} else if (c == '\t') {
+			mybuf_append(buf, "\\t", 2);
+		} else if (c < 0x20) {
+			mybuf_cat_printf(buf, "\\u%04x", c);
+		} else {
+			mybuf_append(buf, (const char*)&c, 1);
+		}
+	}
+	mybuf_append(buf, "\"", 1);
+}
+
+static void printf_stats(mybuf_t* buf) {
+	int i;
+	mybuf_append(buf, "{", 1);
+	for (i = 0; i < 16; i++) {
+		mybuf_cat_printf(buf, "%s\"%s\":%" PRIu64, i ? "," : "", counter_names[i], counters[i]);
+	}
+	for (i = 0; i < 4; i++) {
+		mybuf_cat_printf(buf, ",\"%s\":%.17g", gauge_names[i], gauges[i]);
+	}
+	mybuf_append(buf, "}", 1);
+}
+
+static void printf_records(mybuf_t* buf) {
+	int i, j;
+	mybuf_append(buf, "[", 1);
+	for (i = 0; i < RECORDS; i++) {
+		record_t* r = &records[i];
+		mybuf_cat_printf(buf, "%s{\"id\":%" PRId64 ",\"name\":", i ? "," : "", r->id);
+		printf_string(buf, r->name);
+		mybuf_cat_printf(buf, ",\"email\":");
+		printf_string(buf, r->email);
+		mybuf_cat_printf(buf, ",\"active\":%s,\"score\":%.17g,\"tags\":[", r->active ? "true" : "false", r->score);
+		for (j = 0; j < TAGS; j++) {
+			if (j) mybuf_append(buf, ",", 1);
+			printf_string(buf, r->tags[j]);
+		}
+		mybuf_append(buf, "]}", 2);
+	}
+	mybuf_append(buf, "]", 1);
+}
+
+static void printf_logs(mybuf_t* buf) {
+	int i;
+	mybuf_append(buf, "[", 1);
+	for (i = 0; i < RECORDS; i++) {
+		mybuf_cat_printf(buf, "%s{\"seq\":%d,\"message\":", i ? "," : "", i);
+		printf_string(buf, messages[i]);
+		mybuf_append(buf, "}", 1);
+	}
+	mybuf_append(buf, "]", 1);
+}
+
+
+/*************************** mybuf_json ****************/
+
+static void json_stats(mybuf_t* buf) {
+	mybuf_json_t json;
+	int i;
+	mybuf_json_init(&json, buf, 512);
+	mybuf_json_object_begin(&json);
+	for (i = 0; i < 16; i++) {
+		mybuf_json_key(&json, counter_names[i]);
+		mybuf_json_uint(&json, counters[i]);
+	}
+	for (i = 0; i < 4; i++) {
+		mybuf_json_key(&json, gauge_names[i]);
+		mybuf_json_double(&json, gauges[i]);
+	}
+	mybuf_json_object_end(&json);
+}
+
+static void json_records(mybuf_t* buf) {
+	mybuf_json_t json;
+	int i, j;
+	mybuf_json_init(&json, buf, RECORDS * 128);
+	mybuf_json_array_begin(&json);
+	for (i = 0; i < RECORDS; i++) {
+		record_t* r = &records[i];
+		mybuf_json_object_begin(&json);
+		mybuf_json_key(&json, "id");
+		mybuf_json_int(&json, r->id);
+		mybuf_json_key(&json, "name");
+		mybuf_json_string0(&json, r->name);
+		mybuf_json_key(&json, "email");
+		mybuf_json_string0(&json, r->email);
+		mybuf_json_key(&json, "active");
+		mybuf_json_bool(&json, r->active);
+		mybuf_json_key(&json, "score");
+		mybuf_json_double(&json, r->score);
+		mybuf_json_key(&json, "tags");
+		mybuf_json_array_begin(&json);
+		for (j = 0; j < TAGS; j++) mybuf_json_string0(&json, r->tags[j]);
+		mybuf_json_array_end(&json);
+		mybuf_json_object_end(&json);
+	}
+	mybuf_json_array_end(&json);
+}
+
+static void json_logs(mybuf_t* buf) {
+	mybuf_json_t json;
+	int i;
+	mybuf_json_init(&json, buf, RECORDS * 240);
+	mybuf_json_array_begin(&json);
+	for (i = 0; i < RECORDS; i++) {
+		mybuf_json_object_begin(&json);
+		mybuf_json_key(&json, "seq");
+		mybuf_json_int(&json, i);
+		mybuf_json_key(&json, "message");
+		mybuf_json_string(&json, messages[i], 200);
+		mybuf_json_object_end(&json);
+	}
+	mybuf_json_array_end(&json);
+}
+
+
+typedef void(*payload_fn)(mybuf_t* buf);
+
+// ns per payload, `*bytes` is the size of one
+static double bench(payload_fn fn, size_t n, size_t* bytes) {
+	mybuf_t buf;
+	uint64_t start;
+	mybuf_init(&buf);
+	fn(&buf);
+	*bytes = buf.size;
+	start = uv_hrtime();
+	for (size_t i = 0; i < n; i++) {
+		buf.size = 0;
+		fn(&buf);
+		sink = sink + buf.size;
+	}
+	start = uv_hrtime() - start;
+	mybuf_clear(&buf);
+	return (double)start / n;
+}
+
+static void keep_min(double* best, double v) {
+	if (*best == 0 || v < *best) *best = v;
+}
+
+int main(int argc, char** argv) {
+	static const char* kinds[] = { "stats", "records", "logs" };
+	payload_fn printf_fns[] = { printf_stats, printf_records, printf_logs };
+	payload_fn json_fns[] = { json_stats, json_records, json_logs };
+	double best_printf[3] = { 0 }, best_json[3] = { 0 };
+	size_t bytes_printf[3], bytes_json[3];
+	size_t n = 200000;
+	int rounds = 5, i, k;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			n = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			rounds = atoi(argv[++i]);
+		}
+	}
+	if (n == 0) n = 1;
+	if (rounds < 1) rounds = 1;
+
+	init_payloads();
+	for (i = 0; i < rounds; i++) {
+		for (k = 0; k < 3; k++) {
+			keep_min(&best_printf[k], bench(printf_fns[k], n, &bytes_printf[k]));
+			keep_min(&best_json[k], bench(json_fns[k], n, &bytes_json[k]));
+		}
+	}
+	for (k = 0; k < 3; k++) {
+		printf("%-8s printf %7.0f ns %5zu bytes %6.0f MB/s, mybuf_json %7.0f ns %5zu bytes %6.0f MB/s, %.1fx\n",
+			   kinds[k], best_printf[k], bytes_printf[k], bytes_printf[k] * 1e3 / best_printf[k],
+			   best_json[k], bytes_json[k], bytes_json[k] * 1e3 / best_json[k], best_printf[k] / best_json[k]);
+	}
+	for (i = 0; i < RECORDS; i++) free(messages[i]);
+	return 0;
+}
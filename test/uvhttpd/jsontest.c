@@ -0,0 +1,161 @@
+// regression tests of mybuf_json: doubles read back exactly, values laid out as JSON.stringify does.
+// usage: jsontest [-n samples]
+//   -n: random doubles read back by strtod, default is 300000
+// prints each case, exits with 1 if any fails.
+//
+// half of the samples are random bit patterns over the whole range, subnormals included,
+// the other half are short decimals like those of counters and rates.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include "mybuf_json.h"
+
+static int failures;
+
+static void check(int ok, const char* what) {
+	printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+	if (!ok) failures++;
+}
+
+static uint64_t next_random(uint64_t* state) {
+	// splitmix64
+	uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+// `v` written by mybuf_json_dtoa reads back as `v`, -0 as 0
+static int round_trips(double v) {
+	char buf[32];
+	size_t len = mybuf_json_dtoa(v, buf);
+	buf[len] = '\0';
+	return strtod(buf, NULL) == v;
+}
+
+static void random_doubles(size_t n) {
+	uint64_t state = 1, bits;
+	size_t i, bad = 0, tried = 0;
+	double v;
+	char what[128];
+
+	for (i = 0; i < n; i++) {
+		if (i & 1) {
+			bits = next_random(&state);
+			memcpy(&v, &bits, sizeof(v));
+			if (isnan(v) || isinf(v)) continue;
+		} else {
+			uint64_t r = next_random(&state);
+			v = (double)(int64_t)(r >> 20) / pow(10, (double)(r % 12));
+		}
+		tried++;
+		if (!round_trips(v)) {
+			if (bad++ < 5) {
+				printf("     %.17g does not read back\n", v);
+			}
+		}
+	}
+	snprintf(what, sizeof(what), "%zu random doubles read back exactly", tried);
+	check(bad == 0, what);
+}
+
+// `v` is written as `expected`
+static void double_is(double v, const char* expected) {
+	mybuf_t buf;
+	mybuf_json_t json;
+	char what[128];
+	int ok;
+
+	mybuf_init(&buf);
+	mybuf_json_init(&json, &buf, 0);
+	mybuf_json_double(&json, v);
+	ok = !json.error && buf.size == strlen(expected) && memcmp(buf.buf, expected, buf.size) == 0;
+	snprintf(what, sizeof(what), "%.17g is %s", v, expected);
+	check(ok, what);
+	if (!ok) printf("     got %.*s\n", (int)buf.size, buf.buf);
+	mybuf_clear(&buf);
+}
+
+static void edge_doubles(void) {
+	static const double values[] = {
+		0.0, -0.0, 5e-324, 2.2250738585072009e-308, 2.2250738585072014e-308, 1.7976931348623157e308,
+		0.1, 0.2, 0.3, 1.0 / 3, 2.0 / 3, 9007199254740991.0, 9007199254740993.0, 1e21, 1e22, 1e23,
+		123456789012345680000.0, 1e-6, 1e-7, 4.35, 0.035, 299792458.0,
+	};
+	size_t i;
+	int ok = 1;
+	for (i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+		ok &= round_trips(values[i]) && round_trips(-values[i]);
+	}
+	check(ok, "edge doubles read back exactly");
+
+	double_is(0.0, "0");
+	double_is(-0.0, "0");
+	double_is(0.1, "0.1");
+	double_is(-1.5, "-1.5");
+	double_is(100, "100");
+	double_is(1e20, "100000000000000000000");
+	double_is(1e21, "1e+21");
+	double_is(1e-6, "0.000001");
+	double_is(1e-7, "1e-7");
+	double_is(5e-324, "5e-324");
+	double_is(1.7976931348623157e308, "1.7976931348623157e+308");
+	double_is(NAN, "null");
+	double_is(INFINITY, "null");
+}
+
+static void documents(void) {
+	mybuf_t buf;
+	mybuf_json_t json;
+	const char* expected =
+		"{\"s\":\"a\\\"b\\\\c\\n\\u0001\\u001f\xc3\xa9\",\"i\":-9223372036854775808,"
+		"\"u\":18446744073709551615,\"a\":[true,false,null,[],{}],\"raw\":{\"x\":1}}";
+
+	mybuf_init(&buf);
+	mybuf_json_init(&json, &buf, 0);
+	mybuf_json_object_begin(&json);
+	mybuf_json_key(&json, "s");
+	mybuf_json_string0(&json, "a\"b\\c\n\x01\x1f\xc3\xa9");
+	mybuf_json_key(&json, "i");
+	mybuf_json_int(&json, INT64_MIN);
+	mybuf_json_key(&json, "u");
+	mybuf_json_uint(&json, UINT64_MAX);
+	mybuf_json_key(&json, "a");
+	mybuf_json_array_begin(&json);
+	mybuf_json_bool(&json, 1);
+	mybuf_json_bool(&json, 0);
+	mybuf_json_null(&json);
+	mybuf_json_array_begin(&json);
+	mybuf_json_array_end(&json);
+	mybuf_json_object_begin(&json);
+	mybuf_json_object_end(&json);
+	mybuf_json_array_end(&json);
+	mybuf_json_key(&json, "raw");
+	mybuf_json_raw(&json, "{\"x\":1}", 7);
+	mybuf_json_object_end(&json);
+	check(!json.error && buf.size == strlen(expected) && memcmp(buf.buf, expected, buf.size) == 0,
+		  "escapes, integer limits, commas and nesting");
+	if (buf.size != strlen(expected) || memcmp(buf.buf, expected, buf.size)) {
+		printf("     got %.*s\n", (int)buf.size, buf.buf);
+	}
+	mybuf_clear(&buf);
+}
+
+int main(int argc, char** argv) {
+	size_t n = 300000;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			n = strtoul(argv[++i], NULL, 10);
+		}
+	}
+
+	random_doubles(n);
+	edge_doubles();
+	documents();
+	return failures ? 1 : 0;
+}
@@ -1,17 +1,202 @@
+/* uv_httpd: span scans dispatched by the CPU at runtime.
+ *
+ * llparse emits SSE4.2 scans for a few hot states, but only `#ifdef __SSE4_2__`,
+ * which a build without `-msse4.2` never defines. On x86 the states below call
+ * `llhttp__scan` instead, which takes AVX2, SSE4.2 or a scalar loop over the
+ * lookup table of the state, chosen on the first call. Other targets keep the
+ * generated states as they are.
+ * Keep this and the calls when regenerating llhttp.c.
+ */
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define LLHTTP__SCAN_X86 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _MSC_VER
+ #include <intrin.h>
+ #include <immintrin.h>
+ #define LLHTTP__TARGET(t)
+#else  /* !_MSC_VER */
+ #include <x86intrin.h>
+ #define LLHTTP__TARGET(t) __attribute__((target(t)))
+#endif  /* _MSC_VER */
+
+typedef struct {
+  /* bit `c >> 4` of `lo[c & 0xf]` is set if ASCII `c` is in the class */
+  unsigned char lo[16];
+  /* bytes 0x80-0xff are in the class */
+  int high;
+} llhttp__scan_class_t;
+
+/* HTAB, SP-'~', obs-text */
+static const llhttp__scan_class_t llhttp__scan_header_value = {
+  { 0xfc, 0xfc, 0xfc, 0xfc, 0xfc, 0xfc, 0xfc, 0xfc,
+    0xfc, 0xfd, 0xfc, 0xfc, 0xfc, 0xfc, 0xfc, 0x7c }, 1
+};
+#if LLHTTP_STRICT_MODE
+/* tchar */
+static const llhttp__scan_class_t llhttp__scan_token = {
+  { 0xe8, 0xfc, 0xf8, 0xfc, 0xfc, 0xfc, 0xfc, 0xfc,
+    0xf8, 0xf8, 0xf4, 0x54, 0xd0, 0x54, 0xf4, 0x70 }, 0
+};
+#else  /* !LLHTTP_STRICT_MODE */
+/* tchar and SP, as allowed by the loose mode */
+static const llhttp__scan_class_t llhttp__scan_token_sp = {
+  { 0xec, 0xfc, 0xf8, 0xfc, 0xfc, 0xfc, 0xfc, 0xfc,
+    0xf8, 0xf8, 0xf4, 0x54, 0xd0, 0x54, 0xf4, 0x70 }, 0
+};
+/* HTAB, FF, '!'-'~' except '#' and '?', obs-text */
+static const llhttp__scan_class_t llhttp__scan_url_path = {
+  { 0xf8, 0xfc, 0xfc, 0xf8, 0xfc, 0xfc, 0xfc, 0xfc,
+    0xfc, 0xfd, 0xfc, 0xfc, 0xfd, 0xfc, 0xfc, 0x74 }, 1
+};
+#endif  /* LLHTTP_STRICT_MODE */
+
+/* `table` is the lookup table of the state, 1 for bytes in `cls` */
+typedef const unsigned char* (*llhttp__scan_fn)(
+    const unsigned char* p, const unsigned char* endp,
+    const llhttp__scan_class_t* cls, const uint8_t* table);
+
+static const unsigned char* llhttp__scan_scalar(
+    const unsigned char* p, const unsigned char* endp,
+    const llhttp__scan_class_t* cls, const uint8_t* table) {
+  (void) cls;
+  while (p != endp && table[*p] == 1) {
+    p++;
+  }
+  return p;
+}
+
+static unsigned llhttp__ctz(unsigned x) {
+#ifdef _MSC_VER
+  unsigned long i;
+  _BitScanForward(&i, x);
+  return (unsigned) i;
+#else  /* !_MSC_VER */
+  return (unsigned) __builtin_ctz(x);
+#endif  /* _MSC_VER */
+}
+
+/* classify 16 or 32 bytes at a time by their nibbles, `pshufb` looks up
+ * the low nibble in `lo` and the high nibble in 1 << n, a byte is in the
+ * class if both share a bit, or it is obs-text of a class with `high` */
+
+LLHTTP__TARGET("sse4.2")
+static const unsigned char* llhttp__scan_sse42(
+    const unsigned char* p, const unsigned char* endp,
+    const llhttp__scan_class_t* cls, const uint8_t* table) {
+  const __m128i lo = _mm_loadu_si128((const __m128i*) cls->lo);
+  const __m128i hi = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, (char) 128,
+                                   0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i nibble = _mm_set1_epi8(0xf);
+  const unsigned high = cls->high ? 0xffffu : 0;
+
+  while (endp - p >= 16) {
+    __m128i input = _mm_loadu_si128((const __m128i*) p);
+    __m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(input, nibble));
+    __m128i h = _mm_shuffle_epi8(hi,
+        _mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+    unsigned miss = (unsigned) _mm_movemask_epi8(
+        _mm_cmpeq_epi8(_mm_and_si128(l, h), _mm_setzero_si128()));
+    miss &= ~((unsigned) _mm_movemask_epi8(input) & high);
+    if (miss != 0) {
+      return p + llhttp__ctz(miss);
+    }
+    p += 16;
+  }
+  return llhttp__scan_scalar(p, endp, cls, table);
+}
+
+LLHTTP__TARGET("avx2")
+static const unsigned char* llhttp__scan_avx2(
+    const unsigned char* p, const unsigned char* endp,
+    const llhttp__scan_class_t* cls, const uint8_t* table) {
+  const __m256i lo = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i*) cls->lo));
+  const __m256i hi = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, (char) 128,
+                                      0, 0, 0, 0, 0, 0, 0, 0,
+                                      1, 2, 4, 8, 16, 32, 64, (char) 128,
+                                      0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i nibble = _mm256_set1_epi8(0xf);
+  const unsigned high = cls->high ? 0xffffffffu : 0;
+
+  while (endp - p >= 32) {
+    __m256i input = _mm256_loadu_si256((const __m256i*) p);
+    __m256i l = _mm256_shuffle_epi8(lo, _mm256_and_si256(input, nibble));
+    __m256i h = _mm256_shuffle_epi8(hi,
+        _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+    unsigned miss = (unsigned) _mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(_mm256_and_si256(l, h), _mm256_setzero_si256()));
+    miss &= ~((unsigned) _mm256_movemask_epi8(input) & high);
+    if (miss != 0) {
+      return p + llhttp__ctz(miss);
+    }
+    p += 32;
+  }
+  return llhttp__scan_sse42(p, endp, cls, table);
+}
+
+static llhttp__scan_fn llhttp__scan_select(void) {
+  int sse42, avx2;
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 1) {
+    return llhttp__scan_scalar;
+  }
+  __cpuid(info, 1);
+  sse42 = (info[2] >> 20) & 1;
+  avx2 = 0;
+  /* AVX state enabled by the OS */
+  if (info[0] >= 7 && ((info[2] >> 27) & 1) && (_xgetbv(0) & 6) == 6) {
+    __cpuidex(info, 7, 0);
+    avx2 = (info[1] >> 5) & 1;
+  }
+#else  /* !_MSC_VER */
+  __builtin_cpu_init();
+  sse42 = __builtin_cpu_supports("sse4.2");
+  avx2 = __builtin_cpu_supports("avx2");
+#endif  /* _MSC_VER */
+  if (avx2) {
+    return llhttp__scan_avx2;
+  }
+  if (sse42) {
+    return llhttp__scan_sse42;
+  }
+  return llhttp__scan_scalar;
+}
+
+static const unsigned char* llhttp__scan_first(
+    const unsigned char* p, const unsigned char* endp,
+    const llhttp__scan_class_t* cls, const uint8_t* table);
+
+/* threads racing on the first call store the same function */
+static llhttp__scan_fn llhttp__scan_impl = llhttp__scan_first;
+
+static const unsigned char* llhttp__scan_first(
+    const unsigned char* p, const unsigned char* endp,
+    const llhttp__scan_class_t* cls, const uint8_t* table) {
+  llhttp__scan_impl = llhttp__scan_select();
+  return llhttp__scan_impl(p, endp, cls, table);
+}
+
+/* the first byte from `p` not in `cls`, or `endp` */
+static const unsigned char* llhttp__scan(
+    const unsigned char* p, const unsigned char* endp,
+    const llhttp__scan_class_t* cls, const uint8_t* table) {
+  return llhttp__scan_impl(p, endp, cls, table);
+}
+
+#endif  /* x86 */
+
 #if LLHTTP_STRICT_MODE
 
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 
-#ifdef __SSE4_2__
- #ifdef _MSC_VER
-  #include <nmmintrin.h>
- #else  /* !_MSC_VER */
-  #include <x86intrin.h>
- #endif  /* _MSC_VER */
-#endif  /* __SSE4_2__ */
-
 #ifdef _MSC_VER
  #define ALIGN(n) _declspec(align(n))
 #else  /* !_MSC_VER */
@@ -44,24 +229,6 @@ static const unsigned char llparse_blob5[] = {
 static const unsigned char llparse_blob6[] = {
   'c', 'h', 'u', 'n', 'k', 'e', 'd'
 };
-#ifdef __SSE4_2__
-static const unsigned char ALIGN(16) llparse_blob7[] = {
-  0x9, 0x9, ' ', '~', 0x80, 0xff, 0x0, 0x0, 0x0, 0x0, 0x0,
-  0x0, 0x0, 0x0, 0x0, 0x0
-};
-#endif  /* __SSE4_2__ */
-#ifdef __SSE4_2__
-static const unsigned char ALIGN(16) llparse_blob8[] = {
-  '!', '!', '#', '\'', '*', '+', '-', '.', '0', '9', 'A',
-  'Z', '^', 'z', '|', '|'
-};
-#endif  /* __SSE4_2__ */
-#ifdef __SSE4_2__
-static const unsigned char ALIGN(16) llparse_blob9[] = {
-  '~', '~', 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
-  0x0, 0x0, 0x0, 0x0, 0x0
-};
-#endif  /* __SSE4_2__ */
 static const unsigned char llparse_blob10[] = {
   'e', 'n', 't', '-', 'l', 'e', 'n', 'g', 't', 'h'
 };
@@ -2443,30 +2610,15 @@ static llparse_state_t llhttp__internal__run(
       if (p == endp) {
         return s_n_llhttp__internal__n_header_value;
       }
-      #ifdef __SSE4_2__
+      #ifdef LLHTTP__SCAN_X86
       if (endp - p >= 16) {
-        __m128i ranges;
-        __m128i input;
-        int avail;
-        int match_len;
-      
-        /* Load input */
-        input = _mm_loadu_si128((__m128i const*) p);
-        ranges = _mm_loadu_si128((__m128i const*) llparse_blob7);
-      
-        /* Find first character that does not match `ranges` */
-        match_len = _mm_cmpestri(ranges, 6,
-            input, 16,
-            _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES |
-              _SIDD_NEGATIVE_POLARITY);
-      
-        if (match_len != 0) {
-          p += match_len;
-          goto s_n_llhttp__internal__n_header_value;
+        p = llhttp__scan(p, endp, &llhttp__scan_header_value, lookup_table);
+        if (p == endp) {
+          return s_n_llhttp__internal__n_header_value;
         }
         goto s_n_llhttp__internal__n_header_value_otherwise;
       }
-      #endif  /* __SSE4_2__ */
+      #endif  /* LLHTTP__SCAN_X86 */
       switch (lookup_table[(uint8_t) *p]) {
         case 1: {
           p++;
@@ -2660,42 +2812,15 @@ static llparse_state_t llhttp__internal__run(
       if (p == endp) {
         return s_n_llhttp__internal__n_header_field_general;
       }
-      #ifdef __SSE4_2__
+      #ifdef LLHTTP__SCAN_X86
       if (endp - p >= 16) {
-        __m128i ranges;
-        __m128i input;
-        int avail;
-        int match_len;
-      
-        /* Load input */
-        input = _mm_loadu_si128((__m128i const*) p);
-        ranges = _mm_loadu_si128((__m128i const*) llparse_blob8);
-      
-        /* Find first character that does not match `ranges` */
-        match_len = _mm_cmpestri(ranges, 16,
-            input, 16,
-            _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES |
-              _SIDD_NEGATIVE_POLARITY);
-      
-        if (match_len != 0) {
-          p += match_len;
-          goto s_n_llhttp__internal__n_header_field_general;
-        }
-        ranges = _mm_loadu_si128((__m128i const*) llparse_blob9);
-      
-        /* Find first character that does not match `ranges` */
-        match_len = _mm_cmpestri(ranges, 2,
-            input, 16,
-            _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES |
-              _SIDD_NEGATIVE_POLARITY);
-      
-        if (match_len != 0) {
-          p += match_len;
-          goto s_n_llhttp__internal__n_header_field_general;
+        p = llhttp__scan(p, endp, &llhttp__scan_token, lookup_table);
+        if (p == endp) {
+          return s_n_llhttp__internal__n_header_field_general;
         }
         goto s_n_llhttp__internal__n_header_field_general_otherwise;
       }
-      #endif  /* __SSE4_2__ */
+      #endif  /* LLHTTP__SCAN_X86 */
       switch (lookup_table[(uint8_t) *p]) {
         case 1: {
           p++;
@@ -9245,14 +9370,6 @@ int llhttp__internal_execute(llhttp__internal_t* state, const char* p, const cha
 #include <stdint.h>
 #include <string.h>
 
-#ifdef __SSE4_2__
- #ifdef _MSC_VER
-  #include <nmmintrin.h>
- #else  /* !_MSC_VER */
-  #include <x86intrin.h>
- #endif  /* _MSC_VER */
-#endif  /* __SSE4_2__ */
-
 #ifdef _MSC_VER
  #define ALIGN(n) _declspec(align(n))
 #else  /* !_MSC_VER */
@@ -9264,12 +9381,6 @@ int llhttp__internal_execute(llhttp__internal_t* state, const char* p, const cha
 typedef int (*llhttp__internal__span_cb)(
              llhttp__internal_t*, const char*, const char*);
 
-#ifdef __SSE4_2__
-static const unsigned char ALIGN(16) llparse_blob0[] = {
-  0x9, 0x9, 0xc, 0xc, '!', '"', '$', '>', '@', '~', 0x80,
-  0xff, 0x0, 0x0, 0x0, 0x0
-};
-#endif  /* __SSE4_2__ */
 static const unsigned char llparse_blob1[] = {
   'o', 'n'
 };
@@ -9288,24 +9399,6 @@ static const unsigned char llparse_blob5[] = {
 static const unsigned char llparse_blob6[] = {
   'c', 'h', 'u', 'n', 'k', 'e', 'd'
 };
-#ifdef __SSE4_2__
-static const unsigned char ALIGN(16) llparse_blob7[] = {
-  0x9, 0x9, ' ', '~', 0x80, 0xff, 0x0, 0x0, 0x0, 0x0, 0x0,
-  0x0, 0x0, 0x0, 0x0, 0x0
-};
-#endif  /* __SSE4_2__ */
-#ifdef __SSE4_2__
-static const unsigned char ALIGN(16) llparse_blob8[] = {
-  ' ', '!', '#', '\'', '*', '+', '-', '.', '0', '9', 'A',
-  'Z', '^', 'z', '|', '|'
-};
-#endif  /* __SSE4_2__ */
-#ifdef __SSE4_2__
-static const unsigned char ALIGN(16) llparse_blob9[] = {
-  '~', '~', 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
-  0x0, 0x0, 0x0, 0x0, 0x0
-};
-#endif  /* __SSE4_2__ */
 static const unsigned char llparse_blob10[] = {
   'e', 'n', 't', '-', 'l', 'e', 'n', 'g', 't', 'h'
 };
@@ -11649,30 +11742,15 @@ static llparse_state_t llhttp__internal__run(
       if (p == endp) {
         return s_n_llhttp__internal__n_header_value;
       }
-      #ifdef __SSE4_2__
+      #ifdef LLHTTP__SCAN_X86
       if (endp - p >= 16) {
-        __m128i ranges;
-        __m128i input;
-        int avail;
-        int match_len;
-      
-        /* Load input */
-        input = _mm_loadu_si128((__m128i const*) p);
-        ranges = _mm_loadu_si128((__m128i const*) llparse_blob7);
-      
-        /* Find first character that does not match `ranges` */
-        match_len = _mm_cmpestri(ranges, 6,
-            input, 16,
-            _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES |
-              _SIDD_NEGATIVE_POLARITY);
-      
-        if (match_len != 0) {
-          p += match_len;
-          goto s_n_llhttp__internal__n_header_value;
+        p = llhttp__scan(p, endp, &llhttp__scan_header_value, lookup_table);
+        if (p == endp) {
+          return s_n_llhttp__internal__n_header_value;
         }
         goto s_n_llhttp__internal__n_header_value_otherwise;
       }
-      #endif  /* __SSE4_2__ */
+      #endif  /* LLHTTP__SCAN_X86 */
       switch (lookup_table[(uint8_t) *p]) {
         case 1: {
           p++;
@@ -11866,42 +11944,15 @@ static llparse_state_t llhttp__internal__run(
       if (p == endp) {
         return s_n_llhttp__internal__n_header_field_general;
       }
-      #ifdef __SSE4_2__
+      #ifdef LLHTTP__SCAN_X86
       if (endp - p >= 16) {
-        __m128i ranges;
-        __m128i input;
-        int avail;
-        int match_len;
-      
-        /* Load input */
-        input = _mm_loadu_si128((__m128i const*) p);
-        ranges = _mm_loadu_si128((__m128i const*) llparse_blob8);
-      
-        /* Find first character that does not match `ranges` */
-        match_len = _mm_cmpestri(ranges, 16,
-            input, 16,
-            _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES |
-              _SIDD_NEGATIVE_POLARITY);
-      
-        if (match_len != 0) {
-          p += match_len;
-          goto s_n_llhttp__internal__n_header_field_general;
-        }
-        ranges = _mm_loadu_si128((__m128i const*) llparse_blob9);
-      
-        /* Find first character that does not match `ranges` */
-        match_len = _mm_cmpestri(ranges, 2,
-            input, 16,
-            _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES |
-              _SIDD_NEGATIVE_POLARITY);
-      
-        if (match_len != 0) {
-          p += match_len;
-          goto s_n_llhttp__internal__n_header_field_general;
+        p = llhttp__scan(p, endp, &llhttp__scan_token_sp, lookup_table);
+        if (p == endp) {
+          return s_n_llhttp__internal__n_header_field_general;
         }
         goto s_n_llhttp__internal__n_header_field_general_otherwise;
       }
-      #endif  /* __SSE4_2__ */
+      #endif  /* LLHTTP__SCAN_X86 */
       switch (lookup_table[(uint8_t) *p]) {
         case 1: {
           p++;
@@ -12759,30 +12810,15 @@ static llparse_state_t llhttp__internal__run(
       if (p == endp) {
         return s_n_llhttp__internal__n_url_path;
       }
-      #ifdef __SSE4_2__
+      #ifdef LLHTTP__SCAN_X86
       if (endp - p >= 16) {
-        __m128i ranges;
-        __m128i input;
-        int avail;
-        int match_len;
-      
-        /* Load input */
-        input = _mm_loadu_si128((__m128i const*) p);
-        ranges = _mm_loadu_si128((__m128i const*) llparse_blob0);
-      
-        /* Find first character that does not match `ranges` */
-        match_len = _mm_cmpestri(ranges, 12,
-            input, 16,
-            _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES |
-              _SIDD_NEGATIVE_POLARITY);
-      
-        if (match_len != 0) {
-          p += match_len;
-          goto s_n_llhttp__internal__n_url_path;
+        p = llhttp__scan(p, endp, &llhttp__scan_url_path, lookup_table);
+        if (p == endp) {
+          return s_n_llhttp__internal__n_url_path;
         }
         goto s_n_llhttp__internal__n_url_query_or_fragment;
       }
-      #endif  /* __SSE4_2__ */
+      #endif  /* LLHTTP__SCAN_X86 */
       switch (lookup_table[(uint8_t) *p]) {
         case 1: {
           p++;
@@ -0,0 +1,153 @@
+// cost of an access log line per request over an in-memory connection, no sockets.
+// usage: logbench [-n requests] [-r rounds] [-o path] > uvlog.txt
+//   -n: requests per round of each mode, default is 200000
+//   -r: rounds, the modes are interleaved and the best of each is reported, default is 5
+//   -o: file of uv_httpd_accesslog, default is access.log
+//
+// modes:
+//   none:      no log
+//   accesslog: uv_httpd_accesslog, the loop fills an entry of the ring
+//   uvlog:     uvlog_info of the same fields in `on_request`, written to stdout,
+//              so redirect stdout to a file; results go to stderr
+// `loop` is the CPU time of the loop thread per request, `wall` includes the writer thread,
+// which shares the CPU with the loop on a single core machine. a loop serving sockets waits
+// for I/O now and then, here it sleeps 1 ms every PAUSE requests in every mode,
+// so the writer gets the CPU before the ring is full.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "uv_httpd.h"
+#include "uv_httpd_mem.h"
+#include "uv_httpd_accesslog.h"
+#include "uv_log.h"
+#include "mybuf.h"
+
+#define RESPONSE \
+  "HTTP/1.1 200 OK\r\n" \
+  "Content-Type: text/plain\r\n" \
+  "Content-Length: 12\r\n" \
+  "\r\n" \
+  "hello world\n"
+
+#define REQUEST \
+	"GET /api/items?page=3&sort=name HTTP/1.1\r\n" \
+	"Host: 127.0.0.1:8000\r\n" \
+	"User-Agent: curl/7.88.1\r\n" \
+	"Accept: */*\r\n" \
+	"Connection: keep-alive\r\n" \
+	"\r\n"
+
+#define PAUSE 2048 // requests between sleeps of 1 ms
+
+enum { MODE_NONE, MODE_ACCESSLOG, MODE_UVLOG, MODES };
+
+static int mode;
+
+static void on_request(uv_httpd_server_t* server, uv_httpd_client_t* client, uv_httpd_request_t* req) {
+	uv_httpd_write_response(client, RESPONSE, sizeof(RESPONSE) - 1);
+	if (mode == MODE_UVLOG) {
+		uvlog_info("%s - - \"%s %.*s HTTP/%.*s\" %d %zu", uv_httpd_client_ip(client), llhttp_method_name(req->method),
+				   (int)req->url.len, req->base + req->url.offset, (int)req->version.len,
+				   req->base + req->version.offset, 200, sizeof(RESPONSE) - 1);
+	}
+}
+
+// ns of CPU time of the calling thread
+static uint64_t thread_ns(void) {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+	return uv_hrtime();
+#endif
+}
+
+static void keep_min(double* best, double v) {
+	if (*best == 0 || v < *best) *best = v;
+}
+
+int main(int argc, char** argv) {
+	static const char* names[MODES] = { "none", "accesslog", "uvlog" };
+	double best_loop[MODES] = { 0 }, best_wall[MODES] = { 0 }, best_writer = 0;
+	uv_rusage_t usage;
+	const char* path = "access.log";
+	uv_httpd_server_t* server;
+	uv_httpd_accesslog_t* log;
+	uv_httpd_accesslog_stats_t stats;
+	uv_httpd_mem_t* mem;
+	mybuf_t* output;
+	uint64_t wall, cpu, process;
+	size_t n = 200000, i;
+	int rounds = 5, k, r;
+
+	for (k = 1; k < argc; k++) {
+		if (strcmp(argv[k], "-n") == 0 && k + 1 < argc) {
+			n = strtoul(argv[++k], NULL, 10);
+		} else if (strcmp(argv[k], "-r") == 0 && k + 1 < argc) {
+			rounds = atoi(argv[++k]);
+		} else if (strcmp(argv[k], "-o") == 0 && k + 1 < argc) {
+			path = argv[++k];
+		}
+	}
+	if (n == 0) n = 1;
+	if (rounds < 1) rounds = 1;
+
+	r = uv_httpd_create(&server, uv_default_loop(), on_request);
+	if (!r) r = uv_httpd_accesslog_create(&log, path);
+	if (!r) r = uv_httpd_mem_create(&mem, server);
+	if (r) {
+		fprintf(stderr, "%d %s\n", r, uv_err_name(r));
+		return 1;
+	}
+	output = uv_httpd_mem_output(mem);
+
+	for (k = 0; k < rounds * MODES; k++) {
+		mode = k % MODES;
+		server->accesslog = mode == MODE_ACCESSLOG ? log : NULL;
+		uv_getrusage(&usage);
+		process = usage.ru_utime.tv_sec * 1000000000ULL + usage.ru_utime.tv_usec * 1000ULL +
+			usage.ru_stime.tv_sec * 1000000000ULL + usage.ru_stime.tv_usec * 1000ULL;
+		wall = uv_hrtime();
+		cpu = thread_ns();
+		for (i = 0; i < n; i++) {
+			if (i % PAUSE == PAUSE - 1) {
+				uv_sleep(1);
+			}
+			if (uv_httpd_mem_feed(mem, REQUEST, sizeof(REQUEST) - 1, 0) != sizeof(REQUEST) - 1
+				|| output->size != sizeof(RESPONSE) - 1) {
+				fprintf(stderr, "request %zu of %s not answered\n", i, names[mode]);
+				return 1;
+			}
+			output->size = 0;
+		}
+		wall = uv_hrtime() - wall - n / PAUSE * 1000000;
+		cpu = thread_ns() - cpu;
+		keep_min(&best_loop[mode], (double)cpu / n);
+		keep_min(&best_wall[mode], (double)wall / n);
+		if (mode == MODE_ACCESSLOG) {
+			// the rest of the process is mostly the writer
+			uv_getrusage(&usage);
+			process = usage.ru_utime.tv_sec * 1000000000ULL + usage.ru_utime.tv_usec * 1000ULL +
+				usage.ru_stime.tv_sec * 1000000000ULL + usage.ru_stime.tv_usec * 1000ULL - process;
+			keep_min(&best_writer, process > cpu ? (double)(process - cpu) / n : 0.1);
+		}
+	}
+	fflush(stdout);
+	server->accesslog = NULL;
+	uv_httpd_accesslog_stats(log, &stats);
+	uv_httpd_accesslog_free(log);
+
+	for (k = 0; k < MODES; k++) {
+		fprintf(stderr, "%-9s loop %6.0f ns/request, wall %6.0f ns/request", names[k], best_loop[k], best_wall[k]);
+		if (k) {
+			fprintf(stderr, ", +%.0f ns loop, +%.0f ns wall", best_loop[k] - best_loop[0], best_wall[k] - best_wall[0]);
+		}
+		fprintf(stderr, "\n");
+	}
+	fprintf(stderr, "accesslog: %llu entries, %llu dropped for a full ring, writer thread about %.0f ns/entry\n",
+			(unsigned long long)stats.entries, (unsigned long long)stats.dropped, best_writer);
+	return 0;
+}
@@ -2,18 +2,59 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#ifndef _WIN32
+#include <signal.h>
+#endif
 #include "uv_httpd.h"
+#include "uv_httpd_prefork.h"
+#include "uv_httpd_handoff.h"
+#include "uv_httpd_proxy.h"
+#include "uv_httpd_ratelimit.h"
+#include "uv_httpd_multipart.h"
+#include "uv_httpd_url.h"
+#include "uv_httpd_gzip.h"
+#include "uv_httpd_watchdog.h"
+#include "uv_httpd_tls.h"
+#include "uv_httpd_sse.h"
+#include "uv_httpd_accesslog.h"
+#include "uv_httpd_cache.h"
+#include "uv_httpd_trace.h"
+#include "uv_log.h"
+#include "mybuf.h"
+#include "mybuf_json.h"
 
 static int enable_print = 0;
 
-#define LISTEN_ADDR "0.0.0.0"
 #define LISTEN_PORT 8000
+#define MASTER_STATS_INTERVAL 10000 // ms
+#define DRAIN_TIMEOUT 30000 // ms
+#define EVENTS_INTERVAL 1000 // ms
+#define OBJECT_SIZE 4096 // bytes of an object made up by `load_object`
+#define OBJECT_PREFIX "/api/object/"
+
+static const char* listen_addr = "0.0.0.0";
+static int listen_port = LISTEN_PORT;
+static const char* unix_path = NULL;
+static uv_httpd_proxy_t* proxy = NULL;
+static uv_httpd_sse_t* sse = NULL;
+static uv_timer_t events_timer;
+static uv_httpd_cache_t* cache = NULL;
 #define RESPONSE \
   "HTTP/1.1 200 OK\r\n" \
   "Content-Type: text/plain\r\n" \
   "Content-Length: 12\r\n" \
   "\r\n" \
   "hello world\n"
+#define BAD_REQUEST \
+  "HTTP/1.1 400 Bad Request\r\n" \
+  "Content-Type: text/plain\r\n" \
+  "Content-Length: 12\r\n" \
+  "\r\n" \
+  "bad request\n"
+#define NOT_FOUND \
+  "HTTP/1.1 404 Not Found\r\n" \
+  "Content-Length: 0\r\n" \
+  "\r\n"
 
 
 //uv_loop_t* uvloop;
@@ -21,7 +62,189 @@ static int enable_print = 0;
 //llhttp_settings_t http_settings;
 //uv_buf_t resbuf;
 
+static void json_uint(mybuf_json_t* json, const char* key, uint64_t v) {
+	mybuf_json_key(json, key);
+	mybuf_json_uint(json, v);
+}
+
+static void json_double(mybuf_json_t* json, const char* key, double v) {
+	mybuf_json_key(json, key);
+	mybuf_json_double(json, v);
+}
+
+// answer `len` bytes of `data` by 200 with `type`
+static void write_data(uv_httpd_client_t* client, const char* type, const char* data, size_t len) {
+	mybuf_t buf;
+	mybuf_init(&buf);
+	mybuf_cat_printf(&buf, "HTTP/1.1 200 OK\r\n"
+					 "Content-Type: %s\r\n"
+					 "Content-Length: %zu\r\n\r\n", type, len);
+	if (mybuf_append(&buf, data, len)) {
+		uv_httpd_close(client);
+	} else {
+		uv_httpd_write_response(client, buf.buf, buf.size);
+	}
+	mybuf_clear(&buf);
+}
+
+// answer `body` by 200 with `type`, `body` is cleared
+static void write_body(uv_httpd_client_t* client, const char* type, mybuf_t* body) {
+	write_data(client, type, body->buf, body->size);
+	mybuf_clear(body);
+}
+
+// the counters of /api/gzip, /api/watchdog, /api/tls, the event streams, the access log
+// and the object cache under their names
+static void write_stats_json(uv_httpd_server_t* server, mybuf_json_t* json) {
+	size_t rss = 0;
+	uv_resident_set_memory(&rss);
+	mybuf_json_object_begin(json);
+	json_uint(json, "connections", server->stats.connections);
+	json_uint(json, "active", server->stats.active);
+	json_uint(json, "requests", server->stats.requests);
+	json_uint(json, "limited", server->stats.limited);
+	json_uint(json, "rejected", server->stats.rejected);
+	json_uint(json, "memory", server->stats.memory);
+	json_uint(json, "rss", rss);
+	if (server->gzip) {
+		uv_httpd_gzip_stats_t stats;
+		uv_httpd_gzip_stats(server->gzip, &stats);
+		mybuf_json_key(json, "gzip");
+		mybuf_json_object_begin(json);
+		json_uint(json, "responses", stats.responses);
+		json_uint(json, "in", stats.bytes_in);
+		json_uint(json, "out", stats.bytes_out);
+		json_uint(json, "deflated", stats.deflated);
+		json_double(json, "deflate_ms", stats.deflate_ns / 1e6);
+		json_uint(json, "cache_hits", stats.cache_hits);
+		json_uint(json, "cache_misses", stats.cache_misses);
+		json_uint(json, "cache_entries", stats.cache_entries);
+		json_uint(json, "cache_bytes", stats.cache_bytes);
+		mybuf_json_object_end(json);
+	}
+	if (server->watchdog) {
+		uv_httpd_watchdog_stats_t stats;
+		size_t i;
+		uv_httpd_watchdog_stats(server->watchdog, &stats);
+		mybuf_json_key(json, "watchdog");
+		mybuf_json_object_begin(json);
+		json_uint(json, "iterations", stats.iterations);
+		json_double(json, "busy_ms", stats.busy_ns / 1e6);
+		json_double(json, "idle_ms", stats.idle_ns / 1e6);
+		json_double(json, "lag_max_ms", stats.lag_max_ns / 1e6);
+		json_uint(json, "stalls", stats.stalls);
+		// lag[i] counts iterations under 2^i ms, the last one the rest
+		mybuf_json_key(json, "lag");
+		mybuf_json_array_begin(json);
+		for (i = 0; i < UV_HTTPD_WATCHDOG_BUCKETS; i++) {
+			mybuf_json_uint(json, stats.lag[i]);
+		}
+		mybuf_json_array_end(json);
+		mybuf_json_key(json, "offenders");
+		mybuf_json_array_begin(json);
+		for (i = 0; i < stats.n_offenders; i++) {
+			mybuf_json_object_begin(json);
+			mybuf_json_key(json, "blocked_in");
+			mybuf_json_string0(json, stats.offenders[i].name);
+			json_uint(json, "stalls", stats.offenders[i].stalls);
+			json_uint(json, "total_ms", stats.offenders[i].total_ms);
+			json_uint(json, "max_ms", stats.offenders[i].max_ms);
+			mybuf_json_object_end(json);
+		}
+		mybuf_json_array_end(json);
+		mybuf_json_object_end(json);
+	}
+	if (server->tls) {
+		uv_httpd_tls_stats_t stats;
+		uv_httpd_tls_stats(server->tls, &stats);
+		mybuf_json_key(json, "tls");
+		mybuf_json_object_begin(json);
+		json_uint(json, "handshakes", stats.handshakes);
+		json_uint(json, "resumed", stats.resumed);
+		json_uint(json, "failed", stats.failed);
+		json_uint(json, "cache_hits", stats.cache_hits);
+		json_uint(json, "cache_misses", stats.cache_misses);
+		json_uint(json, "cache_entries", stats.cache_entries);
+		json_uint(json, "in", stats.bytes_in);
+		json_uint(json, "out", stats.bytes_out);
+		mybuf_json_object_end(json);
+	}
+	if (sse) {
+		uv_httpd_sse_stats_t stats;
+		uv_httpd_sse_stats(sse, &stats);
+		mybuf_json_key(json, "sse");
+		mybuf_json_object_begin(json);
+		json_uint(json, "streams", stats.streams);
+		json_uint(json, "opened", stats.opened);
+		json_uint(json, "events", stats.events);
+		json_uint(json, "heartbeats", stats.heartbeats);
+		json_uint(json, "dropped", stats.dropped);
+		json_uint(json, "wakeups", stats.wakeups);
+		mybuf_json_object_end(json);
+	}
+	if (server->accesslog) {
+		uv_httpd_accesslog_stats_t stats;
+		uv_httpd_accesslog_stats(server->accesslog, &stats);
+		mybuf_json_key(json, "accesslog");
+		mybuf_json_object_begin(json);
+		json_uint(json, "entries", stats.entries);
+		json_uint(json, "dropped", stats.dropped);
+		json_uint(json, "written", stats.written);
+		json_uint(json, "writes", stats.writes);
+		json_uint(json, "reopens", stats.reopens);
+		json_uint(json, "errors", stats.errors);
+		mybuf_json_object_end(json);
+	}
+	if (cache) {
+		uv_httpd_cache_stats_t stats;
+		uv_httpd_cache_stats(cache, &stats);
+		mybuf_json_key(json, "cache");
+		mybuf_json_object_begin(json);
+		json_uint(json, "hits", stats.hits);
+		json_uint(json, "misses", stats.misses);
+		json_uint(json, "coalesced", stats.coalesced);
+		json_uint(json, "remote", stats.remote);
+		json_uint(json, "remote_failed", stats.remote_failed);
+		json_uint(json, "served", stats.served);
+		json_uint(json, "evicted", stats.evicted);
+		json_uint(json, "entries", stats.entries);
+		json_uint(json, "bytes", stats.bytes);
+		mybuf_json_object_end(json);
+	}
+	mybuf_json_object_end(json);
+}
+
+// /api/stats to every stream of /api/events
+static void on_events_timer(uv_timer_t* timer) {
+	uv_httpd_sse_stats_t stats;
+	mybuf_t body;
+	mybuf_json_t json;
+
+	uv_httpd_sse_stats(sse, &stats);
+	if (stats.streams == 0) return;
+	mybuf_init(&body);
+	mybuf_json_init(&json, &body, 0);
+	write_stats_json(timer->data, &json);
+	if (!json.error) {
+		uv_httpd_sse_broadcast(sse, "stats", NULL, body.buf, body.size);
+	}
+	mybuf_clear(&body);
+}
+
+// stands for an expensive load, e.g. from a database: OBJECT_SIZE bytes repeating the key
+static void load_object(uv_httpd_cache_t* cache, uv_httpd_cache_load_t* load, const char* key, size_t len) {
+	char value[OBJECT_SIZE];
+	size_t i;
+	for (i = 0; i < sizeof(value); i++) {
+		value[i] = key[i % len];
+	}
+	uv_httpd_cache_loaded(load, 0, value, sizeof(value));
+}
+
 void on_request(uv_httpd_server_t* server, uv_httpd_client_t* client, uv_httpd_request_t* req) {
+	uv_httpd_url_t url;
+	const char* path;
+
 	if (enable_print) {
 		printf("METHOD: %s\n", llhttp_method_name(req->method));
 		printf("URL: "); nprintf(req->base + req->url.offset, req->url.len, 1);
@@ -34,16 +257,399 @@ void on_request(uv_httpd_server_t* server, uv_httpd_client_t* client, uv_httpd_r
 		printf("BODY: \n"); nprintf(req->base + req->body.offset, req->body.len, 1);
 	}
 
-	if (string0_ncmp("/api/enable_print", req->base + req->url.offset, req->url.len) == 0) {
-		uv_httpd_enable_printf(1);
-	} else if (string0_ncmp("/api/disable_print", req->base + req->url.offset, req->url.len) == 0) {
-		uv_httpd_enable_printf(0);
+	// objects asked by the other instances of the sharded cache, over the unix socket only,
+	// not reachable by clients over tcp
+	if (cache && uv_httpd_client_addr(client)->ss_family == AF_UNIX
+		&& uv_httpd_cache_serve(cache, client, req)) return;
+
+	uv_httpd_url_parse(req, &url);
+	path = req->base + url.path.offset;
+	if (string0_ncmp("/api/enable_print", path, url.path.len) == 0) {
+		enable_print = 1;
+	} else if (string0_ncmp("/api/disable_print", path, url.path.len) == 0) {
+		enable_print = 0;
+	} else if (string0_ncmp("/api/trace", path, url.path.len) == 0) {
+		// trace rings, convert by `trace2json`. 404 unless built with UV_HTTPD_TRACE
+		mybuf_t body;
+		mybuf_init(&body);
+		if (uv_httpd_trace_dump(&body)) {
+			uv_httpd_write_response(client, NOT_FOUND, sizeof NOT_FOUND - 1);
+			mybuf_clear(&body);
+		} else {
+			write_body(client, "application/octet-stream", &body);
+		}
+		return;
+	} else if (string0_ncmp("/api/query", path, url.path.len) == 0) {
+		// decoded query parameters, one per line
+		uv_httpd_query_iter_t iter;
+		uv_httpd_string_t key, value;
+		mybuf_t body;
+		mybuf_init(&body);
+		uv_httpd_query_init(&iter, req, &url);
+		while (uv_httpd_query_next(&iter, &key, &value)) {
+			uv_httpd_decode(req, &key, 1);
+			uv_httpd_decode(req, &value, 1);
+			mybuf_cat_printf(&body, "%.*s=%.*s\n", (int)key.len, req->base + key.offset,
+							 (int)value.len, req->base + value.offset);
+		}
+		write_body(client, "text/plain", &body);
+		return;
+	} else if (string0_ncmp("/api/gzip", path, url.path.len) == 0 && server->gzip) {
+		// compression stats
+		uv_httpd_gzip_stats_t stats;
+		mybuf_t body;
+		mybuf_init(&body);
+		uv_httpd_gzip_stats(server->gzip, &stats);
+		mybuf_cat_printf(&body, "responses=%llu in=%llu out=%llu saved=%llu\n"
+						 "deflated=%llu deflate_ms=%.1f ms_per_mb=%.2f\n"
+						 "cache_hits=%llu cache_misses=%llu cache_entries=%llu cache_bytes=%llu\n",
+						 (unsigned long long)stats.responses, (unsigned long long)stats.bytes_in,
+						 (unsigned long long)stats.bytes_out, (unsigned long long)(stats.bytes_in - stats.bytes_out),
+						 (unsigned long long)stats.deflated, stats.deflate_ns / 1e6,
+						 stats.deflated ? stats.deflate_ns / 1e6 / (stats.deflated / 1048576.0) : 0.0,
+						 (unsigned long long)stats.cache_hits, (unsigned long long)stats.cache_misses,
+						 (unsigned long long)stats.cache_entries, (unsigned long long)stats.cache_bytes);
+		write_body(client, "text/plain", &body);
+		return;
+	} else if (string0_ncmp("/api/watchdog", path, url.path.len) == 0 && server->watchdog) {
+		// loop lag histogram and the callbacks that blocked the loop
+		uv_httpd_watchdog_stats_t stats;
+		mybuf_t body;
+		size_t i;
+		mybuf_init(&body);
+		uv_httpd_watchdog_stats(server->watchdog, &stats);
+		mybuf_cat_printf(&body, "iterations=%llu busy_ms=%.1f idle_ms=%.1f lag_max_ms=%.3f stalls=%llu\n",
+						 (unsigned long long)stats.iterations, stats.busy_ns / 1e6, stats.idle_ns / 1e6,
+						 stats.lag_max_ns / 1e6, (unsigned long long)stats.stalls);
+		for (i = 0; i < UV_HTTPD_WATCHDOG_BUCKETS - 1; i++) {
+			mybuf_cat_printf(&body, "lag_lt_%dms=%llu\n", 1 << i, (unsigned long long)stats.lag[i]);
+		}
+		mybuf_cat_printf(&body, "lag_ge_%dms=%llu\n", 1 << (i - 1), (unsigned long long)stats.lag[i]);
+		for (i = 0; i < stats.n_offenders; i++) {
+			mybuf_cat_printf(&body, "blocked_in=%s stalls=%llu total_ms=%llu max_ms=%llu\n", stats.offenders[i].name,
+							 (unsigned long long)stats.offenders[i].stalls, (unsigned long long)stats.offenders[i].total_ms,
+							 (unsigned long long)stats.offenders[i].max_ms);
+		}
+		write_body(client, "text/plain", &body);
+		return;
+	} else if (string0_ncmp("/api/tls", path, url.path.len) == 0 && server->tls) {
+		// handshakes and session resumption
+		uv_httpd_tls_stats_t stats;
+		mybuf_t body;
+		mybuf_init(&body);
+		uv_httpd_tls_stats(server->tls, &stats);
+		mybuf_cat_printf(&body, "handshakes=%llu resumed=%llu failed=%llu\n"
+						 "cache_hits=%llu cache_misses=%llu cache_entries=%llu\n"
+						 "in=%llu out=%llu\n",
+						 (unsigned long long)stats.handshakes, (unsigned long long)stats.resumed,
+						 (unsigned long long)stats.failed, (unsigned long long)stats.cache_hits,
+						 (unsigned long long)stats.cache_misses, (unsigned long long)stats.cache_entries,
+						 (unsigned long long)stats.bytes_in, (unsigned long long)stats.bytes_out);
+		write_body(client, "text/plain", &body);
+		return;
+	} else if (string0_ncmp("/api/stats", path, url.path.len) == 0) {
+		// server stats and those of the enabled modules, as JSON
+		mybuf_t body;
+		mybuf_json_t json;
+		mybuf_init(&body);
+		mybuf_json_init(&json, &body, 0);
+		write_stats_json(server, &json);
+		if (json.error) {
+			uv_httpd_close(client);
+			mybuf_clear(&body);
+		} else {
+			write_body(client, "application/json", &body);
+		}
+		return;
+	} else if (string0_ncmp("/api/events", path, url.path.len) == 0 && sse) {
+		// server-sent events, /api/stats every EVENTS_INTERVAL
+		uv_httpd_sse_stream_t* stream;
+		if (uv_httpd_sse_start(sse, client, req, NULL, NULL, &stream)) {
+			uv_httpd_close(client);
+		}
+		return;
+	} else if (cache && url.path.len > sizeof(OBJECT_PREFIX) - 1
+			   && 0 == memcmp(path, OBJECT_PREFIX, sizeof(OBJECT_PREFIX) - 1)) {
+		// /api/object/<key> from the cache, or its owner instance in sharded mode
+		uv_httpd_string_t key;
+		key.offset = url.path.offset + sizeof(OBJECT_PREFIX) - 1;
+		key.len = url.path.len - (sizeof(OBJECT_PREFIX) - 1);
+		uv_httpd_decode(req, &key, 0);
+		uv_httpd_cache_respond(cache, client, req->base + key.offset, key.len);
+		return;
+	} else if (string0_ncmp("/api/echo", path, url.path.len) == 0) {
+		write_data(client, "application/octet-stream", req->base + req->body.offset, req->body.len);
+		return;
 	}
 
 	uv_httpd_write_response(client, RESPONSE, sizeof RESPONSE - 1);
 }
 
-int main()
+static uv_timer_t master_stats_timer;
+
+static void on_master_stats_timer(uv_timer_t* timer) {
+	uv_httpd_stats_t stats;
+	uv_httpd_master_stats(timer->data, &stats);
+	uvlog_info("workers: connections=%llu active=%llu requests=%llu limited=%llu rejected=%llu memory=%llu",
+			   (unsigned long long)stats.connections, (unsigned long long)stats.active,
+			   (unsigned long long)stats.requests, (unsigned long long)stats.limited,
+			   (unsigned long long)stats.rejected, (unsigned long long)stats.memory);
+}
+
+static void on_master_signal(uv_signal_t* signal, int signum) {
+	uvlog_info("master got signal %d, stopping", signum);
+	uv_httpd_master_stop(signal->data);
+	uv_close((uv_handle_t*)signal, NULL);
+	uv_close((uv_handle_t*)&master_stats_timer, NULL);
+}
+
+// prefork mode: `uvhttpd -w <workers>`
+static int run_master(int nworkers, char** argv) {
+	uv_httpd_master_t* master;
+	uv_signal_t sig;
+	uv_loop_t* loop = uv_default_loop();
+	int r = uv_httpd_master_create(&master, loop, nworkers, argv);
+	if (r) {
+		fprintf(stderr, "%d %s\n", r, uv_err_name(r));
+		return r;
+	}
+
+	r = uv_httpd_master_listen(master, listen_addr, listen_port);
+	if (r) {
+		fprintf(stderr, "%d %s\n", r, uv_err_name(r));
+		return r;
+	}
+
+	uv_timer_init(loop, &master_stats_timer);
+	master_stats_timer.data = master;
+	uv_timer_start(&master_stats_timer, on_master_stats_timer, MASTER_STATS_INTERVAL, MASTER_STATS_INTERVAL);
+	uv_signal_init(loop, &sig);
+	sig.data = master;
+	uv_signal_start(&sig, on_master_signal, SIGINT);
+
+	uv_run(loop, UV_RUN_DEFAULT);
+	uv_httpd_master_free(master);
+	return 0;
+}
+
+#ifndef _WIN32
+static uv_signal_t reopen_signal;
+
+// `mv access.log access.log.1 && kill -USR1 <pid>`
+static void on_reopen_signal(uv_signal_t* signal, int signum) {
+	uv_httpd_accesslog_reopen(signal->data);
+}
+#endif
+
+// close every handle so the loop ends, the rest is freed by `free_server` after it
+static void stop_server(uv_httpd_server_t* server) {
+	uv_httpd_stop(server);
+	if (sse) {
+		uv_httpd_sse_free(sse);
+		sse = NULL;
+		uv_close((uv_handle_t*)&events_timer, NULL);
+	}
+	if (proxy) {
+		uv_httpd_proxy_close(proxy);
+	}
+	if (cache) {
+		uv_httpd_cache_close(cache);
+	}
+	if (server->watchdog) {
+		uv_httpd_watchdog_free(server->watchdog);
+		server->watchdog = NULL;
+	}
+#ifndef _WIN32
+	if (server->accesslog) {
+		uv_close((uv_handle_t*)&reopen_signal, NULL);
+	}
+#endif
+}
+
+static void free_server(uv_httpd_server_t* server) {
+	if (proxy) {
+		uv_httpd_proxy_free(proxy);
+		proxy = NULL;
+	}
+	if (cache) {
+		uv_httpd_cache_free(cache);
+		cache = NULL;
+	}
+	if (server->accesslog) {
+		// the lines still in the ring are written first
+		uv_httpd_accesslog_free(server->accesslog);
+	}
+	if (server->gzip) {
+		uv_httpd_gzip_free(server->gzip);
+	}
+	if (server->ratelimit) {
+		uv_httpd_ratelimit_free(server->ratelimit);
+	}
+	if (server->tls) {
+		uv_httpd_tls_free(server->tls);
+	}
+	uv_httpd_free(server);
+}
+
+static void on_drained(uv_httpd_server_t* server, int status) {
+	uvlog_info("drained: %s", status ? uv_err_name(status) : "ok");
+	stop_server(server);
+}
+
+static void on_handoff_fetched(uv_httpd_server_t* server, int status) {
+	int r;
+	if (status) {
+		uvlog_info("no running instance to take over (%s), listening on %s:%d",
+				   uv_err_name(status), listen_addr, listen_port);
+		r = uv_httpd_listen(server, listen_addr, listen_port);
+		fatal_on_uv_err(r, "uv_httpd_listen");
+	} else {
+		uvlog_info("took over listening socket");
+	}
+	if (unix_path) {
+		// released by the old instance when we connected
+		r = uv_httpd_listen_pipe(server, unix_path);
+		fatal_on_uv_err(r, "uv_httpd_listen_pipe");
+	}
+	// hand off to the next instance
+	r = uv_httpd_handoff_serve(server, UV_HTTPD_HANDOFF_PATH, DRAIN_TIMEOUT, on_drained);
+	warn_on_uv_err(r, "uv_httpd_handoff_serve");
+}
+
+// proxy mode, forward everything to upstreams
+static int on_proxy_headers(uv_httpd_server_t* server, uv_httpd_client_t* client, uv_httpd_request_t* req) {
+	int r = uv_httpd_proxy_pass(proxy, client, req);
+	warn_on_uv_err(r, "uv_httpd_proxy_pass");
+	return r;
+}
+
+// POST /api/upload with multipart/form-data, answered with name, filename and size of each part.
+// parts are counted as they arrive, the body is never buffered as a whole.
+typedef struct {
+	uv_httpd_multipart_t* mp;
+	mybuf_t summary;
+	size_t part_size;
+	int failed;
+}upload_t;
+
+static void free_upload(upload_t* up) {
+	uv_httpd_multipart_free(up->mp);
+	mybuf_clear(&up->summary);
+	free(up);
+}
+
+static void on_upload_part(uv_httpd_multipart_t* mp, const uv_httpd_multipart_part_t* part) {
+	upload_t* up = uv_httpd_multipart_data(mp);
+	mybuf_cat_printf(&up->summary, "%.*s %.*s ",
+					 (int)part->name.len, part->base + part->name.offset,
+					 (int)part->filename.len, part->base + part->filename.offset);
+	up->part_size = 0;
+}
+
+static void on_upload_data(uv_httpd_multipart_t* mp, const char* at, size_t len) {
+	upload_t* up = uv_httpd_multipart_data(mp);
+	if (len) {
+		up->part_size += len;
+	} else {
+		mybuf_cat_printf(&up->summary, "%zu\n", up->part_size);
+	}
+}
+
+static void on_upload_abort(uv_httpd_client_t* client) {
+	free_upload(uv_httpd_client_get_data(client));
+}
+
+static void on_upload_body(uv_httpd_client_t* client, const char* at, size_t len) {
+	upload_t* up = uv_httpd_client_get_data(client);
+	mybuf_t buf;
+	int r;
+
+	if (up->failed) return; // closing, freed by on_upload_abort
+	r = len ? uv_httpd_multipart_execute(up->mp, at, len) : uv_httpd_multipart_finish(up->mp);
+	if (r) {
+		up->failed = 1;
+		uv_httpd_reject(client, BAD_REQUEST, sizeof BAD_REQUEST - 1);
+		return;
+	}
+	if (len) return;
+
+	mybuf_init(&buf);
+	mybuf_cat_printf(&buf, "HTTP/1.1 200 OK\r\n"
+					 "Content-Type: text/plain\r\n"
+					 "Content-Length: %zu\r\n\r\n", up->summary.size);
+	mybuf_append(&buf, up->summary.buf, up->summary.size);
+	uv_httpd_write_response(client, buf.buf, buf.size);
+	mybuf_clear(&buf);
+	uv_httpd_client_set_data(client, NULL);
+	free_upload(up);
+	uv_httpd_response_done(client);
+}
+
+static int on_upload_headers(uv_httpd_server_t* server, uv_httpd_client_t* client, uv_httpd_request_t* req) {
+	const char* boundary;
+	size_t len;
+	upload_t* up;
+
+	if (req->method != HTTP_POST || string0_ncmp("/api/upload", req->base + req->url.offset, req->url.len)) {
+		return 0;
+	}
+	if (uv_httpd_multipart_boundary(req, &boundary, &len)) {
+		uv_httpd_reject(client, BAD_REQUEST, sizeof BAD_REQUEST - 1);
+		return 0;
+	}
+	up = calloc(1, sizeof(*up));
+	if (!up) return UV_ENOMEM;
+	mybuf_init(&up->summary);
+	if (uv_httpd_multipart_create(&up->mp, boundary, len, on_upload_part, on_upload_data, up)) {
+		free(up);
+		uv_httpd_reject(client, BAD_REQUEST, sizeof BAD_REQUEST - 1);
+		return 0;
+	}
+	uv_httpd_client_set_data(client, up);
+	uv_httpd_stream_body(client, on_upload_body, on_upload_abort);
+	return 0;
+}
+
+// `ip:port`, or `[ip]:port` for ipv6
+static int add_upstream(const char* addr) {
+	char ip[64];
+	const char* colon = strrchr(addr, ':');
+	size_t len;
+	if (!colon) return UV_EINVAL;
+	len = colon - addr;
+	if (addr[0] == '[' && len >= 2 && addr[len - 1] == ']') {
+		addr++;
+		len -= 2;
+	}
+	if (len >= sizeof(ip)) return UV_EINVAL;
+	memcpy(ip, addr, len);
+	ip[len] = '\0';
+	if (!proxy) {
+		int r = uv_httpd_proxy_create(&proxy, uv_default_loop());
+		if (r) return r;
+	}
+	return uv_httpd_proxy_add_upstream(proxy, ip, atoi(colon + 1));
+}
+
+// usage: uvhttpd [-a addr] [-l port] [-s path] [-c cert.pem -k key.pem] [-w workers] [-r] [-2] [-z] [-b ms] [-e ms] [-o path] [-q rate] [-m MB] [-C MB [-P path]...] [-u ip:port]...
+//   -a: listen address, default is 0.0.0.0, "::" for ipv6 and ipv4
+//   -l: listen port, default is 8000
+//   -s: also listen on the unix domain socket `path`
+//   -c, -k: TLS with the certificate chain and private key, stats at /api/tls
+//   -w: prefork mode
+//   -r: hot restart, take over the listening socket from a running `uvhttpd -r`
+//   -u: reverse proxy to upstream `ip:port`, `[ip]:port` for ipv6, can be repeated
+//   -q: rate limit per client address, connections and requests per second
+//   -m: memory budget of request buffers in MB, answered 503 if exceeded
+//   -2: accept HTTP/2 over cleartext (h2c)
+//   -z: compress responses by `Accept-Encoding`, stats at /api/gzip
+//   -b: report callbacks blocking the loop longer than `ms`, lag histogram at /api/watchdog
+//   -o: access log appended to `path`, "-" for stdout, reopened on SIGUSR1 for log rotation
+//   -e: /api/stats every second as server-sent events at /api/events, a heartbeat after `ms` idle
+//   -C: object cache of `MB` at /api/object/<key>, an object is made up on a miss
+//   -P: sharded object cache, the unix socket of a peer instance, repeated for each in the same
+//       order on every instance, this one included as its `-s path`
+int main(int argc, char** argv)
 {
 	/*int r;
 
@@ -56,15 +662,153 @@ int main()
 	return r;*/
 	 
 	uv_httpd_server_t* server;
-	uv_httpd_enable_printf(0);
+	int nworkers = 0;
+	int hot_restart = 0;
+	int rate = 0;
+	int memory = 0;
+	int h2c = 0;
+	int gzip = 0;
+	int blocked = 0;
+	int heartbeat = 0;
+	int cache_mb = 0;
+	const char* peers[UV_HTTPD_CACHE_MAX_PEERS];
+	int npeers = 0;
+	const char* access_log = NULL;
+	const char* cert_file = NULL;
+	const char* key_file = NULL;
+
+#ifndef _WIN32
+	// a peer closing while a response is written must not kill the process
+	signal(SIGPIPE, SIG_IGN);
+#endif
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+			nworkers = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-r") == 0) {
+			hot_restart = 1;
+		} else if (strcmp(argv[i], "-2") == 0) {
+			h2c = 1;
+		} else if (strcmp(argv[i], "-z") == 0) {
+			gzip = 1;
+		} else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+			blocked = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+			heartbeat = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			access_log = argv[++i];
+		} else if (strcmp(argv[i], "-C") == 0 && i + 1 < argc) {
+			cache_mb = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-P") == 0 && i + 1 < argc) {
+			if (npeers == UV_HTTPD_CACHE_MAX_PEERS) {
+				fprintf(stderr, "more than %d peers\n", UV_HTTPD_CACHE_MAX_PEERS);
+				return UV_E2BIG;
+			}
+			peers[npeers++] = argv[++i];
+		} else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+			memory = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+			rate = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+			listen_port = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+			listen_addr = argv[++i];
+		} else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			unix_path = argv[++i];
+		} else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+			cert_file = argv[++i];
+		} else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+			key_file = argv[++i];
+		} else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc) {
+			int r = add_upstream(argv[++i]);
+			if (r) {
+				fprintf(stderr, "bad upstream %s: %s\n", argv[i], uv_err_name(r));
+				return r;
+			}
+		}
+	}
+	if (nworkers > 0 && !uv_httpd_is_worker()) {
+		return run_master(nworkers, argv);
+	}
+
 	uv_default_loop();
 	int r = uv_httpd_create(&server, uv_default_loop(), on_request);
 	if (r) {
 		fprintf(stderr, "%d %s\n", r, uv_err_name(r));
 		return r;
 	}
+	if (proxy) {
+		server->on_headers = on_proxy_headers;
+	} else {
+		server->on_headers = on_upload_headers;
+	}
+	if (rate > 0) {
+		// allow bursts of 2 seconds
+		r = uv_httpd_ratelimit_create(&server->ratelimit, rate, rate * 2);
+		fatal_on_uv_err(r, "uv_httpd_ratelimit_create");
+	}
+	if (memory > 0) {
+		server->limits.max_memory = (size_t)memory * 1024 * 1024;
+	}
+	server->h2c = h2c;
+	if (gzip) {
+		r = uv_httpd_gzip_create(&server->gzip, uv_default_loop(), UV_HTTPD_GZIP_LEVEL, UV_HTTPD_GZIP_CACHE_SIZE);
+		fatal_on_uv_err(r, "uv_httpd_gzip_create");
+	}
+	if (blocked > 0) {
+		r = uv_httpd_watchdog_create(&server->watchdog, uv_default_loop(), blocked);
+		fatal_on_uv_err(r, "uv_httpd_watchdog_create");
+	}
+	if (cert_file && key_file) {
+		r = uv_httpd_tls_create(&server->tls, cert_file, key_file);
+		fatal_on_uv_err(r, "uv_httpd_tls_create");
+	}
+	if (access_log) {
+		r = uv_httpd_accesslog_create(&server->accesslog, access_log);
+		fatal_on_uv_err(r, "uv_httpd_accesslog_create");
+#ifndef _WIN32
+		uv_signal_init(uv_default_loop(), &reopen_signal);
+		reopen_signal.data = server->accesslog;
+		uv_signal_start(&reopen_signal, on_reopen_signal, SIGUSR1);
+		uv_unref((uv_handle_t*)&reopen_signal);
+#endif
+	}
+	if (cache_mb > 0) {
+		int self = 0;
+		r = uv_httpd_cache_create(&cache, uv_default_loop(), (size_t)cache_mb * 1024 * 1024, load_object, NULL);
+		fatal_on_uv_err(r, "uv_httpd_cache_create");
+		for (int i = 0; i < npeers; i++) {
+			int is_self = unix_path && strcmp(peers[i], unix_path) == 0;
+			self |= is_self;
+			r = uv_httpd_cache_add_peer(cache, peers[i], is_self);
+			fatal_on_uv_err(r, "uv_httpd_cache_add_peer");
+		}
+		if (npeers && !self) {
+			uvlog_warn("-s path is none of the peers, every object is asked from them");
+		}
+	}
+	if (heartbeat > 0) {
+		r = uv_httpd_sse_create(&sse, uv_default_loop(), heartbeat);
+		fatal_on_uv_err(r, "uv_httpd_sse_create");
+		uv_timer_init(uv_default_loop(), &events_timer);
+		events_timer.data = server;
+		uv_timer_start(&events_timer, on_events_timer, EVENTS_INTERVAL, EVENTS_INTERVAL);
+	}
 
-	r = uv_httpd_listen(server, LISTEN_ADDR, LISTEN_PORT);
+	if (uv_httpd_is_worker()) {
+		r = uv_httpd_worker_start(server);
+	} else if (hot_restart) {
+		r = uv_httpd_handoff_fetch(server, UV_HTTPD_HANDOFF_PATH, on_handoff_fetched);
+	} else {
+		r = uv_httpd_listen(server, listen_addr, listen_port);
+		if (!r && unix_path) {
+			// a file left on the path is not removed, it may be another instance's
+			r = uv_httpd_listen_pipe(server, unix_path);
+			fatal_on_uv_err(r, "uv_httpd_listen_pipe");
+		}
+	}
+	warn_on_uv_err(r, "listen");
 	uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+	free_server(server);
 	return r;
 }
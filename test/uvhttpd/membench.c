@@ -0,0 +1,145 @@
+// benchmark of the parse and handler path over in-memory connections, no sockets.
+// usage: membench [-n requests] [-d depth] [-f fragment] [-r small|browser|post]
+//   -n: requests, default is 1000000
+//   -d: pipelined requests fed at once, default is 1
+//   -f: bytes per read, default is 0 for as much as `on_alloc` gives
+//   -r: request, a curl style GET, a browser GET with a dozen headers, or a POST with 1KB body
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "uv_httpd.h"
+#include "uv_httpd_mem.h"
+#include "mybuf.h"
+
+#define RESPONSE \
+  "HTTP/1.1 200 OK\r\n" \
+  "Content-Type: text/plain\r\n" \
+  "Content-Length: 12\r\n" \
+  "\r\n" \
+  "hello world\n"
+
+static const char* small_request =
+	"GET /api/ping HTTP/1.1\r\n"
+	"Host: 127.0.0.1:8000\r\n"
+	"User-Agent: curl/7.88.1\r\n"
+	"Accept: */*\r\n"
+	"Connection: keep-alive\r\n"
+	"\r\n";
+
+static const char* browser_request =
+	"GET /static/js/app.3f9a1c.js?v=20231018 HTTP/1.1\r\n"
+	"Host: www.example.com\r\n"
+	"Connection: keep-alive\r\n"
+	"sec-ch-ua: \"Chromium\";v=\"118\", \"Google Chrome\";v=\"118\", \"Not=A?Brand\";v=\"99\"\r\n"
+	"sec-ch-ua-mobile: ?0\r\n"
+	"User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36\r\n"
+	"sec-ch-ua-platform: \"Windows\"\r\n"
+	"Accept: */*\r\n"
+	"Sec-Fetch-Site: same-origin\r\n"
+	"Sec-Fetch-Mode: no-cors\r\n"
+	"Sec-Fetch-Dest: script\r\n"
+	"Referer: https://www.example.com/dashboard\r\n"
+	"Accept-Encoding: gzip, deflate, br\r\n"
+	"Accept-Language: en-US,en;q=0.9,zh-CN;q=0.8\r\n"
+	"Cookie: session=8f2b6c1e9d3a4f5b; theme=dark; _ga=GA1.1.1234567890.1697600000\r\n"
+	"\r\n";
+
+static void on_request(uv_httpd_server_t* server, uv_httpd_client_t* client, uv_httpd_request_t* req) {
+	uv_httpd_write_response(client, RESPONSE, sizeof(RESPONSE) - 1);
+}
+
+static void build_post(mybuf_t* buf) {
+	char body[1024];
+	memset(body, 'x', sizeof(body));
+	mybuf_cat_printf(buf, "POST /api/echo HTTP/1.1\r\n"
+					 "Host: 127.0.0.1:8000\r\n"
+					 "Content-Type: application/octet-stream\r\n"
+					 "Content-Length: %zu\r\n"
+					 "Connection: keep-alive\r\n"
+					 "\r\n", sizeof(body));
+	mybuf_append(buf, body, sizeof(body));
+}
+
+// feed `batches` of `depth` requests, return 0 if every request is answered
+static int run(uv_httpd_mem_t* mem, mybuf_t* batch, size_t batches, int depth, size_t fragment) {
+	mybuf_t* output = uv_httpd_mem_output(mem);
+	size_t i;
+	for (i = 0; i < batches; i++) {
+		if (uv_httpd_mem_feed(mem, batch->buf, batch->size, fragment) != batch->size
+			|| output->size != depth * (sizeof(RESPONSE) - 1)) {
+			return -1;
+		}
+		output->size = 0;
+	}
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	size_t n = 1000000, fragment = 0, batches;
+	int depth = 1, i;
+	const char* kind = "small";
+	uv_httpd_server_t* server;
+	uv_httpd_mem_t* mem;
+	mybuf_t request, batch;
+	uint64_t start, ns;
+	int r;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			n = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+			depth = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			fragment = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			kind = argv[++i];
+		}
+	}
+	if (depth < 1) depth = 1;
+
+	mybuf_init(&request);
+	mybuf_init(&batch);
+	if (strcmp(kind, "browser") == 0) {
+		mybuf_append(&request, browser_request, strlen(browser_request));
+	} else if (strcmp(kind, "post") == 0) {
+		build_post(&request);
+	} else {
+		mybuf_append(&request, small_request, strlen(small_request));
+	}
+	for (i = 0; i < depth; i++) {
+		mybuf_append(&batch, request.buf, request.size);
+	}
+
+	r = uv_httpd_create(&server, uv_default_loop(), on_request);
+	if (!r) r = uv_httpd_mem_create(&mem, server);
+	if (r) {
+		fprintf(stderr, "%d %s\n", r, uv_err_name(r));
+		return 1;
+	}
+
+	batches = (n + depth - 1) / depth;
+	// warm up caches and buffers
+	if (run(mem, &batch, batches / 10 + 1, depth, fragment)) {
+		fprintf(stderr, "requests not answered\n");
+		return 1;
+	}
+	start = uv_hrtime();
+	r = run(mem, &batch, batches, depth, fragment);
+	ns = uv_hrtime() - start;
+	if (r) {
+		fprintf(stderr, "requests not answered\n");
+		return 1;
+	}
+	n = batches * depth;
+	printf("%s request %zu bytes, depth %d, fragment %zu: %zu requests in %.3fs, %.1f ns/request, %.0f req/s\n",
+		   kind, request.size, depth, fragment, n, ns / 1e9, (double)ns / n, n / (ns / 1e9));
+
+	uv_httpd_mem_free(mem);
+	uv_httpd_stop(server);
+	uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+	uv_httpd_free(server);
+	mybuf_clear(&request);
+	mybuf_clear(&batch);
+	return 0;
+}
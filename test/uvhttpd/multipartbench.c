@@ -0,0 +1,195 @@
+// throughput of uv_httpd_multipart on one large part, no sockets.
+// usage: multipartbench [-s MB] [-p bytes]
+//   -s: size of the part in MB, default is 1024
+//   -p: bytes per piece fed, default is 65536
+//
+// the part is random binary, then text with CRLF every ~19 bytes, the worst case of the
+// search for the CR starting a delimiter. a smaller body of each is also fed in random
+// 1..70 byte pieces and the part data checked byte-exact.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "uv_httpd_multipart.h"
+#include "mybuf.h"
+
+#define BOUNDARY "----uvhttpdBoundary7MA4YWxkTrZu0gW"
+#define BLOCK (64 * 1024 * 1024) // bytes of the part generated, repeated up to its size, larger than caches
+#define CHECK_SIZE (4 * 1024 * 1024) // bytes of the part fed in small pieces
+
+typedef struct {
+	size_t parts;
+	size_t bytes;
+	uint64_t hash; // FNV-1a of the part data, if `hashing`
+	int hashing;
+}result_t;
+
+static uint64_t x = 88172645463325252ULL;
+
+
+/*************************** helper functions ****************/
+
+static uint32_t next_random(void) {
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return (uint32_t)(x >> 32);
+}
+
+static uint64_t fnv1a(uint64_t h, const char* p, size_t len) {
+	size_t i;
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)p[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+static void fill_binary(char* block, size_t len) {
+	size_t i;
+	for (i = 0; i < len; i++) {
+		block[i] = (char)next_random();
+	}
+}
+
+// lines of 10..24 letters, ending by CRLF
+static void fill_text(char* block, size_t len) {
+	size_t i = 0, n;
+	while (i < len) {
+		n = 10 + next_random() % 15;
+		while (n-- && i < len) {
+			block[i++] = (char)('a' + next_random() % 26);
+		}
+		if (i < len) block[i++] = '\r';
+		if (i < len) block[i++] = '\n';
+	}
+}
+
+static void on_part(uv_httpd_multipart_t* mp, const uv_httpd_multipart_part_t* part) {
+	result_t* r = uv_httpd_multipart_data(mp);
+	r->parts++;
+}
+
+static void on_part_data(uv_httpd_multipart_t* mp, const char* at, size_t len) {
+	result_t* r = uv_httpd_multipart_data(mp);
+	r->bytes += len;
+	if (r->hashing) r->hash = fnv1a(r->hash, at, len);
+}
+
+static uv_httpd_multipart_t* create(result_t* r) {
+	uv_httpd_multipart_t* mp;
+	int err = uv_httpd_multipart_create(&mp, BOUNDARY, sizeof(BOUNDARY) - 1, on_part, on_part_data, r);
+	if (err) {
+		fprintf(stderr, "uv_httpd_multipart_create: %s\n", uv_err_name(err));
+		exit(1);
+	}
+	return mp;
+}
+
+static void feed(uv_httpd_multipart_t* mp, const char* at, size_t len) {
+	int err = uv_httpd_multipart_execute(mp, at, len);
+	if (err) {
+		fprintf(stderr, "uv_httpd_multipart_execute: %s\n", uv_err_name(err));
+		exit(1);
+	}
+}
+
+static void finish(uv_httpd_multipart_t* mp) {
+	int err = uv_httpd_multipart_finish(mp);
+	if (err) {
+		fprintf(stderr, "uv_httpd_multipart_finish: %s\n", uv_err_name(err));
+		exit(1);
+	}
+	uv_httpd_multipart_free(mp);
+}
+
+
+/*************************** runs ****************/
+
+static const char head[] = "--" BOUNDARY "\r\n"
+	"Content-Disposition: form-data; name=\"file\"; filename=\"data.bin\"\r\n"
+	"Content-Type: application/octet-stream\r\n\r\n";
+static const char tail[] = "\r\n--" BOUNDARY "--\r\n";
+
+// `size` bytes of the part, `block` repeated, fed in pieces of `piece` bytes
+static void throughput(const char* kind, const char* block, size_t size, size_t piece) {
+	result_t r = { 0 };
+	uv_httpd_multipart_t* mp = create(&r);
+	size_t off, n;
+	uint64_t start, ns;
+
+	start = uv_hrtime();
+	feed(mp, head, sizeof(head) - 1);
+	for (off = 0; off < size; off += n) {
+		size_t at = off % BLOCK;
+		n = size - off;
+		if (n > piece) n = piece;
+		if (n > BLOCK - at) n = BLOCK - at;
+		feed(mp, block + at, n);
+	}
+	feed(mp, tail, sizeof(tail) - 1);
+	finish(mp);
+	ns = uv_hrtime() - start;
+	if (r.parts != 1 || r.bytes != size) {
+		fprintf(stderr, "%s: %zu parts, %zu bytes\n", kind, r.parts, r.bytes);
+		exit(1);
+	}
+	printf("%-6s %zu MB in pieces of %zu: %.3fs, %.2f GB/s\n",
+		   kind, size >> 20, piece, ns / 1e9, size / (double)ns);
+}
+
+// CHECK_SIZE bytes of the part in random pieces of 1..70 bytes
+static void check(const char* kind, const char* block) {
+	result_t r = { 0 };
+	uv_httpd_multipart_t* mp;
+	mybuf_t body;
+	size_t off, n;
+
+	mybuf_init(&body);
+	mybuf_append(&body, head, sizeof(head) - 1);
+	mybuf_append(&body, block, CHECK_SIZE);
+	mybuf_append(&body, tail, sizeof(tail) - 1);
+
+	r.hashing = 1;
+	r.hash = 14695981039346656037ULL;
+	mp = create(&r);
+	for (off = 0; off < body.size; off += n) {
+		n = 1 + next_random() % 70;
+		if (n > body.size - off) n = body.size - off;
+		feed(mp, body.buf + off, n);
+	}
+	finish(mp);
+	printf("%-6s %zu MB in pieces of 1..70: %s\n", kind, (size_t)CHECK_SIZE >> 20,
+		   r.parts == 1 && r.bytes == CHECK_SIZE
+		   && r.hash == fnv1a(14695981039346656037ULL, body.buf + sizeof(head) - 1, CHECK_SIZE)
+		   ? "byte-exact" : "MISMATCH");
+	mybuf_clear(&body);
+}
+
+int main(int argc, char** argv) {
+	size_t size = 1024, piece = 65536;
+	char* block;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			size = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+			piece = strtoul(argv[++i], NULL, 10);
+		}
+	}
+	if (size == 0) size = 1;
+	if (piece == 0) piece = 1;
+	size <<= 20;
+
+	block = malloc(BLOCK);
+	if (!block) return 1;
+	fill_binary(block, BLOCK);
+	throughput("binary", block, size, piece);
+	check("binary", block);
+	fill_text(block, BLOCK);
+	throughput("text", block, size, piece);
+	check("text", block);
+	free(block);
+	return 0;
+}
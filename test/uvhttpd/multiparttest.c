@@ -0,0 +1,193 @@
+// regression tests of uv_httpd_multipart: parts, their headers and data, fed in every split.
+// usage: multiparttest
+// prints each case, exits with 1 if any fails.
+//
+// the parser sees a body in pieces as read from a socket, so a delimiter or the end of the
+// headers of a part may be cut anywhere. a body is fed whole, cut in two at every position
+// and one byte at a time, each must give the same parts and data.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "uv_httpd_multipart.h"
+#include "mybuf.h"
+
+#define BOUNDARY "----uvhttpdBoundaryX3"
+
+// data lines look like the delimiter without being it
+static const char* body =
+	"preamble, ignored\r\n"
+	"------uvhttpdBoundaryX3\r\n"
+	"Content-Disposition: form-data; name=\"title\"\r\n"
+	"\r\n"
+	"hello\r\n"
+	"------uvhttpdBoundaryX3  \t\r\n"
+	"content-disposition: form-data; name=\"file\"; filename=\"a \\\"b\\\".txt\"\r\n"
+	"Content-Type:  text/plain \r\n"
+	"\r\n"
+	"line 1\r\n"
+	"\r\n"
+	"------uvhttpdBoundaryX\r\n"
+	"\r------uvhttpdBoundaryX3x\r\n"
+	"------uvhttpdBoundaryX3\r\n"
+	"Content-Disposition: form-data; name=empty\r\n"
+	"\r\n"
+	"\r\n"
+	"------uvhttpdBoundaryX3--\r\n"
+	"epilogue, ignored\r\n";
+
+// parts as recorded by `on_part` and `on_part_data`
+static const char* expected =
+	"[title||]hello|"
+	"[file|a \\\"b\\\".txt|text/plain]line 1\r\n\r\n------uvhttpdBoundaryX\r\n\r------uvhttpdBoundaryX3x|"
+	"[empty||]|";
+
+static int failures;
+
+
+/*************************** helper functions ****************/
+
+static void check(int ok, const char* what) {
+	printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+	if (!ok) failures++;
+}
+
+static void append_string(mybuf_t* out, const char* base, const uv_httpd_string_t* s) {
+	mybuf_append(out, base + s->offset, s->len);
+}
+
+static void on_part(uv_httpd_multipart_t* mp, const uv_httpd_multipart_part_t* part) {
+	mybuf_t* out = uv_httpd_multipart_data(mp);
+	mybuf_append(out, "[", 1);
+	append_string(out, part->base, &part->name);
+	mybuf_append(out, "|", 1);
+	append_string(out, part->base, &part->filename);
+	mybuf_append(out, "|", 1);
+	append_string(out, part->base, &part->content_type);
+	mybuf_append(out, "]", 1);
+}
+
+static void on_part_data(uv_httpd_multipart_t* mp, const char* at, size_t len) {
+	mybuf_t* out = uv_httpd_multipart_data(mp);
+	if (len == 0) {
+		mybuf_append(out, "|", 1);
+	} else {
+		mybuf_append(out, at, len);
+	}
+}
+
+// feed `data` in pieces of `piece` bytes, the first one `first` bytes,
+// return the status of execute or finish, the parts recorded in `out`
+static int feed(const char* data, size_t len, size_t first, size_t piece, mybuf_t* out) {
+	uv_httpd_multipart_t* mp;
+	size_t off = 0, n = first;
+	int r;
+
+	out->size = 0;
+	r = uv_httpd_multipart_create(&mp, BOUNDARY, sizeof(BOUNDARY) - 1, on_part, on_part_data, out);
+	if (r) return r;
+	while (!r && off < len) {
+		if (n > len - off) n = len - off;
+		r = uv_httpd_multipart_execute(mp, data + off, n);
+		off += n;
+		n = piece;
+	}
+	if (!r) r = uv_httpd_multipart_finish(mp);
+	uv_httpd_multipart_free(mp);
+	return r;
+}
+
+static int recorded(const mybuf_t* out) {
+	return out->size == strlen(expected) && 0 == memcmp(out->buf, expected, out->size);
+}
+
+// `content_type` gives `boundary`, or UV_EINVAL if NULL
+static void boundary_is(const char* content_type, const char* boundary) {
+	char buf[512], what[600];
+	uv_httpd_header_t header;
+	uv_httpd_request_t req;
+	const char* b = NULL;
+	size_t len = 0;
+	int r;
+
+	snprintf(buf, sizeof(buf), "Content-Type: %s", content_type);
+	memset(&req, 0, sizeof(req));
+	req.base = buf;
+	header.key.offset = 0;
+	header.key.len = 12;
+	header.value.offset = 14;
+	header.value.len = strlen(content_type);
+	req.headers.n = 1;
+	req.headers.headers = &header;
+	r = uv_httpd_multipart_boundary(&req, &b, &len);
+	snprintf(what, sizeof(what), "boundary of `%.60s` is %.30s", content_type, boundary ? boundary : "invalid");
+	if (boundary) {
+		check(r == 0 && len == strlen(boundary) && 0 == memcmp(b, boundary, len), what);
+	} else {
+		check(r == UV_EINVAL, what);
+	}
+}
+
+
+/*************************** cases ****************/
+
+static void splits(void) {
+	size_t len = strlen(body), i;
+	mybuf_t out;
+	int ok = 1;
+
+	mybuf_init(&out);
+	check(feed(body, len, len, len, &out) == 0 && recorded(&out), "parts of the whole body");
+	if (!recorded(&out)) printf("     got %.*s\n", (int)out.size, out.buf);
+	for (i = 1; i < len && ok; i++) {
+		ok = feed(body, len, i, len, &out) == 0 && recorded(&out);
+		if (!ok) printf("     cut at %zu: %.*s\n", i, (int)out.size, out.buf);
+	}
+	check(ok, "the same parts cut in two anywhere");
+	check(feed(body, len, 1, 1, &out) == 0 && recorded(&out), "the same parts one byte at a time");
+	mybuf_clear(&out);
+}
+
+static void malformed(void) {
+	char head[UV_HTTPD_MULTIPART_MAX_HEADERS + 100];
+	mybuf_t out;
+	uv_httpd_multipart_t* mp;
+
+	mybuf_init(&out);
+	check(feed("--" BOUNDARY "x\r\n\r\n", sizeof(BOUNDARY) + 6, 100, 100, &out) == UV_EPROTO,
+		  "text after a boundary is UV_EPROTO");
+	check(feed("--" BOUNDARY "\r\n\r\ndata", sizeof(BOUNDARY) + 9, 100, 100, &out) == UV_EPROTO,
+		  "a body without the closing boundary is UV_EPROTO at finish");
+	check(feed("no boundary", 11, 100, 100, &out) == UV_EPROTO, "a body without any boundary is UV_EPROTO");
+
+	snprintf(head, sizeof(head), "--%s\r\nX: ", BOUNDARY);
+	memset(head + strlen(head), 'x', sizeof(head) - strlen(head));
+	check(feed(head, sizeof(head), 1000, 1000, &out) == UV_EPROTO, "part headers over the limit are UV_EPROTO");
+
+	check(uv_httpd_multipart_create(&mp, "a\rb", 3, on_part, on_part_data, NULL) == UV_EINVAL
+		  && uv_httpd_multipart_create(&mp, "", 0, on_part, on_part_data, NULL) == UV_EINVAL,
+		  "a boundary with CR, or empty, is refused");
+	mybuf_clear(&out);
+}
+
+static void boundaries(void) {
+	char longest[128];
+
+	boundary_is("multipart/form-data; boundary=" BOUNDARY, BOUNDARY);
+	boundary_is("Multipart/Form-Data;charset=utf-8;  BOUNDARY=\"a b;c\"", "a b;c");
+	boundary_is("multipart/mixed; boundary=x", "x");
+	boundary_is("text/plain; boundary=x", NULL);
+	boundary_is("multipart/form-data", NULL);
+	boundary_is("multipart/form-data; boundary=\"\"", NULL);
+	snprintf(longest, sizeof(longest), "multipart/form-data; boundary=%0*d", UV_HTTPD_MULTIPART_MAX_BOUNDARY, 7);
+	boundary_is(longest, longest + 30);
+	snprintf(longest, sizeof(longest), "multipart/form-data; boundary=%0*d", UV_HTTPD_MULTIPART_MAX_BOUNDARY + 1, 7);
+	boundary_is(longest, NULL);
+}
+
+int main(int argc, char** argv) {
+	splits();
+	malformed();
+	boundaries();
+	return failures ? 1 : 0;
+}
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdarg.h>
 #include "mybuf.h"
@@ -15,45 +16,39 @@ size_t mybuf_space(mybuf_t* buf) {
 	return buf->capacity - buf->size;
 }
 
-void mybuf_reserve(mybuf_t* buf, size_t size) {
-	if (mybuf_space(buf) < size) {
-		//fprintf(stderr, "WARN: mybuf_t not enough, space=%zu, needed=%zu\n", mybuf_space(buf), size);
-		while (mybuf_space(buf) < size) {
-			buf->capacity *= 2;
-		}
-		if (buf->buf == buf->mybuf) {
-			buf->buf = (char*)malloc(buf->capacity);
-			fatal_if_null(buf->buf);
-			memcpy(buf->buf, buf->mybuf, buf->size);
-		} else {
-			char* tmp = (char*)realloc(buf->buf, buf->capacity);
-			fatal_if_null(tmp);
-			buf->buf = tmp;
-		}
-	}
+size_t mybuf_heap_size(mybuf_t* buf) {
+	return buf->buf == buf->mybuf ? 0 : buf->capacity;
 }
 
-void mybuf_append(mybuf_t* buf, const char* data, size_t len) {
-	if (mybuf_space(buf) >= len) {
-		memcpy(buf->buf + buf->size, data, len);
-		buf->size += len;
+int mybuf_reserve(mybuf_t* buf, size_t size) {
+	size_t capacity = buf->capacity;
+	char* tmp;
+
+	if (mybuf_space(buf) >= size) return 0;
+	//fprintf(stderr, "WARN: mybuf_t not enough, space=%zu, needed=%zu\n", mybuf_space(buf), size);
+	if (size > SIZE_MAX - buf->size) return -1;
+	while (capacity - buf->size < size) {
+		if (capacity > SIZE_MAX / 2) return -1;
+		capacity *= 2;
+	}
+	if (buf->buf == buf->mybuf) {
+		tmp = (char*)malloc(capacity);
+		if (!tmp) return -1;
+		memcpy(tmp, buf->mybuf, buf->size);
 	} else {
-		//fprintf(stderr, "WARN: mybuf_t not enough, space=%zu, needed=%zu\n", mybuf_space(buf), len);
-		while (mybuf_space(buf) < len) {
-			buf->capacity *= 2;
-		}
-		if (buf->buf == buf->mybuf) {
-			buf->buf = (char*)malloc(buf->capacity);
-			fatal_if_null(buf->buf);
-			memcpy(buf->buf, buf->mybuf, buf->size);
-		} else {
-			char* tmp = (char*)realloc(buf->buf, buf->capacity);
-			fatal_if_null(tmp);
-			buf->buf = tmp;
-		}
-		memcpy(buf->buf + buf->size, data, len);
-		buf->size += len;
+		tmp = (char*)realloc(buf->buf, capacity);
+		if (!tmp) return -1;
 	}
+	buf->buf = tmp;
+	buf->capacity = capacity;
+	return 0;
+}
+
+int mybuf_append(mybuf_t* buf, const char* data, size_t len) {
+	if (mybuf_reserve(buf, len)) return -1;
+	memcpy(buf->buf + buf->size, data, len);
+	buf->size += len;
+	return 0;
 }
 
 static void mybuf_cat_vprintf(mybuf_t* buf, const char* fmt, va_list ap) {
@@ -68,7 +63,10 @@ static void mybuf_cat_vprintf(mybuf_t* buf, const char* fmt, va_list ap) {
 			uvlog_error("mybuf_cat_vprintf error:%d", l);
 			return;
 		} else if ((size_t)l >= mybuf_space(buf)) {
-			mybuf_reserve(buf, (size_t)l + 1);
+			if (mybuf_reserve(buf, (size_t)l + 1)) {
+				uvlog_error("mybuf_cat_vprintf out of memory, len=%d", l);
+				return;
+			}
 			continue;
 		} else {
 			break;
@@ -21,8 +21,11 @@ typedef struct {
 
 void mybuf_init(mybuf_t* buf);
 size_t mybuf_space(mybuf_t* buf);
-void mybuf_reserve(mybuf_t* buf, size_t size);
-void mybuf_append(mybuf_t* buf, const char* data, size_t len);
+// heap memory held by `buf`, 0 if it still uses the inline `mybuf`
+size_t mybuf_heap_size(mybuf_t* buf);
+// return 0 for success, -1 if out of memory and `buf` is left unchanged
+int mybuf_reserve(mybuf_t* buf, size_t size);
+int mybuf_append(mybuf_t* buf, const char* data, size_t len);
 
 #ifdef __GNUC__
 void mybuf_cat_printf(mybuf_t* buf, const char* fmt, ...)
@@ -0,0 +1,650 @@
+#include <string.h>
+#include "mybuf_json.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MYBUF_JSON_SSE2 1
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#define NUMBER_MAX 32 // bytes reserved for a number, see mybuf_json_dtoa
+
+// the byte after '\' for bytes to escape, 'u' for \u00XX, 0 for bytes copied as they are
+static const char escapes[256] = {
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+	0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0,
+};
+
+static const char hex[] = "0123456789abcdef";
+
+static const char digits2[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+
+/*************************** output ****************/
+
+// room for `len` bytes, not counting a comma
+static char* reserve(mybuf_json_t* json, size_t len) {
+	mybuf_t* buf = json->buf;
+	if (json->error) return NULL;
+	if (buf->capacity - buf->size < len && mybuf_reserve(buf, len)) {
+		json->error = -1;
+		return NULL;
+	}
+	return buf->buf + buf->size;
+}
+
+// room for a comma and a value of at most `len` bytes, the comma is written
+static char* begin_value(mybuf_json_t* json, size_t len) {
+	char* p = reserve(json, len + 1);
+	if (!p) return NULL;
+	if (json->comma) *p++ = ',';
+	json->comma = 1;
+	return p;
+}
+
+static void end_value(mybuf_json_t* json, char* p) {
+	json->buf->size = (size_t)(p - json->buf->buf);
+}
+
+void mybuf_json_init(mybuf_json_t* json, mybuf_t* buf, size_t size_hint) {
+	json->buf = buf;
+	json->comma = 0;
+	json->error = 0;
+	if (size_hint) reserve(json, size_hint);
+}
+
+
+/*************************** strings ****************/
+
+#ifdef MYBUF_JSON_SSE2
+static unsigned ctz(unsigned x) {
+#ifdef _MSC_VER
+	unsigned long i;
+	_BitScanForward(&i, x);
+	return (unsigned)i;
+#else
+	return (unsigned)__builtin_ctz(x);
+#endif
+}
+#endif
+
+// SWAR: nonzero if any byte of the word is < 0x20, '"' or '\\'
+static uint64_t dirty8(const char* s) {
+	const uint64_t ones = 0x0101010101010101ull, highs = 0x8080808080808080ull;
+	uint64_t x, q, b;
+	memcpy(&x, s, 8);
+	q = x ^ (ones * '"');
+	b = x ^ (ones * '\\');
+	return ((x - ones * 0x20) & ~x & highs) | ((q - ones) & ~q & highs) | ((b - ones) & ~b & highs);
+}
+
+static uint32_t dirty4(const char* s) {
+	const uint32_t ones = 0x01010101u, highs = 0x80808080u;
+	uint32_t x, q, b;
+	memcpy(&x, s, 4);
+	q = x ^ (ones * '"');
+	b = x ^ (ones * '\\');
+	return ((x - ones * 0x20) & ~x & highs) | ((q - ones) & ~q & highs) | ((b - ones) & ~b & highs);
+}
+
+#ifdef MYBUF_JSON_SSE2
+// bit i is set if byte i is < 0x20, '"' or '\\'
+static unsigned dirty16(const char* s) {
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i control = _mm_set1_epi8(0x1f);
+	__m128i x = _mm_loadu_si128((const __m128i*)s);
+	// x <= 0x1f unsigned if min(x, 0x1f) == x
+	__m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, quote), _mm_cmpeq_epi8(x, backslash)),
+							 _mm_cmpeq_epi8(_mm_min_epu8(x, control), x));
+	return (unsigned)_mm_movemask_epi8(m);
+}
+#endif
+
+// bytes before the first one to escape.
+// the last word overlaps the ones before, as memcpy does, so short strings
+// and tails take no byte loop and nothing past `s + len` is read
+static size_t clean_prefix(const char* s, size_t len) {
+	size_t i = 0;
+#ifdef MYBUF_JSON_SSE2
+	if (len >= 16) {
+		unsigned mask;
+		for (; i + 16 <= len; i += 16) {
+			mask = dirty16(s + i);
+			if (mask) return i + ctz(mask);
+		}
+		// bit 0 for byte i
+		mask = dirty16(s + len - 16) >> (i + 16 - len);
+		return mask ? i + ctz(mask) : len;
+	}
+#endif
+	if (len >= 8) {
+		for (; i + 8 <= len; i += 8) {
+			if (dirty8(s + i)) break;
+		}
+		if (i == len || (i + 8 > len && !dirty8(s + len - 8))) return len;
+	} else if (len >= 4) {
+		if (!dirty4(s) && !dirty4(s + len - 4)) return len;
+	}
+	// the exact position
+	while (i < len && !escapes[(unsigned char)s[i]]) i++;
+	return i;
+}
+
+// the rest of a string from its first byte to escape, return the end or NULL if out of memory
+static char* write_escaped(mybuf_json_t* json, char* p, const char* s, size_t len) {
+	mybuf_t* buf = json->buf;
+	while (len) {
+		unsigned char c = (unsigned char)*s;
+		char e = escapes[c];
+		size_t clean;
+		// \u00XX, the rest of the string, the closing quote and a colon
+		size_t need = 6 + len + 2;
+		if ((size_t)(buf->buf + buf->capacity - p) < need) {
+			end_value(json, p);
+			if (mybuf_reserve(buf, need)) {
+				json->error = -1;
+				return NULL;
+			}
+			p = buf->buf + buf->size;
+		}
+		*p++ = '\\';
+		if (e == 'u') {
+			*p++ = 'u';
+			*p++ = '0';
+			*p++ = '0';
+			*p++ = hex[c >> 4];
+			*p++ = hex[c & 0xf];
+		} else {
+			*p++ = e;
+		}
+		s++;
+		len--;
+		clean = clean_prefix(s, len);
+		memcpy(p, s, clean);
+		p += clean;
+		s += clean;
+		len -= clean;
+	}
+	return p;
+}
+
+// one reserve and one copy unless something needs escaping
+static void write_string(mybuf_json_t* json, const char* s, size_t len, int key) {
+	size_t clean = clean_prefix(s, len);
+	char* p = begin_value(json, len + 3);
+	if (!p) return;
+	*p++ = '"';
+	memcpy(p, s, clean);
+	p += clean;
+	if (clean < len) {
+		p = write_escaped(json, p, s + clean, len - clean);
+		if (!p) return;
+	}
+	*p++ = '"';
+	if (key) {
+		*p++ = ':';
+		json->comma = 0;
+	}
+	end_value(json, p);
+}
+
+void mybuf_json_key(mybuf_json_t* json, const char* key) {
+	write_string(json, key, strlen(key), 1);
+}
+
+void mybuf_json_key_len(mybuf_json_t* json, const char* key, size_t len) {
+	write_string(json, key, len, 1);
+}
+
+void mybuf_json_string(mybuf_json_t* json, const char* s, size_t len) {
+	write_string(json, s, len, 0);
+}
+
+void mybuf_json_string0(mybuf_json_t* json, const char* s) {
+	if (s) {
+		write_string(json, s, strlen(s), 0);
+	} else {
+		mybuf_json_null(json);
+	}
+}
+
+
+/*************************** containers ****************/
+
+static void begin_container(mybuf_json_t* json, char c) {
+	char* p = begin_value(json, 1);
+	if (!p) return;
+	*p++ = c;
+	json->comma = 0;
+	end_value(json, p);
+}
+
+static void end_container(mybuf_json_t* json, char c) {
+	char* p = reserve(json, 1);
+	if (!p) return;
+	*p++ = c;
+	json->comma = 1;
+	end_value(json, p);
+}
+
+void mybuf_json_object_begin(mybuf_json_t* json) {
+	begin_container(json, '{');
+}
+
+void mybuf_json_object_end(mybuf_json_t* json) {
+	end_container(json, '}');
+}
+
+void mybuf_json_array_begin(mybuf_json_t* json) {
+	begin_container(json, '[');
+}
+
+void mybuf_json_array_end(mybuf_json_t* json) {
+	end_container(json, ']');
+}
+
+
+/*************************** integers ****************/
+
+// two digits at a time from the end
+static char* write_uint(char* p, uint64_t v) {
+	char tmp[20];
+	char* t = tmp + sizeof(tmp);
+	size_t n;
+	while (v >= 100) {
+		unsigned r = (unsigned)(v % 100);
+		v /= 100;
+		t -= 2;
+		memcpy(t, digits2 + r * 2, 2);
+	}
+	if (v >= 10) {
+		t -= 2;
+		memcpy(t, digits2 + v * 2, 2);
+	} else {
+		*--t = (char)('0' + v);
+	}
+	n = (size_t)(tmp + sizeof(tmp) - t);
+	memcpy(p, t, n);
+	return p + n;
+}
+
+void mybuf_json_uint(mybuf_json_t* json, uint64_t v) {
+	char* p = begin_value(json, NUMBER_MAX);
+	if (!p) return;
+	end_value(json, write_uint(p, v));
+}
+
+void mybuf_json_int(mybuf_json_t* json, int64_t v) {
+	char* p = begin_value(json, NUMBER_MAX);
+	if (!p) return;
+	if (v < 0) {
+		*p++ = '-';
+		end_value(json, write_uint(p, 0 - (uint64_t)v));
+	} else {
+		end_value(json, write_uint(p, (uint64_t)v));
+	}
+}
+
+
+/*************************** doubles ****************/
+
+// Grisu2 of Florian Loitsch, "Printing Floating-Point Numbers Quickly and Accurately
+// with Integers", with the boundaries of the double so the digits read back the same.
+// the result is the shortest for all but a tiny fraction of doubles, then a digit longer
+
+typedef struct {
+	uint64_t f;
+	int e;
+}diyfp_t;
+
+// c = f * 2^e ~ 10^k, for k = -300, -292, ..., 324
+typedef struct {
+	uint64_t f;
+	int e;
+	int k;
+}cached_power_t;
+
+static const cached_power_t cached_powers[] = {
+	{ 0xAB70FE17C79AC6CAull, -1060, -300 },
+	{ 0xFF77B1FCBEBCDC4Full, -1034, -292 },
+	{ 0xBE5691EF416BD60Cull, -1007, -284 },
+	{ 0x8DD01FAD907FFC3Cull,  -980, -276 },
+	{ 0xD3515C2831559A83ull,  -954, -268 },
+	{ 0x9D71AC8FADA6C9B5ull,  -927, -260 },
+	{ 0xEA9C227723EE8BCBull,  -901, -252 },
+	{ 0xAECC49914078536Dull,  -874, -244 },
+	{ 0x823C12795DB6CE57ull,  -847, -236 },
+	{ 0xC21094364DFB5637ull,  -821, -228 },
+	{ 0x9096EA6F3848984Full,  -794, -220 },
+	{ 0xD77485CB25823AC7ull,  -768, -212 },
+	{ 0xA086CFCD97BF97F4ull,  -741, -204 },
+	{ 0xEF340A98172AACE5ull,  -715, -196 },
+	{ 0xB23867FB2A35B28Eull,  -688, -188 },
+	{ 0x84C8D4DFD2C63F3Bull,  -661, -180 },
+	{ 0xC5DD44271AD3CDBAull,  -635, -172 },
+	{ 0x936B9FCEBB25C996ull,  -608, -164 },
+	{ 0xDBAC6C247D62A584ull,  -582, -156 },
+	{ 0xA3AB66580D5FDAF6ull,  -555, -148 },
+	{ 0xF3E2F893DEC3F126ull,  -529, -140 },
+	{ 0xB5B5ADA8AAFF80B8ull,  -502, -132 },
+	{ 0x87625F056C7C4A8Bull,  -475, -124 },
+	{ 0xC9BCFF6034C13053ull,  -449, -116 },
+	{ 0x964E858C91BA2655ull,  -422, -108 },
+	{ 0xDFF9772470297EBDull,  -396, -100 },
+	{ 0xA6DFBD9FB8E5B88Full,  -369,  -92 },
+	{ 0xF8A95FCF88747D94ull,  -343,  -84 },
+	{ 0xB94470938FA89BCFull,  -316,  -76 },
+	{ 0x8A08F0F8BF0F156Bull,  -289,  -68 },
+	{ 0xCDB02555653131B6ull,  -263,  -60 },
+	{ 0x993FE2C6D07B7FACull,  -236,  -52 },
+	{ 0xE45C10C42A2B3B06ull,  -210,  -44 },
+	{ 0xAA242499697392D3ull,  -183,  -36 },
+	{ 0xFD87B5F28300CA0Eull,  -157,  -28 },
+	{ 0xBCE5086492111AEBull,  -130,  -20 },
+	{ 0x8CBCCC096F5088CCull,  -103,  -12 },
+	{ 0xD1B71758E219652Cull,   -77,   -4 },
+	{ 0x9C40000000000000ull,   -50,    4 },
+	{ 0xE8D4A51000000000ull,   -24,   12 },
+	{ 0xAD78EBC5AC620000ull,     3,   20 },
+	{ 0x813F3978F8940984ull,    30,   28 },
+	{ 0xC097CE7BC90715B3ull,    56,   36 },
+	{ 0x8F7E32CE7BEA5C70ull,    83,   44 },
+	{ 0xD5D238A4ABE98068ull,   109,   52 },
+	{ 0x9F4F2726179A2245ull,   136,   60 },
+	{ 0xED63A231D4C4FB27ull,   162,   68 },
+	{ 0xB0DE65388CC8ADA8ull,   189,   76 },
+	{ 0x83C7088E1AAB65DBull,   216,   84 },
+	{ 0xC45D1DF942711D9Aull,   242,   92 },
+	{ 0x924D692CA61BE758ull,   269,  100 },
+	{ 0xDA01EE641A708DEAull,   295,  108 },
+	{ 0xA26DA3999AEF774Aull,   322,  116 },
+	{ 0xF209787BB47D6B85ull,   348,  124 },
+	{ 0xB454E4A179DD1877ull,   375,  132 },
+	{ 0x865B86925B9BC5C2ull,   402,  140 },
+	{ 0xC83553C5C8965D3Dull,   428,  148 },
+	{ 0x952AB45CFA97A0B3ull,   455,  156 },
+	{ 0xDE469FBD99A05FE3ull,   481,  164 },
+	{ 0xA59BC234DB398C25ull,   508,  172 },
+	{ 0xF6C69A72A3989F5Cull,   534,  180 },
+	{ 0xB7DCBF5354E9BECEull,   561,  188 },
+	{ 0x88FCF317F22241E2ull,   588,  196 },
+	{ 0xCC20CE9BD35C78A5ull,   614,  204 },
+	{ 0x98165AF37B2153DFull,   641,  212 },
+	{ 0xE2A0B5DC971F303Aull,   667,  220 },
+	{ 0xA8D9D1535CE3B396ull,   694,  228 },
+	{ 0xFB9B7CD9A4A7443Cull,   720,  236 },
+	{ 0xBB764C4CA7A44410ull,   747,  244 },
+	{ 0x8BAB8EEFB6409C1Aull,   774,  252 },
+	{ 0xD01FEF10A657842Cull,   800,  260 },
+	{ 0x9B10A4E5E9913129ull,   827,  268 },
+	{ 0xE7109BFBA19C0C9Dull,   853,  276 },
+	{ 0xAC2820D9623BF429ull,   880,  284 },
+	{ 0x80444B5E7AA7CF85ull,   907,  292 },
+	{ 0xBF21E44003ACDD2Dull,   933,  300 },
+	{ 0x8E679C2F5E44FF8Full,   960,  308 },
+	{ 0xD433179D9C8CB841ull,   986,  316 },
+	{ 0x9E19DB92B4E31BA9ull,  1013,  324 },
+};
+
+#define GRISU_ALPHA (-60)
+#define GRISU_GAMMA (-32)
+
+static diyfp_t diyfp_sub(diyfp_t x, diyfp_t y) {
+	diyfp_t r = { x.f - y.f, x.e };
+	return r;
+}
+
+// rounded upper 64 bits of the 128 bit product
+static diyfp_t diyfp_mul(diyfp_t x, diyfp_t y) {
+	diyfp_t r;
+#ifdef __SIZEOF_INT128__
+	unsigned __int128 p = (unsigned __int128)x.f * y.f;
+	r.f = (uint64_t)(p >> 64) + ((uint64_t)p >> 63);
+#else
+	uint64_t u_lo = x.f & 0xffffffffu, u_hi = x.f >> 32;
+	uint64_t v_lo = y.f & 0xffffffffu, v_hi = y.f >> 32;
+	uint64_t p0 = u_lo * v_lo, p1 = u_lo * v_hi, p2 = u_hi * v_lo, p3 = u_hi * v_hi;
+	uint64_t q = (p0 >> 32) + (p1 & 0xffffffffu) + (p2 & 0xffffffffu) + (1u << 31);
+	r.f = p3 + (p1 >> 32) + (p2 >> 32) + (q >> 32);
+#endif
+	r.e = x.e + y.e + 64;
+	return r;
+}
+
+static diyfp_t diyfp_normalize(diyfp_t x) {
+	while ((x.f >> 63) == 0) {
+		x.f <<= 1;
+		x.e--;
+	}
+	return x;
+}
+
+// v and its boundaries m- and m+, normalized to the same exponent
+static void compute_boundaries(double d, diyfp_t* minus, diyfp_t* v, diyfp_t* plus) {
+	uint64_t bits, fraction;
+	int exponent;
+	diyfp_t w, m_minus, m_plus;
+
+	memcpy(&bits, &d, sizeof(bits));
+	fraction = bits & 0x000fffffffffffffull;
+	exponent = (int)(bits >> 52);
+	if (exponent == 0) {
+		w.f = fraction;
+		w.e = 1 - 1075;
+	} else {
+		w.f = fraction + 0x0010000000000000ull;
+		w.e = exponent - 1075;
+	}
+	m_plus.f = 2 * w.f + 1;
+	m_plus.e = w.e - 1;
+	// the lower neighbour is closer for powers of 2
+	if (fraction == 0 && exponent > 1) {
+		m_minus.f = 4 * w.f - 1;
+		m_minus.e = w.e - 2;
+	} else {
+		m_minus.f = 2 * w.f - 1;
+		m_minus.e = w.e - 1;
+	}
+	*plus = diyfp_normalize(m_plus);
+	minus->f = m_minus.f << (m_minus.e - plus->e);
+	minus->e = plus->e;
+	*v = diyfp_normalize(w);
+}
+
+// 10^-k for which w * 10^-k has a binary exponent in [alpha, gamma]
+static const cached_power_t* cached_power(int e) {
+	// k = ceil((alpha - e - 1) * log10(2))
+	int f = GRISU_ALPHA - e - 1;
+	int k = (f * 78913) / (1 << 18) + (f > 0);
+	return &cached_powers[(300 + k + 7) / 8];
+}
+
+// move the last digit down while that is closer to v and still in the interval
+static void grisu2_round(char* buf, int len, uint64_t dist, uint64_t delta, uint64_t rest, uint64_t ten_k) {
+	while (rest < dist && delta - rest >= ten_k && (rest + ten_k < dist || dist - rest > rest + ten_k - dist)) {
+		buf[len - 1]--;
+		rest += ten_k;
+	}
+}
+
+// digits of v, return their count and the decimal exponent of the last one in `*dexp`
+static int grisu2(char* buf, double d, int* dexp) {
+	diyfp_t minus, v, plus, w, w_minus, w_plus, one;
+	const cached_power_t* c;
+	uint64_t delta, dist, p2;
+	uint32_t p1, pow10;
+	int len = 0, n;
+
+	compute_boundaries(d, &minus, &v, &plus);
+	c = cached_power(plus.e);
+	{
+		diyfp_t c_minus_k = { c->f, c->e };
+		w = diyfp_mul(v, c_minus_k);
+		w_minus = diyfp_mul(minus, c_minus_k);
+		w_plus = diyfp_mul(plus, c_minus_k);
+	}
+	// shrink the interval by the error of the products
+	w_minus.f++;
+	w_plus.f--;
+	*dexp = -c->k;
+
+	delta = diyfp_sub(w_plus, w_minus).f;
+	dist = diyfp_sub(w_plus, w).f;
+	one.f = 1ull << -w_plus.e;
+	one.e = w_plus.e;
+	p1 = (uint32_t)(w_plus.f >> -one.e);
+	p2 = w_plus.f & (one.f - 1);
+
+	// the integral part, at most 10 digits
+	if (p1 >= 1000000000) { pow10 = 1000000000; n = 10; }
+	else if (p1 >= 100000000) { pow10 = 100000000; n = 9; }
+	else if (p1 >= 10000000) { pow10 = 10000000; n = 8; }
+	else if (p1 >= 1000000) { pow10 = 1000000; n = 7; }
+	else if (p1 >= 100000) { pow10 = 100000; n = 6; }
+	else if (p1 >= 10000) { pow10 = 10000; n = 5; }
+	else if (p1 >= 1000) { pow10 = 1000; n = 4; }
+	else if (p1 >= 100) { pow10 = 100; n = 3; }
+	else if (p1 >= 10) { pow10 = 10; n = 2; }
+	else { pow10 = 1; n = 1; }
+
+	while (n > 0) {
+		uint64_t rest;
+		buf[len++] = (char)('0' + p1 / pow10);
+		p1 %= pow10;
+		n--;
+		rest = ((uint64_t)p1 << -one.e) + p2;
+		if (rest <= delta) {
+			*dexp += n;
+			grisu2_round(buf, len, dist, delta, rest, (uint64_t)pow10 << -one.e);
+			return len;
+		}
+		pow10 /= 10;
+	}
+
+	// the fractional part
+	for (n = 0;;) {
+		p2 *= 10;
+		buf[len++] = (char)('0' + (p2 >> -one.e));
+		p2 &= one.f - 1;
+		n++;
+		delta *= 10;
+		dist *= 10;
+		if (p2 <= delta) break;
+	}
+	*dexp -= n;
+	grisu2_round(buf, len, dist, delta, p2, one.f);
+	return len;
+}
+
+// `len` digits worth digits * 10^dexp, laid out as Number.prototype.toString does
+static size_t format_digits(char* buf, int len, int dexp) {
+	int n = len + dexp; // digits before the decimal point
+	int e;
+	char* p;
+
+	if (len <= n && n <= 21) {
+		// 1234e7 -> 12340000000
+		memset(buf + len, '0', (size_t)(n - len));
+		return (size_t)n;
+	}
+	if (0 < n && n <= 21) {
+		// 1234e-2 -> 12.34
+		memmove(buf + n + 1, buf + n, (size_t)(len - n));
+		buf[n] = '.';
+		return (size_t)len + 1;
+	}
+	if (-6 < n && n <= 0) {
+		// 1234e-6 -> 0.001234
+		memmove(buf + 2 - n, buf, (size_t)len);
+		buf[0] = '0';
+		buf[1] = '.';
+		memset(buf + 2, '0', (size_t)-n);
+		return (size_t)(2 - n + len);
+	}
+	// 1234e30 -> 1.234e+33
+	if (len == 1) {
+		p = buf + 1;
+	} else {
+		memmove(buf + 2, buf + 1, (size_t)len - 1);
+		buf[1] = '.';
+		p = buf + len + 1;
+	}
+	e = n - 1;
+	*p++ = 'e';
+	if (e < 0) {
+		*p++ = '-';
+		e = -e;
+	} else {
+		*p++ = '+';
+	}
+	if (e >= 100) {
+		*p++ = (char)('0' + e / 100);
+		e %= 100;
+		memcpy(p, digits2 + e * 2, 2);
+		p += 2;
+	} else if (e >= 10) {
+		memcpy(p, digits2 + e * 2, 2);
+		p += 2;
+	} else {
+		*p++ = (char)('0' + e);
+	}
+	return (size_t)(p - buf);
+}
+
+size_t mybuf_json_dtoa(double v, char* out) {
+	uint64_t bits;
+	int len, dexp;
+	char* p = out;
+
+	memcpy(&bits, &v, sizeof(bits));
+	if ((bits & 0x7ff0000000000000ull) == 0x7ff0000000000000ull) {
+		// NaN and Infinity are not JSON
+		memcpy(out, "null", 4);
+		return 4;
+	}
+	if ((bits << 1) == 0) {
+		// -0 too
+		*out = '0';
+		return 1;
+	}
+	if (bits >> 63) {
+		*p++ = '-';
+		v = -v;
+	}
+	len = grisu2(p, v, &dexp);
+	return (size_t)(p - out) + format_digits(p, len, dexp);
+}
+
+void mybuf_json_double(mybuf_json_t* json, double v) {
+	char* p = begin_value(json, NUMBER_MAX);
+	if (!p) return;
+	end_value(json, p + mybuf_json_dtoa(v, p));
+}
+
+
+/*************************** literals ****************/
+
+void mybuf_json_bool(mybuf_json_t* json, int v) {
+	mybuf_json_raw(json, v ? "true" : "false", v ? 4 : 5);
+}
+
+void mybuf_json_null(mybuf_json_t* json) {
+	mybuf_json_raw(json, "null", 4);
+}
+
+void mybuf_json_raw(mybuf_json_t* json, const char* s, size_t len) {
+	char* p = begin_value(json, len);
+	if (!p) return;
+	memcpy(p, s, len);
+	end_value(json, p + len);
+}
@@ -0,0 +1,63 @@
+#ifndef __MYBUF_JSON_H__
+#define __MYBUF_JSON_H__
+
+#pragma once
+
+#include <stdint.h>
+#include "mybuf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// streaming JSON writer appending to a `mybuf_t`, no printf and no intermediate tree.
+// commas are inserted by the writer, a value inside an object follows its `mybuf_json_key`.
+// strings are escaped as JSON.stringify does, bytes >= 0x80 are copied as they are,
+// so they should be UTF-8. doubles are written in the shortest form that reads back
+// the same double (Grisu2), formatted as JSON.stringify does, NaN and Infinity as null.
+//
+//   mybuf_json_t json;
+//   mybuf_json_init(&json, &body, 256);
+//   mybuf_json_object_begin(&json);
+//   mybuf_json_key(&json, "requests");
+//   mybuf_json_uint(&json, stats.requests);
+//   mybuf_json_object_end(&json);
+//   if (json.error) ...
+
+typedef struct {
+	mybuf_t* buf;
+	int comma; // a value was written at this level, the next one needs a comma
+	int error; // -1 if out of memory, the output is incomplete and later writes are dropped
+}mybuf_json_t;
+
+// `size_hint` bytes are reserved up front, 0 for none
+void mybuf_json_init(mybuf_json_t* json, mybuf_t* buf, size_t size_hint);
+
+void mybuf_json_object_begin(mybuf_json_t* json);
+void mybuf_json_object_end(mybuf_json_t* json);
+void mybuf_json_array_begin(mybuf_json_t* json);
+void mybuf_json_array_end(mybuf_json_t* json);
+// NUL-terminated name of the next value in an object
+void mybuf_json_key(mybuf_json_t* json, const char* key);
+void mybuf_json_key_len(mybuf_json_t* json, const char* key, size_t len);
+
+void mybuf_json_string(mybuf_json_t* json, const char* s, size_t len);
+// NUL-terminated, NULL for null
+void mybuf_json_string0(mybuf_json_t* json, const char* s);
+void mybuf_json_int(mybuf_json_t* json, int64_t v);
+void mybuf_json_uint(mybuf_json_t* json, uint64_t v);
+void mybuf_json_double(mybuf_json_t* json, double v);
+void mybuf_json_bool(mybuf_json_t* json, int v);
+void mybuf_json_null(mybuf_json_t* json);
+// a value serialized elsewhere, copied as it is
+void mybuf_json_raw(mybuf_json_t* json, const char* s, size_t len);
+
+// shortest round trip form of `v` into `out`, at least 25 bytes, not NUL-terminated.
+// return the length
+size_t mybuf_json_dtoa(double v, char* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
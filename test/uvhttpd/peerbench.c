@@ -0,0 +1,212 @@
+// cost of the peer address of a connection: formatting it against keeping it binary,
+// and the server side of connection churn with the text formatted on every request or never.
+// usage: peerbench [-n connections] [-c concurrency] [-r runs]
+//   -n: connections of each churn run, default is 20000
+//   -c: connections open at once, default is 8
+//   -r: churn runs of each mode, interleaved, the best is reported, default is 3
+//
+// churn runs a uv_httpd server and its clients on one loop over loopback, each client sends
+// one request without keep-alive and reads until the server closes. the time per connection
+// covers both sides, the difference between the modes is the formatting.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <signal.h>
+#endif
+#include "uv_httpd.h"
+#include "uv_httpd_ratelimit.h"
+
+#define PORT 18960
+#define CALLS 1000000
+
+#define RESPONSE \
+	"HTTP/1.1 200 OK\r\n" \
+	"Content-Type: text/plain\r\n" \
+	"Content-Length: 3\r\n" \
+	"\r\n" \
+	"ok\n"
+
+#define REQUEST \
+	"GET / HTTP/1.1\r\n" \
+	"Host: x\r\n" \
+	"\r\n"
+
+typedef struct {
+	uv_tcp_t tcp;
+	uv_connect_t connect_req;
+	uv_write_t write_req;
+}conn_t;
+
+static uv_loop_t* loop;
+static struct sockaddr_in server_addr;
+static int eager; // format the peer address on every request
+static size_t started, finished, total;
+static int concurrency;
+static size_t formatted; // bytes, keeps the formatting from being optimized out
+
+
+/*************************** formatting ****************/
+
+static double time_ip4_name(const struct sockaddr_in* addr) {
+	char ip[46];
+	uint64_t start = uv_hrtime();
+	size_t i;
+	for (i = 0; i < CALLS; i++) {
+		uv_ip4_name(addr, ip, sizeof(ip));
+		formatted += strlen(ip);
+	}
+	return (double)(uv_hrtime() - start) / CALLS;
+}
+
+static double time_ip6_name(const struct sockaddr_in6* addr) {
+	char ip[46];
+	uint64_t start = uv_hrtime();
+	size_t i;
+	for (i = 0; i < CALLS; i++) {
+		uv_ip6_name(addr, ip, sizeof(ip));
+		formatted += strlen(ip);
+	}
+	return (double)(uv_hrtime() - start) / CALLS;
+}
+
+static double time_addr_key(const struct sockaddr* addr) {
+	uv_httpd_addr_key_t key;
+	uint64_t start = uv_hrtime();
+	size_t i;
+	for (i = 0; i < CALLS; i++) {
+		uv_httpd_addr_key(addr, &key);
+		formatted += (size_t)(key.lo & 1);
+	}
+	return (double)(uv_hrtime() - start) / CALLS;
+}
+
+
+/*************************** churn ****************/
+
+static void on_request(uv_httpd_server_t* server, uv_httpd_client_t* client, uv_httpd_request_t* req) {
+	if (eager) {
+		formatted += strlen(uv_httpd_client_ip(client));
+	}
+	uv_httpd_write_response(client, RESPONSE, sizeof(RESPONSE) - 1);
+}
+
+static void connect_next(void);
+
+static void on_conn_closed(uv_handle_t* handle) {
+	free(handle);
+	finished++;
+	connect_next();
+}
+
+static void on_alloc(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
+	static char slab[4096];
+	buf->base = slab;
+	buf->len = sizeof(slab);
+}
+
+static void on_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
+	if (nread < 0) {
+		uv_close((uv_handle_t*)stream, on_conn_closed);
+	}
+}
+
+static void on_written(uv_write_t* req, int status) {
+}
+
+static void on_connect(uv_connect_t* req, int status) {
+	conn_t* c = req->data;
+	uv_buf_t buf = uv_buf_init(REQUEST, sizeof(REQUEST) - 1);
+	if (status) {
+		fprintf(stderr, "connect: %s\n", uv_err_name(status));
+		uv_close((uv_handle_t*)&c->tcp, on_conn_closed);
+		return;
+	}
+	uv_write(&c->write_req, (uv_stream_t*)&c->tcp, &buf, 1, on_written);
+	uv_read_start((uv_stream_t*)&c->tcp, on_alloc, on_read);
+}
+
+static void connect_next(void) {
+	conn_t* c;
+	if (started == total) return;
+	started++;
+	c = malloc(sizeof(*c));
+	uv_tcp_init(loop, &c->tcp);
+	c->connect_req.data = c;
+	uv_tcp_connect(&c->connect_req, &c->tcp, (const struct sockaddr*)&server_addr, on_connect);
+}
+
+// ns per connection
+static double churn(size_t n, int format) {
+	uint64_t start;
+	int i;
+	eager = format;
+	started = finished = 0;
+	total = n;
+	start = uv_hrtime();
+	for (i = 0; i < concurrency; i++) {
+		connect_next();
+	}
+	while (finished < total) {
+		uv_run(loop, UV_RUN_ONCE);
+	}
+	return (double)(uv_hrtime() - start) / n;
+}
+
+int main(int argc, char** argv) {
+	struct sockaddr_in in4;
+	struct sockaddr_in6 in6;
+	uv_httpd_server_t* server;
+	size_t n = 20000;
+	int runs = 3, i, r;
+	double lazy_ns = 0, eager_ns = 0;
+
+	concurrency = 8;
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			n = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+			concurrency = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			runs = atoi(argv[++i]);
+		}
+	}
+	if (n == 0) n = 1;
+	if (concurrency < 1) concurrency = 1;
+	if (runs < 1) runs = 1;
+
+#ifndef _WIN32
+	signal(SIGPIPE, SIG_IGN);
+#endif
+	uv_ip4_addr("203.0.113.45", 51234, &in4);
+	uv_ip6_addr("2001:db8:85a3::8a2e:370:7334", 51234, &in6);
+	printf("%-28s %6.1f ns/call\n", "uv_ip4_name", time_ip4_name(&in4));
+	printf("%-28s %6.1f ns/call\n", "uv_ip6_name", time_ip6_name(&in6));
+	printf("%-28s %6.1f ns/call\n", "uv_httpd_addr_key, ipv4", time_addr_key((const struct sockaddr*)&in4));
+	printf("%-28s %6.1f ns/call\n", "uv_httpd_addr_key, ipv6", time_addr_key((const struct sockaddr*)&in6));
+
+	loop = uv_default_loop();
+	uv_ip4_addr("127.0.0.1", PORT, &server_addr);
+	r = uv_httpd_create(&server, loop, on_request);
+	if (!r) r = uv_httpd_listen(server, "127.0.0.1", PORT);
+	if (r) {
+		fprintf(stderr, "%d %s\n", r, uv_err_name(r));
+		return 1;
+	}
+	// warm up
+	churn(n / 10 + 1, 0);
+	for (i = 0; i < runs; i++) {
+		double lazy = churn(n, 0), formatted_ns = churn(n, 1);
+		if (!lazy_ns || lazy < lazy_ns) lazy_ns = lazy;
+		if (!eager_ns || formatted_ns < eager_ns) eager_ns = formatted_ns;
+	}
+	printf("churn, %zu connections, %d at once, best of %d\n", n, concurrency, runs);
+	printf("%-28s %6.2f us/connection\n", "address never formatted", lazy_ns / 1e3);
+	printf("%-28s %6.2f us/connection\n", "formatted on every request", eager_ns / 1e3);
+
+	uv_httpd_stop(server);
+	uv_run(loop, UV_RUN_DEFAULT);
+	uv_httpd_free(server);
+	return formatted ? 0 : 1;
+}
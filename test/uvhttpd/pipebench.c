@@ -0,0 +1,388 @@
+// req/s of GET / on one connection to a spawned uvhttpd, with a fixed number of requests
+// in flight: pipelined HTTP/1.1 against h2c multiplexed streams over tcp, or HTTP/1.1
+// over tcp against the unix domain socket listener.
+// usage: pipebench [-x uvhttpd] [-u] [-n requests] [-r runs] [-d depth]...
+//   -x: path of uvhttpd, default is ./uvhttpd
+//   -u: tcp against unix socket, default is HTTP/1.1 against h2c
+//   -n: requests of each run, default is 300000, 100000 with -u
+//   -r: runs of each mode, interleaved, the best is reported, default is 1, 5 with -u
+//   -d: requests in flight, can be repeated, default is 1 16 64, 1 16 with -u,
+//       at most 100 for h2c, the limit of concurrent streams of the server
+//
+// server cpu is utime + stime of the server from /proc, linux only, 0 elsewhere.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <signal.h>
+#include <unistd.h>
+#endif
+#include <uv.h>
+#include "llhttp.h"
+#include "uv_httpd_h2.h"
+#include "mybuf.h"
+
+#define PORT 18800
+#define SOCK_PATH "/tmp/pipebench.sock"
+#define RETRY_INTERVAL 50 // ms, server not listening yet
+#define RETRY_MAX 100
+#define MAX_DEPTHS 8
+
+#define REQUEST \
+	"GET / HTTP/1.1\r\n" \
+	"Host: x\r\n" \
+	"Connection: keep-alive\r\n" \
+	"\r\n"
+
+#define FRAME_DATA 0x0
+#define FRAME_HEADERS 0x1
+#define FRAME_SETTINGS 0x4
+#define FRAME_GOAWAY 0x7
+#define FRAME_WINDOW_UPDATE 0x8
+#define FLAG_ACK 0x1
+#define FLAG_END_STREAM 0x1
+#define FLAG_END_HEADERS 0x4
+
+typedef struct {
+	const char* name;
+	int h2;
+	int unix_socket;
+}bench_mode_t;
+
+typedef struct {
+	uv_write_t req;
+	mybuf_t buf;
+}write_req_t;
+
+// GET / with :authority x, static table entries and a literal without indexing
+static const char header_block[] = { (char)0x82, (char)0x86, (char)0x84, 0x01, 0x01, 'x' };
+
+static uv_loop_t* loop;
+static uv_process_t server;
+static const char* exe = "./uvhttpd";
+static union {
+	uv_tcp_t tcp;
+	uv_pipe_t pipe;
+}conn;
+static uv_connect_t connect_req;
+static uv_timer_t retry;
+static int retries;
+static llhttp_t parser;
+static llhttp_settings_t settings;
+static mybuf_t frames; // h2 input not parsed yet
+static const bench_mode_t* mode;
+static size_t total, sent, done;
+static int depth;
+static uint32_t next_id;
+static uint64_t start, end, cpu0, cpu1;
+
+
+/*************************** helper functions ****************/
+
+// ns of cpu used by the server
+static uint64_t server_cpu(void) {
+#ifdef __linux__
+	char path[64], stat[1024];
+	unsigned long utime, stime;
+	const char* p;
+	size_t n;
+	FILE* f;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", server.pid);
+	f = fopen(path, "r");
+	if (!f) return 0;
+	n = fread(stat, 1, sizeof(stat) - 1, f);
+	fclose(f);
+	stat[n] = '\0';
+	// fields 14 and 15, after the command in parentheses and 11 more
+	p = strrchr(stat, ')');
+	if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) return 0;
+	return (uint64_t)(utime + stime) * 1000000000ULL / sysconf(_SC_CLK_TCK);
+#else
+	return 0;
+#endif
+}
+
+static void frame(mybuf_t* out, int type, int flags, uint32_t id, const void* payload, size_t len) {
+	char header[9];
+	header[0] = (char)(len >> 16);
+	header[1] = (char)(len >> 8);
+	header[2] = (char)len;
+	header[3] = (char)type;
+	header[4] = (char)flags;
+	header[5] = (char)(id >> 24);
+	header[6] = (char)(id >> 16);
+	header[7] = (char)(id >> 8);
+	header[8] = (char)id;
+	mybuf_append(out, header, 9);
+	if (len) mybuf_append(out, payload, len);
+}
+
+static void on_write(uv_write_t* req, int status) {
+	write_req_t* wr = (write_req_t*)req;
+	mybuf_clear(&wr->buf);
+	free(wr);
+}
+
+// `n` more requests after `prefix` in one write
+static void send_requests(size_t n, const mybuf_t* prefix) {
+	write_req_t* wr;
+	uv_buf_t buf;
+
+	if (n > total - sent) n = total - sent;
+	if (n == 0 && (!prefix || prefix->size == 0)) return;
+	wr = malloc(sizeof(write_req_t));
+	if (!wr) exit(1);
+	mybuf_init(&wr->buf);
+	if (prefix) mybuf_append(&wr->buf, prefix->buf, prefix->size);
+	for (; n; n--, sent++) {
+		if (mode->h2) {
+			frame(&wr->buf, FRAME_HEADERS, FLAG_END_STREAM | FLAG_END_HEADERS, next_id, header_block, sizeof(header_block));
+			next_id += 2;
+		} else {
+			mybuf_append(&wr->buf, REQUEST, sizeof(REQUEST) - 1);
+		}
+	}
+	buf = uv_buf_init(wr->buf.buf, (unsigned int)wr->buf.size);
+	if (uv_write(&wr->req, (uv_stream_t*)&conn, &buf, 1, on_write)) {
+		fprintf(stderr, "uv_write failed\n");
+		exit(1);
+	}
+}
+
+static int on_message_complete(llhttp_t* p) {
+	done++;
+	return 0;
+}
+
+// count the streams ended, ack SETTINGS into `out`
+static void parse_frames(mybuf_t* out) {
+	const uint8_t* p;
+	size_t off = 0, len;
+
+	while (off + 9 <= frames.size) {
+		p = (const uint8_t*)frames.buf + off;
+		len = (size_t)p[0] << 16 | p[1] << 8 | p[2];
+		if (off + 9 + len > frames.size) break;
+		if ((p[3] == FRAME_HEADERS || p[3] == FRAME_DATA) && (p[4] & FLAG_END_STREAM)) {
+			done++;
+		} else if (p[3] == FRAME_SETTINGS && !(p[4] & FLAG_ACK)) {
+			frame(out, FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0);
+		} else if (p[3] == FRAME_GOAWAY) {
+			fprintf(stderr, "GOAWAY from the server\n");
+			exit(1);
+		}
+		off += 9 + len;
+	}
+	memmove(frames.buf, frames.buf + off, frames.size - off);
+	frames.size -= off;
+}
+
+
+/*************************** connection ****************/
+
+static void connect_server(void);
+
+static void on_retry(uv_timer_t* timer) {
+	connect_server();
+}
+
+static void on_close_retry(uv_handle_t* handle) {
+	if (++retries == RETRY_MAX) {
+		fprintf(stderr, "cannot connect to %s\n", exe);
+		exit(1);
+	}
+	uv_timer_start(&retry, on_retry, RETRY_INTERVAL, 0);
+}
+
+static void on_alloc(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
+	static char slab[65536];
+	buf->base = slab;
+	buf->len = sizeof(slab);
+}
+
+static void on_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
+	mybuf_t out;
+	size_t before = done;
+
+	if (nread < 0) {
+		fprintf(stderr, "read: %s after %zu responses\n", uv_err_name((int)nread), done);
+		exit(1);
+	}
+	mybuf_init(&out);
+	if (mode->h2) {
+		mybuf_append(&frames, buf->base, nread);
+		parse_frames(&out);
+	} else if (llhttp_execute(&parser, buf->base, nread) != HPE_OK) {
+		fprintf(stderr, "llhttp_execute: %s\n", llhttp_get_error_reason(&parser));
+		exit(1);
+	}
+	if (done == total) {
+		end = uv_hrtime();
+		cpu1 = server_cpu();
+		uv_close((uv_handle_t*)stream, NULL);
+	} else {
+		send_requests(done - before, &out);
+	}
+	mybuf_clear(&out);
+}
+
+static void on_connect(uv_connect_t* req, int status) {
+	mybuf_t out;
+	uint8_t increment[4] = { 0x7f, 0xff, 0, 0 };
+
+	if (status) {
+		uv_close((uv_handle_t*)&conn, on_close_retry);
+		return;
+	}
+	mybuf_init(&out);
+	if (mode->h2) {
+		// a connection window for every response of the run
+		mybuf_append(&out, UV_HTTPD_H2_PREFACE, UV_HTTPD_H2_PREFACE_LEN);
+		frame(&out, FRAME_SETTINGS, 0, 0, NULL, 0);
+		frame(&out, FRAME_WINDOW_UPDATE, 0, 0, increment, sizeof(increment));
+	}
+	cpu0 = server_cpu();
+	start = uv_hrtime();
+	uv_read_start((uv_stream_t*)&conn, on_alloc, on_read);
+	send_requests(depth, &out);
+	mybuf_clear(&out);
+}
+
+static void connect_server(void) {
+	struct sockaddr_in addr;
+
+	if (mode->unix_socket) {
+		uv_pipe_init(loop, &conn.pipe, 0);
+		uv_pipe_connect(&connect_req, &conn.pipe, SOCK_PATH, on_connect);
+	} else {
+		uv_tcp_init(loop, &conn.tcp);
+		uv_tcp_nodelay(&conn.tcp, 1);
+		uv_ip4_addr("127.0.0.1", PORT, &addr);
+		uv_tcp_connect(&connect_req, &conn.tcp, (const struct sockaddr*)&addr, on_connect);
+	}
+}
+
+
+/*************************** runs ****************/
+
+static void on_process_exit(uv_process_t* process, int64_t exit_status, int term_signal) {
+	uv_close((uv_handle_t*)process, NULL);
+}
+
+static int spawn_server(void) {
+	char port[8];
+	char* args[] = { (char*)exe, "-a", "127.0.0.1", "-l", port, "-s", SOCK_PATH, "-2", NULL };
+	uv_process_options_t opts;
+	uv_stdio_container_t stdio[3];
+	int r;
+
+	snprintf(port, sizeof(port), "%d", PORT);
+	remove(SOCK_PATH);
+	memset(&opts, 0, sizeof(opts));
+	memset(stdio, 0, sizeof(stdio));
+	stdio[0].flags = UV_IGNORE;
+	stdio[1].flags = UV_IGNORE;
+	stdio[2].flags = UV_INHERIT_FD;
+	stdio[2].data.fd = 2;
+	opts.file = exe;
+	opts.args = args;
+	opts.exit_cb = on_process_exit;
+	opts.stdio = stdio;
+	opts.stdio_count = 3;
+	r = uv_spawn(loop, &server, &opts);
+	if (r) {
+		fprintf(stderr, "spawn %s: %s\n", exe, uv_err_name(r));
+		return r;
+	}
+	uv_unref((uv_handle_t*)&server);
+	return 0;
+}
+
+// req/s of `n` requests, `d` in flight, server cpu per request in `cpu`
+static double run(const bench_mode_t* m, int d, size_t n, double* cpu) {
+	mode = m;
+	depth = d;
+	total = n;
+	sent = done = 0;
+	next_id = 1;
+	retries = 0;
+	frames.size = 0;
+	llhttp_init(&parser, HTTP_RESPONSE, &settings);
+	connect_server();
+	uv_run(loop, UV_RUN_DEFAULT);
+	*cpu = (double)(cpu1 - cpu0) / n;
+	return n * 1e9 / (end - start);
+}
+
+int main(int argc, char** argv) {
+	static const bench_mode_t h1 = { "http/1.1", 0, 0 }, h2c = { "h2c", 1, 0 };
+	static const bench_mode_t tcp = { "tcp", 0, 0 }, unix_socket = { "unix", 0, 1 };
+	const bench_mode_t* modes[2] = { &h1, &h2c };
+	int depths[MAX_DEPTHS], ndepths = 0, runs = 0, uds = 0, i, j, k;
+	size_t n = 0;
+
+	for (k = 1; k < argc; k++) {
+		if (strcmp(argv[k], "-x") == 0 && k + 1 < argc) {
+			exe = argv[++k];
+		} else if (strcmp(argv[k], "-u") == 0) {
+			uds = 1;
+		} else if (strcmp(argv[k], "-n") == 0 && k + 1 < argc) {
+			n = strtoul(argv[++k], NULL, 10);
+		} else if (strcmp(argv[k], "-r") == 0 && k + 1 < argc) {
+			runs = atoi(argv[++k]);
+		} else if (strcmp(argv[k], "-d") == 0 && k + 1 < argc && ndepths < MAX_DEPTHS) {
+			depths[ndepths] = atoi(argv[++k]);
+			if (depths[ndepths] > 0) ndepths++;
+		}
+	}
+	if (uds) {
+		modes[0] = &tcp;
+		modes[1] = &unix_socket;
+	}
+	if (ndepths == 0) {
+		depths[ndepths++] = 1;
+		depths[ndepths++] = 16;
+		if (!uds) depths[ndepths++] = 64;
+	}
+	if (n == 0) n = uds ? 100000 : 300000;
+	if (runs < 1) runs = uds ? 5 : 1;
+
+#ifndef _WIN32
+	signal(SIGPIPE, SIG_IGN);
+#endif
+	loop = uv_default_loop();
+	llhttp_settings_init(&settings);
+	settings.on_message_complete = on_message_complete;
+	mybuf_init(&frames);
+	uv_timer_init(loop, &retry);
+	if (spawn_server()) return 1;
+
+	printf("%zu requests of GET /, best of %d\n", n, runs);
+	for (i = 0; i < ndepths; i++) {
+		double best[2] = { 0 }, best_cpu[2] = { 0 };
+		for (k = 0; k < runs; k++) {
+			for (j = 0; j < 2; j++) {
+				double cpu, rate = run(modes[j], depths[i], n, &cpu);
+				if (rate > best[j]) {
+					best[j] = rate;
+					best_cpu[j] = cpu;
+				}
+			}
+		}
+		for (j = 0; j < 2; j++) {
+			if (j == 0) printf("depth %3d: ", depths[i]);
+			else printf("           ");
+			printf("%-8s %4.0fk req/s, %.1fus server cpu/req\n", modes[j]->name, best[j] / 1000, best_cpu[j] / 1000);
+		}
+	}
+
+	uv_ref((uv_handle_t*)&server);
+	uv_process_kill(&server, SIGTERM);
+	uv_close((uv_handle_t*)&retry, NULL);
+	uv_run(loop, UV_RUN_DEFAULT);
+	remove(SOCK_PATH);
+	mybuf_clear(&frames);
+	return 0;
+}
@@ -0,0 +1,276 @@
+// regression tests of uv_httpd_proxy against an upstream on the same loop, over loopback.
+// usage: proxytest
+// prints each case, exits with 1 on the first failure.
+//
+// clients are in-memory connections, the upstream answers `ok` to every request except:
+//   /drop on a connection that served a request already: closed unanswered, a stale pooled one
+//   /hang: never answered
+// built with timeouts of 200 ms, see the Makefile.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <signal.h>
+#endif
+#include "uv_httpd.h"
+#include "uv_httpd_mem.h"
+#include "uv_httpd_proxy.h"
+#include "mybuf.h"
+
+#define UPSTREAM_PORT 18950
+#define DOWN_PORT 18951 // nothing listens
+#define GUARD_TIMEOUT 3000 // ms, a case without a response fails
+
+#define OK_RESPONSE \
+	"HTTP/1.1 200 OK\r\n" \
+	"Content-Type: text/plain\r\n" \
+	"Content-Length: 3\r\n" \
+	"\r\n" \
+	"ok\n"
+
+typedef struct {
+	uv_tcp_t tcp;
+	mybuf_t in;
+	int served;
+}upstream_conn_t;
+
+static uv_loop_t* loop;
+static uv_httpd_server_t* server;
+static uv_httpd_proxy_t* proxy; // of the next request
+static uv_httpd_proxy_t* up_proxy;
+static uv_httpd_proxy_t* down_proxy;
+static uv_tcp_t listener;
+static upstream_conn_t* conns[16];
+static int accepted;
+static mybuf_t seen; // request lines the upstream received, `METHOD path\n`...
+static uv_timer_t guard;
+static int timed_out;
+static int failures;
+
+
+/*************************** upstream ****************/
+
+static void on_upstream_closed(uv_handle_t* handle) {
+	upstream_conn_t* c = (upstream_conn_t*)handle;
+	mybuf_clear(&c->in);
+	free(c);
+}
+
+static void upstream_close(upstream_conn_t* c) {
+	int i;
+	for (i = 0; i < accepted; i++) {
+		if (conns[i] == c) conns[i] = NULL;
+	}
+	uv_close((uv_handle_t*)&c->tcp, on_upstream_closed);
+}
+
+static void on_upstream_write(uv_write_t* req, int status) {
+	free(req);
+}
+
+static void on_upstream_alloc(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
+	static char slab[65536];
+	buf->base = slab;
+	buf->len = sizeof(slab);
+}
+
+// a whole request at the start of `c->in` is handled and consumed, return 0 if none
+static int upstream_request(upstream_conn_t* c) {
+	const char* end, * cl, * sp;
+	size_t head, body = 0, line;
+	uv_write_t* req;
+	uv_buf_t buf;
+
+	if (mybuf_append(&c->in, "", 1)) return 0;
+	c->in.size--;
+	end = strstr(c->in.buf, "\r\n\r\n");
+	if (!end) return 0;
+	head = end + 4 - c->in.buf;
+	cl = strstr(c->in.buf, "Content-Length: ");
+	if (cl && cl < end) body = strtoul(cl + 16, NULL, 10);
+	if (c->in.size < head + body) return 0;
+
+	// `METHOD path`
+	sp = strchr(c->in.buf, ' ');
+	sp = sp ? strchr(sp + 1, ' ') : NULL;
+	line = sp ? (size_t)(sp - c->in.buf) : 0;
+	mybuf_append(&seen, c->in.buf, line);
+	mybuf_append(&seen, "\n", 1);
+	memmove(c->in.buf, c->in.buf + head + body, c->in.size - head - body);
+	c->in.size -= head + body;
+
+	if (strstr(seen.buf + seen.size - line - 1, " /drop") && c->served) {
+		upstream_close(c);
+		return 0;
+	}
+	if (strstr(seen.buf + seen.size - line - 1, " /hang")) return 1;
+	req = malloc(sizeof(*req));
+	buf = uv_buf_init(OK_RESPONSE, sizeof(OK_RESPONSE) - 1);
+	uv_write(req, (uv_stream_t*)&c->tcp, &buf, 1, on_upstream_write);
+	c->served++;
+	return 1;
+}
+
+static void on_upstream_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
+	upstream_conn_t* c = (upstream_conn_t*)stream;
+	if (nread < 0) {
+		upstream_close(c);
+		return;
+	}
+	mybuf_append(&c->in, buf->base, nread);
+	while (upstream_request(c));
+}
+
+static void on_upstream_connection(uv_stream_t* l, int status) {
+	upstream_conn_t* c;
+	if (status) return;
+	c = calloc(1, sizeof(*c));
+	mybuf_init(&c->in);
+	uv_tcp_init(loop, &c->tcp);
+	if (uv_accept(l, (uv_stream_t*)&c->tcp)) {
+		uv_close((uv_handle_t*)&c->tcp, on_upstream_closed);
+		return;
+	}
+	if (accepted < (int)(sizeof(conns) / sizeof(conns[0]))) conns[accepted] = c;
+	accepted++;
+	uv_read_start((uv_stream_t*)&c->tcp, on_upstream_alloc, on_upstream_read);
+}
+
+
+/*************************** helper functions ****************/
+
+static void on_request(uv_httpd_server_t* s, uv_httpd_client_t* client, uv_httpd_request_t* req) {
+}
+
+static int on_headers(uv_httpd_server_t* s, uv_httpd_client_t* client, uv_httpd_request_t* req) {
+	return uv_httpd_proxy_pass(proxy, client, req);
+}
+
+static void on_guard(uv_timer_t* timer) {
+	timed_out = 1;
+}
+
+// status of the response to `request` through `p`, 0 if none in GUARD_TIMEOUT
+static int send_request(uv_httpd_proxy_t* p, const char* request) {
+	uv_httpd_mem_t* mem;
+	mybuf_t* out;
+	int status = 0;
+
+	proxy = p;
+	if (uv_httpd_mem_create(&mem, server)) return 0;
+	out = uv_httpd_mem_output(mem);
+	timed_out = 0;
+	uv_timer_start(&guard, on_guard, GUARD_TIMEOUT, 0);
+	uv_httpd_mem_feed(mem, request, strlen(request), 0);
+	while (!timed_out) {
+		const char* end, * cl;
+		if (!mybuf_append(out, "", 1)) out->size--;
+		end = out->size ? strstr(out->buf, "\r\n\r\n") : NULL;
+		if (end) {
+			cl = strstr(out->buf, "Content-Length: ");
+			if (cl && out->size >= end + 4 - out->buf + strtoul(cl + 16, NULL, 10)) {
+				status = atoi(out->buf + 9);
+				break;
+			}
+		}
+		uv_run(loop, UV_RUN_ONCE);
+	}
+	uv_timer_stop(&guard);
+	uv_httpd_mem_free(mem);
+	return status;
+}
+
+// request lines seen by the upstream since the last call
+static int seen_equals(const char* lines) {
+	int equal = seen.size == strlen(lines) && memcmp(seen.buf, lines, seen.size) == 0;
+	seen.size = 0;
+	return equal;
+}
+
+static void check(int ok, const char* what) {
+	printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+	if (!ok) failures++;
+}
+
+
+/*************************** cases ****************/
+
+static void pooling(void) {
+	int a = send_request(up_proxy, "GET /a HTTP/1.1\r\nHost: x\r\n\r\n");
+	int b = send_request(up_proxy, "GET /b HTTP/1.1\r\nHost: x\r\n\r\n");
+	check(a == 200 && b == 200 && seen_equals("GET /a\nGET /b\n"), "two requests answered");
+	check(accepted == 1, "the second one on the pooled connection");
+}
+
+static void stale_get(void) {
+	int status = send_request(up_proxy, "GET /drop HTTP/1.1\r\nHost: x\r\n\r\n");
+	check(status == 200 && seen_equals("GET /drop\nGET /drop\n"), "GET on a stale pooled connection is sent again");
+	check(accepted == 2, "on a new connection");
+}
+
+static void stale_post(void) {
+	int status = send_request(up_proxy, "POST /drop HTTP/1.1\r\nHost: x\r\nContent-Length: 5\r\n\r\nhello");
+	check(status == 502, "POST on a stale pooled connection is answered 502");
+	check(seen_equals("POST /drop\n") && accepted == 2, "and never sent twice");
+}
+
+static void silent_upstream(void) {
+	uint64_t start = uv_hrtime();
+	int status = send_request(up_proxy, "GET /hang HTTP/1.1\r\nHost: x\r\n\r\n");
+	uint64_t ms = (uv_hrtime() - start) / 1000000;
+	check(status == 504 && seen_equals("GET /hang\n"), "silent upstream is answered 504");
+	check(ms >= UV_HTTPD_PROXY_RESPONSE_TIMEOUT && ms < GUARD_TIMEOUT, "after the response timeout");
+}
+
+static void upstream_down(void) {
+	int status = send_request(down_proxy, "GET /a HTTP/1.1\r\nHost: x\r\n\r\n");
+	check(status == 502 && seen_equals(""), "upstream refusing connections is answered 502");
+}
+
+int main(int argc, char** argv) {
+	struct sockaddr_in addr;
+	int i, r;
+
+#ifndef _WIN32
+	signal(SIGPIPE, SIG_IGN);
+#endif
+	loop = uv_default_loop();
+	mybuf_init(&seen);
+	uv_timer_init(loop, &guard);
+	uv_tcp_init(loop, &listener);
+	uv_ip4_addr("127.0.0.1", UPSTREAM_PORT, &addr);
+	r = uv_tcp_bind(&listener, (const struct sockaddr*)&addr, 0);
+	if (!r) r = uv_listen((uv_stream_t*)&listener, 16, on_upstream_connection);
+	if (!r) r = uv_httpd_create(&server, loop, on_request);
+	if (!r) r = uv_httpd_proxy_create(&up_proxy, loop);
+	if (!r) r = uv_httpd_proxy_add_upstream(up_proxy, "127.0.0.1", UPSTREAM_PORT);
+	if (!r) r = uv_httpd_proxy_create(&down_proxy, loop);
+	if (!r) r = uv_httpd_proxy_add_upstream(down_proxy, "127.0.0.1", DOWN_PORT);
+	if (r) {
+		fprintf(stderr, "%d %s\n", r, uv_err_name(r));
+		return 1;
+	}
+	server->on_headers = on_headers;
+
+	pooling();
+	stale_get();
+	stale_post();
+	silent_upstream();
+	upstream_down();
+
+	uv_httpd_proxy_close(up_proxy);
+	uv_httpd_proxy_close(down_proxy);
+	for (i = 0; i < (int)(sizeof(conns) / sizeof(conns[0])); i++) {
+		if (conns[i]) upstream_close(conns[i]);
+	}
+	uv_close((uv_handle_t*)&listener, NULL);
+	uv_close((uv_handle_t*)&guard, NULL);
+	uv_httpd_stop(server);
+	uv_run(loop, UV_RUN_DEFAULT);
+	uv_httpd_free(server);
+	uv_httpd_proxy_free(up_proxy);
+	uv_httpd_proxy_free(down_proxy);
+	mybuf_clear(&seen);
+	return failures ? 1 : 0;
+}
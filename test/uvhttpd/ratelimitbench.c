@@ -0,0 +1,110 @@
+// ns per uv_httpd_ratelimit_take with many tracked addresses, no sockets.
+// usage: ratelimitbench [-a addresses] [-n takes]
+//   -a: distinct ipv4 addresses in the table, default is 1000000
+//   -n: takes timed in each pattern, default is 10000000
+//
+// every address takes a token once before timing. the clock moves 1 ms every 1000 takes,
+// which refills as many tokens as taken meanwhile, so none is refused.
+// patterns: one address again and again, 1000 addresses round robin, and every address
+// in a random order, a cache miss of the table per take. the misses of consecutive takes
+// overlap in the cpu, unlike in a server where a take is far from the next one, so the
+// random order is timed once more with each address depending on the previous result.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "uv_httpd_ratelimit.h"
+
+#define RATE 1000000 // tokens per second, 1000 per ms
+#define TAKES_PER_MS 1000
+#define HOT_ADDRESSES 1000
+
+static void make_key(uv_httpd_addr_key_t* key, uint32_t i) {
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	// spread over 10.0.0.0/8 and beyond, not sequential
+	addr.sin_addr.s_addr = htonl(0x0a000000u + i * 2654435761u);
+	uv_httpd_addr_key((const struct sockaddr*)&addr, key);
+}
+
+enum {
+	SAME,
+	ROUND_ROBIN,
+	RANDOM,
+	RANDOM_DEPENDENT, // the next address waits for the result of the take
+};
+
+// ns per take
+static double run(uv_httpd_ratelimit_t* rl, uint32_t addresses, size_t n, int pattern, int* allowed) {
+	uv_httpd_addr_key_t key;
+	uint64_t start, ns;
+	uint32_t x = 1, a;
+	size_t i;
+	int ok = 0, last = 1;
+
+	start = uv_hrtime();
+	for (i = 0; i < n; i++) {
+		if (pattern >= RANDOM) {
+			// xorshift, cheap next to a cache miss
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			a = x % addresses;
+			if (pattern == RANDOM_DEPENDENT) {
+				// `last` is always 1
+				a = (a + 1 - last) % addresses;
+			}
+		} else {
+			a = (uint32_t)(i % addresses);
+		}
+		make_key(&key, a);
+		last = uv_httpd_ratelimit_take(rl, &key, 1 + i / TAKES_PER_MS);
+		ok += last;
+	}
+	ns = uv_hrtime() - start;
+	*allowed = ok;
+	return (double)ns / n;
+}
+
+int main(int argc, char** argv) {
+	uv_httpd_ratelimit_t* rl;
+	uv_httpd_addr_key_t key;
+	uint32_t addresses = 1000000, i;
+	size_t n = 10000000;
+	int r;
+
+	for (r = 1; r < argc; r++) {
+		if (strcmp(argv[r], "-a") == 0 && r + 1 < argc) {
+			addresses = (uint32_t)strtoul(argv[++r], NULL, 10);
+		} else if (strcmp(argv[r], "-n") == 0 && r + 1 < argc) {
+			n = strtoul(argv[++r], NULL, 10);
+		}
+	}
+	if (addresses < HOT_ADDRESSES) addresses = HOT_ADDRESSES;
+	if (n == 0) n = 1;
+
+	r = uv_httpd_ratelimit_create(&rl, RATE, RATE);
+	if (r) {
+		fprintf(stderr, "%d %s\n", r, uv_err_name(r));
+		return 1;
+	}
+	for (i = 0; i < addresses; i++) {
+		make_key(&key, i);
+		uv_httpd_ratelimit_take(rl, &key, 1);
+	}
+	printf("addresses %u, table %zu entries\n", addresses, uv_httpd_ratelimit_size(rl));
+
+	for (r = 0; r < 4; r++) {
+		static const char* names[] = { "one address", "1000 addresses", "all, random", "all, random, one at a time" };
+		uint32_t a = r == SAME ? 1 : r == ROUND_ROBIN ? HOT_ADDRESSES : addresses;
+		int ok;
+		double ns = run(rl, a, n, r, &ok);
+		printf("%-28s %6.1f ns/take\n", names[r], ns);
+		if (ok != (int)n) {
+			fprintf(stderr, "unexpected 429: %d of %zu\n", (int)n - ok, n);
+		}
+	}
+	uv_httpd_ratelimit_free(rl);
+	return 0;
+}
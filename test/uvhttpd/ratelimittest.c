@@ -0,0 +1,321 @@
+// regression tests of uv_httpd_ratelimit: buckets, address keys, the table, and a server charging them.
+// usage: ratelimittest
+// prints each case, exits with 1 if any fails.
+//
+// buckets are taken at given times, no clock. the server cases run a uv_httpd server on the
+// loop, an in-memory connection is charged on every request, a connection over loopback
+// on accept for its first request.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/un.h>
+#endif
+#include "uv_httpd.h"
+#include "uv_httpd_mem.h"
+#include "uv_httpd_ratelimit.h"
+#include "mybuf.h"
+
+#define PORT 18952
+#define ADDRESSES 10000
+#define GUARD_TIMEOUT 3000 // ms, a case without a response fails
+
+#define OK_RESPONSE \
+	"HTTP/1.1 200 OK\r\n" \
+	"Content-Type: text/plain\r\n" \
+	"Content-Length: 3\r\n" \
+	"\r\n" \
+	"ok\n"
+
+#define REQUEST \
+	"GET / HTTP/1.1\r\n" \
+	"Host: x\r\n" \
+	"Connection: keep-alive\r\n" \
+	"\r\n"
+
+typedef struct {
+	uv_tcp_t tcp;
+	uv_connect_t connect_req;
+	uv_write_t write_req;
+	mybuf_t out; // requests
+	mybuf_t in; // responses
+	int closed;
+}conn_t;
+
+static uv_loop_t* loop;
+static uv_httpd_server_t* server;
+static uv_timer_t guard;
+static int timed_out;
+static int failures;
+
+
+/*************************** helper functions ****************/
+
+static void check(int ok, const char* what) {
+	printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+	if (!ok) failures++;
+}
+
+static void ip_key(const char* ip, uv_httpd_addr_key_t* key) {
+	struct sockaddr_storage addr;
+	if (strchr(ip, ':')) {
+		uv_ip6_addr(ip, 80, (struct sockaddr_in6*)&addr);
+	} else {
+		uv_ip4_addr(ip, 80, (struct sockaddr_in*)&addr);
+	}
+	uv_httpd_addr_key((const struct sockaddr*)&addr, key);
+}
+
+static int same_key(const char* a, const char* b) {
+	uv_httpd_addr_key_t ka, kb;
+	ip_key(a, &ka);
+	ip_key(b, &kb);
+	return ka.hi == kb.hi && ka.lo == kb.lo;
+}
+
+// tokens taken from `key` at `now` until refused, at most `max`
+static int takes(uv_httpd_ratelimit_t* rl, const uv_httpd_addr_key_t* key, uint64_t now, int max) {
+	int n = 0;
+	while (n < max && uv_httpd_ratelimit_take(rl, key, now)) n++;
+	return n;
+}
+
+static void on_request(uv_httpd_server_t* s, uv_httpd_client_t* client, uv_httpd_request_t* req) {
+	uv_httpd_write_response(client, OK_RESPONSE, sizeof(OK_RESPONSE) - 1);
+}
+
+static void on_guard(uv_timer_t* timer) {
+	timed_out = 1;
+}
+
+// status codes of the responses in `out`, `200 200 429`
+static void statuses(const mybuf_t* out, char* codes, size_t size) {
+	const char* p = out->buf, * end = out->buf + out->size;
+	size_t n = 0;
+	codes[0] = '\0';
+	while (p && end - p > 12) {
+		if (0 == memcmp(p, "HTTP/1.1 ", 9)) {
+			n += snprintf(codes + n, size - n, "%s%.3s", n ? " " : "", p + 9);
+			if (n >= size) break;
+		}
+		p = memchr(p + 1, 'H', end - p - 1);
+	}
+}
+
+static void on_conn_alloc(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
+	static char slab[4096];
+	buf->base = slab;
+	buf->len = sizeof(slab);
+}
+
+static void on_conn_closed(uv_handle_t* handle) {
+	((conn_t*)handle)->closed = 1;
+}
+
+static void on_conn_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
+	conn_t* c = (conn_t*)stream;
+	if (nread < 0) {
+		uv_close((uv_handle_t*)stream, on_conn_closed);
+		return;
+	}
+	mybuf_append(&c->in, buf->base, nread);
+}
+
+static void on_conn_written(uv_write_t* req, int status) {
+}
+
+static void on_connect(uv_connect_t* req, int status) {
+	conn_t* c = req->data;
+	uv_buf_t buf = uv_buf_init(c->out.buf, c->out.size);
+	if (status) {
+		uv_close((uv_handle_t*)&c->tcp, on_conn_closed);
+		return;
+	}
+	uv_write(&c->write_req, (uv_stream_t*)&c->tcp, &buf, 1, on_conn_written);
+	uv_read_start((uv_stream_t*)&c->tcp, on_conn_alloc, on_conn_read);
+}
+
+// send `n` pipelined requests on a new connection over loopback,
+// the status codes of the responses read until `n` of them or the server closes
+static void pipelined(int n, char* codes, size_t size) {
+	struct sockaddr_in addr;
+	conn_t c;
+	int i;
+
+	memset(&c, 0, sizeof(c));
+	mybuf_init(&c.out);
+	mybuf_init(&c.in);
+	for (i = 0; i < n; i++) {
+		mybuf_append(&c.out, REQUEST, sizeof(REQUEST) - 1);
+	}
+	codes[0] = '\0';
+	uv_ip4_addr("127.0.0.1", PORT, &addr);
+	uv_tcp_init(loop, &c.tcp);
+	c.connect_req.data = &c;
+	uv_tcp_connect(&c.connect_req, &c.tcp, (const struct sockaddr*)&addr, on_connect);
+	timed_out = 0;
+	uv_timer_start(&guard, on_guard, GUARD_TIMEOUT, 0);
+	while (!c.closed) {
+		uv_run(loop, UV_RUN_ONCE);
+		statuses(&c.in, codes, size);
+		if ((timed_out || (int)strlen(codes) >= n * 4 - 1) && !uv_is_closing((uv_handle_t*)&c.tcp)) {
+			uv_close((uv_handle_t*)&c.tcp, on_conn_closed);
+		}
+	}
+	uv_timer_stop(&guard);
+	mybuf_clear(&c.out);
+	mybuf_clear(&c.in);
+}
+
+
+/*************************** cases ****************/
+
+static void create(void) {
+	uv_httpd_ratelimit_t* rl;
+	check(uv_httpd_ratelimit_create(&rl, 0, 1) == UV_EINVAL && uv_httpd_ratelimit_create(&rl, 1, 0) == UV_EINVAL
+		  && uv_httpd_ratelimit_create(&rl, UINT32_MAX, 1) == UV_EINVAL
+		  && uv_httpd_ratelimit_create(&rl, 1, UINT32_MAX) == UV_EINVAL,
+		  "a rate or burst of 0, or too large, is UV_EINVAL");
+}
+
+static void buckets(void) {
+	uv_httpd_ratelimit_t* rl;
+	uv_httpd_addr_key_t a, b;
+
+	// 10 per second, 100 ms a token, 300 ms to refill
+	uv_httpd_ratelimit_create(&rl, 10, 3);
+	ip_key("192.0.2.1", &a);
+	ip_key("192.0.2.2", &b);
+	check(takes(rl, &a, 1001, 10) == 3, "a new address starts with the burst");
+	check(takes(rl, &b, 1001, 10) == 3, "each address has its own bucket");
+	check(takes(rl, &a, 1099, 10) == 0 && takes(rl, &a, 1101, 10) == 1, "a token is back after 100 ms, not before");
+	check(takes(rl, &a, 1251, 10) == 1 && takes(rl, &a, 1299, 10) == 0 && takes(rl, &a, 1301, 10) == 1,
+		  "a refused take keeps the part of a token");
+	check(takes(rl, &a, 1601, 10) == 3 && takes(rl, &a, 100001, 10) == 3, "a bucket untouched long enough is full");
+	check(uv_httpd_ratelimit_size(rl) == 2, "two addresses in the table");
+	uv_httpd_ratelimit_free(rl);
+}
+
+static void keys(void) {
+#ifndef _WIN32
+	struct sockaddr_un un1, un2;
+	uv_httpd_addr_key_t k1, k2;
+#endif
+
+	check(same_key("192.0.2.1", "::ffff:192.0.2.1"), "ipv4 is the same as ipv4-mapped ipv6");
+	check(!same_key("192.0.2.1", "192.0.2.2") && !same_key("192.0.2.1", "::192.0.2.1"), "other ipv4 addresses differ");
+	check(same_key("2001:db8:1:2::1", "2001:db8:1:2:ffff::9"), "ipv6 in the same /64 share a key");
+	check(!same_key("2001:db8:1:2::1", "2001:db8:1:3::1"), "ipv6 in other /64 differ");
+
+#ifndef _WIN32
+	memset(&un1, 0, sizeof(un1));
+	memset(&un2, 0, sizeof(un2));
+	un1.sun_family = un2.sun_family = AF_UNIX;
+	strcpy(un1.sun_path, "/tmp/a.sock");
+	strcpy(un2.sun_path, "/tmp/b.sock");
+	uv_httpd_addr_key((const struct sockaddr*)&un1, &k1);
+	uv_httpd_addr_key((const struct sockaddr*)&un2, &k2);
+	check(k1.hi == k2.hi && k1.lo == k2.lo, "unix domain sockets share a key");
+#endif
+}
+
+static void table(void) {
+	uv_httpd_ratelimit_t* rl;
+	uv_httpd_addr_key_t key;
+	size_t i, allowed = 0, refused = 0;
+
+	// 1 per second, a token each
+	uv_httpd_ratelimit_create(&rl, 1, 1);
+	key.hi = 0x20010db800000000ULL;
+	for (i = 0; i < ADDRESSES; i++) {
+		key.lo = i;
+		allowed += uv_httpd_ratelimit_take(rl, &key, 1001);
+	}
+	for (i = 0; i < ADDRESSES; i++) {
+		key.lo = i;
+		refused += !uv_httpd_ratelimit_take(rl, &key, 1501);
+	}
+	check(allowed == ADDRESSES && refused == ADDRESSES && uv_httpd_ratelimit_size(rl) == ADDRESSES,
+		  "the table grows, every address keeps its bucket");
+
+	for (i = 0; i < ADDRESSES; i++) {
+		key.lo = ADDRESSES + i;
+		uv_httpd_ratelimit_take(rl, &key, 5001);
+	}
+	check(uv_httpd_ratelimit_size(rl) < 2 * ADDRESSES, "full buckets are reused or dropped");
+	uv_httpd_ratelimit_free(rl);
+}
+
+static void charged_requests(void) {
+	uv_httpd_mem_t* mem;
+	mybuf_t* out;
+	char codes[64];
+	int i;
+
+	server->stats.limited = 0;
+	uv_httpd_ratelimit_create(&server->ratelimit, 1, 3);
+	uv_httpd_mem_create(&mem, server);
+	out = uv_httpd_mem_output(mem);
+	timed_out = 0;
+	uv_timer_start(&guard, on_guard, GUARD_TIMEOUT, 0);
+	for (i = 0; i < 4 && !timed_out; i++) {
+		uv_httpd_mem_feed(mem, REQUEST, sizeof(REQUEST) - 1, 0);
+		statuses(out, codes, sizeof(codes));
+		while ((int)strlen(codes) < i * 4 + 3 && !timed_out) {
+			uv_run(loop, UV_RUN_ONCE);
+			statuses(out, codes, sizeof(codes));
+		}
+	}
+	uv_timer_stop(&guard);
+	check(0 == strcmp(codes, "200 200 200 429") && server->stats.limited == 1, "every request is charged, the fourth is 429");
+	if (strcmp(codes, "200 200 200 429")) printf("     got %s\n", codes);
+	uv_httpd_mem_free(mem);
+	uv_run(loop, UV_RUN_NOWAIT);
+	uv_httpd_ratelimit_free(server->ratelimit);
+	server->ratelimit = NULL;
+}
+
+static void prepaid_accept(void) {
+	char codes[64];
+
+	server->stats.limited = 0;
+	uv_httpd_ratelimit_create(&server->ratelimit, 1, 2);
+	pipelined(3, codes, sizeof(codes));
+	check(0 == strcmp(codes, "200 200 429"), "the token of accept pays for the first request, not twice");
+	if (strcmp(codes, "200 200 429")) printf("     got %s\n", codes);
+	pipelined(1, codes, sizeof(codes));
+	check(0 == strcmp(codes, "429") && server->stats.limited == 2, "an empty bucket is 429 on accept");
+	uv_httpd_ratelimit_free(server->ratelimit);
+	server->ratelimit = NULL;
+}
+
+int main(int argc, char** argv) {
+	int r;
+
+#ifndef _WIN32
+	signal(SIGPIPE, SIG_IGN);
+#endif
+	create();
+	buckets();
+	keys();
+	table();
+
+	loop = uv_default_loop();
+	uv_timer_init(loop, &guard);
+	r = uv_httpd_create(&server, loop, on_request);
+	if (!r) r = uv_httpd_listen(server, "127.0.0.1", PORT);
+	if (r) {
+		fprintf(stderr, "%d %s\n", r, uv_err_name(r));
+		return 1;
+	}
+	charged_requests();
+	prepaid_accept();
+
+	uv_close((uv_handle_t*)&guard, NULL);
+	uv_httpd_stop(server);
+	uv_run(loop, UV_RUN_DEFAULT);
+	uv_httpd_free(server);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,344 @@
+// hit rate and memory of the object cache of uvhttpd instances on one host, each with a
+// cache of its own against the sharded cache over unix sockets. the instances are spawned
+// for each mode, requests of /api/object/<key> go round robin to them like from a balancer.
+// usage: shardbench [-x uvhttpd] [-i instances] [-C MB] [-k keys] [-n requests] [-s zipf] [-c concurrency]
+//   -x: path of uvhttpd, default is ./uvhttpd
+//   -i: instances, default is 4
+//   -C: cache of each instance in MB, default is 16, objects are 4 KB
+//   -k: distinct keys, default is 50000
+//   -n: requests, default is 100000, the same sequence in both modes
+//   -s: zipf exponent of key popularity, default is 0.9
+//   -c: requests in flight, default is 16
+//
+// loads are the objects made up on a miss, the rest is the hit rate. memory is the sum
+// of the cache bytes and of the resident set growth of the instances.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifndef _WIN32
+#include <signal.h>
+#endif
+#include "uv_http_client.h"
+#include "mybuf.h"
+
+#define MAX_INSTANCES 16
+#define BASE_PORT 18700
+#define RETRY_INTERVAL 50 // ms, instances not listening yet
+
+typedef struct {
+	uv_process_t process;
+	int port;
+	char sock[64];
+	char port_arg[8], mb_arg[8];
+	uint64_t rss0;
+	mybuf_t stats; // body of /api/stats
+}instance_t;
+
+static uv_loop_t* loop;
+static uv_http_client_t* client;
+static const char* exe = "./uvhttpd";
+static instance_t instances[MAX_INSTANCES];
+static int ninstances = 4, cache_mb = 16, concurrency = 16;
+static size_t nkeys = 50000, total = 100000;
+static double zipf = 0.9;
+static uint32_t* sequence; // keys of the requests
+static size_t started, done, failed;
+static int pending;
+static uv_timer_t retry;
+
+
+/*************************** helper functions ****************/
+
+// cumulative zipf weights, keys by rank drawn from a fixed seed
+static void make_sequence(void) {
+	double* cdf = malloc(nkeys * sizeof(double));
+	double sum = 0, u;
+	uint64_t x = 88172645463325252ULL;
+	size_t i, lo, hi;
+
+	sequence = malloc(total * sizeof(uint32_t));
+	if (!cdf || !sequence) exit(1);
+	for (i = 0; i < nkeys; i++) {
+		sum += 1.0 / pow((double)(i + 1), zipf);
+		cdf[i] = sum;
+	}
+	for (i = 0; i < total; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		u = (double)(x >> 11) / 9007199254740992.0 * sum;
+		for (lo = 0, hi = nkeys - 1; lo < hi;) {
+			size_t mid = (lo + hi) / 2;
+			if (cdf[mid] < u) lo = mid + 1; else hi = mid;
+		}
+		sequence[i] = (uint32_t)lo;
+	}
+	free(cdf);
+}
+
+// a number after `"key":` in the object after `"section":`, or top level if NULL
+static uint64_t json_number(mybuf_t* body, const char* section, const char* key) {
+	char pattern[64];
+	const char* p;
+
+	if (mybuf_append(body, "", 1)) return 0;
+	body->size--;
+	p = body->buf;
+	if (section) {
+		snprintf(pattern, sizeof(pattern), "\"%s\":", section);
+		p = strstr(p, pattern);
+		if (!p) return 0;
+	}
+	snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+	p = strstr(p, pattern);
+	return p ? strtoull(p + strlen(pattern), NULL, 10) : 0;
+}
+
+
+/*************************** instances ****************/
+
+static void on_process_exit(uv_process_t* process, int64_t exit_status, int term_signal) {
+	uv_close((uv_handle_t*)process, NULL);
+}
+
+static int spawn_instances(int sharded) {
+	char* args[8 + 2 * MAX_INSTANCES];
+	uv_process_options_t opts;
+	uv_stdio_container_t stdio[3];
+	int i, j, n, r;
+
+	for (i = 0; i < ninstances; i++) {
+		instance_t* in = &instances[i];
+		in->port = BASE_PORT + i;
+		snprintf(in->sock, sizeof(in->sock), "/tmp/shardbench.%d.sock", i);
+		snprintf(in->port_arg, sizeof(in->port_arg), "%d", in->port);
+		snprintf(in->mb_arg, sizeof(in->mb_arg), "%d", cache_mb);
+		remove(in->sock);
+	}
+	for (i = 0; i < ninstances; i++) {
+		instance_t* in = &instances[i];
+		n = 0;
+		args[n++] = (char*)exe;
+		args[n++] = "-a";
+		args[n++] = "127.0.0.1";
+		args[n++] = "-l";
+		args[n++] = in->port_arg;
+		args[n++] = "-C";
+		args[n++] = in->mb_arg;
+		if (sharded) {
+			args[n++] = "-s";
+			args[n++] = in->sock;
+			for (j = 0; j < ninstances; j++) {
+				args[n++] = "-P";
+				args[n++] = instances[j].sock;
+			}
+		}
+		args[n] = NULL;
+		memset(&opts, 0, sizeof(opts));
+		memset(stdio, 0, sizeof(stdio));
+		stdio[0].flags = UV_IGNORE;
+		stdio[1].flags = UV_IGNORE;
+		stdio[2].flags = UV_INHERIT_FD;
+		stdio[2].data.fd = 2;
+		opts.file = exe;
+		opts.args = args;
+		opts.exit_cb = on_process_exit;
+		opts.stdio = stdio;
+		opts.stdio_count = 3;
+		r = uv_spawn(loop, &in->process, &opts);
+		if (r) {
+			fprintf(stderr, "spawn %s: %s\n", exe, uv_err_name(r));
+			return r;
+		}
+		uv_unref((uv_handle_t*)&in->process);
+	}
+	return 0;
+}
+
+static void kill_instances(void) {
+	int i;
+	for (i = 0; i < ninstances; i++) {
+		uv_ref((uv_handle_t*)&instances[i].process);
+		uv_process_kill(&instances[i].process, SIGTERM);
+	}
+	uv_run(loop, UV_RUN_DEFAULT);
+	for (i = 0; i < ninstances; i++) {
+		remove(instances[i].sock);
+	}
+}
+
+static void fetch_stats(void);
+
+static void on_retry(uv_timer_t* timer) {
+	fetch_stats();
+}
+
+static void on_stats_body(uv_http_client_req_t* req, const char* at, size_t len) {
+	instance_t* in = uv_http_client_req_data(req);
+	mybuf_append(&in->stats, at, len);
+}
+
+static void on_stats_done(uv_http_client_req_t* req, int status) {
+	instance_t* in = uv_http_client_req_data(req);
+	if (status) {
+		// not listening yet
+		in->stats.size = 0;
+		failed++;
+	}
+	if (--pending == 0 && failed) {
+		uv_timer_start(&retry, on_retry, RETRY_INTERVAL, 0);
+	}
+}
+
+// /api/stats of every instance, again until all answer
+static void fetch_stats(void) {
+	uv_http_client_options_t opts;
+	char url[64];
+	int i;
+
+	failed = 0;
+	for (i = 0; i < ninstances; i++) {
+		instance_t* in = &instances[i];
+		in->stats.size = 0;
+		snprintf(url, sizeof(url), "http://127.0.0.1:%d/api/stats", in->port);
+		memset(&opts, 0, sizeof(opts));
+		opts.method = HTTP_GET;
+		opts.url = url;
+		opts.on_body = on_stats_body;
+		opts.on_done = on_stats_done;
+		opts.data = in;
+		if (uv_http_client_request(client, &opts, NULL) == 0) pending++;
+	}
+}
+
+
+/*************************** requests ****************/
+
+static void next_request(void);
+
+static int on_object_headers(uv_http_client_req_t* req, const uv_http_client_res_t* res) {
+	if (res->status != 200) failed++;
+	return 0;
+}
+
+static void on_object_done(uv_http_client_req_t* req, int status) {
+	if (status && failed++ == 0) {
+		fprintf(stderr, "request failed: %s\n", uv_err_name(status));
+	}
+	done++;
+	next_request();
+}
+
+static void next_request(void) {
+	uv_http_client_options_t opts;
+	char url[64];
+	int r;
+
+	if (started == total) return;
+	snprintf(url, sizeof(url), "http://127.0.0.1:%d/api/object/key%u",
+			 instances[started % ninstances].port, sequence[started]);
+	started++;
+	memset(&opts, 0, sizeof(opts));
+	opts.method = HTTP_GET;
+	opts.url = url;
+	opts.on_headers = on_object_headers;
+	opts.on_done = on_object_done;
+	r = uv_http_client_request(client, &opts, NULL);
+	if (r) {
+		fprintf(stderr, "request: %s\n", uv_err_name(r));
+		exit(1);
+	}
+}
+
+static void run(int sharded) {
+	uint64_t loads = 0, remote = 0, bytes = 0, rss = 0, start;
+	double seconds;
+	int i;
+
+	if (spawn_instances(sharded)) exit(1);
+	fetch_stats();
+	uv_run(loop, UV_RUN_DEFAULT);
+	for (i = 0; i < ninstances; i++) {
+		instances[i].rss0 = json_number(&instances[i].stats, NULL, "rss");
+	}
+
+	started = done = failed = 0;
+	start = uv_hrtime();
+	for (i = 0; i < concurrency; i++) {
+		next_request();
+	}
+	uv_run(loop, UV_RUN_DEFAULT);
+	seconds = (uv_hrtime() - start) / 1e9;
+	if (failed) fprintf(stderr, "%zu requests failed\n", failed);
+
+	fetch_stats();
+	uv_run(loop, UV_RUN_DEFAULT);
+	for (i = 0; i < ninstances; i++) {
+		mybuf_t* s = &instances[i].stats;
+		loads += json_number(s, "cache", "misses") + json_number(s, "cache", "remote_failed");
+		remote += json_number(s, "cache", "remote");
+		bytes += json_number(s, "cache", "bytes");
+		rss += json_number(s, NULL, "rss") - instances[i].rss0;
+	}
+	kill_instances();
+
+	printf("%-11s %zu requests, %.0f req/s, hit rate %.1f%%, loads %llu, asked the owner %llu\n",
+		   sharded ? "sharded" : "independent", total, total / seconds, 100.0 * (total - loads) / total,
+		   (unsigned long long)loads, (unsigned long long)remote);
+	printf("            cache %.1f MB, resident set growth %.1f MB over %d instances\n",
+		   bytes / 1048576.0, rss / 1048576.0, ninstances);
+}
+
+int main(int argc, char** argv) {
+	int k;
+
+	for (k = 1; k < argc; k++) {
+		if (strcmp(argv[k], "-x") == 0 && k + 1 < argc) {
+			exe = argv[++k];
+		} else if (strcmp(argv[k], "-i") == 0 && k + 1 < argc) {
+			ninstances = atoi(argv[++k]);
+		} else if (strcmp(argv[k], "-C") == 0 && k + 1 < argc) {
+			cache_mb = atoi(argv[++k]);
+		} else if (strcmp(argv[k], "-k") == 0 && k + 1 < argc) {
+			nkeys = strtoul(argv[++k], NULL, 10);
+		} else if (strcmp(argv[k], "-n") == 0 && k + 1 < argc) {
+			total = strtoul(argv[++k], NULL, 10);
+		} else if (strcmp(argv[k], "-s") == 0 && k + 1 < argc) {
+			zipf = atof(argv[++k]);
+		} else if (strcmp(argv[k], "-c") == 0 && k + 1 < argc) {
+			concurrency = atoi(argv[++k]);
+		}
+	}
+	if (ninstances < 1) ninstances = 1;
+	if (ninstances > MAX_INSTANCES) ninstances = MAX_INSTANCES;
+	if (nkeys == 0) nkeys = 1;
+	if (total == 0) total = 1;
+	if (concurrency < 1) concurrency = 1;
+
+#ifndef _WIN32
+	signal(SIGPIPE, SIG_IGN);
+#endif
+	loop = uv_default_loop();
+	if (uv_http_client_create(&client, loop)) return 1;
+	client->max_connections = concurrency;
+	uv_timer_init(loop, &retry);
+	for (k = 0; k < MAX_INSTANCES; k++) {
+		mybuf_init(&instances[k].stats);
+	}
+	make_sequence();
+	printf("%d instances of %d MB, %zu keys, zipf %.2f\n", ninstances, cache_mb, nkeys, zipf);
+	run(0);
+	run(1);
+
+	uv_http_client_close(client);
+	uv_close((uv_handle_t*)&retry, NULL);
+	uv_run(loop, UV_RUN_DEFAULT);
+	uv_http_client_free(client);
+	for (k = 0; k < MAX_INSTANCES; k++) {
+		mybuf_clear(&instances[k].stats);
+	}
+	free(sequence);
+	return 0;
+}
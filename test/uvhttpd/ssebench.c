@@ -0,0 +1,190 @@
+// memory and heartbeat cost of idle server-sent event streams over in-memory connections,
+// no sockets, so 100k streams fit in the file descriptor limit.
+// usage: ssebench [-n streams] [-b ms] [-p periods] [-t]
+//   -n: streams, default is 100000
+//   -b: heartbeat, default is 200 ms, so a run takes a few seconds
+//   -p: heartbeat periods to run, default is 10
+//   -t: a uv_timer_t per stream writing the heartbeat, instead of the batching timer of the hub
+//
+// memory is the growth of the resident set, per connection and then per stream on top of it.
+// a connection here also holds the output buffer of the in-memory harness, sizeof(mybuf_t),
+// a socket holds kernel buffers instead.
+// heartbeat cost is the busy time of the loop, from UV_METRICS_IDLE_TIME, per heartbeat written.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "uv_httpd.h"
+#include "uv_httpd_mem.h"
+#include "uv_httpd_sse.h"
+#include "mybuf.h"
+
+#define REQUEST \
+	"GET /api/events HTTP/1.1\r\n" \
+	"Host: 127.0.0.1:8000\r\n" \
+	"Accept: text/event-stream\r\n" \
+	"Cache-Control: no-cache\r\n" \
+	"\r\n"
+
+#define EVENT_SIZE 200
+#define BROADCASTS 10
+
+typedef struct {
+	uv_timer_t timer;
+	uv_httpd_sse_stream_t* stream;
+}stream_timer_t;
+
+static uv_httpd_sse_t* sse;
+static uv_httpd_sse_stream_t** streams;
+static size_t nstreams;
+static uint64_t timer_heartbeats;
+
+static void on_request(uv_httpd_server_t* server, uv_httpd_client_t* client, uv_httpd_request_t* req) {
+	uv_httpd_sse_stream_t* stream;
+	if (uv_httpd_sse_start(sse, client, req, NULL, NULL, &stream)) {
+		uv_httpd_close(client);
+		return;
+	}
+	streams[nstreams++] = stream;
+}
+
+static void on_stream_timer(uv_timer_t* timer) {
+	stream_timer_t* t = timer->data;
+	uv_httpd_sse_comment(t->stream, "");
+	timer_heartbeats++;
+}
+
+static void on_stop(uv_timer_t* timer) {
+	uv_stop(timer->loop);
+}
+
+static double rss_mb(void) {
+	size_t rss = 0;
+	uv_resident_set_memory(&rss);
+	return rss / 1048576.0;
+}
+
+int main(int argc, char** argv) {
+	uv_loop_t* loop = uv_default_loop();
+	uv_httpd_server_t* server;
+	uv_httpd_mem_t** mems;
+	stream_timer_t* timers = NULL;
+	uv_timer_t stop;
+	uv_httpd_sse_stats_t stats;
+	char event[EVENT_SIZE];
+	uint64_t start, idle, heartbeat = 200, best = 0;
+	double rss0, rss1, rss2, rss3;
+	size_t n = 100000, i;
+	int periods = 10, per_stream = 0, k, r;
+
+	for (k = 1; k < argc; k++) {
+		if (strcmp(argv[k], "-n") == 0 && k + 1 < argc) {
+			n = strtoul(argv[++k], NULL, 10);
+		} else if (strcmp(argv[k], "-b") == 0 && k + 1 < argc) {
+			heartbeat = strtoul(argv[++k], NULL, 10);
+		} else if (strcmp(argv[k], "-p") == 0 && k + 1 < argc) {
+			periods = atoi(argv[++k]);
+		} else if (strcmp(argv[k], "-t") == 0) {
+			per_stream = 1;
+		}
+	}
+	if (n == 0) n = 1;
+	if (heartbeat == 0) heartbeat = 1;
+	if (periods < 1) periods = 1;
+
+	uv_loop_configure(loop, UV_METRICS_IDLE_TIME);
+	r = uv_httpd_create(&server, loop, on_request);
+	if (r) {
+		fprintf(stderr, "uv_httpd_create: %s\n", uv_err_name(r));
+		return 1;
+	}
+	// the hub stays quiet if every stream has its own timer
+	r = uv_httpd_sse_create(&sse, loop, per_stream ? 3600 * 1000 : heartbeat);
+	if (r) {
+		fprintf(stderr, "uv_httpd_sse_create: %s\n", uv_err_name(r));
+		return 1;
+	}
+	mems = malloc(n * sizeof(*mems));
+	streams = malloc(n * sizeof(*streams));
+	if (!mems || !streams) return 1;
+
+	rss0 = rss_mb();
+	for (i = 0; i < n; i++) {
+		r = uv_httpd_mem_create(&mems[i], server);
+		if (r) {
+			fprintf(stderr, "uv_httpd_mem_create: %s after %zu\n", uv_err_name(r), i);
+			return 1;
+		}
+	}
+	rss1 = rss_mb();
+	for (i = 0; i < n; i++) {
+		uv_httpd_mem_feed(mems[i], REQUEST, sizeof(REQUEST) - 1, 0);
+		uv_httpd_mem_output(mems[i])->size = 0;
+	}
+	rss2 = rss_mb();
+	if (nstreams != n) {
+		fprintf(stderr, "%zu streams of %zu\n", nstreams, n);
+		return 1;
+	}
+	rss3 = rss2;
+	if (per_stream) {
+		timers = malloc(n * sizeof(*timers));
+		if (!timers) return 1;
+		for (i = 0; i < n; i++) {
+			timers[i].stream = streams[i];
+			uv_timer_init(loop, &timers[i].timer);
+			timers[i].timer.data = &timers[i];
+			uv_timer_start(&timers[i].timer, on_stream_timer, heartbeat, heartbeat);
+		}
+		rss3 = rss_mb();
+	}
+	printf("%zu streams: connection %.0f bytes, stream %.0f bytes%s, harness output buffer %zu bytes\n", n,
+		   (rss1 - rss0) * 1048576 / n, (rss2 - rss1) * 1048576 / n,
+		   per_stream ? "" : " with the batching timer", sizeof(mybuf_t));
+	if (per_stream) {
+		printf("  uv_timer_t per stream: %.0f bytes more\n", (rss3 - rss2) * 1048576 / n);
+	}
+
+	// idle streams for `periods` heartbeats
+	uv_timer_init(loop, &stop);
+	uv_timer_start(&stop, on_stop, heartbeat * periods + heartbeat / 2, 0);
+	idle = uv_metrics_idle_time(loop);
+	start = uv_hrtime();
+	uv_run(loop, UV_RUN_DEFAULT);
+	start = uv_hrtime() - start - (uv_metrics_idle_time(loop) - idle);
+	uv_httpd_sse_stats(sse, &stats);
+	stats.heartbeats += timer_heartbeats;
+	printf("heartbeats: %llu in %d periods, %llu timer wakeups, busy %.1f ms, %.0f ns per heartbeat\n",
+		   (unsigned long long)stats.heartbeats, periods,
+		   (unsigned long long)(per_stream ? timer_heartbeats : stats.wakeups), start / 1e6,
+		   stats.heartbeats ? (double)start / stats.heartbeats : 0.0);
+
+	// events to every stream, formatted once
+	memset(event, 'x', sizeof(event));
+	for (k = 0; k < BROADCASTS; k++) {
+		for (i = 0; i < n; i++) {
+			uv_httpd_mem_output(mems[i])->size = 0;
+		}
+		start = uv_hrtime();
+		uv_httpd_sse_broadcast(sse, "update", NULL, event, sizeof(event));
+		start = uv_hrtime() - start;
+		if (best == 0 || start < best) best = start;
+	}
+	printf("broadcast of %d bytes: %.1f ms, %.0f ns per stream\n", EVENT_SIZE, best / 1e6, (double)best / n);
+
+	if (timers) {
+		for (i = 0; i < n; i++) {
+			uv_close((uv_handle_t*)&timers[i].timer, NULL);
+		}
+	}
+	uv_close((uv_handle_t*)&stop, NULL);
+	uv_httpd_sse_free(sse);
+	for (i = 0; i < n; i++) {
+		uv_httpd_mem_free(mems[i]);
+	}
+	uv_run(loop, UV_RUN_DEFAULT);
+	free(timers);
+	free(streams);
+	free(mems);
+	return 0;
+}
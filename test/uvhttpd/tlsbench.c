@@ -0,0 +1,339 @@
+// handshakes/s of the TLS termination of a spawned uvhttpd, full and resumed, TLS 1.3 and
+// 1.2, then the throughput of /api/echo over TLS against a plain instance.
+// usage: tlsbench -c cert.pem -k key.pem [-x uvhttpd] [-n handshakes] [-m MB]
+//   -c, -k: certificate chain and private key of the server, a P-256 one is made by
+//           openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:P-256 -nodes -days 365
+//           -subj /CN=localhost -keyout key.pem -out cert.pem
+//   -x: path of uvhttpd, default is ./uvhttpd
+//   -n: connections of each handshake kind, default is 2000
+//   -m: MB of request bodies of each echo size, default is 256
+//
+// a connection is one GET / with `Connection: close`, the session of the previous one is
+// offered for the resumed kinds. echo is POST /api/echo of 16 KB and 256 KB bodies on one
+// keep-alive connection, MB/s counts the request bodies.
+// the client is blocking OpenSSL over loopback, posix only.
+// server cpu is utime + stime of the server from /proc, linux only, 0 elsewhere.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <uv.h>
+#include "llhttp.h"
+
+#define TLS_PORT 18900
+#define PLAIN_PORT 18901
+#define RETRY_INTERVAL 50 // ms, server not listening yet
+#define RETRY_MAX 100
+
+#define REQUEST \
+	"GET / HTTP/1.1\r\n" \
+	"Host: localhost\r\n" \
+	"Connection: close\r\n" \
+	"\r\n"
+
+typedef struct {
+	int fd;
+	SSL* ssl; // NULL for plain
+	llhttp_t parser;
+	int complete;
+	size_t body;
+}conn_t;
+
+typedef struct {
+	uv_process_t process;
+	char port_arg[8];
+}server_t;
+
+static uv_loop_t* loop;
+static const char* exe = "./uvhttpd";
+static const char* cert_file;
+static const char* key_file;
+static server_t tls_server, plain_server;
+static llhttp_settings_t settings;
+
+
+/*************************** helper functions ****************/
+
+// ns of cpu used by `server`
+static uint64_t server_cpu(server_t* server) {
+#ifdef __linux__
+	char path[64], stat[1024];
+	unsigned long utime, stime;
+	const char* p;
+	size_t n;
+	FILE* f;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", server->process.pid);
+	f = fopen(path, "r");
+	if (!f) return 0;
+	n = fread(stat, 1, sizeof(stat) - 1, f);
+	fclose(f);
+	stat[n] = '\0';
+	// fields 14 and 15, after the command in parentheses and 11 more
+	p = strrchr(stat, ')');
+	if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) return 0;
+	return (uint64_t)(utime + stime) * 1000000000ULL / sysconf(_SC_CLK_TCK);
+#else
+	return 0;
+#endif
+}
+
+static void fail(const char* what) {
+	fprintf(stderr, "%s failed\n", what);
+	ERR_print_errors_fp(stderr);
+	exit(1);
+}
+
+static int on_body(llhttp_t* parser, const char* at, size_t length) {
+	conn_t* c = parser->data;
+	c->body += length;
+	return 0;
+}
+
+static int on_message_complete(llhttp_t* parser) {
+	conn_t* c = parser->data;
+	c->complete = 1;
+	return HPE_PAUSED;
+}
+
+// a tcp connection to `port`, -1 if refused
+static int tcp_connect(int port) {
+	struct sockaddr_in addr;
+	int fd = socket(AF_INET, SOCK_STREAM, 0), one = 1;
+
+	if (fd < 0) fail("socket");
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+		close(fd);
+		return -1;
+	}
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return fd;
+}
+
+static void conn_open(conn_t* c, int port, SSL_CTX* ctx, SSL_SESSION* session) {
+	memset(c, 0, sizeof(*c));
+	c->fd = tcp_connect(port);
+	if (c->fd < 0) fail("connect");
+	llhttp_init(&c->parser, HTTP_RESPONSE, &settings);
+	c->parser.data = c;
+	if (!ctx) return;
+	c->ssl = SSL_new(ctx);
+	if (!c->ssl) fail("SSL_new");
+	SSL_set_fd(c->ssl, c->fd);
+	SSL_set_tlsext_host_name(c->ssl, "localhost");
+	if (session) SSL_set_session(c->ssl, session);
+	if (SSL_connect(c->ssl) != 1) fail("SSL_connect");
+}
+
+static void conn_close(conn_t* c) {
+	if (c->ssl) {
+		// close_notify, otherwise SSL_free marks the session not resumable
+		SSL_shutdown(c->ssl);
+		SSL_free(c->ssl);
+	}
+	close(c->fd);
+}
+
+static void conn_write(conn_t* c, const char* data, size_t len) {
+	while (len) {
+		int n = c->ssl ? SSL_write(c->ssl, data, (int)len) : (int)send(c->fd, data, len, 0);
+		if (n <= 0) fail("write");
+		data += n;
+		len -= n;
+	}
+}
+
+// one response, its body is counted and dropped
+static void conn_read_response(conn_t* c) {
+	static char buf[65536];
+	enum llhttp_errno err;
+
+	c->complete = 0;
+	c->body = 0;
+	llhttp_resume(&c->parser);
+	while (!c->complete) {
+		int n = c->ssl ? SSL_read(c->ssl, buf, sizeof(buf)) : (int)recv(c->fd, buf, sizeof(buf), 0);
+		if (n <= 0) fail("read");
+		err = llhttp_execute(&c->parser, buf, n);
+		if (err != HPE_OK && err != HPE_PAUSED) fail("llhttp_execute");
+	}
+}
+
+
+/*************************** servers ****************/
+
+static void on_process_exit(uv_process_t* process, int64_t exit_status, int term_signal) {
+	uv_close((uv_handle_t*)process, NULL);
+}
+
+static void spawn_server(server_t* server, int port, int tls) {
+	char* args[] = { (char*)exe, "-a", "127.0.0.1", "-l", server->port_arg, "-c", (char*)cert_file, "-k", (char*)key_file, NULL };
+	uv_process_options_t opts;
+	uv_stdio_container_t stdio[3];
+	int r, i, fd;
+
+	snprintf(server->port_arg, sizeof(server->port_arg), "%d", port);
+	if (!tls) args[5] = NULL;
+	memset(&opts, 0, sizeof(opts));
+	memset(stdio, 0, sizeof(stdio));
+	stdio[0].flags = UV_IGNORE;
+	stdio[1].flags = UV_IGNORE;
+	stdio[2].flags = UV_INHERIT_FD;
+	stdio[2].data.fd = 2;
+	opts.file = exe;
+	opts.args = args;
+	opts.exit_cb = on_process_exit;
+	opts.stdio = stdio;
+	opts.stdio_count = 3;
+	r = uv_spawn(loop, &server->process, &opts);
+	if (r) {
+		fprintf(stderr, "spawn %s: %s\n", exe, uv_err_name(r));
+		exit(1);
+	}
+	for (i = 0; (fd = tcp_connect(port)) < 0; i++) {
+		if (i == RETRY_MAX) {
+			fprintf(stderr, "cannot connect to %s\n", exe);
+			exit(1);
+		}
+		uv_sleep(RETRY_INTERVAL);
+	}
+	close(fd);
+}
+
+static void kill_server(server_t* server) {
+	uv_process_kill(&server->process, SIGTERM);
+}
+
+
+/*************************** runs ****************/
+
+static void handshakes(const char* name, int version, int resume, int n) {
+	SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
+	SSL_SESSION* session = NULL;
+	uint64_t start, ns, cpu;
+	int i, reused = 0;
+	conn_t c;
+
+	if (!ctx) fail("SSL_CTX_new");
+	SSL_CTX_set_min_proto_version(ctx, version);
+	SSL_CTX_set_max_proto_version(ctx, version);
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT);
+	cpu = server_cpu(&tls_server);
+	start = uv_hrtime();
+	for (i = 0; i < n; i++) {
+		conn_open(&c, TLS_PORT, ctx, session);
+		reused += SSL_session_reused(c.ssl);
+		conn_write(&c, REQUEST, sizeof(REQUEST) - 1);
+		conn_read_response(&c);
+		if (resume) {
+			// taken after the response, TLS 1.3 sends its ticket after the handshake
+			if (session) SSL_SESSION_free(session);
+			session = SSL_get1_session(c.ssl);
+		}
+		conn_close(&c);
+	}
+	ns = uv_hrtime() - start;
+	cpu = server_cpu(&tls_server) - cpu;
+	if (session) SSL_SESSION_free(session);
+	SSL_CTX_free(ctx);
+	printf("%s %-7s %6.0f/s, %4.0fus server cpu/handshake, %d resumed\n",
+		   name, resume ? "resumed" : "full", n * 1e9 / ns, cpu / 1e3 / n, reused);
+}
+
+// MB/s of `mb` MB of POST bodies of `size` bytes, server cpu per MB in `cpu_per_mb`
+static double echo(server_t* server, int port, SSL_CTX* ctx, size_t size, int mb, double* cpu_per_mb) {
+	char head[128], * body = malloc(size);
+	size_t count = ((size_t)mb << 20) / size, i;
+	int len = snprintf(head, sizeof(head), "POST /api/echo HTTP/1.1\r\nHost: localhost\r\n"
+					   "Connection: keep-alive\r\nContent-Length: %zu\r\n\r\n", size);
+	uint64_t start, ns, cpu;
+	conn_t c;
+
+	if (!body) fail("malloc");
+	memset(body, 'x', size);
+	if (count == 0) count = 1;
+	conn_open(&c, port, ctx, NULL);
+	cpu = server_cpu(server);
+	start = uv_hrtime();
+	for (i = 0; i < count; i++) {
+		conn_write(&c, head, len);
+		conn_write(&c, body, size);
+		conn_read_response(&c);
+		if (c.body != size) fail("echo");
+	}
+	ns = uv_hrtime() - start;
+	cpu = server_cpu(server) - cpu;
+	conn_close(&c);
+	free(body);
+	*cpu_per_mb = cpu / 1e6 / ((double)count * size / 1048576);
+	return (double)count * size / 1048576 / (ns / 1e9);
+}
+
+int main(int argc, char** argv) {
+	static const size_t sizes[] = { 16 * 1024, 256 * 1024 };
+	SSL_CTX* ctx;
+	int n = 2000, mb = 256, k;
+	size_t i;
+
+	for (k = 1; k < argc; k++) {
+		if (strcmp(argv[k], "-c") == 0 && k + 1 < argc) {
+			cert_file = argv[++k];
+		} else if (strcmp(argv[k], "-k") == 0 && k + 1 < argc) {
+			key_file = argv[++k];
+		} else if (strcmp(argv[k], "-x") == 0 && k + 1 < argc) {
+			exe = argv[++k];
+		} else if (strcmp(argv[k], "-n") == 0 && k + 1 < argc) {
+			n = atoi(argv[++k]);
+		} else if (strcmp(argv[k], "-m") == 0 && k + 1 < argc) {
+			mb = atoi(argv[++k]);
+		}
+	}
+	if (!cert_file || !key_file) {
+		fprintf(stderr, "usage: tlsbench -c cert.pem -k key.pem [-x uvhttpd] [-n handshakes] [-m MB]\n");
+		return 1;
+	}
+	if (n < 1) n = 1;
+	if (mb < 1) mb = 1;
+
+	signal(SIGPIPE, SIG_IGN);
+	loop = uv_default_loop();
+	llhttp_settings_init(&settings);
+	settings.on_body = on_body;
+	settings.on_message_complete = on_message_complete;
+	spawn_server(&tls_server, TLS_PORT, 1);
+	spawn_server(&plain_server, PLAIN_PORT, 0);
+
+	printf("%d connections of each kind, %s\n", n, OpenSSL_version(OPENSSL_VERSION));
+	handshakes("TLS1.3", TLS1_3_VERSION, 0, n);
+	handshakes("TLS1.3", TLS1_3_VERSION, 1, n);
+	handshakes("TLS1.2", TLS1_2_VERSION, 0, n);
+	handshakes("TLS1.2", TLS1_2_VERSION, 1, n);
+
+	ctx = SSL_CTX_new(TLS_client_method());
+	if (!ctx) fail("SSL_CTX_new");
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		double tls_cpu, plain_cpu;
+		double tls = echo(&tls_server, TLS_PORT, ctx, sizes[i], mb, &tls_cpu);
+		double plain = echo(&plain_server, PLAIN_PORT, NULL, sizes[i], mb, &plain_cpu);
+		printf("echo %3zuKB  tls %4.0f MB/s (%.2f ms cpu/MB)  plain %4.0f MB/s (%.2f ms cpu/MB)\n",
+			   sizes[i] >> 10, tls, tls_cpu, plain, plain_cpu);
+	}
+	SSL_CTX_free(ctx);
+
+	kill_server(&tls_server);
+	kill_server(&plain_server);
+	uv_run(loop, UV_RUN_DEFAULT);
+	return 0;
+}
@@ -0,0 +1,102 @@
+// convert a dump of uv_httpd trace rings to the Chrome trace event format.
+// usage: trace2json [dump] > trace.json, the dump is read from stdin if not given,
+// e.g. `curl -s http://127.0.0.1:8000/api/trace | ./trace2json > trace.json`,
+// then open it in chrome://tracing or https://ui.perfetto.dev
+// the dump must come from the same architecture, it is in host byte order.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "uv_httpd_trace.h"
+
+static const char* names[] = {
+#define XX(name, str, arg) str,
+	UV_HTTPD_TRACE_MAP(XX)
+#undef XX
+};
+
+static const char* arg_names[] = {
+#define XX(name, str, arg) arg,
+	UV_HTTPD_TRACE_MAP(XX)
+#undef XX
+};
+
+typedef struct {
+	uint32_t thread;
+	uint32_t n;
+	uv_httpd_trace_event_t* events;
+}ring_t;
+
+static int read_all(FILE* f, void* p, size_t len) {
+	return fread(p, 1, len, f) == len ? 0 : -1;
+}
+
+static void print_event(const uv_httpd_trace_event_t* e, uint32_t thread, uint64_t base, int* first) {
+	uint64_t ts = e->ts - base;
+	const char* arg = arg_names[e->name];
+
+	printf("%s\n{\"name\":\"%s\",\"cat\":\"uv_httpd\",\"ph\":\"%c\",\"ts\":%llu.%03u,\"pid\":1,\"tid\":%u",
+		   *first ? "" : ",", names[e->name], e->phase,
+		   (unsigned long long)(ts / 1000), (unsigned int)(ts % 1000), thread);
+	if (e->phase == 'b' || e->phase == 'e') {
+		printf(",\"id\":\"0x%llx\"", (unsigned long long)e->id);
+	} else if (e->phase == 'i') {
+		printf(",\"s\":\"t\"");
+	}
+	printf(",\"args\":{\"client\":\"0x%llx\"", (unsigned long long)e->id);
+	if (*arg) {
+		printf(",\"%s\":%d", arg, (int)e->arg);
+	}
+	printf("}}");
+	*first = 0;
+}
+
+int main(int argc, char** argv) {
+	FILE* f = stdin;
+	char magic[8];
+	uint32_t nrings, i, j;
+	ring_t* rings;
+	uint64_t base = UINT64_MAX;
+	int first = 1;
+
+	if (argc > 1 && !(f = fopen(argv[1], "rb"))) {
+		perror(argv[1]);
+		return 1;
+	}
+	if (read_all(f, magic, sizeof(magic)) || memcmp(magic, UV_HTTPD_TRACE_MAGIC, sizeof(magic))
+		|| read_all(f, &nrings, sizeof(nrings))) {
+		fprintf(stderr, "not a uv_httpd trace dump\n");
+		return 1;
+	}
+	rings = calloc(nrings ? nrings : 1, sizeof(ring_t));
+	if (!rings) return 1;
+	for (i = 0; i < nrings; i++) {
+		ring_t* r = &rings[i];
+		if (read_all(f, &r->thread, 4) || read_all(f, &r->n, 4)
+			|| !(r->events = malloc((r->n ? r->n : 1) * sizeof(uv_httpd_trace_event_t)))
+			|| read_all(f, r->events, r->n * sizeof(uv_httpd_trace_event_t))) {
+			fprintf(stderr, "truncated trace dump\n");
+			return 1;
+		}
+		for (j = 0; j < r->n; j++) {
+			if (r->events[j].ts < base) base = r->events[j].ts;
+		}
+	}
+
+	printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	for (i = 0; i < nrings; i++) {
+		printf("%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+			   first ? "" : ",", rings[i].thread, rings[i].thread);
+		first = 0;
+		for (j = 0; j < rings[i].n; j++) {
+			const uv_httpd_trace_event_t* e = &rings[i].events[j];
+			// a write in progress when dumped
+			if (e->name >= UV_HTTPD_TRACE_MAX || !e->phase || !strchr("BEbei", e->phase)) continue;
+			print_event(e, rings[i].thread, base, &first);
+		}
+		free(rings[i].events);
+	}
+	printf("\n]}\n");
+	free(rings);
+	return 0;
+}
@@ -0,0 +1,98 @@
+// throughput of uv_httpd_percent_decode on a 4 KB query against a byte loop, no sockets.
+// usage: urlbench [-n iterations]
+//   -n: decodes of each input, default is 200000
+//
+// decoding is in place, so each iteration copies the input first, in both loops.
+// the inputs have no escapes, an escape every 400 bytes and an escape every 12 bytes.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "uv_httpd_url.h"
+
+#define INPUT_SIZE 4096
+
+static int hex_value(char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+// one byte at a time, the same output as uv_httpd_percent_decode
+static size_t byte_decode(char* s, size_t len, int form) {
+	size_t i, o = 0;
+	int h, l;
+	for (i = 0; i < len; i++) {
+		char c = s[i];
+		if (c == '%' && i + 2 < len && (h = hex_value(s[i + 1])) >= 0 && (l = hex_value(s[i + 2])) >= 0) {
+			c = (char)(h << 4 | l);
+			i += 2;
+		} else if (c == '+' && form) {
+			c = ' ';
+		}
+		s[o++] = c;
+	}
+	return o;
+}
+
+// `a=...&b=...` of INPUT_SIZE bytes, `%2F` every `every` bytes, none if 0
+static void make_input(char* input, size_t every) {
+	size_t i;
+	for (i = 0; i < INPUT_SIZE; i++) {
+		input[i] = (char)('a' + i % 26);
+		if (i % 64 == 63) input[i] = '&';
+		else if (i % 64 == 1) input[i] = '=';
+	}
+	for (i = every; every && i + 3 <= INPUT_SIZE; i += every) {
+		memcpy(input + i - 3, "%2F", 3);
+	}
+}
+
+static double run(size_t(*decode)(char*, size_t, int), const char* input, size_t n, size_t* out) {
+	char buf[INPUT_SIZE];
+	uint64_t start = uv_hrtime(), ns;
+	size_t i, len = 0;
+	for (i = 0; i < n; i++) {
+		memcpy(buf, input, INPUT_SIZE);
+		len += decode(buf, INPUT_SIZE, 1);
+	}
+	ns = uv_hrtime() - start;
+	*out = len / n;
+	return (double)n * INPUT_SIZE / ns;
+}
+
+int main(int argc, char** argv) {
+	static const size_t every[] = { 0, 400, 12 };
+	char input[INPUT_SIZE], a[INPUT_SIZE], b[INPUT_SIZE];
+	size_t n = 200000, len_a, len_b, i;
+	double swar, bytes;
+
+	for (i = 1; i < (size_t)argc; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < (size_t)argc) {
+			n = strtoul(argv[++i], NULL, 10);
+		}
+	}
+	if (n == 0) n = 1;
+
+	for (i = 0; i < sizeof(every) / sizeof(every[0]); i++) {
+		make_input(input, every[i]);
+		memcpy(a, input, INPUT_SIZE);
+		memcpy(b, input, INPUT_SIZE);
+		len_a = uv_httpd_percent_decode(a, INPUT_SIZE, 1);
+		len_b = byte_decode(b, INPUT_SIZE, 1);
+		if (len_a != len_b || memcmp(a, b, len_a)) {
+			fprintf(stderr, "outputs differ, escape every %zu bytes\n", every[i]);
+			return 1;
+		}
+		swar = run(uv_httpd_percent_decode, input, n, &len_a);
+		bytes = run(byte_decode, input, n, &len_b);
+		if (every[i]) {
+			printf("escape every %3zu B: ", every[i]);
+		} else {
+			printf("no escapes:         ");
+		}
+		printf("uv_httpd_percent_decode %.2f GB/s, byte loop %.2f GB/s\n", swar, bytes);
+	}
+	return 0;
+}
@@ -0,0 +1,188 @@
+// regression tests of uv_httpd_url: url components, query parameters and percent-decoding.
+// usage: urltest
+// prints each case, exits with 1 if any fails.
+//
+// the word-at-a-time decoder is checked against a byte loop on random inputs, escapes
+// placed across the 8 byte words, at the ends and cut short.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "uv_httpd_url.h"
+
+#define RANDOM_INPUTS 20000
+
+static int failures;
+static uint64_t x = 88172645463325252ULL;
+
+
+/*************************** helper functions ****************/
+
+static uint32_t next_random(void) {
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return (uint32_t)(x >> 32);
+}
+
+static void check(int ok, const char* what) {
+	printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+	if (!ok) failures++;
+}
+
+// `req` of the request target `url`, kept in `buf`
+static void make_request(uv_httpd_request_t* req, char* buf, size_t size, const char* url) {
+	size_t len = strlen(url);
+	memset(req, 0, sizeof(*req));
+	// an offset other than 0, as in a real request line
+	snprintf(buf, size, "GET %s HTTP/1.1", url);
+	req->base = buf;
+	req->url.offset = 4;
+	req->url.len = len;
+}
+
+static int string_is(const uv_httpd_request_t* req, const uv_httpd_string_t* s, const char* expected) {
+	return s->len == strlen(expected) && 0 == memcmp(req->base + s->offset, expected, s->len);
+}
+
+// path, query and fragment of `url`
+static void url_is(const char* url, const char* path, const char* query, const char* fragment) {
+	uv_httpd_request_t req;
+	uv_httpd_url_t u;
+	char buf[256], what[300];
+	int ok;
+
+	make_request(&req, buf, sizeof(buf), url);
+	uv_httpd_url_parse(&req, &u);
+	ok = string_is(&req, &u.path, path) && string_is(&req, &u.query, query) && string_is(&req, &u.fragment, fragment);
+	snprintf(what, sizeof(what), "%s is path `%s` query `%s` fragment `%s`", url, path, query, fragment);
+	check(ok, what);
+}
+
+static int hex_value(char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+// one byte at a time, the expected output of uv_httpd_percent_decode
+static size_t byte_decode(char* s, size_t len, int form) {
+	size_t i, o = 0;
+	int h, l;
+	for (i = 0; i < len; i++) {
+		char c = s[i];
+		if (c == '%' && i + 2 < len && (h = hex_value(s[i + 1])) >= 0 && (l = hex_value(s[i + 2])) >= 0) {
+			c = (char)(h << 4 | l);
+			i += 2;
+		} else if (c == '+' && form) {
+			c = ' ';
+		}
+		s[o++] = c;
+	}
+	return o;
+}
+
+static void decoded_is(const char* input, int form, const char* expected) {
+	char buf[256], what[300];
+	size_t len = strlen(input);
+	memcpy(buf, input, len);
+	len = uv_httpd_percent_decode(buf, len, form);
+	snprintf(what, sizeof(what), "%s decodes to `%s`%s", input, expected, form ? " as a form" : "");
+	check(len == strlen(expected) && 0 == memcmp(buf, expected, len), what);
+}
+
+
+/*************************** cases ****************/
+
+static void components(void) {
+	url_is("/", "/", "", "");
+	url_is("/a/b", "/a/b", "", "");
+	url_is("/a?x=1&y=2", "/a", "x=1&y=2", "");
+	url_is("/a?", "/a", "", "");
+	url_is("/a#top", "/a", "", "top");
+	url_is("/a?x=1#top", "/a", "x=1", "top");
+	url_is("/a#top?x=1", "/a", "", "top?x=1");
+	url_is("http://example.com/a?x=1", "/a", "x=1", "");
+	url_is("http://example.com", "", "", "");
+	url_is("http://example.com?x=1", "", "x=1", "");
+	url_is("*", "*", "", "");
+}
+
+static void query(void) {
+	static const char* expected[][2] = { { "a", "1" }, { "b", "" }, { "c", "" }, { "d", "x=y" }, { "%41", "%42" } };
+	uv_httpd_request_t req;
+	uv_httpd_url_t u;
+	uv_httpd_query_iter_t iter;
+	uv_httpd_string_t key, value;
+	char buf[256];
+	size_t n = 0;
+	int ok = 1;
+
+	make_request(&req, buf, sizeof(buf), "/q?a=1&&b=&c&d=x=y&%41=%42&#f");
+	uv_httpd_url_parse(&req, &u);
+	uv_httpd_query_init(&iter, &req, &u);
+	while (uv_httpd_query_next(&iter, &key, &value)) {
+		if (n >= sizeof(expected) / sizeof(expected[0])
+			|| !string_is(&req, &key, expected[n][0]) || !string_is(&req, &value, expected[n][1])) {
+			ok = 0;
+		}
+		n++;
+	}
+	check(ok && n == sizeof(expected) / sizeof(expected[0]), "pairs in order, empty ones skipped, not decoded");
+
+	check(uv_httpd_query_get(&req, &u, "d", &value) && string_is(&req, &value, "x=y"), "a value by its key");
+	check(!uv_httpd_query_get(&req, &u, "e", &value) && !uv_httpd_query_get(&req, &u, "A", &value),
+		  "a missing key, or one only found after decoding");
+
+	make_request(&req, buf, sizeof(buf), "/q?k=%E2%82%AC+1");
+	uv_httpd_url_parse(&req, &u);
+	uv_httpd_query_get(&req, &u, "k", &value);
+	uv_httpd_decode(&req, &value, 1);
+	check(string_is(&req, &value, "\xe2\x82\xac 1") && 0 == memcmp(buf, "GET /q?k=", 9),
+		  "a value decoded in place, the rest of the request kept");
+}
+
+static void decode(void) {
+	decoded_is("plain", 0, "plain");
+	decoded_is("a%20b", 0, "a b");
+	decoded_is("%2f%2F", 0, "//");
+	decoded_is("a+b", 0, "a+b");
+	decoded_is("a+b", 1, "a b");
+	decoded_is("%zz%4", 0, "%zz%4");
+	decoded_is("%", 0, "%");
+	decoded_is("abcdefg%41", 0, "abcdefgA");
+	decoded_is("abcdefgh%41bcdefgh", 0, "abcdefghAbcdefgh");
+}
+
+static void random_inputs(void) {
+	// hex digits and others, `%` and `+` often
+	static const char alphabet[] = "ab%+2fFz0%";
+	char input[64], expected[64], got[64];
+	size_t i, j, len, elen, glen, bad = 0;
+	int form;
+
+	for (i = 0; i < RANDOM_INPUTS; i++) {
+		len = next_random() % sizeof(input);
+		for (j = 0; j < len; j++) {
+			input[j] = alphabet[next_random() % (sizeof(alphabet) - 1)];
+		}
+		form = next_random() & 1;
+		memcpy(expected, input, len);
+		memcpy(got, input, len);
+		elen = byte_decode(expected, len, form);
+		glen = uv_httpd_percent_decode(got, len, form);
+		if (elen != glen || memcmp(expected, got, elen)) {
+			if (bad++ < 5) printf("     %.*s decodes differently\n", (int)len, input);
+		}
+	}
+	check(bad == 0, "random inputs decode as a byte loop does");
+}
+
+int main(int argc, char** argv) {
+	components();
+	query();
+	decode();
+	random_inputs();
+	return failures ? 1 : 0;
+}
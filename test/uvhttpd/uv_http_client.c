@@ -0,0 +1,839 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "uv_http_client.h"
+#include "uv_httpd_url.h"
+#include "mybuf.h"
+#include "uv_log.h"
+
+#define CLIENT_READ_BUFF_SIZE 65536
+#define CLIENT_TIMER_INTERVAL 100 // ms, granularity of timeouts
+#define HOST_NAME_SIZE 256
+#define HEADERS_DEFAULT_LENGTH 16
+
+typedef struct host_s host_t;
+
+typedef struct {
+	union {
+		uv_tcp_t tcp;
+		uv_pipe_t pipe; // host->pipe
+	}io;
+	uv_connect_t connect_req;
+	llhttp_t parser; // HTTP_RESPONSE
+	host_t* host;
+	QUEUE node; // in host->conns
+	QUEUE inflight; // requests sent, the head one is being answered
+	int ninflight;
+	int connected;
+	int reading;
+	int closing;
+	int error; // uv_tcp_connect failed, requests waiting fail once it is closed
+	int answered; // responses received, later requests reuse the connection
+	int informational; // 1xx response, the final one follows
+	int in_field;
+	mybuf_t pending; // written before connected
+	mybuf_t head; // header fields and values of the current response
+	uv_httpd_header_t* headers;
+	size_t nheaders, headers_cap;
+}conn_t;
+
+struct host_s {
+	QUEUE node; // in client->hosts
+	uv_http_client_t* client;
+	char name[HOST_NAME_SIZE]; // host[:port] as in the url, sent as Host
+	char host[HOST_NAME_SIZE]; // without [] of an ipv6 address, the decoded path of a unix socket
+	int port;
+	int pipe; // http+unix://, connected by uv_pipe_connect
+	struct sockaddr_storage addr;
+	int resolved;
+	int resolving;
+	uv_getaddrinfo_t gai;
+	int nconns; // connecting or connected
+	int connect_error; // nothing is sent until the failed connection is closed
+	QUEUE conns;
+	QUEUE waiting; // requests not sent yet, oldest first
+};
+
+struct uv_http_client_req_s {
+	QUEUE node; // in host->waiting or conn->inflight
+	uv_http_client_t* client;
+	host_t* host;
+	conn_t* conn; // NULL while waiting
+	llhttp_method_t method;
+	char* raw; // the whole request, kept for a retry
+	size_t raw_len;
+	uint64_t deadline;
+	int retried;
+	int responded; // response bytes received
+	int paused;
+	uv_http_client_on_headers_t on_headers;
+	uv_http_client_on_body_t on_body;
+	uv_http_client_on_done_t on_done;
+	void* data;
+};
+
+struct conn_write_req_t {
+	uv_write_t req;
+	uv_buf_t buf;
+};
+
+static void conn_close(conn_t* conn, int err);
+static void host_dispatch(host_t* host);
+static void on_conn_alloc(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf);
+static void on_conn_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf);
+
+
+/*************************** helper functions ****************/
+
+// safe to send again if the server may have handled it already
+static int is_idempotent(llhttp_method_t method) {
+	return method == HTTP_GET || method == HTTP_HEAD;
+}
+
+static uv_http_client_req_t* conn_current(conn_t* conn) {
+	if (conn->closing || QUEUE_EMPTY(&conn->inflight)) return NULL;
+	return QUEUE_DATA(QUEUE_HEAD(&conn->inflight), uv_http_client_req_t, node);
+}
+
+// request done, `on_done` may start or cancel others
+static void req_finish(uv_http_client_req_t* req, int status) {
+	uv_http_client_t* client = req->client;
+
+	QUEUE_REMOVE(&req->node);
+	if (req->conn) {
+		req->conn->ninflight--;
+		req->conn = NULL;
+	}
+	if (status) {
+		client->stats.failed++;
+	} else {
+		client->stats.requests++;
+	}
+	if (--client->pending == 0) {
+		uv_timer_stop(&client->timer);
+	}
+	if (req->on_done) {
+		req->on_done(req, status);
+	}
+	free(req->raw);
+	free(req);
+}
+
+// fail the requests waiting on `host`
+static void host_fail(host_t* host, int err) {
+	while (!QUEUE_EMPTY(&host->waiting)) {
+		req_finish(QUEUE_DATA(QUEUE_HEAD(&host->waiting), uv_http_client_req_t, node), err);
+	}
+}
+
+// `url` is http://host[:port][/path][?query][#fragment],
+// or http+unix://socket[/path]... with the percent-encoded path of the socket as host
+// return 0 for success, otherwise it is `uv_errno_t`
+static int parse_url(const char* url, char* name, char* host, int* port, int* pipe,
+					 const char** path, size_t* path_len) {
+	const char* p, *end, *colon = NULL;
+	size_t len;
+
+	*pipe = 0 == string0_nicmp("http+unix://", url, 12);
+	if (!*pipe && 0 != string0_nicmp("http://", url, 7)) {
+		return 0 == string0_nicmp("https://", url, 8) ? UV_ENOTSUP : UV_EINVAL;
+	}
+	p = url + (*pipe ? 12 : 7);
+	end = p + strcspn(p, "/?#");
+	len = (size_t)(end - p);
+	if (len == 0 || len >= HOST_NAME_SIZE || memchr(p, '@', len)) return UV_EINVAL;
+	memcpy(name, p, len);
+	name[len] = '\0';
+
+	if (*pipe) {
+		memcpy(host, p, len);
+		host[uv_httpd_percent_decode(host, len, 0)] = '\0';
+		*port = 0;
+		*path = end;
+		*path_len = strcspn(end, "#");
+		return 0;
+	}
+
+	if (*p == '[') {
+		const char* rb = memchr(p, ']', len);
+		if (!rb || rb == p + 1) return UV_EINVAL;
+		memcpy(host, p + 1, rb - p - 1);
+		host[rb - p - 1] = '\0';
+		if (rb + 1 < end) {
+			if (rb[1] != ':') return UV_EINVAL;
+			colon = rb + 1;
+		}
+	} else {
+		colon = memchr(p, ':', len);
+		len = colon ? (size_t)(colon - p) : len;
+		if (len == 0) return UV_EINVAL;
+		memcpy(host, p, len);
+		host[len] = '\0';
+	}
+
+	*port = 80;
+	if (colon) {
+		*port = 0;
+		for (p = colon + 1; p < end; p++) {
+			if (*p < '0' || *p > '9' || *port > 65535) return UV_EINVAL;
+			*port = *port * 10 + (*p - '0');
+		}
+		if (*port == 0 || *port > 65535) return UV_EINVAL;
+	}
+
+	*path = end;
+	*path_len = strcspn(end, "#");
+	return 0;
+}
+
+
+/*************************** connection ****************/
+
+static void on_conn_closed(uv_handle_t* handle) {
+	conn_t* conn = (conn_t*)handle;
+	if (conn->error) {
+		conn->host->connect_error = 0;
+		host_fail(conn->host, conn->error);
+	}
+	mybuf_clear(&conn->pending);
+	mybuf_clear(&conn->head);
+	free(conn->headers);
+	free(conn);
+}
+
+// requests without any response byte are sent again on another connection if
+// they are idempotent or were never sent, others fail with `err`.
+// a server may close a kept-alive connection any time, those pipelined are lost
+static void conn_close(conn_t* conn, int err) {
+	host_t* host = conn->host;
+	uv_http_client_t* client = host->client;
+	QUEUE failed;
+
+	if (conn->closing) return;
+	conn->closing = 1;
+	host->nconns--;
+	QUEUE_REMOVE(&conn->node);
+	uv_close((uv_handle_t*)&conn->io, on_conn_closed);
+
+	// back to the front of the waiting ones, in order
+	QUEUE_INIT(&failed);
+	while (!QUEUE_EMPTY(&conn->inflight)) {
+		QUEUE* q = QUEUE_PREV(&conn->inflight);
+		uv_http_client_req_t* req = QUEUE_DATA(q, uv_http_client_req_t, node);
+		QUEUE_REMOVE(q);
+		req->conn = NULL;
+		conn->ninflight--;
+		if (!client->closing && !req->responded && (!req->retried || conn->answered)
+			&& (is_idempotent(req->method) || !conn->connected)) {
+			// once if the connection never answered, it may be the request itself
+			req->retried = 1;
+			client->stats.retried++;
+			QUEUE_INSERT_HEAD(&host->waiting, q);
+		} else {
+			QUEUE_INSERT_HEAD(&failed, q);
+		}
+	}
+	while (!QUEUE_EMPTY(&failed)) {
+		req_finish(QUEUE_DATA(QUEUE_HEAD(&failed), uv_http_client_req_t, node), err);
+	}
+	host_dispatch(host);
+}
+
+// idle connections don't keep the loop alive, and a paused request stops reading
+static void conn_update(conn_t* conn) {
+	uv_http_client_req_t* req = conn_current(conn);
+
+	if (conn->closing) return;
+	if (req) {
+		uv_ref((uv_handle_t*)&conn->io);
+	} else {
+		uv_unref((uv_handle_t*)&conn->io);
+	}
+	if (!conn->connected) return;
+	if (req && req->paused) {
+		if (conn->reading) uv_read_stop((uv_stream_t*)&conn->io);
+		conn->reading = 0;
+	} else if (!conn->reading) {
+		uv_read_start((uv_stream_t*)&conn->io, on_conn_alloc, on_conn_read);
+		conn->reading = 1;
+	}
+}
+
+static void on_conn_write(uv_write_t* req, int status) {
+	struct conn_write_req_t* wr = req->data;
+	conn_t* conn = (conn_t*)req->handle;
+	free(wr->buf.base);
+	free(wr);
+	if (status && status != UV_ECANCELED) {
+		conn_close(conn, status);
+	}
+}
+
+// write to the server, queued until connected
+static void conn_write(conn_t* conn, const char* data, size_t len) {
+	struct conn_write_req_t* wr;
+	int r;
+
+	if (!conn->connected) {
+		mybuf_append(&conn->pending, data, len);
+		return;
+	}
+
+	wr = malloc(sizeof(*wr));
+	fatal_if_null(wr);
+	wr->buf.base = malloc(len);
+	fatal_if_null(wr->buf.base);
+	memcpy(wr->buf.base, data, len);
+#ifdef _WIN32
+	wr->buf.len = (ULONG)len;
+#else
+	wr->buf.len = len;
+#endif
+	wr->req.data = wr;
+	r = uv_write(&wr->req, (uv_stream_t*)&conn->io, &wr->buf, 1, on_conn_write);
+	if (r) {
+		free(wr->buf.base);
+		free(wr);
+		conn_close(conn, r);
+	}
+}
+
+static void conn_send(conn_t* conn, uv_http_client_req_t* req) {
+	uv_http_client_t* client = conn->host->client;
+
+	if (conn->answered) client->stats.reused++;
+	if (conn->ninflight) client->stats.pipelined++;
+	req->conn = conn;
+	QUEUE_INSERT_TAIL(&conn->inflight, &req->node);
+	conn->ninflight++;
+	conn_update(conn);
+	conn_write(conn, req->raw, req->raw_len);
+}
+
+static void on_conn_connected(uv_connect_t* req, int status) {
+	conn_t* conn = req->data;
+
+	if (status) {
+		if (status != UV_ECANCELED) conn_close(conn, status);
+		return;
+	}
+	conn->connected = 1;
+	conn_update(conn);
+	if (conn->pending.size) {
+		conn_write(conn, conn->pending.buf, conn->pending.size);
+		mybuf_clear(&conn->pending);
+	}
+}
+
+// return 0 for success, otherwise it is `uv_errno_t`
+static int conn_new(host_t* host, conn_t** out) {
+	uv_http_client_t* client = host->client;
+	conn_t* conn = calloc(1, sizeof(*conn));
+	int r;
+
+	if (!conn) return UV_ENOMEM;
+	conn->host = host;
+	QUEUE_INIT(&conn->inflight);
+	mybuf_init(&conn->pending);
+	mybuf_init(&conn->head);
+	if (host->pipe) {
+		uv_pipe_init(client->loop, &conn->io.pipe, 0);
+	} else {
+		uv_tcp_init(client->loop, &conn->io.tcp);
+		uv_tcp_nodelay(&conn->io.tcp, 1);
+	}
+	conn->io.tcp.data = client;
+	llhttp_init(&conn->parser, HTTP_RESPONSE, &client->settings);
+	conn->parser.data = conn;
+	conn->connect_req.data = conn;
+	QUEUE_INSERT_TAIL(&host->conns, &conn->node);
+	host->nconns++;
+	client->stats.connections++;
+	if (host->pipe) {
+		// errors come to `on_conn_connected`
+		uv_pipe_connect(&conn->connect_req, &conn->io.pipe, host->host, on_conn_connected);
+		r = 0;
+	} else {
+		r = uv_tcp_connect(&conn->connect_req, &conn->io.tcp, (const struct sockaddr*)&host->addr, on_conn_connected);
+	}
+	if (r) {
+		// fail the waiting requests once closed, not in `uv_http_client_request`
+		warn_on_uv_err(r, "uv_tcp_connect");
+		conn->error = r;
+		conn->closing = 1;
+		host->nconns--;
+		host->connect_error = 1;
+		QUEUE_REMOVE(&conn->node);
+		uv_close((uv_handle_t*)&conn->io, on_conn_closed);
+		return r;
+	}
+	*out = conn;
+	return 0;
+}
+
+// an idle connection, a new one, or the least busy one to pipeline on
+static conn_t* host_pick_conn(host_t* host, uv_http_client_req_t* req) {
+	uv_http_client_t* client = host->client;
+	conn_t* best = NULL;
+	QUEUE* q;
+
+	QUEUE_FOREACH(q, &host->conns) {
+		conn_t* conn = QUEUE_DATA(q, conn_t, node);
+		if (conn->ninflight == 0) return conn;
+		if (!best || conn->ninflight < best->ninflight) best = conn;
+	}
+	if (host->nconns < client->max_connections) {
+		return conn_new(host, &best) ? NULL : best;
+	}
+	if (best && best->ninflight < client->pipeline && is_idempotent(req->method)) {
+		return best;
+	}
+	return NULL;
+}
+
+static void host_dispatch(host_t* host) {
+	uv_http_client_t* client = host->client;
+
+	while (host->resolved && !host->connect_error && !client->closing && !QUEUE_EMPTY(&host->waiting)) {
+		uv_http_client_req_t* req = QUEUE_DATA(QUEUE_HEAD(&host->waiting), uv_http_client_req_t, node);
+		conn_t* conn = host_pick_conn(host, req);
+		if (!conn) break;
+		QUEUE_REMOVE(&req->node);
+		conn_send(conn, req);
+	}
+}
+
+static void on_resolved(uv_getaddrinfo_t* gai, int status, struct addrinfo* res) {
+	host_t* host = gai->data;
+
+	host->resolving = 0;
+	if (status) {
+		uvlog_warn("resolve %s: %s", host->host, uv_err_name(status));
+		host_fail(host, status == UV_EAI_CANCELED ? UV_ECANCELED : status);
+		return;
+	}
+	memcpy(&host->addr, res->ai_addr, res->ai_addrlen);
+	uv_freeaddrinfo(res);
+	host->resolved = 1;
+	host_dispatch(host);
+}
+
+static int host_resolve(host_t* host) {
+	struct addrinfo hints;
+	char port[8];
+	int r;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+	snprintf(port, sizeof(port), "%d", host->port);
+	host->gai.data = host;
+	r = uv_getaddrinfo(host->client->loop, &host->gai, on_resolved, host->host, port, &hints);
+	if (r == 0) host->resolving = 1;
+	return r;
+}
+
+static host_t* get_host(uv_http_client_t* client, const char* name, const char* hostname, int port, int pipe) {
+	host_t* host;
+	QUEUE* q;
+
+	QUEUE_FOREACH(q, &client->hosts) {
+		host = QUEUE_DATA(q, host_t, node);
+		if (0 == strcmp(host->name, name)) return host;
+	}
+
+	host = calloc(1, sizeof(*host));
+	if (!host) return NULL;
+	host->client = client;
+	strcpy(host->name, name);
+	strcpy(host->host, hostname);
+	host->port = port;
+	host->pipe = pipe;
+	// ip addresses and unix sockets are not resolved
+	if (pipe || 0 == uv_ip4_addr(hostname, port, (struct sockaddr_in*)&host->addr)
+		|| 0 == uv_ip6_addr(hostname, port, (struct sockaddr_in6*)&host->addr)) {
+		host->resolved = 1;
+	}
+	QUEUE_INIT(&host->conns);
+	QUEUE_INIT(&host->waiting);
+	QUEUE_INSERT_TAIL(&client->hosts, &host->node);
+	return host;
+}
+
+static void on_timer(uv_timer_t* timer) {
+	uv_http_client_t* client = timer->data;
+	uint64_t now = uv_now(client->loop);
+	QUEUE* hq, *cq, *rq;
+	QUEUE expired;
+
+	// `on_done` may change the queues, collect first
+	QUEUE_INIT(&expired);
+	QUEUE_FOREACH(hq, &client->hosts) {
+		host_t* host = QUEUE_DATA(hq, host_t, node);
+		rq = QUEUE_HEAD(&host->waiting);
+		while (rq != &host->waiting) {
+			uv_http_client_req_t* req = QUEUE_DATA(rq, uv_http_client_req_t, node);
+			rq = QUEUE_NEXT(rq);
+			if (req->deadline <= now) {
+				QUEUE_REMOVE(&req->node);
+				QUEUE_INSERT_TAIL(&expired, &req->node);
+			}
+		}
+	}
+
+again:
+	QUEUE_FOREACH(hq, &client->hosts) {
+		host_t* host = QUEUE_DATA(hq, host_t, node);
+		QUEUE_FOREACH(cq, &host->conns) {
+			conn_t* conn = QUEUE_DATA(cq, conn_t, node);
+			int n = 0;
+			rq = QUEUE_HEAD(&conn->inflight);
+			while (rq != &conn->inflight) {
+				uv_http_client_req_t* req = QUEUE_DATA(rq, uv_http_client_req_t, node);
+				rq = QUEUE_NEXT(rq);
+				if (req->deadline <= now) {
+					QUEUE_REMOVE(&req->node);
+					QUEUE_INSERT_TAIL(&expired, &req->node);
+					conn->ninflight--;
+					req->conn = NULL;
+					n++;
+				}
+			}
+			if (n) {
+				// the responses before and after are lost with it
+				conn_close(conn, UV_ECONNABORTED);
+				goto again;
+			}
+		}
+	}
+
+	while (!QUEUE_EMPTY(&expired)) {
+		req_finish(QUEUE_DATA(QUEUE_HEAD(&expired), uv_http_client_req_t, node), UV_ETIMEDOUT);
+	}
+}
+
+
+/*************************** response ****************/
+
+static int on_response_begin(llhttp_t* parser) {
+	conn_t* conn = parser->data;
+	uv_http_client_req_t* req = conn_current(conn);
+
+	// nothing was asked
+	if (!req) return -1;
+	req->responded = 1;
+	conn->head.size = 0;
+	conn->nheaders = 0;
+	conn->in_field = 0;
+	return 0;
+}
+
+static int on_response_header_field(llhttp_t* parser, const char* at, size_t length) {
+	conn_t* conn = parser->data;
+	if (conn->head.size + length > UV_HTTP_CLIENT_MAX_HEADERS) return -1;
+	if (!conn->in_field) {
+		if (conn->nheaders == conn->headers_cap) {
+			size_t cap = conn->headers_cap ? conn->headers_cap * 2 : HEADERS_DEFAULT_LENGTH;
+			uv_httpd_header_t* headers = realloc(conn->headers, cap * sizeof(uv_httpd_header_t));
+			fatal_if_null(headers);
+			conn->headers = headers;
+			conn->headers_cap = cap;
+		}
+		conn->headers[conn->nheaders].key.offset = conn->head.size;
+		conn->headers[conn->nheaders].key.len = 0;
+		conn->in_field = 1;
+	}
+	conn->headers[conn->nheaders].key.len += length;
+	mybuf_append(&conn->head, at, length);
+	return 0;
+}
+
+static int on_response_header_field_complete(llhttp_t* parser) {
+	conn_t* conn = parser->data;
+	conn->in_field = 0;
+	// value may be empty, on_header_value won't be called then
+	conn->headers[conn->nheaders].value.offset = conn->head.size;
+	conn->headers[conn->nheaders].value.len = 0;
+	return 0;
+}
+
+static int on_response_header_value(llhttp_t* parser, const char* at, size_t length) {
+	conn_t* conn = parser->data;
+	if (conn->head.size + length > UV_HTTP_CLIENT_MAX_HEADERS) return -1;
+	conn->headers[conn->nheaders].value.len += length;
+	mybuf_append(&conn->head, at, length);
+	return 0;
+}
+
+static int on_response_header_value_complete(llhttp_t* parser) {
+	conn_t* conn = parser->data;
+	conn->nheaders++;
+	return 0;
+}
+
+static int on_response_headers_complete(llhttp_t* parser) {
+	conn_t* conn = parser->data;
+	uv_http_client_req_t* req = conn_current(conn);
+	uv_http_client_res_t res;
+
+	if (!req) return -1;
+	// 100 Continue and the like, 101 is not supported and ends the connection
+	if (parser->status_code >= 100 && parser->status_code < 200 && parser->status_code != 101) {
+		conn->informational = 1;
+		return 0;
+	}
+	if (req->on_headers) {
+		res.status = parser->status_code;
+		res.http_major = parser->http_major;
+		res.http_minor = parser->http_minor;
+		res.base = conn->head.buf;
+		res.headers.n = conn->nheaders;
+		res.headers.headers = conn->headers;
+		res.has_content_length = (parser->flags & F_CONTENT_LENGTH) != 0;
+		res.content_length = res.has_content_length ? parser->content_length : 0;
+		if (req->on_headers(req, &res)) {
+			req_finish(req, UV_ECANCELED);
+			conn_close(conn, UV_ECONNABORTED);
+			return -1;
+		}
+		if (conn->closing) return -1;
+	}
+
+	// response to HEAD has no body
+	return req->method == HTTP_HEAD ? 1 : 0;
+}
+
+static int on_response_body(llhttp_t* parser, const char* at, size_t length) {
+	conn_t* conn = parser->data;
+	uv_http_client_req_t* req = conn_current(conn);
+
+	if (!req) return -1;
+	if (req->on_body) {
+		req->on_body(req, at, length);
+		// canceled, or the client closed
+		if (conn->closing) return -1;
+	}
+	return 0;
+}
+
+static int on_response_complete(llhttp_t* parser) {
+	conn_t* conn = parser->data;
+	uv_http_client_req_t* req = conn_current(conn);
+	int keep_alive = llhttp_should_keep_alive(parser);
+
+	if (!req) return -1;
+	if (conn->informational) {
+		conn->informational = 0;
+		return 0;
+	}
+	conn->answered++;
+	req_finish(req, 0);
+	if (conn->closing) return -1;
+	if (!keep_alive) {
+		// those pipelined after are sent again
+		conn_close(conn, UV_ECONNRESET);
+		return -1;
+	}
+	conn_update(conn);
+	host_dispatch(conn->host);
+	return conn->closing ? -1 : 0;
+}
+
+static void setup_response_settings(llhttp_settings_t* settings) {
+	llhttp_settings_init(settings);
+	settings->on_message_begin = on_response_begin;
+	settings->on_header_field = on_response_header_field;
+	settings->on_header_field_complete = on_response_header_field_complete;
+	settings->on_header_value = on_response_header_value;
+	settings->on_header_value_complete = on_response_header_value_complete;
+	settings->on_headers_complete = on_response_headers_complete;
+	settings->on_body = on_response_body;
+	settings->on_message_complete = on_response_complete;
+}
+
+static void on_conn_alloc(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
+	uv_http_client_t* client = handle->data;
+	buf->base = client->rbuf;
+	buf->len = CLIENT_READ_BUFF_SIZE;
+}
+
+static void on_conn_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
+	conn_t* conn = (conn_t*)stream;
+	enum llhttp_errno r;
+
+	if (nread == 0) return;
+	if (nread < 0) {
+		// response without length ends at EOF
+		if (nread == UV_EOF && !QUEUE_EMPTY(&conn->inflight)) {
+			llhttp_finish(&conn->parser);
+			if (conn->closing) return;
+		}
+		conn_close(conn, nread == UV_EOF ? UV_ECONNRESET : (int)nread);
+		return;
+	}
+
+	if (QUEUE_EMPTY(&conn->inflight)) {
+		// nothing expected on an idle connection
+		conn_close(conn, 0);
+		return;
+	}
+
+	r = llhttp_execute(&conn->parser, buf->base, (size_t)nread);
+	if (conn->closing) return;
+	if (r != HPE_OK) {
+		uvlog_warn("http client %s parse error: %s %s", conn->host->name,
+				   llhttp_errno_name(r), conn->parser.reason);
+		conn_close(conn, UV_EPROTO);
+	}
+}
+
+
+/*************************** public functions ****************/
+
+int uv_http_client_create(uv_http_client_t** client, uv_loop_t* loop) {
+	uv_http_client_t* c = calloc(1, sizeof(*c));
+	if (!c) return UV_ENOMEM;
+	c->rbuf = malloc(CLIENT_READ_BUFF_SIZE);
+	if (!c->rbuf) {
+		free(c);
+		return UV_ENOMEM;
+	}
+	c->loop = loop;
+	c->max_connections = UV_HTTP_CLIENT_MAX_CONNECTIONS;
+	c->pipeline = UV_HTTP_CLIENT_PIPELINE;
+	c->timeout = UV_HTTP_CLIENT_TIMEOUT;
+	setup_response_settings(&c->settings);
+	QUEUE_INIT(&c->hosts);
+	uv_timer_init(loop, &c->timer);
+	c->timer.data = c;
+	*client = c;
+	return 0;
+}
+
+void uv_http_client_close(uv_http_client_t* client) {
+	QUEUE* q;
+
+	if (client->closing) return;
+	client->closing = 1;
+	uv_timer_stop(&client->timer);
+	uv_close((uv_handle_t*)&client->timer, NULL);
+	QUEUE_FOREACH(q, &client->hosts) {
+		host_t* host = QUEUE_DATA(q, host_t, node);
+		if (host->resolving) {
+			uv_cancel((uv_req_t*)&host->gai);
+		}
+		while (!QUEUE_EMPTY(&host->conns)) {
+			conn_close(QUEUE_DATA(QUEUE_HEAD(&host->conns), conn_t, node), UV_ECANCELED);
+		}
+		host_fail(host, UV_ECANCELED);
+	}
+}
+
+void uv_http_client_free(uv_http_client_t* client) {
+	while (!QUEUE_EMPTY(&client->hosts)) {
+		QUEUE* q = QUEUE_HEAD(&client->hosts);
+		QUEUE_REMOVE(q);
+		free(QUEUE_DATA(q, host_t, node));
+	}
+	free(client->rbuf);
+	free(client);
+}
+
+int uv_http_client_request(uv_http_client_t* client, const uv_http_client_options_t* opts, uv_http_client_req_t** req) {
+	char name[HOST_NAME_SIZE], hostname[HOST_NAME_SIZE];
+	const char* path;
+	size_t path_len;
+	int port, pipe, r;
+	host_t* host;
+	uv_http_client_req_t* rq;
+	mybuf_t buf;
+
+	if (client->closing) return UV_ECANCELED;
+	r = parse_url(opts->url, name, hostname, &port, &pipe, &path, &path_len);
+	if (r) return r;
+	host = get_host(client, name, hostname, port, pipe);
+	if (!host) return UV_ENOMEM;
+	rq = calloc(1, sizeof(*rq));
+	if (!rq) return UV_ENOMEM;
+
+	mybuf_init(&buf);
+	mybuf_cat_printf(&buf, "%s %s%.*s HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\n",
+					 llhttp_method_name(opts->method), (path_len == 0 || path[0] == '?') ? "/" : "",
+					 (int)path_len, path, host->pipe ? "localhost" : host->name);
+	if (opts->body_len || opts->method == HTTP_POST || opts->method == HTTP_PUT || opts->method == HTTP_PATCH) {
+		mybuf_cat_printf(&buf, "Content-Length: %zu\r\n", opts->body_len);
+	}
+	if (opts->headers) {
+		mybuf_append(&buf, opts->headers, strlen(opts->headers));
+	}
+	mybuf_append(&buf, "\r\n", 2);
+	if (opts->body_len) {
+		mybuf_append(&buf, opts->body, opts->body_len);
+	}
+	rq->raw = malloc(buf.size);
+	if (!rq->raw) {
+		mybuf_clear(&buf);
+		free(rq);
+		return UV_ENOMEM;
+	}
+	memcpy(rq->raw, buf.buf, buf.size);
+	rq->raw_len = buf.size;
+	mybuf_clear(&buf);
+
+	rq->client = client;
+	rq->host = host;
+	rq->method = opts->method;
+	rq->deadline = uv_now(client->loop) + (opts->timeout ? opts->timeout : client->timeout);
+	rq->on_headers = opts->on_headers;
+	rq->on_body = opts->on_body;
+	rq->on_done = opts->on_done;
+	rq->data = opts->data;
+
+	if (!host->resolved && !host->resolving) {
+		r = host_resolve(host);
+		if (r) {
+			free(rq->raw);
+			free(rq);
+			return r;
+		}
+	}
+	QUEUE_INSERT_TAIL(&host->waiting, &rq->node);
+	if (client->pending++ == 0) {
+		uv_timer_start(&client->timer, on_timer, CLIENT_TIMER_INTERVAL, CLIENT_TIMER_INTERVAL);
+	}
+	if (req) *req = rq;
+	host_dispatch(host);
+	return 0;
+}
+
+void uv_http_client_cancel(uv_http_client_req_t* req) {
+	conn_t* conn = req->conn;
+	req_finish(req, UV_ECANCELED);
+	// its response can't be skipped
+	if (conn) conn_close(conn, UV_ECONNABORTED);
+}
+
+void uv_http_client_read_stop(uv_http_client_req_t* req) {
+	req->paused = 1;
+	if (req->conn) conn_update(req->conn);
+}
+
+void uv_http_client_read_start(uv_http_client_req_t* req) {
+	req->paused = 0;
+	if (req->conn) conn_update(req->conn);
+}
+
+void* uv_http_client_req_data(uv_http_client_req_t* req) {
+	return req->data;
+}
+
+const uv_httpd_string_t* uv_http_client_header(const uv_http_client_res_t* res, const char* key) {
+	for (size_t i = 0; i < res->headers.n; i++) {
+		const uv_httpd_header_t* header = &res->headers.headers[i];
+		if (0 == string0_nicmp(key, res->base + header->key.offset, header->key.len)) {
+			return &header->value;
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,112 @@
+#ifndef __UV_HTTP_CLIENT_H__
+#define __UV_HTTP_CLIENT_H__
+
+#pragma once
+
+#include "uv_httpd.h"
+
+// HTTP/1.1 client on a loop, with the llhttp parser and `mybuf_t` of uv_httpd.
+// connections are kept alive and pooled per host. a host has at most `max_connections`,
+// when all are busy GET and HEAD requests are pipelined up to `pipeline` deep, others wait.
+// response bodies are streamed by `on_body`, nothing is buffered as a whole.
+// a GET or HEAD failing before any byte of its response, e.g. on a connection closed
+// by the server while idle, is retried once on another connection.
+// only `http://` urls, a host name is resolved once by uv_getaddrinfo.
+// `http+unix://` urls reach a server on a unix socket (named pipe on windows), its path
+// percent-encoded as the host, e.g. http+unix://%2Ftmp%2Fuvhttpd.sock/api/stats
+
+#ifndef UV_HTTP_CLIENT_MAX_CONNECTIONS
+#define UV_HTTP_CLIENT_MAX_CONNECTIONS 6 // per host
+#endif
+
+#ifndef UV_HTTP_CLIENT_PIPELINE
+#define UV_HTTP_CLIENT_PIPELINE 1 // requests in flight per connection, 1 for no pipelining
+#endif
+
+#ifndef UV_HTTP_CLIENT_TIMEOUT
+#define UV_HTTP_CLIENT_TIMEOUT 30000 // ms, from the request to the end of its response
+#endif
+
+#ifndef UV_HTTP_CLIENT_MAX_HEADERS
+#define UV_HTTP_CLIENT_MAX_HEADERS (64 * 1024) // bytes of response header fields and values
+#endif
+
+typedef struct uv_http_client_s uv_http_client_t;
+typedef struct uv_http_client_req_s uv_http_client_req_t;
+
+typedef struct {
+	int status;
+	int http_major, http_minor;
+	const char* base; // base address for offset/len, only valid in `on_headers`
+	uv_httpd_headers_t headers;
+	int has_content_length;
+	uint64_t content_length;
+}uv_http_client_res_t;
+
+// status line and headers of the response.
+// return 0 to continue, otherwise the request is aborted with UV_ECANCELED
+typedef int(*uv_http_client_on_headers_t)(uv_http_client_req_t* req, const uv_http_client_res_t* res);
+// a piece of the response body
+typedef void(*uv_http_client_on_body_t)(uv_http_client_req_t* req, const char* at, size_t len);
+// status is 0 if the whole response is received, otherwise it is `uv_errno_t`,
+// e.g. UV_ETIMEDOUT. the request is freed after it returns
+typedef void(*uv_http_client_on_done_t)(uv_http_client_req_t* req, int status);
+
+typedef struct {
+	llhttp_method_t method;
+	const char* url; // http://host[:port][/path][?query], host may be [ipv6], or http+unix://
+	const char* headers; // optional, extra header lines, each ends with CRLF
+	const char* body; // optional, copied
+	size_t body_len;
+	uint64_t timeout; // ms, 0 for `client->timeout`
+	uv_http_client_on_headers_t on_headers; // optional
+	uv_http_client_on_body_t on_body; // optional
+	uv_http_client_on_done_t on_done; // optional
+	void* data;
+}uv_http_client_options_t;
+
+typedef struct {
+	uint64_t requests; // completed
+	uint64_t failed;
+	uint64_t retried;
+	uint64_t connections; // opened
+	uint64_t reused; // requests sent on a connection that answered before
+	uint64_t pipelined; // requests sent while others were in flight on the connection
+}uv_http_client_stats_t;
+
+// return 0 for success, otherwise it is `uv_errno_t`
+int uv_http_client_create(uv_http_client_t** client, uv_loop_t* loop);
+// cancel requests, close connections. free the client after the loop ends
+void uv_http_client_close(uv_http_client_t* client);
+void uv_http_client_free(uv_http_client_t* client);
+
+// `req` may be NULL. `on_done` is not called before it returns.
+// return 0 for success, otherwise it is `uv_errno_t`, e.g. UV_EINVAL for a bad url
+int uv_http_client_request(uv_http_client_t* client, const uv_http_client_options_t* opts, uv_http_client_req_t** req);
+// `on_done` gets UV_ECANCELED, a connection answering it is closed
+void uv_http_client_cancel(uv_http_client_req_t* req);
+// flow control of the response body, the connection stops reading.
+// the rest of a read already done is still delivered
+void uv_http_client_read_stop(uv_http_client_req_t* req);
+void uv_http_client_read_start(uv_http_client_req_t* req);
+void* uv_http_client_req_data(uv_http_client_req_t* req);
+// find header by case insensitive `key`, return NULL if not found
+const uv_httpd_string_t* uv_http_client_header(const uv_http_client_res_t* res, const char* key);
+
+
+struct uv_http_client_s {
+	uv_loop_t* loop;
+	int max_connections; // per host, default UV_HTTP_CLIENT_MAX_CONNECTIONS
+	int pipeline; // default UV_HTTP_CLIENT_PIPELINE
+	uint64_t timeout; // ms, default UV_HTTP_CLIENT_TIMEOUT
+	uv_http_client_stats_t stats;
+	llhttp_settings_t settings; // of response parsers
+	QUEUE hosts;
+	uv_timer_t timer; // checks timeouts while requests are pending
+	size_t pending; // requests not done
+	int closing;
+	char* rbuf; // shared by all connection reads
+	void* data;
+};
+
+#endif
@@ -1,40 +1,107 @@
 #include <assert.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
 #include "uv_httpd.h"
+#include "uv_httpd_ratelimit.h"
+#include "uv_httpd_h2.h"
+#include "uv_httpd_gzip.h"
+#include "uv_httpd_watchdog.h"
+#include "uv_httpd_tls.h"
+#include "uv_httpd_accesslog.h"
+#include "uv_httpd_trace.h"
+#include "uv_httpd_mem.h"
 #include "mybuf.h"
 #include "uv_log.h"
 
-static int enable_print = 0;
-
-#define dprintf if (enable_print) printf
-#define dnprintf if (enable_print) nprintf
-#define print_func dprintf("%s\n", __FUNCTION__);
-
-
 #define HEADERS_DEFAULT_LENGTH 16
 #define DEFAULT_BUFF_SIZE 1024
 
 
 struct uv_httpd_client_s {
-	uv_tcp_t tcp;
+	// `pipe` if accepted on `server->pipe`. both are streams, so the stream
+	// functions take either by `tcp`
+	union {
+		uv_tcp_t tcp;
+		uv_pipe_t pipe;
+	};
 	uv_httpd_server_t* server;
 	llhttp_t parser;
 	on_request_t on_request;
 	uv_httpd_request_t req;
 	uv_httpd_header_t headers[HEADERS_DEFAULT_LENGTH];
+	QUEUE node; // in server->clients
+	int pending_writes;
+	int in_message; // between on_message_begin and on_message_complete
+	uint64_t last_active; // loop time of last read
+	int close_when_flushed; // close after pending writes done
+	int closing;
+	int in_field, in_value; // header spans may be split across reads
+	int deferred; // see uv_httpd_defer_response
+	int waiting; // parser paused until the deferred response done
+	int reading;
+	int read_paused; // by uv_httpd_read_stop
+	on_body_t on_body; // see uv_httpd_stream_body
+	on_abort_t on_abort;
+	on_flushed_t on_flushed;
+	void* data;
+	struct sockaddr_storage peer; // ss_family is AF_UNIX for a unix domain socket
+	uv_httpd_addr_key_t addr_key;
+	char ip[46]; // text of `peer`, "" until `uv_httpd_client_ip`
+	int limited; // rejected by rate limit, answer 429
+	int prepaid; // the token taken on accept pays for the first request
+	int started; // a message has begun on the connection
+	uv_httpd_h2_t* h2; // HTTP/2 session of the connection or of the stream
+	uv_httpd_h2_stream_t* stream; // NULL for a connection, `tcp` is not used otherwise
+	uv_httpd_gzip_filter_t* gzip; // compression of the response to the current request
+	int gzip_decided; // `gzip` is created or not needed for the current request
+	uv_httpd_mem_t* mem; // in-memory connection, `tcp` is not connected
+	uv_httpd_tls_conn_t* tls; // NULL unless accepted on `server->tcp` of a TLS server
+	int head_written; // the final response of the current request has begun, see write_response
+	uint64_t log_start; // loop time of the first byte of the request
+	uint64_t log_bytes; // of the response written
+	int log_status; // of the response, 0 until its head is written
+	// buffers last, a stream client does not zero them, see uv_httpd_h2_on_stream_open
 	mybuf_t buf;
 	mybuf_t pkt;
 };
 
+struct uv_httpd_mem_s {
+	uv_httpd_client_t* client; // NULL if closed
+	mybuf_t output;
+};
+
 struct write_req_t {
 	uv_write_t req;
 	uv_buf_t buf;
 };
 
+#define CONNECTION_CLOSE "Connection: close\r\n"
+#define TOO_MANY_REQUESTS \
+  "HTTP/1.1 429 Too Many Requests\r\n" \
+  "Content-Type: text/plain\r\n" \
+  "Content-Length: 18\r\n" \
+  "Retry-After: 1\r\n" \
+  "\r\n" \
+  "too many requests\n"
+#define CONTINUE "HTTP/1.1 100 Continue\r\n\r\n"
+#define SWITCHING_TO_H2C \
+  "HTTP/1.1 101 Switching Protocols\r\n" \
+  "Connection: Upgrade\r\n" \
+  "Upgrade: h2c\r\n" \
+  "\r\n"
+#define DRAIN_CHECK_INTERVAL 100 // ms
+#define DRAIN_IDLE_GRACE 1000 // ms, keep-alive connections idle longer are closed while draining
+
 static void on_close(uv_handle_t* peer);
+static void on_alloc(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf);
+static void on_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf);
+static int write_response(uv_httpd_client_t* client, const char* response, size_t len, int close);
+static int write_bufs(uv_httpd_client_t* client, const uv_buf_t* bufs, unsigned int nbufs);
+static int upgrade_h2c(uv_httpd_client_t* client);
+static void gzip_request(uv_httpd_client_t* client);
 
 
 /*************************** helper functions ****************/
@@ -43,7 +110,7 @@ static void reset_request(uv_httpd_client_t* client) {
 	if (client->req.headers.headers != client->headers) {
 		free(client->req.headers.headers);
 	}
-	memset((char*)&client->req + sizeof(client->req.ip), 0, sizeof(uv_httpd_request_t) - sizeof(client->req.ip));
+	memset(&client->req, 0, sizeof(client->req));
 	client->req.headers.headers = client->headers;
 }
 
@@ -60,12 +127,150 @@ static void headers_append_key(uv_httpd_client_t* client, size_t offset, size_t
 	}
 	client->req.headers.headers[client->req.headers.n].key.offset = offset;
 	client->req.headers.headers[client->req.headers.n].key.len = len;
+	// value may be empty, on_header_value won't be called then
+	client->req.headers.headers[client->req.headers.n].value.offset = offset + len;
+	client->req.headers.headers[client->req.headers.n].value.len = 0;
 }
 
 static void headers_append_value(uv_httpd_client_t* client, size_t offset, size_t len) {
 	client->req.headers.headers[client->req.headers.n].value.offset = offset;
 	client->req.headers.headers[client->req.headers.n].value.len = len;
-	client->req.headers.n++;
+}
+
+// `str` is empty or ends at pkt's end, append `len` bytes to it
+static void string_extend(uv_httpd_string_t* str, size_t offset, size_t len) {
+	if (str->len == 0) {
+		str->offset = offset;
+	}
+	str->len += len;
+}
+
+static int compressing(uv_httpd_client_t* client) {
+	return client->gzip && uv_httpd_gzip_filter_busy(client->gzip);
+}
+
+// close now if `force` or nothing left to write, otherwise after pending writes done
+static void close_client(uv_httpd_client_t* client, int force) {
+	if (client->closing) return;
+	if (!force && (client->pending_writes > 0 || compressing(client))) {
+		client->close_when_flushed = 1;
+		return;
+	}
+	if (!force && client->tls && uv_httpd_tls_shutdown(client->tls)) {
+		// closed when close_notify is flushed
+		client->close_when_flushed = 1;
+		return;
+	}
+	client->closing = 1;
+	UV_HTTPD_TRACE_INSTANT(CLOSE, client, force);
+	if (client->stream) {
+		uv_httpd_h2_close_stream(client->h2, client->stream);
+		return;
+	}
+	uv_close((uv_handle_t*)&client->tcp, on_close);
+}
+
+// answer the request with an error status and close the connection
+// return HPE_PAUSED for llhttp callbacks, the rest of the input is dropped
+static int reject_request(uv_httpd_client_t* client, int status) {
+	const char* reason;
+	char response[256];
+	int len;
+
+	switch (status) {
+	case 429:
+		client->server->stats.limited++;
+		write_response(client, TOO_MANY_REQUESTS, sizeof(TOO_MANY_REQUESTS) - 1, 1);
+		close_client(client, 0);
+		return HPE_PAUSED;
+	case 400: reason = "Bad Request"; break;
+	case 413: reason = "Payload Too Large"; break;
+	case 414: reason = "URI Too Long"; break;
+	case 431: reason = "Request Header Fields Too Large"; break;
+	default: status = 503; reason = "Service Unavailable"; break;
+	}
+	len = snprintf(response, sizeof(response),
+				   "HTTP/1.1 %d %s\r\n"
+				   "Content-Type: text/plain\r\n"
+				   "Content-Length: %zu\r\n"
+				   "%s"
+				   "\r\n"
+				   "%s\n",
+				   status, reason, strlen(reason) + 1, status == 503 ? "Retry-After: 1\r\n" : "", reason);
+	client->server->stats.rejected++;
+	uvlog_debug("%s rejected: %d %s", uv_httpd_client_ip(client), status, reason);
+	write_response(client, response, (size_t)len, 1);
+	close_client(client, 0);
+	return HPE_PAUSED;
+}
+
+// buffer a part of the request in `client->pkt`
+// return 0 for success, otherwise the status to reject the request with
+static int pkt_append(uv_httpd_client_t* client, const char* at, size_t len) {
+	uv_httpd_server_t* server = client->server;
+	size_t before = mybuf_heap_size(&client->pkt);
+	size_t after;
+
+	if (mybuf_append(&client->pkt, at, len)) return 503;
+	after = mybuf_heap_size(&client->pkt);
+	server->stats.memory += after - before;
+	// requests fitting in the inline buffer are never rejected for memory
+	if (after > before && server->limits.max_memory && server->stats.memory > server->limits.max_memory) {
+		return 503;
+	}
+	return 0;
+}
+
+static void client_buf_clear(uv_httpd_client_t* client, mybuf_t* buf) {
+	client->server->stats.memory -= mybuf_heap_size(buf);
+	mybuf_clear(buf);
+}
+
+// header fields and values buffered so far, `pkt` holds url and version before them
+static size_t header_bytes(uv_httpd_client_t* client) {
+	return client->pkt.size - client->req.url.len - client->req.version.len;
+}
+
+static void finish_drain(uv_httpd_server_t* server, int status) {
+	uv_timer_stop(&server->drain_timer);
+	server->draining = 0;
+	if (server->on_drained) {
+		uv_httpd_done_t cb = server->on_drained;
+		uv_httpd_watchdog_t* wd = server->watchdog;
+		const char* prev = uv_httpd_watchdog_enter(wd, "on_drained");
+		server->on_drained = NULL;
+		UV_HTTPD_TRACE_BEGIN(ON_DRAINED, server, status);
+		cb(server, status);
+		UV_HTTPD_TRACE_END(ON_DRAINED, server, status);
+		uv_httpd_watchdog_leave(wd, prev);
+	}
+}
+
+static void update_reading(uv_httpd_client_t* client) {
+	int want = !client->closing && !client->waiting && !client->read_paused;
+	if (client->stream) {
+		if (want != client->reading && !client->closing) {
+			uv_httpd_h2_reading(client->h2, client->stream, want);
+		}
+	} else if (client->mem) {
+		// fed by uv_httpd_mem_feed while reading
+	} else if (want && !client->reading) {
+		uv_read_start((uv_stream_t*)&client->tcp, on_alloc, on_read);
+	} else if (!want && client->reading && !client->closing) {
+		uv_read_stop((uv_stream_t*)&client->tcp);
+	}
+	client->reading = want;
+}
+
+// the client waits for `100 Continue` before sending the body
+static int expects_continue(uv_httpd_client_t* client) {
+	llhttp_t* parser = &client->parser;
+	const uv_httpd_string_t* expect;
+
+	if (parser->http_major != 1 || parser->http_minor == 0) return 0;
+	if (!(parser->flags & F_CHUNKED) && parser->content_length == 0) return 0;
+	expect = uv_httpd_header(&client->req, "Expect");
+	return expect && 0 == string0_nicmp("100-continue", client->req.base + expect->offset, expect->len);
 }
 
 static int headers_contains(uv_httpd_client_t* client, const char* key, const char* value) {
@@ -80,202 +285,381 @@ static int headers_contains(uv_httpd_client_t* client, const char* key, const ch
 }
 
 
+// an entry of the access log for the request ending now
+static void log_request(uv_httpd_client_t* client) {
+	uv_httpd_accesslog_t* log = client->server->accesslog;
+	uv_httpd_accesslog_entry_t* e;
+	size_t len = client->req.url.len;
+
+	if (!log || !(e = uv_httpd_accesslog_reserve(log))) return;
+	e->start = client->log_start;
+	e->end = uv_now(client->server->tcp.loop);
+	e->bytes = client->log_bytes;
+	e->status = (uint16_t)client->log_status;
+	e->method = (uint8_t)client->req.method;
+	e->version = client->stream ? 20 : (uint8_t)(client->parser.http_major * 10 + client->parser.http_minor);
+	e->family = (uint8_t)client->peer.ss_family;
+	if (client->peer.ss_family == AF_INET) {
+		memcpy(e->addr, &((struct sockaddr_in*)&client->peer)->sin_addr, 4);
+	} else if (client->peer.ss_family == AF_INET6) {
+		memcpy(e->addr, &((struct sockaddr_in6*)&client->peer)->sin6_addr, 16);
+	}
+	if (client->req.url.offset + len > client->pkt.size) {
+		len = 0;
+	}
+	e->truncated = len > UV_HTTPD_ACCESSLOG_TARGET;
+	if (e->truncated) {
+		len = UV_HTTPD_ACCESSLOG_TARGET;
+	}
+	memcpy(e->target, client->pkt.buf + client->req.url.offset, len);
+	e->target_len = (uint8_t)len;
+	uv_httpd_accesslog_commit(log);
+}
+
+// keep-alive or close after the response of current request
+// return nonzero if the connection is closing
+static int finish_request(uv_httpd_client_t* client) {
+	int keep_alive = !client->server->draining && headers_contains(client, "Connection", "keep-alive");
+	UV_HTTPD_TRACE_ASYNC_END(REQUEST, client, keep_alive);
+	log_request(client);
+	reset_request(client);
+	client->head_written = 0;
+	client->on_body = NULL;
+	client->on_abort = NULL;
+	if (client->gzip) {
+		uv_httpd_gzip_filter_free(client->gzip);
+		client->gzip = NULL;
+	}
+	client->gzip_decided = 0;
+	if (!keep_alive) {
+		close_client(client, 0);
+		return 1;
+	}
+	return 0;
+}
+
+
 /*************************** llhttp callback functions ****************/
 
 static int on_message_begin(llhttp_t* llhttp) {
-	print_func;
 	uv_httpd_client_t* client = llhttp->data; 
-	mybuf_clear(&client->pkt); 
+	UV_HTTPD_TRACE_ASYNC_BEGIN(REQUEST, client, 0);
+	client->in_message = 1;
+	client->started = 1;
+	client->log_start = uv_now(client->server->tcp.loop);
+	client->log_bytes = 0;
+	client->log_status = 0;
+	client_buf_clear(client, &client->pkt);
 	reset_request(client);
 	return 0;
 }
 
 static int on_url(llhttp_t* llhttp, const char* at, size_t length) {
-	print_func;
-	dnprintf(at, length, 1);
 	uv_httpd_client_t* client = llhttp->data;
-	client->req.url.offset = client->pkt.size;
-	client->req.url.len = length;
-	mybuf_append(&client->pkt, at, length);
-	return 0;
-}
-
-static int on_status(llhttp_t* llhttp, const char* at, size_t length) {
-	print_func;
-	dnprintf(at, length, 1);
-	return 0;
-}
-
-static int on_method(llhttp_t* llhttp, const char* at, size_t length) {
-	print_func;
-	dnprintf(at, length, 1);
+	int status;
+	if (client->req.url.len + length > client->server->limits.max_url) {
+		return reject_request(client, 414);
+	}
+	string_extend(&client->req.url, client->pkt.size, length);
+	if ((status = pkt_append(client, at, length))) {
+		return reject_request(client, status);
+	}
 	return 0;
 }
 
 static int on_version(llhttp_t* llhttp, const char* at, size_t length) {
-	print_func;
-	dnprintf(at, length, 1);
 	uv_httpd_client_t* client = llhttp->data;
-	client->req.version.offset = client->pkt.size;
-	client->req.version.len = length;
-	mybuf_append(&client->pkt, at, length);
+	int status;
+	string_extend(&client->req.version, client->pkt.size, length);
+	if ((status = pkt_append(client, at, length))) {
+		return reject_request(client, status);
+	}
 	return 0;
 }
 
 static int on_header_field(llhttp_t* llhttp, const char* at, size_t length) {
-	print_func;
-	dnprintf(at, length, 1);
 	uv_httpd_client_t* client = llhttp->data;
-	headers_append_key(client, client->pkt.size, length);
-	mybuf_append(&client->pkt, at, length);
+	int status;
+	if (header_bytes(client) + length > client->server->limits.max_headers
+		|| (!client->in_field && client->req.headers.n >= client->server->limits.max_header_count)) {
+		return reject_request(client, 431);
+	}
+	if (client->in_field) {
+		client->req.headers.headers[client->req.headers.n].key.len += length;
+		client->req.headers.headers[client->req.headers.n].value.offset += length;
+	} else {
+		headers_append_key(client, client->pkt.size, length);
+		client->in_field = 1;
+	}
+	if ((status = pkt_append(client, at, length))) {
+		return reject_request(client, status);
+	}
 	return 0;
 }
 
 static int on_header_value(llhttp_t* llhttp, const char* at, size_t length) {
-	print_func;
-	dnprintf(at, length, 1);
 	uv_httpd_client_t* client = llhttp->data;
-	headers_append_value(client, client->pkt.size, length);
-	mybuf_append(&client->pkt, at, length);
-	return 0;
-}
-
-static int on_chunk_extension_name(llhttp_t* llhttp, const char* at, size_t length) {
-	print_func;
-	dnprintf(at, length, 1);
-	return 0;
-}
-
-static int on_chunk_extension_value(llhttp_t* llhttp, const char* at, size_t length) {
-	print_func;
-	dnprintf(at, length, 1);
+	int status;
+	if (header_bytes(client) + length > client->server->limits.max_headers) {
+		return reject_request(client, 431);
+	}
+	if (client->in_value) {
+		client->req.headers.headers[client->req.headers.n].value.len += length;
+	} else {
+		headers_append_value(client, client->pkt.size, length);
+		client->in_value = 1;
+	}
+	if ((status = pkt_append(client, at, length))) {
+		return reject_request(client, status);
+	}
 	return 0;
 }
 
 static int on_headers_complete(llhttp_t* llhttp) {
-	print_func;
+	uv_httpd_client_t* client = llhttp->data;
+	uv_httpd_ratelimit_t* rl = client->server->ratelimit;
+	int expect_continue;
+
+	client->req.base = client->pkt.buf;
+	expect_continue = expects_continue(client);
+	if (client->prepaid) {
+		client->prepaid = 0;
+	} else if (rl && !uv_httpd_ratelimit_take(rl, &client->addr_key, uv_now(client->server->tcp.loop))) {
+		if (expect_continue) {
+			// the body is not sent yet, keep it that way
+			return reject_request(client, 429);
+		}
+		// body is dropped, 429 in on_message_complete
+		client->limited = 1;
+		return 0;
+	}
+	if (client->server->on_headers) {
+		uv_httpd_watchdog_t* wd = client->server->watchdog;
+		const char* prev = uv_httpd_watchdog_enter(wd, "on_headers");
+		int r;
+		UV_HTTPD_TRACE_BEGIN(ON_HEADERS, client, 0);
+		r = client->server->on_headers(client->server, client, &client->req);
+		UV_HTTPD_TRACE_END(ON_HEADERS, client, r);
+		uv_httpd_watchdog_leave(wd, prev);
+		if (r) {
+			return -1;
+		}
+		if (client->close_when_flushed || client->closing) {
+			// uv_httpd_reject
+			return HPE_PAUSED;
+		}
+	}
+	if (!client->on_body && (llhttp->flags & F_CONTENT_LENGTH)
+		&& llhttp->content_length > client->server->limits.max_body) {
+		// do not wait for a body to be rejected anyway
+		return reject_request(client, 413);
+	}
+	if (expect_continue) {
+		write_response(client, CONTINUE, sizeof(CONTINUE) - 1, 0);
+	}
 	return 0;
 }
 
 static int on_body(llhttp_t* llhttp, const char* at, size_t length) {
-	print_func;
-	dnprintf(at, length, 1);
 	uv_httpd_client_t* client = llhttp->data;
-	client->req.body.offset = client->pkt.size;
-	client->req.body.len = length;
-	mybuf_append(&client->pkt, at, length);
+	int status;
+	if (client->on_body) {
+		uv_httpd_watchdog_t* wd = client->server->watchdog;
+		const char* prev = uv_httpd_watchdog_enter(wd, "on_body");
+		UV_HTTPD_TRACE_BEGIN(ON_BODY, client, length);
+		client->on_body(client, at, length);
+		UV_HTTPD_TRACE_END(ON_BODY, client, length);
+		uv_httpd_watchdog_leave(wd, prev);
+		return 0;
+	} else if (client->limited) {
+		return 0;
+	}
+	if (client->req.body.len + length > client->server->limits.max_body) {
+		// chunked, the size is unknown until now
+		return reject_request(client, 413);
+	}
+	string_extend(&client->req.body, client->pkt.size, length);
+	if ((status = pkt_append(client, at, length))) {
+		return reject_request(client, status);
+	}
 	return 0;
 }
 
 static int on_message_complete(llhttp_t* llhttp) {
-	print_func;
 	uv_httpd_client_t* client = llhttp->data;
 	client->req.base = client->pkt.buf;
-	client->on_request(client->server, client, &client->req);
-	if (!headers_contains(client, "Connection", "keep-alive")) {
-		uv_close((uv_handle_t*)&client->tcp, on_close);
+	if (llhttp->upgrade && 0 == upgrade_h2c(client)) {
+		// answered on stream 1, frames follow
+		client->in_message = 0;
+		return 0;
+	}
+	client->server->stats.requests++;
+	if (client->limited) {
+		client->limited = 0;
+		client->server->stats.limited++;
+		uv_httpd_write_response(client, TOO_MANY_REQUESTS, sizeof(TOO_MANY_REQUESTS) - 1);
+	} else {
+		uv_httpd_watchdog_t* wd = client->server->watchdog;
+		const char* prev = uv_httpd_watchdog_enter(wd, client->on_body ? "on_body" : "on_request");
+		if (client->on_body) {
+			UV_HTTPD_TRACE_BEGIN(ON_BODY, client, 0);
+			client->on_body(client, NULL, 0);
+			UV_HTTPD_TRACE_END(ON_BODY, client, 0);
+		} else {
+			UV_HTTPD_TRACE_BEGIN(ON_REQUEST, client, 0);
+			client->on_request(client->server, client, &client->req);
+			UV_HTTPD_TRACE_END(ON_REQUEST, client, 0);
+		}
+		uv_httpd_watchdog_leave(wd, prev);
+	}
+	client->in_message = 0;
+	if (client->deferred || compressing(client)) {
+		// pipelined requests wait for uv_httpd_response_done or uv_httpd_gzip_on_done
+		client->waiting = 1;
+		return HPE_PAUSED;
+	}
+	if (finish_request(client)) {
+		// do not parse pipelined requests on a closing connection
+		return HPE_PAUSED;
 	}
-	reset_request(client);
-	return 0;
-}
-
-static int on_url_complete(llhttp_t* llhttp) {
-	print_func;
-	return 0;
-}
-
-static int on_status_complete(llhttp_t* llhttp) {
-	print_func;
 	return 0;
 }
 
 static int on_method_complete(llhttp_t* llhttp) {
-	print_func;
 	uv_httpd_client_t* client = llhttp->data;
 	client->req.method = llhttp->method;
 	return 0;
 }
 
-static int on_version_complete(llhttp_t* llhttp) {
-	print_func;
-	return 0;
-}
-
 static int on_header_field_complete(llhttp_t* llhttp) {
-	print_func;
+	uv_httpd_client_t* client = llhttp->data;
+	client->in_field = 0;
 	return 0;
 }
 
 static int on_header_value_complete(llhttp_t* llhttp) {
-	print_func;
+	uv_httpd_client_t* client = llhttp->data;
+	client->in_value = 0;
+	client->req.headers.n++;
 	return 0;
 }
 
-static int on_chunk_extension_name_complete(llhttp_t* llhttp) {
-	print_func;
+#ifdef UV_HTTPD_TRACE
+// callbacks of no use but to trace what llhttp sees, not registered otherwise
+// to save llhttp an indirect call per span and event
+
+static int on_method(llhttp_t* llhttp, const char* at, size_t length) {
+	UV_HTTPD_TRACE_INSTANT(ON_METHOD, llhttp->data, length);
 	return 0;
 }
 
-//static int on_chunk_extension_value_complete(llhttp_t* llhttp) {
-//	print_func;
-//	return 0;
-//}
+static int on_chunk_extension(llhttp_t* llhttp, const char* at, size_t length) {
+	UV_HTTPD_TRACE_INSTANT(ON_CHUNK_EXTENSION, llhttp->data, length);
+	return 0;
+}
 
 static int on_chunk_header(llhttp_t* llhttp) {
-	print_func;
+	UV_HTTPD_TRACE_INSTANT(ON_CHUNK_HEADER, llhttp->data, llhttp->content_length);
 	return 0;
 }
 
 static int on_chunk_complete(llhttp_t* llhttp) {
-	print_func;
+	UV_HTTPD_TRACE_INSTANT(ON_CHUNK_COMPLETE, llhttp->data, 0);
 	return 0;
 }
 
 static int on_reset(llhttp_t* llhttp) {
-	print_func;
+	UV_HTTPD_TRACE_INSTANT(ON_RESET, llhttp->data, 0);
 	return 0;
 }
+#endif
 
+// only the callbacks uv_httpd needs, llhttp skips the others by a NULL check.
+// requests never have a status line, and the `*_complete` of url and version
+// are implied by the next span.
 static void setup_default_llhttp_settings(llhttp_settings_t* settings) {
+	llhttp_settings_init(settings);
 	settings->on_message_begin = on_message_begin;
 	settings->on_url = on_url;
-	settings->on_status = on_status;
-	settings->on_method = on_method;
 	settings->on_version = on_version;
 	settings->on_header_field = on_header_field;
 	settings->on_header_value = on_header_value;
-	settings->on_chunk_extension_name = on_chunk_extension_name;
-	settings->on_chunk_extension_value = on_chunk_extension_value;
 	settings->on_headers_complete = on_headers_complete;
 	settings->on_body = on_body;
 	settings->on_message_complete = on_message_complete;
-	settings->on_url_complete = on_url_complete;
-	settings->on_status_complete = on_status_complete;
 	settings->on_method_complete = on_method_complete;
-	settings->on_version_complete = on_version_complete;
 	settings->on_header_field_complete = on_header_field_complete;
 	settings->on_header_value_complete = on_header_value_complete;
-	settings->on_chunk_extension_name_complete = on_chunk_extension_name_complete;
+#ifdef UV_HTTPD_TRACE
+	settings->on_method = on_method;
+	settings->on_chunk_extension_name = on_chunk_extension;
+	settings->on_chunk_extension_value = on_chunk_extension;
 	settings->on_chunk_header = on_chunk_header;
 	settings->on_chunk_complete = on_chunk_complete;
 	settings->on_reset = on_reset;
+#endif
 }
 
 /*************************** uv callback functions ****************/
 
+static void abort_response(uv_httpd_client_t* client) {
+	uv_httpd_watchdog_t* wd = client->server->watchdog;
+	const char* prev = uv_httpd_watchdog_enter(wd, "on_abort");
+	UV_HTTPD_TRACE_BEGIN(ON_ABORT, client, 0);
+	client->on_abort(client);
+	UV_HTTPD_TRACE_END(ON_ABORT, client, 0);
+	uv_httpd_watchdog_leave(wd, prev);
+}
+
+static void flushed(uv_httpd_client_t* client) {
+	if (client->close_when_flushed) {
+		close_client(client, 0);
+	} else if (client->on_flushed) {
+		on_flushed_t cb = client->on_flushed;
+		uv_httpd_watchdog_t* wd = client->server->watchdog;
+		const char* prev = uv_httpd_watchdog_enter(wd, "on_flushed");
+		client->on_flushed = NULL;
+		UV_HTTPD_TRACE_BEGIN(ON_FLUSHED, client, 0);
+		cb(client);
+		UV_HTTPD_TRACE_END(ON_FLUSHED, client, 0);
+		uv_httpd_watchdog_leave(wd, prev);
+	}
+}
+
 static void on_write(uv_write_t* req, int status) {
-	print_func;
-	assert(status == 0);
 	struct write_req_t* wr = req->data;
+	uv_httpd_client_t* client = req->handle->data;
+	uv_httpd_watchdog_t* wd = client->server->watchdog;
+	const char* prev = uv_httpd_watchdog_enter(wd, "on_write");
+	UV_HTTPD_TRACE_BEGIN(ON_WRITE, client, status);
+	if (status && status != UV_ECANCELED) {
+		uvlog_debug("write failed: %s", uv_err_name(status));
+	}
 	free(wr->buf.base);
 	free(wr);
+	if (--client->pending_writes == 0) {
+		flushed(client);
+	}
+	if (client->h2 && !client->closing) {
+		uv_httpd_h2_on_written(client->h2);
+	}
+	UV_HTTPD_TRACE_END(ON_WRITE, client, status);
+	uv_httpd_watchdog_leave(wd, prev);
 }
 
 static void on_alloc(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
-	print_func; dprintf("suggested_size=%zu\n", suggested_size);
 	uv_httpd_client_t* client = handle->data;
+	size_t before = mybuf_heap_size(&client->buf);
+	if (client->tls) {
+		// ciphertext, decrypted into `client->buf` by on_read
+		*buf = uv_httpd_tls_read_buf(client->tls);
+		return;
+	}
+	// fails only if out of memory, then the read gets UV_ENOBUFS if no space left.
+	// appended to a partial HTTP/2 frame or connection preface, if any
 	mybuf_reserve(&client->buf, DEFAULT_BUFF_SIZE);
-	buf->base = client->buf.buf;
+	client->server->stats.memory += mybuf_heap_size(&client->buf) - before;
+	buf->base = client->buf.buf + client->buf.size;
 #ifdef _WIN32
 	buf->len = (ULONG)mybuf_space(&client->buf);
 #else
@@ -284,69 +668,178 @@ static void on_alloc(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf)
 }
 
 static void on_close(uv_handle_t* peer) {
-	print_func;
 	uv_httpd_client_t* client = peer->data;
-	mybuf_clear(&client->buf);
-	mybuf_clear(&client->pkt);
+	uv_httpd_server_t* server = client->server;
+	if (client->deferred && client->on_abort) {
+		abort_response(client);
+	}
+	if (client->in_message || client->deferred) {
+		UV_HTTPD_TRACE_ASYNC_END(REQUEST, client, 0);
+		log_request(client);
+	}
+	UV_HTTPD_TRACE_ASYNC_END(CONNECTION, client, 0);
+	if (client->mem) {
+		client->mem->client = NULL;
+	}
+	server->stats.active--;
+	QUEUE_REMOVE(&client->node);
+	if (client->h2) {
+		uv_httpd_h2_free(client->h2);
+	}
+	if (client->gzip) {
+		uv_httpd_gzip_filter_free(client->gzip);
+	}
+	if (client->tls) {
+		uv_httpd_tls_conn_free(client->tls);
+	}
+	client_buf_clear(client, &client->buf);
+	client_buf_clear(client, &client->pkt);
 	reset_request(client);
 	free(peer); // since our uv_tcpclient_t's first member is uv_tcp_t, so peer's addr IS our client's addr, just free it.
+	if (server->draining && QUEUE_EMPTY(&server->clients)) {
+		finish_drain(server, 0);
+	}
 }
 
-static void on_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
-	print_func; dprintf("nread= %zd\n", nread);
-	uv_httpd_client_t* client = stream->data;
+// feed HTTP/2 frames from `offset` of `client->buf`, keep a partial frame
+static void h2_parse(uv_httpd_client_t* client, size_t offset) {
+	size_t consumed;
+	if (uv_httpd_h2_feed(client->h2, client->buf.buf + offset, client->buf.size - offset, &consumed)) {
+		// GOAWAY is sent, or received and no stream is open
+		close_client(client, 0);
+		client_buf_clear(client, &client->buf);
+		return;
+	}
+	offset += consumed;
+	if (offset == client->buf.size) {
+		client_buf_clear(client, &client->buf);
+	} else if (offset) {
+		memmove(client->buf.buf, client->buf.buf + offset, client->buf.size - offset);
+		client->buf.size -= offset;
+	}
+}
+
+// HTTP/2 with prior knowledge starts with the connection preface instead of a request.
+// return 1 if it is, 0 if not, -1 if more data is needed to tell
+static int h2_preface(uv_httpd_client_t* client) {
+	size_t n = client->buf.size < UV_HTTPD_H2_PREFACE_LEN ? client->buf.size : UV_HTTPD_H2_PREFACE_LEN;
+	if (!client->server->h2c || client->started || memcmp(client->buf.buf, UV_HTTPD_H2_PREFACE, n)) return 0;
+	return n == UV_HTTPD_H2_PREFACE_LEN ? 1 : -1;
+}
+
+// parse data in `client->buf`, keep the unparsed part if parser paused by a deferred response
+static void client_parse(uv_httpd_client_t* client) {
 	enum llhttp_errno parse_ret;
 
-	if (nread < 0) {
-		uv_close((uv_handle_t*)stream, on_close);
-		return;
-	} else if (nread == 0) {
+	if (!client->h2) {
+		int preface = h2_preface(client);
+		if (preface < 0) return;
+		if (preface > 0 && uv_httpd_h2_create(&client->h2, client, NULL, 0)) {
+			close_client(client, 1);
+			return;
+		}
+	}
+	if (client->h2) {
+		h2_parse(client, 0);
 		return;
 	}
 
-	dprintf("before llhttp_execute\n");
-	dnprintf(buf->base, nread, 1);
-	parse_ret = llhttp_execute(&client->parser, client->buf.buf, nread);
-	if (parse_ret != HPE_OK) {
+	parse_ret = llhttp_execute(&client->parser, client->buf.buf, client->buf.size);
+	if (parse_ret == HPE_PAUSED_UPGRADE && client->h2) {
+		// upgraded to h2c, the client preface follows
+		h2_parse(client, (size_t)(llhttp_get_error_pos(&client->parser) - client->buf.buf));
+		return;
+	} else if (parse_ret == HPE_PAUSED_UPGRADE) {
+		// answered without switching protocols, nothing to parse after it
+		close_client(client, 0);
+	} else if (parse_ret == HPE_PAUSED && (client->close_when_flushed || client->closing)) {
+		// paused by on_message_complete, connection is closing
+	} else if (parse_ret == HPE_PAUSED && client->waiting) {
+		const char* pos = llhttp_get_error_pos(&client->parser);
+		size_t left = client->buf.size - (size_t)(pos - client->buf.buf);
+		memmove(client->buf.buf, pos, left);
+		client->buf.size = left;
+		update_reading(client);
+		return;
+	} else if (parse_ret != HPE_OK) {
 		fprintf(stderr, "Parse error: %s %s\n", llhttp_errno_name(parse_ret),
 				client->parser.reason);
-		uv_close((uv_handle_t*)stream, on_close);
+		close_client(client, 1);
 	} else {
 		// parse succeed, on_request_t should be called in on_message_complete		
 	}
-	dprintf("after llhttp_execute\n");
-	mybuf_clear(&client->buf);
+	client_buf_clear(client, &client->buf);
 }
 
-static int getpeeraddr(uv_tcp_t* tcp, char* ip, size_t len) {
-	struct sockaddr_in addr;
-	int addrlen = sizeof(addr);
-	int r = uv_tcp_getpeername(tcp, (struct sockaddr*)&addr, &addrlen);
-	if (r) {
-		warn_on_uv_err(r, "uv_tcp_getpeername");
-		return r;
+static void on_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
+	uv_httpd_client_t* client = stream->data;
+	uv_httpd_watchdog_t* wd = client->server->watchdog;
+	const char* prev;
+
+	UV_HTTPD_TRACE_INSTANT(READ, client, nread);
+	client->last_active = uv_now(stream->loop);
+	if (nread < 0) {
+		close_client(client, 1);
+		return;
+	} else if (nread == 0) {
+		// EAGAIN, keep what is buffered of a partial request or h2 frame
+		if (client->buf.size == 0) client_buf_clear(client, &client->buf);
+		return;
+	} else if (client->close_when_flushed || client->closing) {
+		client_buf_clear(client, &client->buf);
+		return;
 	}
-	r = uv_ip4_name(&addr, ip, len);
-	if (r) {
-		warn_on_uv_err(r, "uv_ip4_name");
+
+	if (client->tls) {
+		size_t before = mybuf_heap_size(&client->buf), size = client->buf.size;
+		int r = uv_httpd_tls_read(client->tls, buf->base, (size_t)nread, &client->buf);
+		client->server->stats.memory += mybuf_heap_size(&client->buf) - before;
+		if (r) {
+			// an alert may be pending, nothing to answer after close_notify
+			close_client(client, r == UV_EOF);
+			return;
+		}
+		if (client->buf.size == size) {
+			// a handshake message or a partial record
+			if (size == 0) client_buf_clear(client, &client->buf);
+			return;
+		}
+	} else {
+		client->buf.size += (size_t)nread;
 	}
-	if (len)
-		ip[len - 1] = '\0';
-	return r;
+	prev = uv_httpd_watchdog_enter(wd, "on_read");
+	UV_HTTPD_TRACE_BEGIN(PARSE, client, client->buf.size);
+	client_parse(client);
+	UV_HTTPD_TRACE_END(PARSE, client, 0);
+	uv_httpd_watchdog_leave(wd, prev);
 }
 
-static void on_connected(uv_stream_t* stream, int status) {
-	print_func;
-	assert(status == 0);
-	uv_httpd_server_t* server = stream->data;
-	uv_httpd_client_t* client = malloc(sizeof * client);
-	fatal_if_null(client);
-	int r = uv_tcp_init(stream->loop, &client->tcp);
-	fatal_on_uv_err(r, "uv_tcp_init failed");
-	r = uv_accept(stream, (uv_stream_t*)&client->tcp);
-	fatal_on_uv_err(r, "uv_accept error");
+// the text is formatted by `uv_httpd_client_ip` when asked, most handlers never do
+static int getpeeraddr(uv_httpd_client_t* client) {
+	int addrlen = sizeof(client->peer);
+	int r;
+
+	if (client->tcp.type == UV_NAMED_PIPE) {
+		// the peer of a unix domain socket is rarely bound to a path
+		client->peer.ss_family = AF_UNIX;
+	} else {
+		r = uv_tcp_getpeername(&client->tcp, (struct sockaddr*)&client->peer, &addrlen);
+		if (r) {
+			warn_on_uv_err(r, "uv_tcp_getpeername");
+			return r;
+		}
+	}
+	uv_httpd_addr_key((const struct sockaddr*)&client->peer, &client->addr_key);
+	return 0;
+}
 
+// `client` is zeroed and `tcp` initialized
+static void client_init(uv_httpd_server_t* server, uv_httpd_client_t* client) {
+	server->stats.connections++;
+	server->stats.active++;
 	client->server = server;
+	QUEUE_INSERT_TAIL(&server->clients, &client->node);
+	client->last_active = uv_now(client->tcp.loop);
 	client->on_request = server->on_request;
 	client->tcp.data = client;
 	llhttp_init(&client->parser, HTTP_REQUEST, &server->http_settings);
@@ -355,8 +848,53 @@ static void on_connected(uv_stream_t* stream, int status) {
 	mybuf_init(&client->pkt);
 	client->req.headers.headers = client->headers;
 	client->req.headers.n = 0;
-	getpeeraddr(&client->tcp, client->req.ip, sizeof(client->req.ip));
-	uv_read_start((uv_stream_t*)&client->tcp, on_alloc, on_read);
+}
+
+static void on_connected(uv_stream_t* stream, int status) {
+	assert(status == 0);
+	uv_httpd_server_t* server = stream->data;
+	uv_httpd_client_t* client = calloc(1, sizeof * client);
+	fatal_if_null(client);
+	UV_HTTPD_TRACE_BEGIN(ACCEPT, client, 0);
+	UV_HTTPD_TRACE_ASYNC_BEGIN(CONNECTION, client, 0);
+	int r;
+	if (stream->type == UV_NAMED_PIPE) {
+		r = uv_pipe_init(stream->loop, &client->pipe, 0);
+		fatal_on_uv_err(r, "uv_pipe_init failed");
+	} else {
+		r = uv_tcp_init(stream->loop, &client->tcp);
+		fatal_on_uv_err(r, "uv_tcp_init failed");
+	}
+	r = uv_accept(stream, (uv_stream_t*)&client->tcp);
+	fatal_on_uv_err(r, "uv_accept error");
+	if (stream->type == UV_TCP) {
+		// responses may be written in several pieces, e.g. by the proxy
+		uv_tcp_nodelay(&client->tcp, 1);
+	}
+
+	client_init(server, client);
+	getpeeraddr(client);
+	if (server->tls && stream == (uv_stream_t*)&server->tcp) {
+		r = uv_httpd_tls_conn_create(&client->tls, server->tls, client);
+		if (r) {
+			warn_on_uv_err(r, "uv_httpd_tls_conn_create");
+			close_client(client, 1);
+			UV_HTTPD_TRACE_END(ACCEPT, client, 0);
+			return;
+		}
+	}
+	if (server->ratelimit && !uv_httpd_ratelimit_take(server->ratelimit, &client->addr_key, uv_now(stream->loop))) {
+		server->stats.limited++;
+		// nothing can be answered before the TLS handshake
+		if (!client->tls) {
+			uv_httpd_write_response(client, TOO_MANY_REQUESTS, sizeof(TOO_MANY_REQUESTS) - 1);
+		}
+		close_client(client, 0);
+	} else {
+		client->prepaid = server->ratelimit != NULL;
+		update_reading(client);
+	}
+	UV_HTTPD_TRACE_END(ACCEPT, client, 0);
 }
 
 
@@ -419,8 +957,14 @@ int string0_nicmp(const char* s1, const char* s2, size_t len2) {
 	return 1;
 }
 
-void uv_httpd_enable_printf(int enable) {
-	enable_print = enable;
+const uv_httpd_string_t* uv_httpd_header(const uv_httpd_request_t* req, const char* key) {
+	for (size_t i = 0; i < req->headers.n; i++) {
+		const uv_httpd_header_t* header = &req->headers.headers[i];
+		if (0 == string0_nicmp(key, req->base + header->key.offset, header->key.len)) {
+			return &header->value;
+		}
+	}
+	return NULL;
 }
 
 int uv_httpd_create(uv_httpd_server_t** server, uv_loop_t* loop, on_request_t on_request) {
@@ -437,7 +981,26 @@ int uv_httpd_create(uv_httpd_server_t** server, uv_loop_t* loop, on_request_t on
 		goto failed;
 	}
 	s->tcp.data = s;
+	s->pipe = NULL;
 	s->on_request = on_request;
+	s->on_headers = NULL;
+	s->ratelimit = NULL;
+	s->limits.max_url = UV_HTTPD_MAX_URL;
+	s->limits.max_headers = UV_HTTPD_MAX_HEADERS;
+	s->limits.max_header_count = UV_HTTPD_MAX_HEADER_COUNT;
+	s->limits.max_body = UV_HTTPD_MAX_BODY;
+	s->limits.max_memory = 0;
+	s->h2c = 0;
+	s->gzip = NULL;
+	s->watchdog = NULL;
+	s->tls = NULL;
+	s->accesslog = NULL;
+	memset(&s->stats, 0, sizeof(s->stats));
+	QUEUE_INIT(&s->clients);
+	s->draining = 0;
+	s->on_drained = NULL;
+	uv_timer_init(loop, &s->drain_timer);
+	s->drain_timer.data = s;
 	setup_default_llhttp_settings(&s->http_settings);
 
 	*server = s;
@@ -452,8 +1015,69 @@ static void on_server_closed(uv_handle_t* handle) {
 	uvlog_debug("uv_httpd.tcp closed");
 }
 
+static void on_pipe_closed(uv_handle_t* handle) {
+	uvlog_debug("uv_httpd.pipe closed");
+	free(handle);
+}
+
+static void close_listeners(uv_httpd_server_t* server) {
+	if (!uv_is_closing((uv_handle_t*)&server->tcp)) {
+		uv_close((uv_handle_t*)&server->tcp, on_server_closed);
+	}
+	if (server->pipe) {
+		uv_close((uv_handle_t*)server->pipe, on_pipe_closed);
+		server->pipe = NULL;
+	}
+}
+
 void uv_httpd_stop(uv_httpd_server_t* server) {
-	uv_close((uv_handle_t*)&server->tcp, on_server_closed);
+	close_listeners(server);
+	if (!uv_is_closing((uv_handle_t*)&server->drain_timer)) {
+		uv_close((uv_handle_t*)&server->drain_timer, NULL);
+	}
+}
+
+static void on_drain_timer(uv_timer_t* timer) {
+	uv_httpd_server_t* server = timer->data;
+	uint64_t now = uv_now(timer->loop);
+	int force = now >= server->drain_deadline;
+	QUEUE* q;
+
+	if (force) {
+		uvlog_warn("uv_httpd drain timeout, closing %llu connections", (unsigned long long)server->stats.active);
+	}
+	QUEUE_FOREACH(q, &server->clients) {
+		uv_httpd_client_t* client = QUEUE_DATA(q, uv_httpd_client_t, node);
+		if (force) {
+			close_client(client, 1);
+		} else if (client->h2) {
+			// no new streams, close after the open ones are done
+			uv_httpd_h2_goaway(client->h2);
+			if (uv_httpd_h2_streams(client->h2) == 0) {
+				close_client(client, 0);
+			}
+		} else if (!client->in_message && now - client->last_active >= DRAIN_IDLE_GRACE) {
+			// closing an idle keep-alive connection races with the client sending
+			// a new request on it, active ones get `Connection: close` instead.
+			close_client(client, 0);
+		}
+	}
+	if (force) {
+		finish_drain(server, UV_ETIMEDOUT);
+	}
+}
+
+void uv_httpd_drain(uv_httpd_server_t* server, uint64_t timeout, uv_httpd_done_t on_drained) {
+	close_listeners(server);
+	server->draining = 1;
+	server->on_drained = on_drained;
+	server->drain_deadline = uv_now(server->tcp.loop) + timeout;
+
+	if (QUEUE_EMPTY(&server->clients)) {
+		finish_drain(server, 0);
+	} else {
+		uv_timer_start(&server->drain_timer, on_drain_timer, DRAIN_CHECK_INTERVAL, DRAIN_CHECK_INTERVAL);
+	}
 }
 
 void uv_httpd_free(uv_httpd_server_t* server) {
@@ -463,22 +1087,121 @@ void uv_httpd_free(uv_httpd_server_t* server) {
 int uv_httpd_listen(uv_httpd_server_t* server, const char* ip, int port)
 {
 	int r;
-	struct sockaddr_in addr;
+	struct sockaddr_storage addr;
 
-	r = uv_ip4_addr(ip, port, &addr);
+	if (strchr(ip, ':')) {
+		r = uv_ip6_addr(ip, port, (struct sockaddr_in6*)&addr);
+	} else {
+		r = uv_ip4_addr(ip, port, (struct sockaddr_in*)&addr);
+	}
 	if (r) return r;
 
 	r = uv_tcp_bind(&server->tcp, (const struct sockaddr*)&addr, 0);
 	if (r) return r;
 
-	r = uv_listen((uv_stream_t*)&server->tcp, SOMAXCONN, on_connected);
-	if (r) return r;
+	return uv_httpd_listen_bound(server);
+}
 
-	return r;
+int uv_httpd_listen_bound(uv_httpd_server_t* server)
+{
+	return uv_listen((uv_stream_t*)&server->tcp, SOMAXCONN, on_connected);
 }
 
-int uv_httpd_write_response(uv_httpd_client_t* client, char* response, size_t len)
+int uv_httpd_listen_pipe(uv_httpd_server_t* server, const char* name)
 {
+	int r;
+	uv_pipe_t* pipe;
+
+	if (server->pipe) return UV_EALREADY;
+	pipe = malloc(sizeof(*pipe));
+	if (!pipe) return UV_ENOMEM;
+	r = uv_pipe_init(server->tcp.loop, pipe, 0);
+	if (r) {
+		free(pipe);
+		return r;
+	}
+	pipe->data = server;
+	r = uv_pipe_bind(pipe, name);
+	if (!r) {
+		r = uv_listen((uv_stream_t*)pipe, SOMAXCONN, on_connected);
+	}
+	if (r) {
+		uv_close((uv_handle_t*)pipe, on_pipe_closed);
+		return r;
+	}
+	server->pipe = pipe;
+	return 0;
+}
+
+// insert `Connection: close` after the status line if `close` or draining.
+// only into the head of the final response: 1xx responses are followed by it,
+// and later writes are its body, which may start with `HTTP/` too
+static int write_response(uv_httpd_client_t* client, const char* response, size_t len, int close)
+{
+	const char* eol = NULL;
+	size_t head = 0;
+	uv_buf_t bufs[3];
+	unsigned int nbufs;
+	int final_head = 0;
+
+	if (client->closing) return UV_ECANCELED;
+	if (!client->head_written && len > 12 && memcmp(response, "HTTP/", 5) == 0 && response[9] != '1') {
+		client->head_written = 1;
+		final_head = 1;
+	}
+	if (client->server->accesslog) {
+		client->log_bytes += len;
+		if (final_head) {
+			client->log_status = (response[9] - '0') * 100 + (response[10] - '0') * 10 + (response[11] - '0');
+		}
+	}
+	if (client->stream) {
+		// converted to frames, hop-by-hop headers are dropped
+		int r;
+		UV_HTTPD_TRACE_INSTANT(WRITE, client, len);
+		r = uv_httpd_h2_write(client->h2, client->stream, response, len);
+		client->pending_writes = uv_httpd_h2_queue_size(client->stream) > 0;
+		return r;
+	}
+	if (client->mem) {
+		// written at once, nothing pending
+		UV_HTTPD_TRACE_INSTANT(WRITE, client, len);
+		return mybuf_append(&client->mem->output, response, len) ? UV_ENOMEM : 0;
+	}
+	if (final_head && (close || client->server->draining)) {
+		eol = memchr(response, '\n', len);
+		head = eol ? (size_t)(eol - response) + 1 : 0;
+	}
+
+	if (eol) {
+		// status line, `Connection: close`, rest of the response
+		bufs[0] = uv_buf_init((char*)response, (unsigned int)head);
+		bufs[1] = uv_buf_init(CONNECTION_CLOSE, sizeof(CONNECTION_CLOSE) - 1);
+		bufs[2] = uv_buf_init((char*)response + head, (unsigned int)(len - head));
+		nbufs = 3;
+		len += sizeof(CONNECTION_CLOSE) - 1;
+	} else {
+		bufs[0] = uv_buf_init((char*)response, (unsigned int)len);
+		nbufs = 1;
+	}
+	UV_HTTPD_TRACE_INSTANT(WRITE, client, len);
+	if (client->tls) {
+		// encrypted into one write by uv_httpd_tls_send
+		return uv_httpd_tls_write(client->tls, bufs, nbufs);
+	}
+	return write_bufs(client, bufs, nbufs);
+}
+
+// copy `bufs` into one write to the socket
+static int write_bufs(uv_httpd_client_t* client, const uv_buf_t* bufs, unsigned int nbufs)
+{
+	size_t len = 0, off = 0;
+	unsigned int i;
+	int r;
+
+	for (i = 0; i < nbufs; i++) {
+		len += bufs[i].len;
+	}
 	struct write_req_t* req = malloc(sizeof * req);
 	if (!req) return UV_ENOMEM;
 	req->buf.base = malloc(len);
@@ -486,12 +1209,415 @@ int uv_httpd_write_response(uv_httpd_client_t* client, char* response, size_t le
 		free(req);
 		return UV_ENOMEM;
 	}
-	memcpy(req->buf.base, response, len);
+	for (i = 0; i < nbufs; i++) {
+		memcpy(req->buf.base + off, bufs[i].base, bufs[i].len);
+		off += bufs[i].len;
+	}
 #ifdef _WIN32
 	req->buf.len = (ULONG)len;
 #else
 	req->buf.len = len;
 #endif
 	req->req.data = req;
-	return uv_write(&req->req, (uv_stream_t*)&client->tcp, &req->buf, 1, on_write);
+	r = uv_write(&req->req, (uv_stream_t*)&client->tcp, &req->buf, 1, on_write);
+	if (r) {
+		free(req->buf.base);
+		free(req);
+		return r;
+	}
+	client->pending_writes++;
+	return 0;
+}
+
+int uv_httpd_write_response(uv_httpd_client_t* client, char* response, size_t len)
+{
+	int r;
+
+	if (client->server->gzip && !client->closing && !client->gzip_decided) {
+		client->gzip_decided = 1;
+		gzip_request(client);
+	}
+	if (client->gzip && !client->closing) {
+		r = uv_httpd_gzip_filter_write(client->gzip, response, len);
+		if (r) {
+			uvlog_warn("%s compression failed: %s", uv_httpd_client_ip(client), uv_err_name(r));
+			close_client(client, 0);
+		}
+		return r;
+	}
+	return write_response(client, response, len, 0);
+}
+
+int uv_httpd_reject(uv_httpd_client_t* client, char* response, size_t len)
+{
+	int r = write_response(client, response, len, 1);
+	client->server->stats.rejected++;
+	close_client(client, 0);
+	return r;
+}
+
+void uv_httpd_defer_response(uv_httpd_client_t* client, on_abort_t on_abort) {
+	client->deferred = 1;
+	client->on_abort = on_abort;
+}
+
+// the response is done, go on with pipelined requests
+static void next_request(uv_httpd_client_t* client) {
+	client->waiting = 0;
+	if (client->closing || finish_request(client)) return;
+	llhttp_resume(&client->parser);
+	if (client->buf.size) {
+		// pipelined requests
+		UV_HTTPD_TRACE_BEGIN(PARSE, client, client->buf.size);
+		client_parse(client);
+		UV_HTTPD_TRACE_END(PARSE, client, 0);
+	}
+	update_reading(client);
+}
+
+void uv_httpd_response_done(uv_httpd_client_t* client) {
+	if (!client->deferred) return;
+	client->deferred = 0;
+	if (!client->waiting || compressing(client)) {
+		// still in on_request/on_body, on_message_complete finishes it,
+		// or the body is on the threadpool, uv_httpd_gzip_on_done does
+		return;
+	}
+	next_request(client);
+}
+
+void uv_httpd_stream_body(uv_httpd_client_t* client, on_body_t on_body, on_abort_t on_abort) {
+	client->on_body = on_body;
+	uv_httpd_defer_response(client, on_abort);
+}
+
+void uv_httpd_read_stop(uv_httpd_client_t* client) {
+	client->read_paused = 1;
+	update_reading(client);
+}
+
+void uv_httpd_read_start(uv_httpd_client_t* client) {
+	client->read_paused = 0;
+	update_reading(client);
+}
+
+void uv_httpd_on_flushed(uv_httpd_client_t* client, on_flushed_t cb) {
+	if (client->pending_writes == 0 && !compressing(client)) {
+		cb(client);
+	} else {
+		client->on_flushed = cb;
+	}
+}
+
+size_t uv_httpd_write_queue_size(uv_httpd_client_t* client) {
+	if (client->stream) return uv_httpd_h2_queue_size(client->stream);
+	return client->tcp.write_queue_size;
+}
+
+void uv_httpd_client_set_data(uv_httpd_client_t* client, void* data) {
+	client->data = data;
+}
+
+void* uv_httpd_client_get_data(uv_httpd_client_t* client) {
+	return client->data;
+}
+
+uv_httpd_server_t* uv_httpd_client_server(uv_httpd_client_t* client) {
+	return client->server;
+}
+
+const struct sockaddr_storage* uv_httpd_client_addr(uv_httpd_client_t* client) {
+	return &client->peer;
+}
+
+const char* uv_httpd_client_ip(uv_httpd_client_t* client) {
+	int r = 0;
+	if (client->ip[0]) return client->ip;
+	if (client->peer.ss_family == AF_INET) {
+		r = uv_ip4_name((const struct sockaddr_in*)&client->peer, client->ip, sizeof(client->ip));
+	} else if (client->peer.ss_family == AF_INET6) {
+		r = uv_ip6_name((const struct sockaddr_in6*)&client->peer, client->ip, sizeof(client->ip));
+	} else if (client->peer.ss_family == AF_UNIX) {
+		snprintf(client->ip, sizeof(client->ip), "unix:");
+	}
+	if (r) {
+		warn_on_uv_err(r, "uv_ip_name");
+		client->ip[0] = '\0';
+	}
+	client->ip[sizeof(client->ip) - 1] = '\0';
+	return client->ip;
+}
+
+const uv_httpd_addr_key_t* uv_httpd_client_addr_key(uv_httpd_client_t* client) {
+	return &client->addr_key;
+}
+
+void uv_httpd_close(uv_httpd_client_t* client) {
+	close_client(client, 0);
+}
+
+void uv_httpd_abort(uv_httpd_client_t* client) {
+	close_client(client, 1);
+}
+
+
+/*************************** HTTP/2 streams ****************/
+
+// answer `Upgrade: h2c` and serve the request on stream 1
+// return 0 if upgraded, or the connection is closing if it failed halfway,
+// otherwise it is served as HTTP/1.1
+static int upgrade_h2c(uv_httpd_client_t* client) {
+	const uv_httpd_string_t* settings = uv_httpd_header(&client->req, "HTTP2-Settings");
+	uv_httpd_client_t* stream;
+	int status;
+
+	if (!client->server->h2c || client->stream || client->limited || client->on_body || client->deferred
+		|| client->req.body.len || !settings || !headers_contains(client, "Upgrade", "h2c")) {
+		return UV_EINVAL;
+	}
+	write_response(client, SWITCHING_TO_H2C, sizeof(SWITCHING_TO_H2C) - 1, 0);
+	if (uv_httpd_h2_create(&client->h2, client, client->req.base + settings->offset, settings->len)
+		|| !(stream = uv_httpd_h2_upgrade(client->h2, client->req.method == HTTP_HEAD))) {
+		close_client(client, 0);
+		return 0;
+	}
+
+	// move the request, offsets are kept
+	client_buf_clear(stream, &stream->pkt);
+	status = pkt_append(stream, client->pkt.buf, client->pkt.size);
+	memcpy(&stream->req, &client->req, sizeof(client->req));
+	if (client->req.headers.headers == client->headers) {
+		memcpy(stream->headers, client->headers, sizeof(client->headers));
+		stream->req.headers.headers = stream->headers;
+	} else {
+		client->req.headers.headers = client->headers;
+	}
+	stream->req.base = stream->pkt.buf;
+	reset_request(client);
+	client_buf_clear(client, &client->pkt);
+	if (status) {
+		reject_request(stream, status);
+	} else {
+		on_message_complete(&stream->parser);
+	}
+	return 0;
+}
+
+static int h2_method(uv_httpd_client_t* client, const char* name, size_t len) {
+#define METHOD_GEN(NUM, NAME, STRING) \
+	if (0 == string0_ncmp(#STRING, name, len)) { \
+		client->parser.method = HTTP_##NAME; \
+		return on_method_complete(&client->parser); \
+	}
+	HTTP_METHOD_MAP(METHOD_GEN)
+#undef METHOD_GEN
+	return reject_request(client, 400);
+}
+
+uv_httpd_client_t* uv_httpd_h2_on_stream_open(uv_httpd_client_t* conn, uv_httpd_h2_stream_t* stream) {
+	uv_httpd_client_t* client = malloc(sizeof(*client));
+	if (!client) return NULL;
+	memset(client, 0, offsetof(uv_httpd_client_t, buf));
+	client->server = conn->server;
+	client->h2 = conn->h2;
+	client->stream = stream;
+	client->on_request = conn->on_request;
+	client->addr_key = conn->addr_key;
+	client->reading = 1;
+	llhttp_init(&client->parser, HTTP_REQUEST, &client->server->http_settings);
+	client->parser.data = client;
+	mybuf_init(&client->buf);
+	mybuf_init(&client->pkt);
+	client->peer = conn->peer;
+	memcpy(client->ip, conn->ip, sizeof(client->ip));
+	client->req.headers.headers = client->headers;
+	on_message_begin(&client->parser);
+	on_version(&client->parser, "2.0", 3);
+	return client;
+}
+
+int uv_httpd_h2_on_header(uv_httpd_client_t* client, const char* name, size_t name_len, const char* value, size_t value_len) {
+	llhttp_t* parser = &client->parser;
+	int r;
+
+	if (client->closing || client->close_when_flushed) return 1;
+	if (name_len && name[0] == ':') {
+		if (0 == string0_ncmp(":method", name, name_len)) {
+			return h2_method(client, value, value_len);
+		} else if (0 == string0_ncmp(":path", name, name_len)) {
+			return on_url(parser, value, value_len);
+		} else if (string0_ncmp(":authority", name, name_len)) {
+			// :scheme
+			return 0;
+		}
+		name = "host";
+		name_len = 4;
+	} else if (0 == string0_ncmp("content-length", name, name_len)) {
+		// digits only and no overflow, a malformed one resets the stream, see uv_httpd_h2.c on_header.
+		// DATA beyond it resets the stream too, the body is never longer
+		size_t i;
+		parser->content_length = 0;
+		for (i = 0; i < value_len && value[i] >= '0' && value[i] <= '9'; i++) {
+			parser->content_length = parser->content_length * 10 + (uint64_t)(value[i] - '0');
+		}
+		parser->flags |= F_CONTENT_LENGTH;
+	}
+	if ((r = on_header_field(parser, name, name_len)) || (r = on_header_field_complete(parser))
+		|| (r = on_header_value(parser, value, value_len)) || (r = on_header_value_complete(parser))) {
+		return r;
+	}
+	return 0;
+}
+
+int uv_httpd_h2_on_headers_done(uv_httpd_client_t* client) {
+	if (client->closing || client->close_when_flushed) return 0;
+	return on_headers_complete(&client->parser);
+}
+
+void uv_httpd_h2_on_data(uv_httpd_client_t* client, const char* data, size_t len) {
+	if (client->closing || client->close_when_flushed) return;
+	on_body(&client->parser, data, len);
+}
+
+void uv_httpd_h2_on_end(uv_httpd_client_t* client) {
+	if (client->closing || client->close_when_flushed) return;
+	on_message_complete(&client->parser);
+}
+
+void uv_httpd_h2_on_flushed(uv_httpd_client_t* client) {
+	if (client->pending_writes == 0) return;
+	client->pending_writes = 0;
+	flushed(client);
+}
+
+void uv_httpd_h2_on_reset(uv_httpd_client_t* client) {
+	client->closing = 1;
+}
+
+void uv_httpd_h2_on_stream_free(uv_httpd_client_t* client) {
+	client->closing = 1;
+	if (client->deferred && client->on_abort) {
+		abort_response(client);
+	}
+	if (client->in_message || client->deferred) {
+		UV_HTTPD_TRACE_ASYNC_END(REQUEST, client, 0);
+		log_request(client);
+	}
+	if (client->gzip) {
+		uv_httpd_gzip_filter_free(client->gzip);
+	}
+	if (client->tls) {
+		uv_httpd_tls_conn_free(client->tls);
+	}
+	client_buf_clear(client, &client->buf);
+	client_buf_clear(client, &client->pkt);
+	reset_request(client);
+	free(client);
+}
+
+int uv_httpd_h2_send(uv_httpd_client_t* conn, const char* data, size_t len) {
+	// a frame never starts with `HTTP/`, nothing is inserted
+	return write_response(conn, data, len, 0);
+}
+
+
+/*************************** compression ****************/
+
+// filter the response if the request accepts a content coding
+static void gzip_request(uv_httpd_client_t* client) {
+	int encoding = uv_httpd_gzip_encoding(&client->req);
+	int chunked = string0_ncmp("1.0", client->req.base + client->req.version.offset, client->req.version.len);
+	int r;
+
+	if (encoding == UV_HTTPD_IDENTITY || client->req.method == HTTP_HEAD) return;
+	r = uv_httpd_gzip_filter_create(&client->gzip, client->server->gzip, client, encoding, chunked);
+	warn_on_uv_err(r, "uv_httpd_gzip_filter_create");
+}
+
+int uv_httpd_gzip_send(uv_httpd_client_t* client, const char* data, size_t len) {
+	return write_response(client, data, len, 0);
+}
+
+void uv_httpd_gzip_on_done(uv_httpd_client_t* client) {
+	if (client->closing || compressing(client)) return;
+	if (client->waiting && !client->deferred) {
+		// on_message_complete waited for it
+		next_request(client);
+	} else if (client->pending_writes == 0) {
+		// close_client or uv_httpd_on_flushed may wait for it
+		flushed(client);
+	}
+}
+
+
+/*************************** TLS ****************/
+
+int uv_httpd_tls_send(uv_httpd_client_t* client, const char* data, size_t len) {
+	uv_buf_t buf = uv_buf_init((char*)data, (unsigned int)len);
+	return write_bufs(client, &buf, 1);
+}
+
+
+/*************************** in-memory connections ****************/
+
+int uv_httpd_mem_create(uv_httpd_mem_t** mem, uv_httpd_server_t* server) {
+	uv_httpd_client_t* client;
+	uv_httpd_mem_t* m = malloc(sizeof(*m));
+	if (!m) return UV_ENOMEM;
+	client = calloc(1, sizeof(*client));
+	if (!client) {
+		free(m);
+		return UV_ENOMEM;
+	}
+	// never connected, but closed as usual so the client is freed by on_close
+	uv_tcp_init(server->tcp.loop, &client->tcp);
+	UV_HTTPD_TRACE_ASYNC_BEGIN(CONNECTION, client, 0);
+	client_init(server, client);
+	client->mem = m;
+	m->client = client;
+	mybuf_init(&m->output);
+	update_reading(client);
+	*mem = m;
+	return 0;
+}
+
+void uv_httpd_mem_free(uv_httpd_mem_t* mem) {
+	if (mem->client) {
+		mem->client->mem = NULL;
+		close_client(mem->client, 1);
+	}
+	mybuf_clear(&mem->output);
+	free(mem);
+}
+
+size_t uv_httpd_mem_feed(uv_httpd_mem_t* mem, const char* data, size_t len, size_t fragment) {
+	size_t fed = 0, n;
+	uv_buf_t buf;
+
+	while (fed < len && !uv_httpd_mem_closed(mem) && mem->client->reading) {
+		uv_httpd_client_t* client = mem->client;
+		on_alloc((uv_handle_t*)&client->tcp, 65536, &buf);
+		n = len - fed;
+		if (n > buf.len) n = buf.len;
+		if (fragment && n > fragment) n = fragment;
+		memcpy(buf.base, data + fed, n);
+		on_read((uv_stream_t*)&client->tcp, (ssize_t)n, &buf);
+		fed += n;
+	}
+	return fed;
+}
+
+void uv_httpd_mem_eof(uv_httpd_mem_t* mem) {
+	uv_buf_t buf = uv_buf_init(NULL, 0);
+	if (mem->client && !mem->client->closing) {
+		on_read((uv_stream_t*)&mem->client->tcp, UV_EOF, &buf);
+	}
+}
+
+mybuf_t* uv_httpd_mem_output(uv_httpd_mem_t* mem) {
+	return &mem->output;
+}
+
+int uv_httpd_mem_closed(uv_httpd_mem_t* mem) {
+	return !mem->client || mem->client->closing || mem->client->close_when_flushed;
 }
@@ -5,6 +5,27 @@
 
 #include <uv.h>
 #include "llhttp/include/llhttp.h"
+#include "queue.h"
+
+#ifndef UV_HTTPD_MAX_URL
+#define UV_HTTPD_MAX_URL (8 * 1024)
+#endif
+
+#ifndef UV_HTTPD_MAX_HEADERS
+#define UV_HTTPD_MAX_HEADERS (32 * 1024) // bytes of all header fields and values
+#endif
+
+#ifndef UV_HTTPD_MAX_HEADER_COUNT
+#define UV_HTTPD_MAX_HEADER_COUNT 100
+#endif
+
+#ifndef UV_HTTPD_MAX_BODY
+#define UV_HTTPD_MAX_BODY (1024 * 1024) // buffered body, streamed bodies are not limited
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 typedef struct {
 	size_t offset;
@@ -22,7 +43,6 @@ typedef struct {
 }uv_httpd_headers_t;
 
 typedef struct {
-	char ip[24]; // peer address
 	const char* base; // base address for offset/len
 	uv_httpd_string_t remote; // remote address ip:port
 	llhttp_method_t method;
@@ -32,10 +52,48 @@ typedef struct {
 	uv_httpd_string_t body;
 }uv_httpd_request_t;
 
+typedef struct {
+	uint64_t connections; // accepted connections
+	uint64_t active; // current open connections
+	uint64_t requests; // completed requests
+	uint64_t limited; // connections and requests rejected by rate limit
+	uint64_t rejected; // requests rejected by `uv_httpd_limits_t` or `uv_httpd_reject`
+	uint64_t memory; // current bytes buffered by connections
+}uv_httpd_stats_t;
+
+// a request exceeding a limit is answered 414/431/413 and the connection is closed,
+// so a connection buffers at most about `max_url + max_headers + max_body` bytes.
+// requests that would push the total over `max_memory` are answered 503.
+typedef struct {
+	size_t max_url;
+	size_t max_headers;
+	size_t max_header_count;
+	size_t max_body;
+	size_t max_memory; // all connections, 0 for unlimited
+}uv_httpd_limits_t;
+
 typedef struct uv_httpd_client_s uv_httpd_client_t;
 typedef struct uv_httpd_server_s uv_httpd_server_t;
+typedef struct uv_httpd_ratelimit_s uv_httpd_ratelimit_t;
+typedef struct uv_httpd_gzip_s uv_httpd_gzip_t;
+typedef struct uv_httpd_watchdog_s uv_httpd_watchdog_t;
+typedef struct uv_httpd_tls_s uv_httpd_tls_t;
+typedef struct uv_httpd_accesslog_s uv_httpd_accesslog_t;
 
 typedef void(*on_request_t)(uv_httpd_server_t* server, uv_httpd_client_t* client, uv_httpd_request_t* req);
+// called when headers are parsed, before the body. `req->body` is empty, and
+// `req->base` is only valid in this call.
+// return 0 to continue, otherwise the connection is closed.
+// if the client sent `Expect: 100-continue`, `100 Continue` is written after it returns,
+// unless the request is answered by `uv_httpd_reject`.
+typedef int(*on_headers_t)(uv_httpd_server_t* server, uv_httpd_client_t* client, uv_httpd_request_t* req);
+// body data of a request, `len` is 0 at the end of the body
+typedef void(*on_body_t)(uv_httpd_client_t* client, const char* at, size_t len);
+// connection closed before `uv_httpd_response_done`
+typedef void(*on_abort_t)(uv_httpd_client_t* client);
+typedef void(*on_flushed_t)(uv_httpd_client_t* client);
+// status is 0 for success, otherwise it is `uv_errno_t`
+typedef void(*uv_httpd_done_t)(uv_httpd_server_t* server, int status);
 
 void nprintf(const char* msg, size_t len, int newline);
 int string_ncmp(const char* s1, size_t len1, const char* s2, size_t len2);
@@ -43,25 +101,105 @@ int string0_ncmp(const char* s1, const char* s2, size_t len2);
 int string_nicmp(const char* s1, size_t len1, const char* s2, size_t len2);
 int string0_nicmp(const char* s1, const char* s2, size_t len2);
 
-// enable `printf`s, default is disabled
-void uv_httpd_enable_printf(int enable);
+// find header by case insensitive `key`, return NULL if not found
+const uv_httpd_string_t* uv_httpd_header(const uv_httpd_request_t* req, const char* key);
+
 // return 0 for success, otherwise it is `uv_errno_t`
 // if your want to use a existing `uv_loop_t`, pass it by `loop`
 // otherwise a new `uv_loop_t` will be created.
 int uv_httpd_create(uv_httpd_server_t** server, uv_loop_t* loop, on_request_t on_request);
 void uv_httpd_stop(uv_httpd_server_t* server);
+// graceful stop: stop accepting, close keep-alive connections idle for a while,
+// answer in-flight and new requests with `Connection: close` and close them after their
+// write queues are flushed. connections still open after `timeout` ms are closed
+// by force, and `on_drained` gets `UV_ETIMEDOUT` in that case.
+// while draining, `uv_httpd_write_response` inserts `Connection: close` after
+// the status line, so responses should not carry their own `Connection` header.
+void uv_httpd_drain(uv_httpd_server_t* server, uint64_t timeout, uv_httpd_done_t on_drained);
 void uv_httpd_free(uv_httpd_server_t* server);
+// `ip` is ipv4 or ipv6, e.g. "::" accepts both on a dual-stack host.
 // return 0 for success, otherwise it is uv_errno_t
 int uv_httpd_listen(uv_httpd_server_t* server, const char* ip, int port);
+// listen on a unix domain socket, or a named pipe `\\.\pipe\name` on windows,
+// e.g. behind a local reverse proxy. it can be used along with `uv_httpd_listen`.
+// the socket file is removed when the server stops, UV_EADDRINUSE if it exists.
+// return 0 for success, otherwise it is uv_errno_t
+int uv_httpd_listen_pipe(uv_httpd_server_t* server, const char* name);
+// start accepting on `server->tcp` which is already bound,
+// e.g. a listening socket received from the prefork master.
+// return 0 for success, otherwise it is uv_errno_t
+int uv_httpd_listen_bound(uv_httpd_server_t* server);
 // return 0 for success, otherwise it is uv_errno_t
 int uv_httpd_write_response(uv_httpd_client_t* client, char* response, size_t len);
+// answer the request without receiving the rest of the body, e.g. 401 or 413
+// in `on_headers`, or 400 on a malformed streamed body in `on_body`.
+// the connection is closed after `response` is written, since a client sending
+// `Expect: 100-continue` may or may not send the body after a final status.
+// return 0 for success, otherwise it is uv_errno_t
+int uv_httpd_reject(uv_httpd_client_t* client, char* response, size_t len);
+
+// respond asynchronously: call it in `on_request` or `on_headers`, and call
+// `uv_httpd_response_done` after the whole response is written.
+// pipelined requests are not parsed until then.
+void uv_httpd_defer_response(uv_httpd_client_t* client, on_abort_t on_abort);
+void uv_httpd_response_done(uv_httpd_client_t* client);
+// receive the request body by `on_body` instead of `req->body`, call it in `on_headers`.
+// `on_request` is not called, the response is deferred.
+void uv_httpd_stream_body(uv_httpd_client_t* client, on_body_t on_body, on_abort_t on_abort);
+// flow control of the request body
+void uv_httpd_read_stop(uv_httpd_client_t* client);
+void uv_httpd_read_start(uv_httpd_client_t* client);
+// `cb` is called once when all written responses are flushed
+void uv_httpd_on_flushed(uv_httpd_client_t* client, on_flushed_t cb);
+size_t uv_httpd_write_queue_size(uv_httpd_client_t* client);
+void uv_httpd_client_set_data(uv_httpd_client_t* client, void* data);
+void* uv_httpd_client_get_data(uv_httpd_client_t* client);
+uv_httpd_server_t* uv_httpd_client_server(uv_httpd_client_t* client);
+// peer address of the connection, `ss_family` is AF_UNIX for a unix domain socket,
+// AF_UNSPEC for an in-memory connection
+const struct sockaddr_storage* uv_httpd_client_addr(uv_httpd_client_t* client);
+// peer address text, ipv4 or ipv6, "unix:" for a unix domain socket, "" if unknown.
+// formatted by the first call and cached for the connection
+const char* uv_httpd_client_ip(uv_httpd_client_t* client);
+// close the connection after written responses are flushed, e.g. a deferred response failed halfway
+void uv_httpd_close(uv_httpd_client_t* client);
+// close the connection now, responses not written yet are dropped, e.g. a reader too slow
+void uv_httpd_abort(uv_httpd_client_t* client);
 
 
 struct uv_httpd_server_s {
 	uv_tcp_t tcp;
+	uv_pipe_t* pipe; // NULL unless `uv_httpd_listen_pipe`
 	llhttp_settings_t http_settings;
 	on_request_t on_request;
+	on_headers_t on_headers; // optional
+	// optional, each connection and each request after its first takes a token of the
+	// client address, answered 429 if none left. see uv_httpd_ratelimit.h
+	uv_httpd_ratelimit_t* ratelimit;
+	uv_httpd_limits_t limits; // defaults to UV_HTTPD_MAX_*, no memory budget
+	// accept HTTP/2 over cleartext, with prior knowledge or by `Upgrade: h2c`.
+	// every stream is a `uv_httpd_client_t` answered by HTTP/1.1 responses as usual.
+	// default is 0, see uv_httpd_h2.h
+	int h2c;
+	// optional, compress responses accepted by `Accept-Encoding`. see uv_httpd_gzip.h
+	uv_httpd_gzip_t* gzip;
+	// optional, callbacks blocking the loop are reported by it. see uv_httpd_watchdog.h
+	uv_httpd_watchdog_t* watchdog;
+	// optional, connections accepted on `tcp` are TLS. see uv_httpd_tls.h
+	uv_httpd_tls_t* tls;
+	// optional, a line per request written by a thread of its own. see uv_httpd_accesslog.h
+	uv_httpd_accesslog_t* accesslog;
+	uv_httpd_stats_t stats;
+	QUEUE clients;
+	int draining;
+	uv_timer_t drain_timer;
+	uint64_t drain_deadline;
+	uv_httpd_done_t on_drained;
 	void* data;
 };
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
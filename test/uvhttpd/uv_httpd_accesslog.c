@@ -0,0 +1,401 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "uv_httpd_accesslog.h"
+#include "uv_log.h"
+
+// the loop publishes `head` after filling an entry, the writer publishes `tail` after
+// formatting entries. each is written by one thread only
+#ifdef _MSC_VER
+// volatile accesses are acquire and release by /volatile:ms, the default on x86 and x64
+#define LOAD_ACQUIRE(p) (*(volatile uint64_t*)(p))
+#define STORE_RELEASE(p, v) (*(volatile uint64_t*)(p) = (v))
+#else
+#define LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+
+#define NS_PER_MS 1000000
+#define CACHE_LINE 64
+// a formatted entry: the target escaped takes at most 4 times its size, the rest is under 256
+#define ENTRY_LINE_MAX (4 * UV_HTTPD_ACCESSLOG_TARGET + 256)
+#define MASK (UV_HTTPD_ACCESSLOG_ENTRIES - 1)
+#define WAKE_EVERY 64 // entries between wakeups of the writer past a half full ring
+
+struct uv_httpd_accesslog_s {
+	uv_httpd_accesslog_entry_t ring[UV_HTTPD_ACCESSLOG_ENTRIES];
+	// the loop
+	uint64_t head; // entries committed
+	uint64_t tail_seen; // `tail` when last read, the ring is full only if it says so
+	uint64_t entries, dropped;
+	uint64_t errors_reported; // of `errors`, logged by the loop
+	char pad[CACHE_LINE]; // `head` and `tail` are not on the same cache line
+	// the writer
+	uint64_t tail; // entries formatted
+	uint64_t errors; // `stats.errors` published for the loop, which logs them, see report_errors
+	char* path; // NULL for stdout
+	uv_file file;
+	int64_t cached_sec; // of `cached_time`
+	char cached_time[48];
+	size_t cached_len;
+	size_t batch_len;
+	char batch[UV_HTTPD_ACCESSLOG_BATCH + ENTRY_LINE_MAX];
+	// `stop`, `reopen` and `stats` are guarded by `mutex`, the loop's counters excepted
+	uv_thread_t thread;
+	uv_mutex_t mutex;
+	uv_cond_t cond;
+	int stop;
+	int reopen;
+	int last_error; // of the errors so far, `uv_errno_t`
+	uv_httpd_accesslog_stats_t stats;
+};
+
+
+/*************************** writer thread ****************/
+
+static char* write_u64(char* p, uint64_t v) {
+	char tmp[20];
+	size_t n = 0;
+	do {
+		tmp[n++] = (char)('0' + v % 10);
+		v /= 10;
+	} while (v);
+	while (n) *p++ = tmp[--n];
+	return p;
+}
+
+static char* write_2digits(char* p, int v) {
+	*p++ = (char)('0' + v / 10);
+	*p++ = (char)('0' + v % 10);
+	return p;
+}
+
+// days since 1970-01-01 of a civil date
+static int64_t days_from_civil(int64_t y, int m, int d) {
+	int64_t era, yoe, doy;
+	y -= m <= 2;
+	era = (y >= 0 ? y : y - 399) / 400;
+	yoe = y - era * 400;
+	doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+	return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+}
+
+// "18/Oct/2026:19:26:43 +0800" of local time, formatted once a second
+static void format_time(uv_httpd_accesslog_t* log, int64_t sec) {
+	time_t t = (time_t)sec;
+	struct tm tm;
+	int64_t offset;
+	char* p;
+
+	if (sec == log->cached_sec && log->cached_len) return;
+#ifdef _WIN32
+	localtime_s(&tm, &t);
+#else
+	localtime_r(&t, &tm);
+#endif
+	offset = (days_from_civil(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday) * 86400 +
+			  tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec - sec) / 60;
+	p = log->cached_time + strftime(log->cached_time, 32, "%d/%b/%Y:%H:%M:%S ", &tm);
+	*p++ = offset < 0 ? '-' : '+';
+	if (offset < 0) offset = -offset;
+	p = write_2digits(p, (int)(offset / 60 % 100));
+	p = write_2digits(p, (int)(offset % 60));
+	log->cached_len = p - log->cached_time;
+	log->cached_sec = sec;
+}
+
+// `wall` is the wall clock in ms at uv_now 0
+static void format_entry(uv_httpd_accesslog_t* log, const uv_httpd_accesslog_entry_t* e, int64_t wall) {
+	static const char hex[] = "0123456789abcdef";
+	char* p = log->batch + log->batch_len;
+	uint64_t ms = e->end - e->start;
+	size_t i;
+
+	if ((e->family == AF_INET || e->family == AF_INET6) && 0 == uv_inet_ntop(e->family, e->addr, p, 46)) {
+		p += strlen(p);
+	} else {
+		*p++ = '-';
+	}
+	memcpy(p, " - - [", 6);
+	p += 6;
+	format_time(log, (wall + (int64_t)e->end) / 1000);
+	memcpy(p, log->cached_time, log->cached_len);
+	p += log->cached_len;
+	memcpy(p, "] \"", 3);
+	p += 3;
+	i = strlen(llhttp_method_name(e->method));
+	memcpy(p, llhttp_method_name(e->method), i);
+	p += i;
+	*p++ = ' ';
+	// the line stays one line and its quotes stay balanced
+	for (i = 0; i < e->target_len; i++) {
+		unsigned char c = (unsigned char)e->target[i];
+		if (c < 0x20 || c >= 0x7f || c == '"' || c == '\\') {
+			*p++ = '\\';
+			*p++ = 'x';
+			*p++ = hex[c >> 4];
+			*p++ = hex[c & 15];
+		} else {
+			*p++ = (char)c;
+		}
+	}
+	if (e->truncated) {
+		memcpy(p, "...", 3);
+		p += 3;
+	}
+	if (e->version) {
+		// not parsed yet if the request was rejected early
+		memcpy(p, " HTTP/", 6);
+		p += 6;
+		*p++ = (char)('0' + e->version / 10 % 10);
+		*p++ = '.';
+		*p++ = (char)('0' + e->version % 10);
+	}
+	*p++ = '"';
+	*p++ = ' ';
+	if (e->status) {
+		p = write_u64(p, e->status);
+	} else {
+		*p++ = '-';
+	}
+	*p++ = ' ';
+	p = write_u64(p, e->bytes);
+	*p++ = ' ';
+	p = write_u64(p, ms / 1000);
+	*p++ = '.';
+	*p++ = (char)('0' + ms / 100 % 10);
+	p = write_2digits(p, (int)(ms % 100));
+	*p++ = '\n';
+	log->batch_len = p - log->batch;
+}
+
+static int open_file(uv_httpd_accesslog_t* log) {
+	uv_fs_t req;
+	int r;
+	if (!log->path) {
+		log->file = 1;
+		return 0;
+	}
+	r = uv_fs_open(NULL, &req, log->path, UV_FS_O_WRONLY | UV_FS_O_APPEND | UV_FS_O_CREAT, 0644, NULL);
+	uv_fs_req_cleanup(&req);
+	if (r < 0) return r;
+	log->file = r;
+	return 0;
+}
+
+static void close_file(uv_httpd_accesslog_t* log) {
+	uv_fs_t req;
+	if (!log->path || log->file < 0) return;
+	uv_fs_close(NULL, &req, log->file, NULL);
+	uv_fs_req_cleanup(&req);
+	log->file = -1;
+}
+
+// write `batch` whole, return 0 for success, otherwise it is `uv_errno_t`
+static int flush(uv_httpd_accesslog_t* log, uv_httpd_accesslog_stats_t* stats) {
+	size_t off = 0;
+	uv_buf_t buf;
+	uv_fs_t req;
+	int r = 0;
+
+	while (off < log->batch_len && log->file >= 0) {
+		buf = uv_buf_init(log->batch + off, (unsigned int)(log->batch_len - off));
+		r = uv_fs_write(NULL, &req, log->file, &buf, 1, -1, NULL);
+		uv_fs_req_cleanup(&req);
+		if (r < 0) break;
+		stats->writes++;
+		stats->written += r;
+		off += r;
+		r = 0;
+	}
+	if (off < log->batch_len) {
+		stats->errors++;
+		if (r == 0) r = UV_EBADF; // not reopened
+	}
+	log->batch_len = 0;
+	return r;
+}
+
+// format and write all entries committed so far, return the last error or 0
+static int drain(uv_httpd_accesslog_t* log, uv_httpd_accesslog_stats_t* stats) {
+	uint64_t head = LOAD_ACQUIRE(&log->head);
+	uint64_t tail = log->tail;
+	uv_timeval64_t now;
+	int64_t wall;
+	int r, err = 0;
+
+	if (head == tail) return 0;
+	// uv_now is uv_hrtime in ms, cached by the loop
+	uv_gettimeofday(&now);
+	wall = now.tv_sec * 1000 + now.tv_usec / 1000 - (int64_t)(uv_hrtime() / NS_PER_MS);
+	while (tail != head) {
+		format_entry(log, &log->ring[tail++ & MASK], wall);
+		if (log->batch_len >= UV_HTTPD_ACCESSLOG_BATCH) {
+			// formatted, the loop may reuse them
+			STORE_RELEASE(&log->tail, tail);
+			if ((r = flush(log, stats))) {
+				err = r;
+			}
+		}
+	}
+	STORE_RELEASE(&log->tail, tail);
+	if ((r = flush(log, stats))) {
+		err = r;
+	}
+	return err;
+}
+
+static void write_thread(void* arg) {
+	uv_httpd_accesslog_t* log = arg;
+	uv_httpd_accesslog_stats_t stats;
+	int stop, reopen, r, err;
+
+	uv_mutex_lock(&log->mutex);
+	for (;;) {
+		stop = log->stop;
+		reopen = log->reopen;
+		log->reopen = 0;
+		uv_mutex_unlock(&log->mutex);
+
+		memset(&stats, 0, sizeof(stats));
+		// errors are only counted here, the loop logs them, see report_errors
+		err = drain(log, &stats);
+		if (reopen) {
+			close_file(log);
+			stats.reopens++;
+			if ((r = open_file(log))) {
+				stats.errors++;
+				err = r;
+			}
+		}
+
+		uv_mutex_lock(&log->mutex);
+		log->stats.written += stats.written;
+		log->stats.writes += stats.writes;
+		log->stats.reopens += stats.reopens;
+		if (stats.errors) {
+			log->stats.errors += stats.errors;
+			log->last_error = err;
+			STORE_RELEASE(&log->errors, log->stats.errors);
+		}
+		if (stop) break;
+		// woken early by a half full ring, `stop` or `reopen`
+		if (!log->stop && !log->reopen && LOAD_ACQUIRE(&log->head) - log->tail < UV_HTTPD_ACCESSLOG_ENTRIES / 2) {
+			uv_cond_timedwait(&log->cond, &log->mutex, (uint64_t)UV_HTTPD_ACCESSLOG_FLUSH * NS_PER_MS);
+		}
+	}
+	uv_mutex_unlock(&log->mutex);
+}
+
+
+/*************************** loop ****************/
+
+// errors of the writer since the last report, logged on the loop
+static void report_errors(uv_httpd_accesslog_t* log) {
+	uint64_t errors;
+	int err;
+	uv_mutex_lock(&log->mutex);
+	errors = log->stats.errors;
+	err = log->last_error;
+	uv_mutex_unlock(&log->mutex);
+	uvlog_warn("access log: %llu failed writes or reopens of %s, the last %s, their lines are lost",
+			   (unsigned long long)(errors - log->errors_reported), log->path ? log->path : "stdout", uv_err_name(err));
+	log->errors_reported = errors;
+}
+
+uv_httpd_accesslog_entry_t* uv_httpd_accesslog_reserve(uv_httpd_accesslog_t* log) {
+	if (log->head - log->tail_seen == UV_HTTPD_ACCESSLOG_ENTRIES) {
+		log->tail_seen = LOAD_ACQUIRE(&log->tail);
+		if (log->head - log->tail_seen == UV_HTTPD_ACCESSLOG_ENTRIES) {
+			log->dropped++;
+			return NULL;
+		}
+	}
+	return &log->ring[log->head & MASK];
+}
+
+void uv_httpd_accesslog_commit(uv_httpd_accesslog_t* log) {
+	STORE_RELEASE(&log->head, log->head + 1);
+	log->entries++;
+	if (LOAD_ACQUIRE(&log->errors) != log->errors_reported) {
+		report_errors(log);
+	}
+	if (log->head - log->tail_seen >= UV_HTTPD_ACCESSLOG_ENTRIES / 2 && (log->head & (WAKE_EVERY - 1)) == 0) {
+		// the writer is woken by a half full ring, otherwise by UV_HTTPD_ACCESSLOG_FLUSH.
+		// not under `mutex`, a wakeup lost while the writer is busy is made up by the next one
+		log->tail_seen = LOAD_ACQUIRE(&log->tail);
+		if (log->head - log->tail_seen >= UV_HTTPD_ACCESSLOG_ENTRIES / 2) {
+			uv_cond_signal(&log->cond);
+		}
+	}
+}
+
+int uv_httpd_accesslog_create(uv_httpd_accesslog_t** log, const char* path) {
+	uv_httpd_accesslog_t* l = calloc(1, sizeof(*l));
+	int r;
+	if (!l) return UV_ENOMEM;
+	l->file = -1;
+	if (path && strcmp(path, "-") != 0) {
+		l->path = strdup(path);
+		if (!l->path) {
+			free(l);
+			return UV_ENOMEM;
+		}
+	}
+	if ((r = open_file(l))) {
+		free(l->path);
+		free(l);
+		return r;
+	}
+	if ((r = uv_mutex_init(&l->mutex))) {
+		goto failed;
+	}
+	if ((r = uv_cond_init(&l->cond))) {
+		uv_mutex_destroy(&l->mutex);
+		goto failed;
+	}
+	if ((r = uv_thread_create(&l->thread, write_thread, l))) {
+		uv_cond_destroy(&l->cond);
+		uv_mutex_destroy(&l->mutex);
+		goto failed;
+	}
+	*log = l;
+	return 0;
+
+failed:
+	close_file(l);
+	free(l->path);
+	free(l);
+	return r;
+}
+
+void uv_httpd_accesslog_free(uv_httpd_accesslog_t* log) {
+	uv_mutex_lock(&log->mutex);
+	log->stop = 1;
+	uv_cond_signal(&log->cond);
+	uv_mutex_unlock(&log->mutex);
+	uv_thread_join(&log->thread);
+	if (log->errors != log->errors_reported) {
+		report_errors(log);
+	}
+	uv_cond_destroy(&log->cond);
+	uv_mutex_destroy(&log->mutex);
+	close_file(log);
+	free(log->path);
+	free(log);
+}
+
+void uv_httpd_accesslog_reopen(uv_httpd_accesslog_t* log) {
+	uv_mutex_lock(&log->mutex);
+	log->reopen = 1;
+	uv_cond_signal(&log->cond);
+	uv_mutex_unlock(&log->mutex);
+}
+
+void uv_httpd_accesslog_stats(uv_httpd_accesslog_t* log, uv_httpd_accesslog_stats_t* stats) {
+	uv_mutex_lock(&log->mutex);
+	*stats = log->stats;
+	uv_mutex_unlock(&log->mutex);
+	stats->entries = log->entries;
+	stats->dropped = log->dropped;
+}
@@ -0,0 +1,75 @@
+#ifndef __UV_HTTPD_ACCESSLOG_H__
+#define __UV_HTTPD_ACCESSLOG_H__
+
+#pragma once
+
+#include <stdint.h>
+#include "uv_httpd.h"
+
+// access log: a line per request in the Common Log Format, followed by the seconds from
+// the first byte of the request to its end, e.g.
+//   127.0.0.1 - - [18/Oct/2026:19:26:43 +0800] "GET /api/stats HTTP/1.1" 200 421 0.002
+// the loop only copies a fixed size entry into a ring, a thread of the log formats the
+// entries and writes them in batches by `uv_fs_write`, so the loop never formats a time
+// or blocks on the file. the ring has one producer and one consumer and takes no lock:
+// a log belongs to one loop, servers of other loops need logs of their own.
+// if the ring is full the entry is dropped and counted, the loop never waits for the disk.
+// `uv_httpd_accesslog_reopen` after the file is renamed, e.g. by logrotate, on a signal.
+
+#ifndef UV_HTTPD_ACCESSLOG_ENTRIES
+#define UV_HTTPD_ACCESSLOG_ENTRIES 8192 // entries of the ring, must be power of 2
+#endif
+
+#ifndef UV_HTTPD_ACCESSLOG_TARGET
+#define UV_HTTPD_ACCESSLOG_TARGET 96 // bytes of the request target kept, at most 255
+#endif
+
+#ifndef UV_HTTPD_ACCESSLOG_FLUSH
+#define UV_HTTPD_ACCESSLOG_FLUSH 200 // ms, entries wait at most about this long
+#endif
+
+#ifndef UV_HTTPD_ACCESSLOG_BATCH
+#define UV_HTTPD_ACCESSLOG_BATCH (64 * 1024) // bytes of lines per write
+#endif
+
+typedef struct uv_httpd_accesslog_s uv_httpd_accesslog_t;
+
+typedef struct {
+	uint64_t start; // uv_now of the first byte of the request
+	uint64_t end; // uv_now of the end of the response
+	uint64_t bytes; // of the response written, after compression
+	uint16_t status; // 0 if no response was written
+	uint8_t method; // llhttp_method_t
+	uint8_t version; // major * 10 + minor, 20 for HTTP/2
+	uint8_t family; // of `addr`, AF_INET or AF_INET6, otherwise no address
+	uint8_t target_len;
+	uint8_t truncated; // the target was longer than UV_HTTPD_ACCESSLOG_TARGET
+	uint8_t addr[16];
+	char target[UV_HTTPD_ACCESSLOG_TARGET];
+}uv_httpd_accesslog_entry_t;
+
+typedef struct {
+	uint64_t entries; // committed by the loop
+	uint64_t dropped; // the ring was full
+	uint64_t written; // bytes written to the file
+	uint64_t writes;
+	uint64_t reopens;
+	uint64_t errors; // failed writes and opens, their lines are lost
+}uv_httpd_accesslog_stats_t;
+
+// append to the file at `path`, created if not exists, "-" for stdout.
+// return 0 for success, otherwise it is `uv_errno_t`
+int uv_httpd_accesslog_create(uv_httpd_accesslog_t** log, const char* path);
+// entries in the ring are written first
+void uv_httpd_accesslog_free(uv_httpd_accesslog_t* log);
+// open `path` again by the writer after the entries so far are written
+void uv_httpd_accesslog_reopen(uv_httpd_accesslog_t* log);
+
+// the next entry to fill on the loop, NULL if the ring is full.
+// `uv_httpd_accesslog_commit` hands it to the writer
+uv_httpd_accesslog_entry_t* uv_httpd_accesslog_reserve(uv_httpd_accesslog_t* log);
+void uv_httpd_accesslog_commit(uv_httpd_accesslog_t* log);
+
+void uv_httpd_accesslog_stats(uv_httpd_accesslog_t* log, uv_httpd_accesslog_stats_t* stats);
+
+#endif
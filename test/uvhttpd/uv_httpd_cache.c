@@ -0,0 +1,596 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "uv_httpd_cache.h"
+#include "uv_http_client.h"
+#include "uv_httpd_url.h"
+#include "mybuf.h"
+#include "uv_log.h"
+
+#define BUCKETS_MIN 1024 // must be power of 2, doubled as entries grow
+#define LOAD_BUCKETS 256 // must be power of 2
+
+#define CACHE_HEAD "HTTP/1.1 200 OK\r\n" \
+	"Content-Type: application/octet-stream\r\n" \
+	"Content-Length: %zu\r\n\r\n"
+#define CACHE_NOT_FOUND "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n"
+#define CACHE_FAILED "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n"
+#define CACHE_BAD_METHOD "HTTP/1.1 405 Method Not Allowed\r\nAllow: GET\r\nContent-Length: 0\r\n\r\n"
+
+typedef struct entry_s {
+	QUEUE lru; // in cache->lru, most recent first
+	struct entry_s* next; // in bucket
+	uint64_t hash;
+	size_t key_len, len; // the key follows the entry, then the value
+}entry_t;
+
+typedef struct {
+	QUEUE node; // in load->waiters
+	uv_httpd_cache_on_value_t on_value;
+	void* data;
+}waiter_t;
+
+struct uv_httpd_cache_load_s {
+	uv_httpd_cache_t* cache;
+	struct uv_httpd_cache_load_s* next; // in cache->loads
+	uint64_t hash;
+	QUEUE waiters;
+	int cacheable; // 0 if loaded here because the owner didn't answer
+	int asking; // waiting for the owner, see `get`
+	int remote_status; // of the response of the owner
+	mybuf_t remote; // the value from the owner
+	size_t key_len; // the key follows the load
+};
+
+typedef struct {
+	char* path; // of the unix socket
+	char* url; // http+unix:// of `path`
+}peer_t;
+
+typedef struct {
+	uint32_t hash;
+	int peer;
+}point_t;
+
+struct uv_httpd_cache_s {
+	uv_loop_t* loop;
+	size_t size;
+	uv_httpd_cache_loader_t loader;
+	void* data;
+	entry_t** buckets;
+	size_t nbuckets;
+	QUEUE lru;
+	uv_httpd_cache_load_t* loads[LOAD_BUCKETS];
+	peer_t peers[UV_HTTPD_CACHE_MAX_PEERS];
+	int npeers;
+	int self; // index in `peers`, -1 if not a member
+	point_t* ring; // sorted by hash
+	size_t npoints;
+	uv_http_client_t* client; // to peers, created with the first one
+	int closing;
+	uv_httpd_cache_stats_t stats;
+};
+
+// a response waiting for its value
+typedef struct {
+	uv_httpd_client_t* client; // NULL if closed before
+}serve_t;
+
+
+/*************************** helper functions ****************/
+
+static uint64_t hash_key(const char* p, size_t len) {
+	uint64_t h = len * 0x9E3779B97F4A7C15ULL, v;
+	size_t i;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		memcpy(&v, p + i, 8);
+		h = (h ^ v) * 0xFF51AFD7ED558CCDULL;
+		h = h << 31 | h >> 33;
+	}
+	for (; i < len; i++) {
+		h = (h ^ (unsigned char)p[i]) * 0x100000001B3ULL;
+	}
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+// unreserved characters as is, others as %XX
+static void append_encoded(mybuf_t* buf, const char* s, size_t len) {
+	static const char hex[] = "0123456789ABCDEF";
+	size_t i;
+
+	if (mybuf_reserve(buf, len * 3)) return;
+	for (i = 0; i < len; i++) {
+		unsigned char c = (unsigned char)s[i];
+		if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+			|| c == '-' || c == '.' || c == '_' || c == '~') {
+			buf->buf[buf->size++] = (char)c;
+		} else {
+			buf->buf[buf->size++] = '%';
+			buf->buf[buf->size++] = hex[c >> 4];
+			buf->buf[buf->size++] = hex[c & 15];
+		}
+	}
+}
+
+static char* load_key(uv_httpd_cache_load_t* load) {
+	return (char*)(load + 1);
+}
+
+
+/*************************** entries ****************/
+
+static char* entry_key(entry_t* e) {
+	return (char*)(e + 1);
+}
+
+static void entry_remove(uv_httpd_cache_t* cache, entry_t* e) {
+	entry_t** pp = &cache->buckets[e->hash & (cache->nbuckets - 1)];
+	while (*pp != e) pp = &(*pp)->next;
+	*pp = e->next;
+	QUEUE_REMOVE(&e->lru);
+	cache->stats.entries--;
+	cache->stats.bytes -= e->key_len + e->len;
+	free(e);
+}
+
+static entry_t* entry_find(uv_httpd_cache_t* cache, uint64_t hash, const char* key, size_t len) {
+	entry_t* e;
+	for (e = cache->buckets[hash & (cache->nbuckets - 1)]; e; e = e->next) {
+		if (e->hash == hash && e->key_len == len && 0 == memcmp(entry_key(e), key, len)) {
+			QUEUE_REMOVE(&e->lru);
+			QUEUE_INSERT_HEAD(&cache->lru, &e->lru);
+			return e;
+		}
+	}
+	return NULL;
+}
+
+// double the buckets when there are more entries, chains stay short
+static void grow(uv_httpd_cache_t* cache) {
+	size_t n = cache->nbuckets * 2, i;
+	entry_t** buckets = calloc(n, sizeof(entry_t*));
+
+	if (!buckets) return;
+	for (i = 0; i < cache->nbuckets; i++) {
+		while (cache->buckets[i]) {
+			entry_t* e = cache->buckets[i];
+			cache->buckets[i] = e->next;
+			e->next = buckets[e->hash & (n - 1)];
+			buckets[e->hash & (n - 1)] = e;
+		}
+	}
+	free(cache->buckets);
+	cache->buckets = buckets;
+	cache->nbuckets = n;
+}
+
+static void entry_add(uv_httpd_cache_t* cache, uint64_t hash, const char* key, size_t key_len,
+					  const char* value, size_t len) {
+	entry_t* e;
+
+	// a value taking a large part of the cache would evict everything else
+	if (key_len + len > cache->size / 4 || entry_find(cache, hash, key, key_len)) return;
+	while (cache->stats.bytes + key_len + len > cache->size) {
+		entry_remove(cache, QUEUE_DATA(QUEUE_PREV(&cache->lru), entry_t, lru));
+		cache->stats.evicted++;
+	}
+	e = malloc(sizeof(*e) + key_len + len);
+	if (!e) return;
+	e->hash = hash;
+	e->key_len = key_len;
+	e->len = len;
+	memcpy(entry_key(e), key, key_len);
+	memcpy(entry_key(e) + key_len, value, len);
+	e->next = cache->buckets[hash & (cache->nbuckets - 1)];
+	cache->buckets[hash & (cache->nbuckets - 1)] = e;
+	QUEUE_INSERT_HEAD(&cache->lru, &e->lru);
+	cache->stats.entries++;
+	cache->stats.bytes += key_len + len;
+	if (cache->stats.entries > cache->nbuckets) grow(cache);
+}
+
+
+/*************************** hash ring ****************/
+
+static int point_cmp(const void* a, const void* b) {
+	const point_t* x = a;
+	const point_t* y = b;
+	if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+	return x->peer - y->peer;
+}
+
+// UV_HTTPD_CACHE_VNODES points of each peer, by the hash of its path and the point number
+static int build_ring(uv_httpd_cache_t* cache) {
+	point_t* ring = malloc((size_t)cache->npeers * UV_HTTPD_CACHE_VNODES * sizeof(point_t));
+	char name[1024];
+	size_t n = 0;
+	int i, v, len;
+
+	if (!ring) return UV_ENOMEM;
+	for (i = 0; i < cache->npeers; i++) {
+		for (v = 0; v < UV_HTTPD_CACHE_VNODES; v++) {
+			len = snprintf(name, sizeof(name), "%s#%d", cache->peers[i].path, v);
+			if (len < 0 || (size_t)len >= sizeof(name)) len = (int)sizeof(name) - 1;
+			ring[n].hash = (uint32_t)(hash_key(name, len) >> 32);
+			ring[n].peer = i;
+			n++;
+		}
+	}
+	qsort(ring, n, sizeof(point_t), point_cmp);
+	free(cache->ring);
+	cache->ring = ring;
+	cache->npoints = n;
+	return 0;
+}
+
+// the first point clockwise from `hash`
+static int ring_owner(uv_httpd_cache_t* cache, uint64_t hash) {
+	uint32_t h = (uint32_t)(hash >> 32);
+	size_t lo = 0, hi = cache->npoints;
+
+	if (cache->npoints == 0) return cache->self;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (cache->ring[mid].hash < h) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return cache->ring[lo == cache->npoints ? 0 : lo].peer;
+}
+
+
+/*************************** loads ****************/
+
+// a load of `key`, not one asking the owner if `local`
+static uv_httpd_cache_load_t* load_find(uv_httpd_cache_t* cache, uint64_t hash, const char* key, size_t len, int local) {
+	uv_httpd_cache_load_t* load;
+	for (load = cache->loads[hash & (LOAD_BUCKETS - 1)]; load; load = load->next) {
+		if (load->hash == hash && load->key_len == len && 0 == memcmp(load_key(load), key, len)
+			&& !(local && load->asking)) {
+			return load;
+		}
+	}
+	return NULL;
+}
+
+// the value to every waiter. the load is out of `cache->loads` first,
+// a waiter asking for the key again starts a new one
+static void load_finish(uv_httpd_cache_load_t* load, int status, const char* value, size_t len) {
+	uv_httpd_cache_t* cache = load->cache;
+	uv_httpd_cache_load_t** pp = &cache->loads[load->hash & (LOAD_BUCKETS - 1)];
+	QUEUE waiters;
+
+	while (*pp != load) pp = &(*pp)->next;
+	*pp = load->next;
+	if (status == 0 && load->cacheable) {
+		entry_add(cache, load->hash, load_key(load), load->key_len, value, len);
+	}
+	QUEUE_MOVE(&load->waiters, &waiters);
+	while (!QUEUE_EMPTY(&waiters)) {
+		waiter_t* w = QUEUE_DATA(QUEUE_HEAD(&waiters), waiter_t, node);
+		QUEUE_REMOVE(&w->node);
+		w->on_value(w->data, status, status ? NULL : value, status ? 0 : len);
+		free(w);
+	}
+	mybuf_clear(&load->remote);
+	free(load);
+}
+
+static int on_remote_headers(uv_http_client_req_t* req, const uv_http_client_res_t* res) {
+	uv_httpd_cache_load_t* load = uv_http_client_req_data(req);
+	if (res->status == 200) {
+		load->remote_status = 0;
+	} else {
+		load->remote_status = res->status == 404 ? UV_ENOENT : UV_EIO;
+	}
+	return 0;
+}
+
+static void on_remote_body(uv_http_client_req_t* req, const char* at, size_t len) {
+	uv_httpd_cache_load_t* load = uv_http_client_req_data(req);
+	if (load->remote_status == 0 && mybuf_append(&load->remote, at, len)) {
+		load->remote_status = UV_ENOMEM;
+	}
+}
+
+static void on_remote_done(uv_http_client_req_t* req, int status) {
+	uv_httpd_cache_load_t* load = uv_http_client_req_data(req);
+	uv_httpd_cache_t* cache = load->cache;
+
+	load->asking = 0;
+	if (status == 0) {
+		// the owner answered, a failure of its load is the answer
+		load_finish(load, load->remote_status, load->remote.buf, load->remote.size);
+	} else if (cache->closing || status == UV_ECANCELED) {
+		load_finish(load, UV_ECANCELED, NULL, 0);
+	} else {
+		uvlog_warn("cache owner of %.*s: %s, loaded locally", (int)load->key_len, load_key(load),
+				   uv_err_name(status));
+		cache->stats.remote_failed++;
+		load->cacheable = 0;
+		load->remote.size = 0;
+		cache->loader(cache, load, load_key(load), load->key_len);
+	}
+}
+
+// GET the key of `load` from peer `owner`
+static int load_remote(uv_httpd_cache_t* cache, uv_httpd_cache_load_t* load, int owner) {
+	uv_http_client_options_t opts;
+	mybuf_t url;
+	int r;
+
+	mybuf_init(&url);
+	mybuf_cat_printf(&url, "%s" UV_HTTPD_CACHE_PREFIX, cache->peers[owner].url);
+	append_encoded(&url, load_key(load), load->key_len);
+	if (mybuf_append(&url, "", 1)) {
+		mybuf_clear(&url);
+		return UV_ENOMEM;
+	}
+	memset(&opts, 0, sizeof(opts));
+	opts.method = HTTP_GET;
+	opts.url = url.buf;
+	opts.on_headers = on_remote_headers;
+	opts.on_body = on_remote_body;
+	opts.on_done = on_remote_done;
+	opts.data = load;
+	r = uv_http_client_request(cache->client, &opts, NULL);
+	mybuf_clear(&url);
+	return r;
+}
+
+static void load_start(uv_httpd_cache_t* cache, uv_httpd_cache_load_t* load) {
+	int owner = ring_owner(cache, load->hash);
+
+	if (owner != cache->self && owner >= 0) {
+		// kept by the owner only
+		cache->stats.remote++;
+		load->cacheable = 0;
+		load->asking = 1;
+		if (load_remote(cache, load, owner) == 0) return;
+		load->asking = 0;
+		cache->stats.remote_failed++;
+	} else {
+		cache->stats.misses++;
+	}
+	cache->loader(cache, load, load_key(load), load->key_len);
+}
+
+// the value from the cache of this instance, a load in progress, or a new one,
+// from the owner unless `local`
+static int get(uv_httpd_cache_t* cache, const char* key, size_t len, int local,
+			   uv_httpd_cache_on_value_t on_value, void* data) {
+	uint64_t hash = hash_key(key, len);
+	uv_httpd_cache_load_t* load;
+	waiter_t* w;
+	entry_t* e;
+
+	if (len > UV_HTTPD_CACHE_MAX_KEY) return UV_E2BIG;
+	if (cache->closing) return UV_ECANCELED;
+	e = entry_find(cache, hash, key, len);
+	if (e) {
+		cache->stats.hits++;
+		on_value(data, 0, entry_key(e) + e->key_len, e->len);
+		return 0;
+	}
+
+	w = malloc(sizeof(*w));
+	if (!w) return UV_ENOMEM;
+	w->on_value = on_value;
+	w->data = data;
+	// a `local` get, asked by a peer, never waits for a peer. the owner of the key on this
+	// instance may be the asking one if their membership differs, the two would wait for each other
+	load = load_find(cache, hash, key, len, local);
+	if (load) {
+		cache->stats.coalesced++;
+		QUEUE_INSERT_TAIL(&load->waiters, &w->node);
+		return 0;
+	}
+
+	load = calloc(1, sizeof(*load) + len);
+	if (!load) {
+		free(w);
+		return UV_ENOMEM;
+	}
+	load->cache = cache;
+	load->hash = hash;
+	load->key_len = len;
+	load->cacheable = 1;
+	memcpy(load_key(load), key, len);
+	mybuf_init(&load->remote);
+	QUEUE_INIT(&load->waiters);
+	QUEUE_INSERT_TAIL(&load->waiters, &w->node);
+	load->next = cache->loads[hash & (LOAD_BUCKETS - 1)];
+	cache->loads[hash & (LOAD_BUCKETS - 1)] = load;
+	if (local) {
+		cache->stats.misses++;
+		cache->loader(cache, load, key, len);
+	} else {
+		load_start(cache, load);
+	}
+	return 0;
+}
+
+
+/*************************** responses ****************/
+
+static void on_serve_abort(uv_httpd_client_t* client) {
+	serve_t* serve = uv_httpd_client_get_data(client);
+	serve->client = NULL;
+	uv_httpd_client_set_data(client, NULL);
+}
+
+static void on_serve_value(void* data, int status, const char* value, size_t len) {
+	serve_t* serve = data;
+	uv_httpd_client_t* client = serve->client;
+	char head[128];
+	int n;
+
+	free(serve);
+	if (!client) return;
+	uv_httpd_client_set_data(client, NULL);
+	if (status == 0) {
+		n = snprintf(head, sizeof(head), CACHE_HEAD, len);
+		uv_httpd_write_response(client, head, n);
+		if (len) uv_httpd_write_response(client, (char*)value, len);
+	} else if (status == UV_ENOENT) {
+		uv_httpd_write_response(client, CACHE_NOT_FOUND, sizeof(CACHE_NOT_FOUND) - 1);
+	} else {
+		uv_httpd_write_response(client, CACHE_FAILED, sizeof(CACHE_FAILED) - 1);
+	}
+	uv_httpd_response_done(client);
+}
+
+// answer `client` by the value of `key`, deferred until it is loaded
+static void respond(uv_httpd_cache_t* cache, uv_httpd_client_t* client, const char* key, size_t len, int local) {
+	serve_t* serve = malloc(sizeof(*serve));
+	int r;
+
+	if (!serve) {
+		uv_httpd_write_response(client, CACHE_FAILED, sizeof(CACHE_FAILED) - 1);
+		return;
+	}
+	serve->client = client;
+	uv_httpd_client_set_data(client, serve);
+	uv_httpd_defer_response(client, on_serve_abort);
+	r = get(cache, key, len, local, on_serve_value, serve);
+	if (r) {
+		on_serve_value(serve, r, NULL, 0);
+	}
+}
+
+int uv_httpd_cache_serve(uv_httpd_cache_t* cache, uv_httpd_client_t* client, uv_httpd_request_t* req) {
+	static const size_t prefix_len = sizeof(UV_HTTPD_CACHE_PREFIX) - 1;
+	uv_httpd_url_t url;
+	uv_httpd_string_t key;
+
+	uv_httpd_url_parse(req, &url);
+	if (url.path.len < prefix_len
+		|| 0 != memcmp(req->base + url.path.offset, UV_HTTPD_CACHE_PREFIX, prefix_len)) {
+		return 0;
+	}
+	if (req->method != HTTP_GET) {
+		uv_httpd_write_response(client, CACHE_BAD_METHOD, sizeof(CACHE_BAD_METHOD) - 1);
+		return 1;
+	}
+	key.offset = url.path.offset + prefix_len;
+	key.len = url.path.len - prefix_len;
+	uv_httpd_decode(req, &key, 0);
+	cache->stats.served++;
+	// never asks another peer, the membership of the asking one may differ
+	respond(cache, client, req->base + key.offset, key.len, 1);
+	return 1;
+}
+
+void uv_httpd_cache_respond(uv_httpd_cache_t* cache, uv_httpd_client_t* client, const char* key, size_t len) {
+	respond(cache, client, key, len, 0);
+}
+
+
+/*************************** public functions ****************/
+
+int uv_httpd_cache_create(uv_httpd_cache_t** cache, uv_loop_t* loop, size_t size,
+						  uv_httpd_cache_loader_t loader, void* data) {
+	uv_httpd_cache_t* c = calloc(1, sizeof(*c));
+	if (!c) return UV_ENOMEM;
+	c->buckets = calloc(BUCKETS_MIN, sizeof(entry_t*));
+	if (!c->buckets) {
+		free(c);
+		return UV_ENOMEM;
+	}
+	c->nbuckets = BUCKETS_MIN;
+	c->loop = loop;
+	c->size = size;
+	c->loader = loader;
+	c->data = data;
+	c->self = -1;
+	QUEUE_INIT(&c->lru);
+	*cache = c;
+	return 0;
+}
+
+int uv_httpd_cache_add_peer(uv_httpd_cache_t* cache, const char* path, int self) {
+	peer_t* peer;
+	mybuf_t url;
+	int r;
+
+	if (cache->npeers == UV_HTTPD_CACHE_MAX_PEERS) return UV_E2BIG;
+	if (!cache->client) {
+		r = uv_http_client_create(&cache->client, cache->loop);
+		if (r) return r;
+		cache->client->max_connections = UV_HTTPD_CACHE_PEER_CONNECTIONS;
+		cache->client->timeout = UV_HTTPD_CACHE_PEER_TIMEOUT;
+	}
+	mybuf_init(&url);
+	mybuf_append(&url, "http+unix://", 12);
+	append_encoded(&url, path, strlen(path));
+	if (mybuf_append(&url, "", 1)) {
+		mybuf_clear(&url);
+		return UV_ENOMEM;
+	}
+	peer = &cache->peers[cache->npeers];
+	peer->path = strdup(path);
+	peer->url = strdup(url.buf);
+	mybuf_clear(&url);
+	if (!peer->path || !peer->url) {
+		free(peer->path);
+		free(peer->url);
+		return UV_ENOMEM;
+	}
+	if (self) cache->self = cache->npeers;
+	cache->npeers++;
+	return build_ring(cache);
+}
+
+void uv_httpd_cache_close(uv_httpd_cache_t* cache) {
+	if (cache->closing) return;
+	cache->closing = 1;
+	if (cache->client) {
+		uv_http_client_close(cache->client);
+	}
+}
+
+void uv_httpd_cache_free(uv_httpd_cache_t* cache) {
+	int i;
+
+	while (!QUEUE_EMPTY(&cache->lru)) {
+		entry_remove(cache, QUEUE_DATA(QUEUE_HEAD(&cache->lru), entry_t, lru));
+	}
+	for (i = 0; i < cache->npeers; i++) {
+		free(cache->peers[i].path);
+		free(cache->peers[i].url);
+	}
+	if (cache->client) {
+		uv_http_client_free(cache->client);
+	}
+	free(cache->ring);
+	free(cache->buckets);
+	free(cache);
+}
+
+void* uv_httpd_cache_data(uv_httpd_cache_t* cache) {
+	return cache->data;
+}
+
+int uv_httpd_cache_get(uv_httpd_cache_t* cache, const char* key, size_t len,
+					   uv_httpd_cache_on_value_t on_value, void* data) {
+	return get(cache, key, len, 0, on_value, data);
+}
+
+void uv_httpd_cache_loaded(uv_httpd_cache_load_t* load, int status, const char* value, size_t len) {
+	load_finish(load, status, value, len);
+}
+
+const char* uv_httpd_cache_owner(uv_httpd_cache_t* cache, const char* key, size_t len) {
+	int owner = ring_owner(cache, hash_key(key, len));
+	return owner < 0 || owner == cache->self ? NULL : cache->peers[owner].path;
+}
+
+void uv_httpd_cache_stats(uv_httpd_cache_t* cache, uv_httpd_cache_stats_t* stats) {
+	*stats = cache->stats;
+}
@@ -0,0 +1,95 @@
+#ifndef __UV_HTTPD_CACHE_H__
+#define __UV_HTTPD_CACHE_H__
+
+#pragma once
+
+#include "uv_httpd.h"
+
+// object cache of the application: values by key, least recently used evicted first,
+// loaded by the application on a miss. concurrent misses of a key wait for one load.
+// sharded mode: instances on a host list the same peers, each by the unix socket it listens on
+// (`uv_httpd_listen_pipe`). a key is owned by one instance, picked by a consistent hash ring
+// with UV_HTTPD_CACHE_VNODES points per instance, so a peer added or removed moves only its
+// share of the keys. only the owner caches and loads a key, other instances ask it
+// by GET UV_HTTPD_CACHE_PREFIX<key> over pooled connections of `uv_http_client`.
+// the value is not kept by the asking instance, each object is held once on the host.
+// if the owner doesn't answer, the key is loaded locally and not cached.
+
+#ifndef UV_HTTPD_CACHE_VNODES
+#define UV_HTTPD_CACHE_VNODES 160 // points of an instance on the hash ring
+#endif
+
+#ifndef UV_HTTPD_CACHE_MAX_PEERS
+#define UV_HTTPD_CACHE_MAX_PEERS 64
+#endif
+
+#ifndef UV_HTTPD_CACHE_MAX_KEY
+#define UV_HTTPD_CACHE_MAX_KEY 1024 // bytes, longer keys fail with UV_E2BIG
+#endif
+
+#ifndef UV_HTTPD_CACHE_PEER_TIMEOUT
+#define UV_HTTPD_CACHE_PEER_TIMEOUT 2000 // ms, a slower owner is given up, the key loaded locally
+#endif
+
+#ifndef UV_HTTPD_CACHE_PEER_CONNECTIONS
+#define UV_HTTPD_CACHE_PEER_CONNECTIONS 4 // pooled per peer
+#endif
+
+// path of the requests between peers, answered by `uv_httpd_cache_serve`
+#define UV_HTTPD_CACHE_PREFIX "/_cache/"
+
+typedef struct uv_httpd_cache_s uv_httpd_cache_t;
+typedef struct uv_httpd_cache_load_s uv_httpd_cache_load_t;
+
+// `status` is 0 and `value` valid during the call, otherwise it is `uv_errno_t`
+typedef void(*uv_httpd_cache_on_value_t)(void* data, int status, const char* value, size_t len);
+// load `key` missing from the cache, now or later, and pass it to `uv_httpd_cache_loaded`
+typedef void(*uv_httpd_cache_loader_t)(uv_httpd_cache_t* cache, uv_httpd_cache_load_t* load,
+									   const char* key, size_t len);
+
+typedef struct {
+	uint64_t hits; // found in the cache of this instance, for peers too
+	uint64_t misses; // loaded and cached by this instance
+	uint64_t coalesced; // waited for a load of the same key in progress
+	uint64_t remote; // asked the owner
+	uint64_t remote_failed; // the owner didn't answer, loaded here without caching
+	uint64_t served; // requests of peers answered
+	uint64_t evicted;
+	uint64_t entries;
+	uint64_t bytes; // of keys and values
+}uv_httpd_cache_stats_t;
+
+// `size` is in bytes of keys and values.
+// return 0 for success, otherwise it is `uv_errno_t`
+int uv_httpd_cache_create(uv_httpd_cache_t** cache, uv_loop_t* loop, size_t size,
+						  uv_httpd_cache_loader_t loader, void* data);
+// static membership, in the same order on every instance: the unix socket path of a peer,
+// `self` for the one of this instance. without peers every key is owned by this instance.
+// return 0 for success, otherwise it is `uv_errno_t`
+int uv_httpd_cache_add_peer(uv_httpd_cache_t* cache, const char* path, int self);
+// cancel requests to peers, `on_value` gets UV_ECANCELED. loads in progress must still
+// be finished. free the cache after the loop ends
+void uv_httpd_cache_close(uv_httpd_cache_t* cache);
+void uv_httpd_cache_free(uv_httpd_cache_t* cache);
+void* uv_httpd_cache_data(uv_httpd_cache_t* cache);
+
+// the value of `key`, `on_value` may be called before it returns.
+// return 0 for success, otherwise it is `uv_errno_t` and `on_value` is not called
+int uv_httpd_cache_get(uv_httpd_cache_t* cache, const char* key, size_t len,
+					   uv_httpd_cache_on_value_t on_value, void* data);
+// the end of a load, `status` is 0 for `value`, otherwise it is `uv_errno_t` and nothing is cached
+void uv_httpd_cache_loaded(uv_httpd_cache_load_t* load, int status, const char* value, size_t len);
+// the path of the unix socket of the instance owning `key`, NULL for this instance
+const char* uv_httpd_cache_owner(uv_httpd_cache_t* cache, const char* key, size_t len);
+
+// answer `client` by the value of `key` as application/octet-stream, 404 if the load
+// fails with UV_ENOENT, 503 for other failures. the response is deferred until then
+void uv_httpd_cache_respond(uv_httpd_cache_t* cache, uv_httpd_client_t* client, const char* key, size_t len);
+// answer `req` of a peer for a key under UV_HTTPD_CACHE_PREFIX, from the cache of this
+// instance or by loading it, never from another peer. call it first in `on_request`.
+// return 1 if `req` is one of them, otherwise 0
+int uv_httpd_cache_serve(uv_httpd_cache_t* cache, uv_httpd_client_t* client, uv_httpd_request_t* req);
+
+void uv_httpd_cache_stats(uv_httpd_cache_t* cache, uv_httpd_cache_stats_t* stats);
+
+#endif
@@ -0,0 +1,500 @@
+#ifndef __UV_HTTPD_CO_HPP__
+#define __UV_HTTPD_CO_HPP__
+
+#pragma once
+
+// C++20 coroutines over uv_httpd and libuv handles, header only.
+//
+//   uv_httpd_co::task<void> hello(uv_httpd_co::request& r) {
+//       co_await uv_httpd_co::delay(uv_httpd_client_server(r.client())->tcp.loop, 10);
+//       r.respond(RESPONSE, sizeof(RESPONSE) - 1);
+//   }
+//   server->on_request = uv_httpd_co::on_request<hello>;
+//
+// a `task` starts when awaited and resumes its awaiter by symmetric transfer when it ends,
+// so nested tasks neither grow the stack nor go through the loop.
+// frames are taken from per thread free lists instead of the heap.
+// everything runs on the loop thread, except the function given to `queue_work`.
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "uv_httpd.h"
+
+#ifndef UV_HTTPD_CO_POOL_MAX
+#define UV_HTTPD_CO_POOL_MAX 1024 // bytes, larger frames come from the heap
+#endif
+
+#ifndef UV_HTTPD_CO_POOL_CACHED
+#define UV_HTTPD_CO_POOL_CACHED 256 // free frames kept per size class
+#endif
+
+namespace uv_httpd_co {
+
+template <class T = void> class task;
+
+namespace detail {
+
+// free lists of coroutine frames by 64 byte size classes, per thread
+class frame_pool {
+public:
+	static void* allocate(std::size_t size) {
+		if (size > UV_HTTPD_CO_POOL_MAX) return ::operator new(size);
+		lists& l = get();
+		std::size_t i = index(size);
+		if (block* b = l.heads[i]) {
+			l.heads[i] = b->next;
+			l.counts[i]--;
+			return b;
+		}
+		return ::operator new((i + 1) * granularity);
+	}
+
+	static void deallocate(void* p, std::size_t size) noexcept {
+		if (size > UV_HTTPD_CO_POOL_MAX) {
+			::operator delete(p);
+			return;
+		}
+		lists& l = get();
+		std::size_t i = index(size);
+		if (l.counts[i] == UV_HTTPD_CO_POOL_CACHED) {
+			::operator delete(p);
+			return;
+		}
+		block* b = static_cast<block*>(p);
+		b->next = l.heads[i];
+		l.heads[i] = b;
+		l.counts[i]++;
+	}
+
+private:
+	static constexpr std::size_t granularity = 64;
+	static constexpr std::size_t nclasses = (UV_HTTPD_CO_POOL_MAX + granularity - 1) / granularity;
+
+	struct block {
+		block* next;
+	};
+
+	struct lists {
+		block* heads[nclasses] = {};
+		std::size_t counts[nclasses] = {};
+		~lists() {
+			for (block* b : heads) {
+				while (b) {
+					block* next = b->next;
+					::operator delete(b);
+					b = next;
+				}
+			}
+		}
+	};
+
+	static std::size_t index(std::size_t size) noexcept {
+		return size ? (size - 1) / granularity : 0;
+	}
+
+	static lists& get() noexcept {
+		thread_local lists l;
+		return l;
+	}
+};
+
+struct promise_base {
+	std::coroutine_handle<> continuation;
+	std::exception_ptr exception;
+
+	static void* operator new(std::size_t size) {
+		return frame_pool::allocate(size);
+	}
+
+	static void operator delete(void* p, std::size_t size) noexcept {
+		frame_pool::deallocate(p, size);
+	}
+
+	// resume the awaiter, or nothing for a detached task
+	struct final_awaiter {
+		bool await_ready() const noexcept { return false; }
+		template <class P>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+			std::coroutine_handle<> c = h.promise().continuation;
+			return c ? c : std::noop_coroutine();
+		}
+		void await_resume() const noexcept {}
+	};
+
+	std::suspend_always initial_suspend() const noexcept { return {}; }
+	final_awaiter final_suspend() const noexcept { return {}; }
+	void unhandled_exception() noexcept { exception = std::current_exception(); }
+};
+
+template <class T>
+struct task_promise : promise_base {
+	alignas(T) unsigned char storage[sizeof(T)];
+	bool has_value = false;
+
+	task<T> get_return_object() noexcept;
+
+	template <class U>
+	void return_value(U&& value) {
+		::new (static_cast<void*>(storage)) T(std::forward<U>(value));
+		has_value = true;
+	}
+
+	T& value() {
+		if (exception) std::rethrow_exception(exception);
+		return *std::launder(reinterpret_cast<T*>(storage));
+	}
+
+	~task_promise() {
+		if (has_value) value().~T();
+	}
+};
+
+template <>
+struct task_promise<void> : promise_base {
+	task<void> get_return_object() noexcept;
+	void return_void() const noexcept {}
+	void value() {
+		if (exception) std::rethrow_exception(exception);
+	}
+};
+
+} // namespace detail
+
+// lazy coroutine, owned by the task until awaited to the end
+template <class T>
+class task {
+public:
+	using promise_type = detail::task_promise<T>;
+	using handle_type = std::coroutine_handle<promise_type>;
+
+	task(task&& t) noexcept : h_(std::exchange(t.h_, nullptr)) {}
+	task(const task&) = delete;
+	task& operator=(const task&) = delete;
+	task& operator=(task&& t) noexcept {
+		if (this != &t) {
+			if (h_) h_.destroy();
+			h_ = std::exchange(t.h_, nullptr);
+		}
+		return *this;
+	}
+	~task() {
+		if (h_) h_.destroy();
+	}
+
+	struct awaiter {
+		handle_type h;
+		bool await_ready() const noexcept { return false; }
+		// symmetric transfer, the task runs without a nested resume
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+			h.promise().continuation = caller;
+			return h;
+		}
+		decltype(auto) await_resume() {
+			if constexpr (std::is_void_v<T>) {
+				h.promise().value();
+			} else {
+				return std::move(h.promise().value());
+			}
+		}
+	};
+
+	awaiter operator co_await() && noexcept { return awaiter{h_}; }
+	awaiter operator co_await() & noexcept { return awaiter{h_}; }
+
+private:
+	friend promise_type;
+	explicit task(handle_type h) noexcept : h_(h) {}
+	handle_type h_;
+};
+
+namespace detail {
+
+template <class T>
+inline task<T> task_promise<T>::get_return_object() noexcept {
+	return task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+}
+
+inline task<void> task_promise<void>::get_return_object() noexcept {
+	return task<void>(std::coroutine_handle<task_promise<void>>::from_promise(*this));
+}
+
+// eager and self destroying, the root of a chain of tasks
+struct detached {
+	struct promise_type {
+		static void* operator new(std::size_t size) {
+			return frame_pool::allocate(size);
+		}
+		static void operator delete(void* p, std::size_t size) noexcept {
+			frame_pool::deallocate(p, size);
+		}
+		detached get_return_object() const noexcept { return {}; }
+		std::suspend_never initial_suspend() const noexcept { return {}; }
+		std::suspend_never final_suspend() const noexcept { return {}; }
+		void return_void() const noexcept {}
+		// nobody to report to
+		void unhandled_exception() const noexcept { std::terminate(); }
+	};
+};
+
+inline detached run_detached(task<void> t) {
+	co_await std::move(t);
+}
+
+} // namespace detail
+
+// run `t` now until its first suspension, it frees itself when done
+inline void spawn(task<void> t) {
+	detail::run_detached(std::move(t));
+}
+
+
+/*************************** libuv ****************/
+
+// resume after `timeout` ms. the timer is closed before resuming, since it lives in the frame
+class delay {
+public:
+	delay(uv_loop_t* loop, uint64_t timeout) noexcept : loop_(loop), timeout_(timeout) {}
+
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> h) noexcept {
+		h_ = h;
+		uv_timer_init(loop_, &timer_);
+		timer_.data = this;
+		uv_timer_start(&timer_, on_timer, timeout_, 0);
+	}
+	void await_resume() const noexcept {}
+
+private:
+	static void on_timer(uv_timer_t* timer) {
+		uv_close((uv_handle_t*)timer, on_closed);
+	}
+	static void on_closed(uv_handle_t* handle) {
+		static_cast<delay*>(handle->data)->h_.resume();
+	}
+
+	uv_loop_t* loop_;
+	uint64_t timeout_;
+	uv_timer_t timer_;
+	std::coroutine_handle<> h_;
+};
+
+// run `fn()` on the thread pool by uv_queue_work, resume on the loop.
+// result is 0, or `uv_errno_t` e.g. UV_ECANCELED
+template <class F>
+class queue_work {
+public:
+	queue_work(uv_loop_t* loop, F fn) : loop_(loop), fn_(std::move(fn)) {}
+
+	bool await_ready() const noexcept { return false; }
+	bool await_suspend(std::coroutine_handle<> h) noexcept {
+		h_ = h;
+		req_.data = this;
+		status_ = uv_queue_work(loop_, &req_, on_work, on_after_work);
+		return status_ == 0;
+	}
+	int await_resume() const noexcept { return status_; }
+
+private:
+	static void on_work(uv_work_t* req) {
+		static_cast<queue_work*>(req->data)->fn_();
+	}
+	static void on_after_work(uv_work_t* req, int status) {
+		queue_work* w = static_cast<queue_work*>(req->data);
+		w->status_ = status;
+		w->h_.resume();
+	}
+
+	uv_loop_t* loop_;
+	F fn_;
+	uv_work_t req_;
+	int status_ = 0;
+	std::coroutine_handle<> h_;
+};
+
+// read once into `base`, result is the bytes read, or `uv_errno_t` e.g. UV_EOF.
+// `stream->data` is used while reading
+class stream_read {
+public:
+	stream_read(uv_stream_t* stream, char* base, size_t len) noexcept : stream_(stream), base_(base), len_(len) {}
+
+	bool await_ready() const noexcept { return false; }
+	bool await_suspend(std::coroutine_handle<> h) noexcept {
+		h_ = h;
+		stream_->data = this;
+		nread_ = uv_read_start(stream_, on_alloc, on_read);
+		return nread_ == 0;
+	}
+	ssize_t await_resume() const noexcept { return nread_; }
+
+private:
+	static void on_alloc(uv_handle_t* handle, size_t /*suggested_size*/, uv_buf_t* buf) {
+		stream_read* r = static_cast<stream_read*>(handle->data);
+		buf->base = r->base_;
+		buf->len = r->len_;
+	}
+	static void on_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* /*buf*/) {
+		stream_read* r = static_cast<stream_read*>(stream->data);
+		if (nread == 0) return;
+		uv_read_stop(stream);
+		r->nread_ = nread;
+		r->h_.resume();
+	}
+
+	uv_stream_t* stream_;
+	char* base_;
+	size_t len_;
+	ssize_t nread_ = 0;
+	std::coroutine_handle<> h_;
+};
+
+// write `bufs`, they must stay valid until resumed. result is 0 or `uv_errno_t`
+class stream_write {
+public:
+	stream_write(uv_stream_t* stream, const uv_buf_t* bufs, unsigned int nbufs) noexcept
+		: stream_(stream), bufs_(bufs), nbufs_(nbufs) {}
+
+	bool await_ready() const noexcept { return false; }
+	bool await_suspend(std::coroutine_handle<> h) noexcept {
+		h_ = h;
+		req_.data = this;
+		status_ = uv_write(&req_, stream_, bufs_, nbufs_, on_write);
+		return status_ == 0;
+	}
+	int await_resume() const noexcept { return status_; }
+
+private:
+	static void on_write(uv_write_t* req, int status) {
+		stream_write* w = static_cast<stream_write*>(req->data);
+		w->status_ = status;
+		w->h_.resume();
+	}
+
+	uv_stream_t* stream_;
+	const uv_buf_t* bufs_;
+	unsigned int nbufs_;
+	uv_write_t req_;
+	int status_ = 0;
+	std::coroutine_handle<> h_;
+};
+
+
+/*************************** uv_httpd ****************/
+
+// a deferred response answered by a coroutine, see `on_request`.
+// `client()` is NULL once the connection is closed, and writes fail with UV_ECANCELED
+class request {
+public:
+	request(uv_httpd_server_t* server, uv_httpd_client_t* client, uv_httpd_request_t* req) noexcept
+		: server_(server), client_(client), req_(req) {
+		uv_httpd_defer_response(client, on_abort);
+		uv_httpd_client_set_data(client, this);
+	}
+	request(const request&) = delete;
+	request& operator=(const request&) = delete;
+
+	uv_httpd_server_t* server() const noexcept { return server_; }
+	uv_httpd_client_t* client() const noexcept { return client_; }
+	// valid until `done`, or until the connection is closed
+	const uv_httpd_request_t* req() const noexcept { return req_; }
+	bool aborted() const noexcept { return !client_; }
+	bool is_done() const noexcept { return done_; }
+
+	// more may follow. return 0 for success, otherwise it is `uv_errno_t`
+	int write(char* response, size_t len) noexcept {
+		if (!client_ || done_) return UV_ECANCELED;
+		written_ = true;
+		int r = uv_httpd_write_response(client_, response, len);
+		// e.g. UV_ECANCELED once the connection is closing, before `on_abort`
+		if (r) failed_ = true;
+		return r;
+	}
+
+	// the whole response is written, the next pipelined request is parsed
+	void done() noexcept {
+		if (!client_ || done_) return;
+		done_ = true;
+		uv_httpd_client_set_data(client_, nullptr);
+		// nothing was written, the client would wait forever
+		if (!written_) uv_httpd_close(client_);
+		uv_httpd_response_done(client_);
+		client_ = nullptr;
+		req_ = nullptr;
+	}
+
+	int respond(char* response, size_t len) noexcept {
+		int r = write(response, len);
+		done();
+		return r;
+	}
+
+	// resume when written responses are flushed, or the connection is closed.
+	// e.g. a large response written piece by piece.
+	// false if the connection is closed or a write failed, stop writing then
+	class flushed {
+	public:
+		explicit flushed(request& r) noexcept : r_(r) {}
+		bool await_ready() const noexcept {
+			return !r_.client_ || r_.failed_ || uv_httpd_write_queue_size(r_.client_) == 0;
+		}
+		void await_suspend(std::coroutine_handle<> h) noexcept {
+			r_.waiter_ = h;
+			uv_httpd_on_flushed(r_.client_, on_flushed);
+		}
+		bool await_resume() const noexcept { return r_.client_ && !r_.failed_; }
+
+	private:
+		request& r_;
+	};
+
+	flushed flush() noexcept { return flushed(*this); }
+
+private:
+	static void wake(request* r) {
+		std::coroutine_handle<> h = std::exchange(r->waiter_, nullptr);
+		if (h) h.resume();
+	}
+	static void on_flushed(uv_httpd_client_t* client) {
+		if (request* r = static_cast<request*>(uv_httpd_client_get_data(client))) wake(r);
+	}
+	static void on_abort(uv_httpd_client_t* client) {
+		request* r = static_cast<request*>(uv_httpd_client_get_data(client));
+		if (!r) return;
+		r->client_ = nullptr;
+		r->req_ = nullptr;
+		wake(r);
+	}
+
+	uv_httpd_server_t* server_;
+	uv_httpd_client_t* client_;
+	uv_httpd_request_t* req_;
+	std::coroutine_handle<> waiter_;
+	bool written_ = false;
+	bool failed_ = false;
+	bool done_ = false;
+};
+
+using handler_t = task<void> (*)(request& r);
+
+namespace detail {
+
+inline detached serve(uv_httpd_server_t* server, uv_httpd_client_t* client, uv_httpd_request_t* req, handler_t handler) {
+	request r(server, client, req);
+	co_await handler(r);
+	r.done();
+}
+
+} // namespace detail
+
+// `on_request_t` running `Handler` as a coroutine, the response is deferred until it ends
+template <handler_t Handler>
+void on_request(uv_httpd_server_t* server, uv_httpd_client_t* client, uv_httpd_request_t* req) {
+	detail::serve(server, client, req, Handler);
+}
+
+} // namespace uv_httpd_co
+
+#endif
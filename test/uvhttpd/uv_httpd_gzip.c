@@ -0,0 +1,735 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <zlib.h>
+#include "uv_httpd_gzip.h"
+#include "mybuf.h"
+#include "uv_log.h"
+
+#define CACHE_BUCKETS 4096 // must be power of 2
+#define DEFLATE_CHUNK (16 * 1024)
+#define WINDOW_BITS 15
+#define GZIP_HEADER 16 // added to window bits for a gzip wrapper instead of zlib
+
+typedef struct cache_entry_s {
+	QUEUE lru; // in gz->lru, most recent first
+	struct cache_entry_s* next; // in bucket
+	uint64_t hash;
+	int encoding;
+	size_t len, zlen;
+	char* data; // plain body followed by the compressed one
+}cache_entry_t;
+
+struct uv_httpd_gzip_s {
+	uv_loop_t* loop;
+	int level;
+	llhttp_settings_t settings; // of response parsers
+	z_stream zs[3]; // compressions on the loop, by encoding, initialized on first use
+	int zs_ready[3];
+	cache_entry_t** buckets;
+	QUEUE lru;
+	size_t cache_size;
+	uv_httpd_gzip_stats_t stats;
+};
+
+enum {
+	MODE_HEAD, // collecting the response head
+	MODE_PASS, // sent as is
+	MODE_BUFFER, // the body is collected, then compressed as a whole
+	MODE_STREAM, // the body is compressed as written, sent chunked
+	MODE_BROKEN, // not a response we understand, everything is sent as is
+};
+
+struct uv_httpd_gzip_filter_s {
+	uv_httpd_gzip_t* gz;
+	uv_httpd_client_t* client; // NULL if freed while busy
+	int encoding;
+	int chunked; // the client accepts chunked responses
+	int mode;
+	int cacheable;
+	int busy; // `work` is queued
+	int failed; // compression on the threadpool failed
+	uint64_t work_ns;
+	uint64_t hash; // of `body` if cacheable
+	llhttp_t parser; // the HTTP/1.1 response written by the application
+	z_stream zs; // MODE_STREAM
+	int zs_ready;
+	size_t stream_in; // compressed since the last flush
+	uv_work_t work;
+	// buffers last, they are not zeroed on creation, see uv_httpd_gzip_filter_create
+	mybuf_t head; // raw response head
+	mybuf_t body; // MODE_BUFFER
+	mybuf_t zbody; // compressed `body`, or pending chunk of MODE_STREAM
+	mybuf_t out; // output of a write, sent at once
+	mybuf_t queued; // written while busy
+};
+
+static int filter(uv_httpd_gzip_filter_t* f, const char* data, size_t len);
+
+
+/*************************** helper functions ****************/
+
+static int zs_init(z_stream* zs, int level, int encoding) {
+	memset(zs, 0, sizeof(*zs));
+	if (Z_OK != deflateInit2(zs, level, Z_DEFLATED, WINDOW_BITS + (encoding == UV_HTTPD_GZIP ? GZIP_HEADER : 0),
+							 8, Z_DEFAULT_STRATEGY)) {
+		return UV_ENOMEM;
+	}
+	return 0;
+}
+
+// compress `len` bytes of `in`, append to `out`.
+// `flush` is Z_NO_FLUSH, Z_SYNC_FLUSH or Z_FINISH
+static int deflate_to(z_stream* zs, const char* in, size_t len, int flush, mybuf_t* out) {
+	int r;
+
+	zs->next_in = (Bytef*)in;
+	zs->avail_in = (uInt)len;
+	do {
+		if (mybuf_reserve(out, DEFLATE_CHUNK)) return UV_ENOMEM;
+		zs->next_out = (Bytef*)out->buf + out->size;
+		zs->avail_out = (uInt)mybuf_space(out);
+		r = deflate(zs, flush);
+		out->size = (size_t)((char*)zs->next_out - out->buf);
+		if (r == Z_STREAM_ERROR) return UV_EINVAL;
+	} while (zs->avail_out == 0 || (flush == Z_FINISH && r != Z_STREAM_END));
+	return 0;
+}
+
+// the compressor of `encoding` for use on the loop, reset
+static z_stream* loop_zs(uv_httpd_gzip_t* gz, int encoding) {
+	if (!gz->zs_ready[encoding]) {
+		if (zs_init(&gz->zs[encoding], gz->level, encoding)) return NULL;
+		gz->zs_ready[encoding] = 1;
+	} else {
+		deflateReset(&gz->zs[encoding]);
+	}
+	return &gz->zs[encoding];
+}
+
+static uint64_t hash_body(const char* p, size_t len) {
+	uint64_t h = len * 0x9E3779B97F4A7C15ULL, v;
+	size_t i;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		memcpy(&v, p + i, 8);
+		h = (h ^ v) * 0xFF51AFD7ED558CCDULL;
+		h = h << 31 | h >> 33;
+	}
+	for (; i < len; i++) {
+		h = (h ^ (unsigned char)p[i]) * 0x100000001B3ULL;
+	}
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+// case insensitive search of `token` in `s`
+static int icontains(const char* s, size_t len, const char* token) {
+	size_t n = strlen(token), i, j;
+	for (i = 0; i + n <= len; i++) {
+		for (j = 0; j < n && tolower((unsigned char)s[i + j]) == token[j]; j++);
+		if (j == n) return 1;
+	}
+	return 0;
+}
+
+static int has_prefix(const char* s, size_t len, const char* prefix) {
+	size_t n = strlen(prefix), i;
+	if (len < n) return 0;
+	for (i = 0; i < n && tolower((unsigned char)s[i]) == prefix[i]; i++);
+	return i == n;
+}
+
+// next header line of a raw head from `*p`, without CRLF.
+// return 0 at the empty line or the end
+static int next_field(const char** p, const char* end, const char** name, size_t* name_len,
+					  const char** value, size_t* value_len) {
+	const char* eol = memchr(*p, '\n', (size_t)(end - *p));
+	const char* line = *p;
+	const char* colon;
+	size_t len;
+
+	if (!eol) return 0;
+	*p = eol + 1;
+	len = (size_t)(eol - line);
+	if (len && line[len - 1] == '\r') len--;
+	if (len == 0) return 0;
+	colon = memchr(line, ':', len);
+	if (!colon) colon = line + len;
+	*name = line;
+	*name_len = (size_t)(colon - line);
+	*value = colon < line + len ? colon + 1 : colon;
+	*value_len = (size_t)(line + len - *value);
+	while (*value_len && (**value == ' ' || **value == '\t')) {
+		(*value)++;
+		(*value_len)--;
+	}
+	return 1;
+}
+
+// first value of header `name` in `head`, return 1 if found
+static int find_field(const mybuf_t* head, const char* name, const char** value, size_t* value_len) {
+	const char* end = head->buf + head->size;
+	const char* p = memchr(head->buf, '\n', head->size); // after the status line
+	const char* n;
+	size_t nlen;
+
+	if (!p) return 0;
+	p++;
+	while (next_field(&p, end, &n, &nlen, value, value_len)) {
+		if (0 == string0_nicmp(name, n, nlen)) return 1;
+	}
+	return 0;
+}
+
+static int compressible_type(const char* type, size_t len) {
+	static const char* types[] = {
+		"text/",
+		"application/json",
+		"application/javascript",
+		"application/x-javascript",
+		"application/xml",
+		"image/svg+xml",
+	};
+	size_t i, n = 0;
+
+	while (n < len && type[n] != ';' && type[n] != ' ') n++;
+	for (i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+		if (has_prefix(type, n, types[i])) return 1;
+	}
+	// e.g. application/problem+json
+	return (n > 5 && has_prefix(type + n - 5, 5, "+json")) || (n > 4 && has_prefix(type + n - 4, 4, "+xml"));
+}
+
+static int compressible(uv_httpd_gzip_filter_t* f) {
+	const char* value;
+	size_t len;
+	int status = f->parser.status_code;
+
+	if (status < 200 || status > 299 || status == 204 || status == 206) return 0;
+	if (find_field(&f->head, "Content-Encoding", &value, &len)) return 0;
+	if (find_field(&f->head, "Cache-Control", &value, &len) && icontains(value, len, "no-transform")) return 0;
+	return find_field(&f->head, "Content-Type", &value, &len) && compressible_type(value, len);
+}
+
+// static, validated by `ETag` or `Last-Modified`, or explicitly cacheable
+static int cacheable(uv_httpd_gzip_filter_t* f) {
+	const char* value;
+	size_t len;
+
+	if (find_field(&f->head, "Cache-Control", &value, &len)) {
+		if (icontains(value, len, "no-store") || icontains(value, len, "private")) return 0;
+		if (icontains(value, len, "max-age") || icontains(value, len, "public") || icontains(value, len, "immutable")) {
+			return 1;
+		}
+	}
+	return find_field(&f->head, "ETag", &value, &len) || find_field(&f->head, "Last-Modified", &value, &len);
+}
+
+
+/*************************** cache ****************/
+
+static void cache_remove(uv_httpd_gzip_t* gz, cache_entry_t* e) {
+	cache_entry_t** pp = &gz->buckets[e->hash & (CACHE_BUCKETS - 1)];
+	while (*pp != e) pp = &(*pp)->next;
+	*pp = e->next;
+	QUEUE_REMOVE(&e->lru);
+	gz->stats.cache_entries--;
+	gz->stats.cache_bytes -= e->len + e->zlen;
+	free(e);
+}
+
+static cache_entry_t* cache_find(uv_httpd_gzip_t* gz, uint64_t hash, int encoding, const char* body, size_t len) {
+	cache_entry_t* e;
+	for (e = gz->buckets[hash & (CACHE_BUCKETS - 1)]; e; e = e->next) {
+		if (e->hash == hash && e->encoding == encoding && e->len == len && 0 == memcmp(e->data, body, len)) {
+			QUEUE_REMOVE(&e->lru);
+			QUEUE_INSERT_HEAD(&gz->lru, &e->lru);
+			return e;
+		}
+	}
+	return NULL;
+}
+
+static void cache_add(uv_httpd_gzip_t* gz, uint64_t hash, int encoding, const char* body, size_t len,
+					  const char* z, size_t zlen) {
+	cache_entry_t* e;
+
+	// a body taking a large part of the cache would evict everything else
+	if (len + zlen > gz->cache_size / 4 || cache_find(gz, hash, encoding, body, len)) return;
+	while (gz->stats.cache_bytes + len + zlen > gz->cache_size) {
+		cache_remove(gz, QUEUE_DATA(QUEUE_PREV(&gz->lru), cache_entry_t, lru));
+	}
+	e = malloc(sizeof(*e) + len + zlen);
+	if (!e) return;
+	e->hash = hash;
+	e->encoding = encoding;
+	e->len = len;
+	e->zlen = zlen;
+	e->data = (char*)(e + 1);
+	memcpy(e->data, body, len);
+	memcpy(e->data + len, z, zlen);
+	e->next = gz->buckets[hash & (CACHE_BUCKETS - 1)];
+	gz->buckets[hash & (CACHE_BUCKETS - 1)] = e;
+	QUEUE_INSERT_HEAD(&gz->lru, &e->lru);
+	gz->stats.cache_entries++;
+	gz->stats.cache_bytes += len + zlen;
+}
+
+
+/*************************** responses ****************/
+
+// the head for the compressed body, chunked if `stream`, otherwise `zlen` is its Content-Length.
+// the status line and other fields are kept, a strong ETag is weakened
+static void rewrite_head(uv_httpd_gzip_filter_t* f, int stream, size_t zlen) {
+	const char* end = f->head.buf + f->head.size;
+	const char* p = memchr(f->head.buf, '\n', f->head.size) + 1;
+	const char *name, *value;
+	size_t name_len, value_len;
+	int vary = 0;
+
+	mybuf_append(&f->out, f->head.buf, (size_t)(p - f->head.buf));
+	while (next_field(&p, end, &name, &name_len, &value, &value_len)) {
+		if (0 == string0_nicmp("Content-Length", name, name_len)
+			|| 0 == string0_nicmp("Transfer-Encoding", name, name_len)) {
+			continue;
+		}
+		if (0 == string0_nicmp("ETag", name, name_len) && value_len && value[0] == '"') {
+			mybuf_cat_printf(&f->out, "ETag: W/%.*s\r\n", (int)value_len, value);
+			continue;
+		}
+		if (0 == string0_nicmp("Vary", name, name_len) && icontains(value, value_len, "accept-encoding")) {
+			vary = 1;
+		}
+		mybuf_cat_printf(&f->out, "%.*s: %.*s\r\n", (int)name_len, name, (int)value_len, value);
+	}
+	mybuf_cat_printf(&f->out, "Content-Encoding: %s\r\n%s", f->encoding == UV_HTTPD_GZIP ? "gzip" : "deflate",
+					 vary ? "" : "Vary: Accept-Encoding\r\n");
+	if (stream) {
+		mybuf_cat_printf(&f->out, "Transfer-Encoding: chunked\r\n\r\n");
+	} else {
+		mybuf_cat_printf(&f->out, "Content-Length: %zu\r\n\r\n", zlen);
+	}
+	f->gz->stats.responses++;
+}
+
+static int send_out(uv_httpd_gzip_filter_t* f) {
+	int r = 0;
+	if (f->out.size) {
+		r = uv_httpd_gzip_send(f->client, f->out.buf, f->out.size);
+	}
+	mybuf_clear(&f->out);
+	return r;
+}
+
+// compressed data of MODE_STREAM so far as a chunk
+static int emit_chunk(uv_httpd_gzip_filter_t* f, int flush) {
+	uint64_t start = uv_hrtime();
+	int r = deflate_to(&f->zs, NULL, 0, flush, &f->zbody);
+
+	f->gz->stats.deflate_ns += uv_hrtime() - start;
+	f->stream_in = 0;
+	if (r) return r;
+	if (f->zbody.size) {
+		mybuf_cat_printf(&f->out, "%zx\r\n", f->zbody.size);
+		mybuf_append(&f->out, f->zbody.buf, f->zbody.size);
+		mybuf_append(&f->out, "\r\n", 2);
+		f->gz->stats.bytes_out += f->zbody.size;
+		f->zbody.size = 0;
+	}
+	return 0;
+}
+
+// decide by the head
+static int headers_done(uv_httpd_gzip_filter_t* f) {
+	llhttp_t* parser = &f->parser;
+	int stream;
+
+	if (!compressible(f)) {
+		stream = -1;
+	} else if (parser->flags & F_CHUNKED) {
+		stream = 1;
+	} else if ((parser->flags & F_CONTENT_LENGTH) && parser->content_length >= UV_HTTPD_GZIP_MIN_SIZE) {
+		stream = parser->content_length > UV_HTTPD_GZIP_MAX_BUFFER;
+	} else {
+		// small, or delimited by the end of the connection
+		stream = -1;
+	}
+	if (stream < 0 || (stream && !f->chunked)) {
+		f->mode = MODE_PASS;
+		mybuf_append(&f->out, f->head.buf, f->head.size);
+		mybuf_clear(&f->head);
+		return 0;
+	}
+	if (stream) {
+		if (!f->zs_ready) {
+			if (zs_init(&f->zs, f->gz->level, f->encoding)) return UV_ENOMEM;
+			f->zs_ready = 1;
+		} else {
+			deflateReset(&f->zs);
+		}
+		f->mode = MODE_STREAM;
+		rewrite_head(f, 1, 0);
+		return 0;
+	}
+	f->mode = MODE_BUFFER;
+	f->cacheable = f->gz->cache_size && cacheable(f);
+	return mybuf_reserve(&f->body, (size_t)parser->content_length) ? UV_ENOMEM : 0;
+}
+
+// the compressed body, or the original one if compression failed or did not help
+static void finish_body(uv_httpd_gzip_filter_t* f, int status, uint64_t ns) {
+	uv_httpd_gzip_t* gz = f->gz;
+
+	gz->stats.deflate_ns += ns;
+	gz->stats.deflated += f->body.size;
+	if (status == 0 && f->zbody.size < f->body.size) {
+		if (f->cacheable) {
+			gz->stats.cache_misses++;
+			cache_add(gz, f->hash, f->encoding, f->body.buf, f->body.size, f->zbody.buf, f->zbody.size);
+		}
+		rewrite_head(f, 0, f->zbody.size);
+		mybuf_append(&f->out, f->zbody.buf, f->zbody.size);
+		gz->stats.bytes_in += f->body.size;
+		gz->stats.bytes_out += f->zbody.size;
+	} else {
+		mybuf_append(&f->out, f->head.buf, f->head.size);
+		mybuf_append(&f->out, f->body.buf, f->body.size);
+	}
+	mybuf_clear(&f->head);
+	mybuf_clear(&f->body);
+	mybuf_clear(&f->zbody);
+}
+
+static void on_work(uv_work_t* req) {
+	uv_httpd_gzip_filter_t* f = req->data;
+	uint64_t start = uv_hrtime();
+	z_stream zs;
+
+	f->failed = zs_init(&zs, f->gz->level, f->encoding);
+	if (!f->failed) {
+		f->failed = mybuf_reserve(&f->zbody, deflateBound(&zs, (uLong)f->body.size))
+			|| deflate_to(&zs, f->body.buf, f->body.size, Z_FINISH, &f->zbody);
+		deflateEnd(&zs);
+	}
+	f->work_ns = uv_hrtime() - start;
+}
+
+static void filter_release(uv_httpd_gzip_filter_t* f) {
+	if (f->zs_ready) deflateEnd(&f->zs);
+	mybuf_clear(&f->head);
+	mybuf_clear(&f->body);
+	mybuf_clear(&f->zbody);
+	mybuf_clear(&f->out);
+	mybuf_clear(&f->queued);
+	free(f);
+}
+
+static void on_work_done(uv_work_t* req, int status) {
+	uv_httpd_gzip_filter_t* f = req->data;
+	mybuf_t queued;
+	int r;
+
+	f->busy = 0;
+	if (!f->client) {
+		filter_release(f);
+		return;
+	}
+	finish_body(f, status || f->failed ? UV_ENOMEM : 0, f->work_ns);
+	f->mode = MODE_HEAD;
+	r = send_out(f);
+	if (r == 0 && f->queued.size) {
+		// `filter` may queue again
+		mybuf_init(&queued);
+		if (mybuf_append(&queued, f->queued.buf, f->queued.size)) {
+			r = UV_ENOMEM;
+		} else {
+			mybuf_clear(&f->queued);
+			r = filter(f, queued.buf, queued.size);
+		}
+		mybuf_clear(&queued);
+	}
+	if (r) {
+		uvlog_warn("gzip response failed: %s", uv_err_name(r));
+		uv_httpd_close(f->client);
+	}
+	uv_httpd_gzip_on_done(f->client);
+}
+
+// the whole body of MODE_BUFFER is collected
+static int compress_body(uv_httpd_gzip_filter_t* f) {
+	uv_httpd_gzip_t* gz = f->gz;
+	cache_entry_t* e;
+	z_stream* zs;
+	uint64_t start;
+	int r;
+
+	if (f->cacheable) {
+		f->hash = hash_body(f->body.buf, f->body.size);
+		e = cache_find(gz, f->hash, f->encoding, f->body.buf, f->body.size);
+		if (e) {
+			gz->stats.cache_hits++;
+			gz->stats.bytes_in += e->len;
+			gz->stats.bytes_out += e->zlen;
+			rewrite_head(f, 0, e->zlen);
+			mybuf_append(&f->out, e->data + e->len, e->zlen);
+			mybuf_clear(&f->head);
+			mybuf_clear(&f->body);
+			return 0;
+		}
+	}
+	if (f->body.size >= UV_HTTPD_GZIP_POOL_SIZE) {
+		// responses before it are sent, writes after it are queued
+		if ((r = send_out(f))) return r;
+		f->work.data = f;
+		if (0 == uv_queue_work(gz->loop, &f->work, on_work, on_work_done)) {
+			f->busy = 1;
+			return 0;
+		}
+	}
+	zs = loop_zs(gz, f->encoding);
+	if (!zs) {
+		finish_body(f, UV_ENOMEM, 0);
+		return 0;
+	}
+	start = uv_hrtime();
+	r = mybuf_reserve(&f->zbody, deflateBound(zs, (uLong)f->body.size)) ? UV_ENOMEM
+		: deflate_to(zs, f->body.buf, f->body.size, Z_FINISH, &f->zbody);
+	finish_body(f, r, uv_hrtime() - start);
+	return 0;
+}
+
+static int message_done(uv_httpd_gzip_filter_t* f) {
+	int r = 0;
+	if (f->mode == MODE_STREAM) {
+		r = emit_chunk(f, Z_FINISH);
+		mybuf_append(&f->out, "0\r\n\r\n", 5);
+	} else if (f->mode == MODE_BUFFER) {
+		r = compress_body(f);
+	}
+	if (!f->busy) f->mode = MODE_HEAD;
+	return r;
+}
+
+// raw bytes of the response from the position of the last pause
+static void segment(uv_httpd_gzip_filter_t* f, const char* data, size_t len) {
+	if (f->mode == MODE_HEAD) {
+		mybuf_append(&f->head, data, len);
+	} else if (f->mode == MODE_PASS) {
+		mybuf_append(&f->out, data, len);
+	}
+}
+
+static int filter(uv_httpd_gzip_filter_t* f, const char* data, size_t len) {
+	size_t off = 0;
+	int r = 0;
+
+	while (off < len && !f->busy && f->mode != MODE_BROKEN && r == 0) {
+		enum llhttp_errno e = llhttp_execute(&f->parser, data + off, len - off);
+		size_t end = e == HPE_OK ? len : (size_t)(llhttp_get_error_pos(&f->parser) - data);
+
+		if (e != HPE_OK && e != HPE_PAUSED) {
+			if (f->mode == MODE_STREAM || f->mode == MODE_BUFFER) {
+				// the head is sent, or the body is lost
+				return e == HPE_USER ? UV_ENOMEM : UV_EPROTO;
+			}
+			uvlog_debug("gzip passes a response as is: %s %s", llhttp_errno_name(e), f->parser.reason);
+			mybuf_append(&f->out, f->head.buf, f->head.size);
+			mybuf_clear(&f->head);
+			f->mode = MODE_BROKEN;
+			break;
+		}
+		segment(f, data + off, end - off);
+		off = end;
+		if (e == HPE_PAUSED) {
+			llhttp_resume(&f->parser);
+			r = f->mode == MODE_HEAD ? headers_done(f) : message_done(f);
+		}
+	}
+	if (r == 0 && off < len) {
+		// after a body given to the threadpool, or not understood
+		if (f->busy) {
+			r = mybuf_append(&f->queued, data + off, len - off) ? UV_ENOMEM : 0;
+		} else {
+			mybuf_append(&f->out, data + off, len - off);
+		}
+	}
+	if (r == 0 && f->mode == MODE_STREAM && f->stream_in) {
+		// do not hold back what is written so far, e.g. events
+		r = emit_chunk(f, Z_SYNC_FLUSH);
+	}
+	if (r == 0) {
+		r = send_out(f);
+	}
+	return r;
+}
+
+
+/*************************** response parser callback functions ****************/
+
+static int on_response_begin(llhttp_t* parser) {
+	uv_httpd_gzip_filter_t* f = parser->data;
+	f->mode = MODE_HEAD;
+	return 0;
+}
+
+static int on_response_headers_complete(llhttp_t* parser) {
+	// decided by `filter` with the raw head
+	return HPE_PAUSED;
+}
+
+static int on_response_body(llhttp_t* parser, const char* at, size_t length) {
+	uv_httpd_gzip_filter_t* f = parser->data;
+	uint64_t start;
+	int r;
+
+	if (f->mode == MODE_BUFFER) {
+		return mybuf_append(&f->body, at, length) ? HPE_USER : 0;
+	} else if (f->mode == MODE_STREAM) {
+		start = uv_hrtime();
+		r = deflate_to(&f->zs, at, length, Z_NO_FLUSH, &f->zbody);
+		f->gz->stats.deflate_ns += uv_hrtime() - start;
+		f->gz->stats.deflated += length;
+		f->gz->stats.bytes_in += length;
+		f->stream_in += length;
+		return r ? HPE_USER : 0;
+	}
+	return 0;
+}
+
+static int on_response_complete(llhttp_t* parser) {
+	return HPE_PAUSED;
+}
+
+
+/*************************** public functions ****************/
+
+int uv_httpd_gzip_create(uv_httpd_gzip_t** gz, uv_loop_t* loop, int level, size_t cache_size) {
+	uv_httpd_gzip_t* g = calloc(1, sizeof(*g));
+	if (!g) return UV_ENOMEM;
+	g->buckets = calloc(CACHE_BUCKETS, sizeof(cache_entry_t*));
+	if (!g->buckets) {
+		free(g);
+		return UV_ENOMEM;
+	}
+	g->loop = loop;
+	g->level = level;
+	g->cache_size = cache_size;
+	QUEUE_INIT(&g->lru);
+	llhttp_settings_init(&g->settings);
+	g->settings.on_message_begin = on_response_begin;
+	g->settings.on_headers_complete = on_response_headers_complete;
+	g->settings.on_body = on_response_body;
+	g->settings.on_message_complete = on_response_complete;
+	*gz = g;
+	return 0;
+}
+
+void uv_httpd_gzip_free(uv_httpd_gzip_t* gz) {
+	int i;
+	while (!QUEUE_EMPTY(&gz->lru)) {
+		cache_remove(gz, QUEUE_DATA(QUEUE_HEAD(&gz->lru), cache_entry_t, lru));
+	}
+	for (i = 0; i < 3; i++) {
+		if (gz->zs_ready[i]) deflateEnd(&gz->zs[i]);
+	}
+	free(gz->buckets);
+	free(gz);
+}
+
+void uv_httpd_gzip_stats(uv_httpd_gzip_t* gz, uv_httpd_gzip_stats_t* stats) {
+	*stats = gz->stats;
+}
+
+// `q=0` means not acceptable
+static int q_zero(const char* p, const char* end) {
+	const char* q;
+	for (q = p; q + 1 < end; q++) {
+		if ((*q == 'q' || *q == 'Q') && q[1] == '=') {
+			q += 2;
+			if (q == end || *q != '0') return 0;
+			for (q++; q < end && (*q == '.' || *q == '0'); q++);
+			return q == end || *q == ' ' || *q == ';';
+		}
+	}
+	return 0;
+}
+
+int uv_httpd_gzip_encoding(const uv_httpd_request_t* req) {
+	const uv_httpd_string_t* ae = uv_httpd_header(req, "Accept-Encoding");
+	const char *p, *end;
+	int gzip = 0, deflate = 0, any = 0; // 1 if acceptable, -1 if refused
+
+	if (!ae) return UV_HTTPD_IDENTITY;
+	p = req->base + ae->offset;
+	end = p + ae->len;
+	while (p < end) {
+		const char *token, *params;
+		size_t n;
+		int ok;
+
+		while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) p++;
+		token = p;
+		while (p < end && *p != ',' && *p != ';' && *p != ' ') p++;
+		n = (size_t)(p - token);
+		params = p;
+		while (p < end && *p != ',') p++;
+		ok = q_zero(params, p) ? -1 : 1;
+		if (0 == string0_nicmp("gzip", token, n) || 0 == string0_nicmp("x-gzip", token, n)) {
+			gzip = ok;
+		} else if (0 == string0_nicmp("deflate", token, n)) {
+			deflate = ok;
+		} else if (n == 1 && token[0] == '*') {
+			any = ok;
+		}
+	}
+	if (gzip > 0 || (gzip == 0 && any > 0)) return UV_HTTPD_GZIP;
+	if (deflate > 0) return UV_HTTPD_DEFLATE;
+	return UV_HTTPD_IDENTITY;
+}
+
+int uv_httpd_gzip_filter_create(uv_httpd_gzip_filter_t** f, uv_httpd_gzip_t* gz, uv_httpd_client_t* client,
+								int encoding, int chunked) {
+	// created per request, only the inline buffers that are used get touched
+	uv_httpd_gzip_filter_t* p = malloc(sizeof(*p));
+	if (!p) return UV_ENOMEM;
+	memset(p, 0, offsetof(uv_httpd_gzip_filter_t, head));
+	p->gz = gz;
+	p->client = client;
+	p->encoding = encoding;
+	p->chunked = chunked;
+	llhttp_init(&p->parser, HTTP_RESPONSE, &gz->settings);
+	p->parser.data = p;
+	mybuf_init(&p->head);
+	mybuf_init(&p->body);
+	mybuf_init(&p->zbody);
+	mybuf_init(&p->out);
+	mybuf_init(&p->queued);
+	*f = p;
+	return 0;
+}
+
+int uv_httpd_gzip_filter_write(uv_httpd_gzip_filter_t* f, const char* data, size_t len) {
+	if (f->busy) {
+		return mybuf_append(&f->queued, data, len) ? UV_ENOMEM : 0;
+	} else if (f->mode == MODE_BROKEN) {
+		return uv_httpd_gzip_send(f->client, data, len);
+	}
+	return filter(f, data, len);
+}
+
+int uv_httpd_gzip_filter_busy(uv_httpd_gzip_filter_t* f) {
+	return f->busy;
+}
+
+void uv_httpd_gzip_filter_free(uv_httpd_gzip_filter_t* f) {
+	if (f->busy) {
+		// released by on_work_done
+		f->client = NULL;
+		return;
+	}
+	filter_release(f);
+}
@@ -0,0 +1,89 @@
+#ifndef __UV_HTTPD_GZIP_H__
+#define __UV_HTTPD_GZIP_H__
+
+#pragma once
+
+#include "uv_httpd.h"
+
+// response compression with zlib, negotiated by `Accept-Encoding`, see `server->gzip`.
+// responses written by `uv_httpd_write_response` are parsed and rewritten:
+// - `Content-Length` bodies are compressed as a whole, on the threadpool if large.
+//   compressed bodies of static and cacheable responses, those with `ETag`,
+//   `Last-Modified` or `Cache-Control: max-age/public/immutable`, are kept in memory
+//   keyed by content, so repeated hits are not compressed again.
+// - chunked bodies are compressed as they are written, each write is flushed.
+// only compressible types are compressed, and never if the response has
+// `Content-Encoding` or `Cache-Control: no-transform`, or it answers HEAD.
+
+#ifndef UV_HTTPD_GZIP_LEVEL
+#define UV_HTTPD_GZIP_LEVEL 6
+#endif
+
+#ifndef UV_HTTPD_GZIP_MIN_SIZE
+#define UV_HTTPD_GZIP_MIN_SIZE 256 // smaller bodies are sent as is
+#endif
+
+#ifndef UV_HTTPD_GZIP_POOL_SIZE
+#define UV_HTTPD_GZIP_POOL_SIZE (64 * 1024) // larger bodies are compressed on the threadpool
+#endif
+
+#ifndef UV_HTTPD_GZIP_MAX_BUFFER
+#define UV_HTTPD_GZIP_MAX_BUFFER (4 * 1024 * 1024) // larger `Content-Length` bodies are streamed chunked
+#endif
+
+#ifndef UV_HTTPD_GZIP_CACHE_SIZE
+#define UV_HTTPD_GZIP_CACHE_SIZE (16 * 1024 * 1024) // bytes of cached bodies, both plain and compressed
+#endif
+
+typedef struct uv_httpd_gzip_s uv_httpd_gzip_t;
+typedef struct uv_httpd_gzip_filter_s uv_httpd_gzip_filter_t;
+
+typedef struct {
+	uint64_t responses; // compressed responses, cache hits included
+	uint64_t bytes_in; // body bytes before compression
+	uint64_t bytes_out; // body bytes after compression, `bytes_in - bytes_out` is saved
+	uint64_t deflated; // body bytes actually compressed, cache hits excluded
+	uint64_t deflate_ns; // time spent in deflate, both on the loop and on the threadpool
+	uint64_t cache_hits;
+	uint64_t cache_misses; // cacheable responses compressed and added
+	uint64_t cache_entries;
+	uint64_t cache_bytes;
+}uv_httpd_gzip_stats_t;
+
+// `level` is zlib compression level, `cache_size` is in bytes, 0 to disable the cache.
+// return 0 for success, otherwise it is `uv_errno_t`
+int uv_httpd_gzip_create(uv_httpd_gzip_t** gz, uv_loop_t* loop, int level, size_t cache_size);
+// free after the loop ends, compressions on the threadpool keep it alive
+void uv_httpd_gzip_free(uv_httpd_gzip_t* gz);
+void uv_httpd_gzip_stats(uv_httpd_gzip_t* gz, uv_httpd_gzip_stats_t* stats);
+
+/*************************** responses, called by uv_httpd.c ****************/
+
+enum {
+	UV_HTTPD_IDENTITY,
+	UV_HTTPD_GZIP,
+	UV_HTTPD_DEFLATE,
+};
+
+// the content coding to answer `req` with, from its `Accept-Encoding`
+int uv_httpd_gzip_encoding(const uv_httpd_request_t* req);
+// filter the responses of a request, `chunked` if the client accepts chunked responses.
+// return 0 for success, otherwise it is `uv_errno_t`
+int uv_httpd_gzip_filter_create(uv_httpd_gzip_filter_t** f, uv_httpd_gzip_t* gz, uv_httpd_client_t* client,
+								int encoding, int chunked);
+// a piece of the response, the output goes to `uv_httpd_gzip_send`.
+// return 0 for success, otherwise it is `uv_errno_t`
+int uv_httpd_gzip_filter_write(uv_httpd_gzip_filter_t* f, const char* data, size_t len);
+// a body is being compressed on the threadpool, later writes are queued
+int uv_httpd_gzip_filter_busy(uv_httpd_gzip_filter_t* f);
+// the client is done or closed, freed when the threadpool work is done if busy
+void uv_httpd_gzip_filter_free(uv_httpd_gzip_filter_t* f);
+
+/*************************** implemented by uv_httpd.c ****************/
+
+// write filtered output
+int uv_httpd_gzip_send(uv_httpd_client_t* client, const char* data, size_t len);
+// no longer busy, the response goes on
+void uv_httpd_gzip_on_done(uv_httpd_client_t* client);
+
+#endif
@@ -0,0 +1,1024 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "uv_httpd_h2.h"
+#include "uv_httpd_hpack.h"
+#include "mybuf.h"
+#include "uv_log.h"
+
+enum {
+	FRAME_DATA,
+	FRAME_HEADERS,
+	FRAME_PRIORITY,
+	FRAME_RST_STREAM,
+	FRAME_SETTINGS,
+	FRAME_PUSH_PROMISE,
+	FRAME_PING,
+	FRAME_GOAWAY,
+	FRAME_WINDOW_UPDATE,
+	FRAME_CONTINUATION,
+};
+
+#define FLAG_END_STREAM 0x1
+#define FLAG_ACK 0x1
+#define FLAG_END_HEADERS 0x4
+#define FLAG_PADDED 0x8
+#define FLAG_PRIORITY 0x20
+
+enum {
+	H2_NO_ERROR,
+	H2_PROTOCOL_ERROR,
+	H2_INTERNAL_ERROR,
+	H2_FLOW_CONTROL_ERROR,
+	H2_SETTINGS_TIMEOUT,
+	H2_STREAM_CLOSED,
+	H2_FRAME_SIZE_ERROR,
+	H2_REFUSED_STREAM,
+	H2_CANCEL,
+	H2_COMPRESSION_ERROR,
+	H2_CONNECT_ERROR,
+	H2_ENHANCE_YOUR_CALM,
+};
+
+#define SETTINGS_ENABLE_PUSH 2
+#define SETTINGS_MAX_CONCURRENT_STREAMS 3
+#define SETTINGS_INITIAL_WINDOW_SIZE 4
+#define SETTINGS_MAX_FRAME_SIZE 5
+
+#define FRAME_HEADER_LEN 9
+#define DEFAULT_WINDOW 65535
+#define DEFAULT_MAX_FRAME 16384 // ours is never changed
+#define MAX_WINDOW 0x7fffffff
+#define MAX_HEADER_BLOCK (64 * 1024) // HEADERS and CONTINUATION of a request
+#define MAX_UPGRADE_SETTINGS 512 // base64url chars of `HTTP2-Settings`
+
+struct uv_httpd_h2_stream_s {
+	QUEUE node; // in h2->streams, or h2->closed until reaped
+	QUEUE send_node; // in h2->sending
+	uv_httpd_h2_t* h2;
+	uv_httpd_client_t* client;
+	uint32_t id;
+	int sending;
+	int head_request; // the response has no body
+	int remote_closed; // END_STREAM received
+	int local_closed; // END_STREAM or RST_STREAM sent
+	int closed; // no more frames are processed
+	int paused; // by uv_httpd_h2_reading
+	int delivering; // in uv_httpd_h2_on_data of held data
+	int end_held; // END_STREAM received while paused
+	int64_t content_length; // of the request, -1 if none
+	uint64_t received; // request body bytes in DATA
+	int64_t send_window;
+	int64_t recv_window;
+	size_t consumed; // delivered bytes not yet given back by WINDOW_UPDATE
+	size_t held_off;
+	llhttp_t parser; // the HTTP/1.1 response written by the application
+	int response_done; // the final response is parsed, END_STREAM after `data`
+	size_t data_off;
+	// buffers last, they are not zeroed on creation, see stream_new
+	mybuf_t held; // DATA received while paused
+	mybuf_t fields; // raw response header fields, `name\0value\0`...
+	mybuf_t data; // response body to send in DATA frames
+};
+
+struct uv_httpd_h2_s {
+	uv_httpd_client_t* conn;
+	llhttp_settings_t settings; // of response parsers
+	uv_httpd_hpack_t decoder;
+	mybuf_t out; // frames to write
+	mybuf_t block; // header block of HEADERS and CONTINUATION
+	mybuf_t encoded; // header block of a response
+	uint32_t block_stream; // CONTINUATION is expected if nonzero
+	int block_end_stream;
+	size_t preface_left;
+	uint32_t last_stream_id; // highest stream opened by the peer
+	int nstreams;
+	QUEUE streams;
+	QUEUE closed;
+	// reaped streams kept for the next ones, freeing a batch of them each round trip
+	// makes malloc trim the heap and fault the pages back in
+	QUEUE spare;
+	int nspare;
+	QUEUE sending; // streams with DATA to send, round robin
+	int64_t send_window;
+	int64_t recv_window;
+	int64_t peer_window; // initial window of streams
+	size_t peer_max_frame;
+	// END_STREAM may be set on the last HEADERS in `out`,
+	// if the response has no body, instead of an empty DATA
+	uv_httpd_h2_stream_t* patch_stream;
+	size_t patch_pos;
+	int goaway_sent;
+	int goaway_received;
+	int dead; // connection error
+	int feeding; // frames are written once when `uv_httpd_h2_feed` returns
+	uv_idle_t reaper; // frees closed streams out of their callbacks
+};
+
+// state of decoding a header block
+typedef struct {
+	uv_httpd_h2_stream_t* stream; // NULL if the fields are ignored
+	int trailers;
+	int regular; // a regular field is seen, no more pseudo-header fields
+	int has_method;
+	int has_path;
+	int malformed;
+}header_ctx_t;
+
+static uint32_t get32(const uint8_t* p) {
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void put32(uint8_t* p, uint32_t v) {
+	p[0] = (uint8_t)(v >> 24);
+	p[1] = (uint8_t)(v >> 16);
+	p[2] = (uint8_t)(v >> 8);
+	p[3] = (uint8_t)v;
+}
+
+static int is_connection_header(const char* name, size_t len) {
+	return 0 == string0_nicmp("connection", name, len)
+		|| 0 == string0_nicmp("keep-alive", name, len)
+		|| 0 == string0_nicmp("proxy-connection", name, len)
+		|| 0 == string0_nicmp("transfer-encoding", name, len)
+		|| 0 == string0_nicmp("upgrade", name, len);
+}
+
+static void on_reap(uv_idle_t* idle);
+
+
+/*************************** frames ****************/
+
+static int frame(uv_httpd_h2_t* h2, uint8_t type, uint8_t flags, uint32_t id, const void* payload, size_t len) {
+	uint8_t header[FRAME_HEADER_LEN];
+
+	header[0] = (uint8_t)(len >> 16);
+	header[1] = (uint8_t)(len >> 8);
+	header[2] = (uint8_t)len;
+	header[3] = type;
+	header[4] = flags;
+	put32(header + 5, id & MAX_WINDOW);
+	// both or none
+	if (mybuf_reserve(&h2->out, FRAME_HEADER_LEN + len)) return UV_ENOMEM;
+	mybuf_append(&h2->out, (const char*)header, FRAME_HEADER_LEN);
+	if (len) mybuf_append(&h2->out, payload, len);
+	return 0;
+}
+
+static void rst_stream(uv_httpd_h2_t* h2, uint32_t id, uint32_t code) {
+	uint8_t payload[4];
+	put32(payload, code);
+	frame(h2, FRAME_RST_STREAM, 0, id, payload, 4);
+}
+
+static void window_update(uv_httpd_h2_t* h2, uint32_t id, uint32_t increment) {
+	uint8_t payload[4];
+	put32(payload, increment);
+	frame(h2, FRAME_WINDOW_UPDATE, 0, id, payload, 4);
+}
+
+static void goaway(uv_httpd_h2_t* h2, uint32_t code) {
+	uint8_t payload[8];
+	if (h2->goaway_sent) return;
+	h2->goaway_sent = 1;
+	put32(payload, h2->last_stream_id);
+	put32(payload + 4, code);
+	frame(h2, FRAME_GOAWAY, 0, 0, payload, 8);
+}
+
+static void connection_error(uv_httpd_h2_t* h2, uint32_t code) {
+	uvlog_debug("h2 connection error %u", code);
+	goaway(h2, code);
+	h2->dead = 1;
+}
+
+static void flush(uv_httpd_h2_t* h2) {
+	if (h2->out.size == 0 || !h2->conn || h2->feeding) return;
+	uv_httpd_h2_send(h2->conn, h2->out.buf, h2->out.size);
+	mybuf_clear(&h2->out);
+	h2->patch_stream = NULL;
+}
+
+static int throttled(uv_httpd_h2_t* h2) {
+	return uv_httpd_write_queue_size(h2->conn) + h2->out.size > UV_HTTPD_H2_WRITE_HIGH;
+}
+
+
+/*************************** streams ****************/
+
+static uv_httpd_h2_stream_t* find_stream(uv_httpd_h2_t* h2, uint32_t id) {
+	QUEUE* q;
+	QUEUE_FOREACH(q, &h2->streams) {
+		uv_httpd_h2_stream_t* s = QUEUE_DATA(q, uv_httpd_h2_stream_t, node);
+		if (s->id == id) return s;
+	}
+	return NULL;
+}
+
+static void stream_release(uv_httpd_h2_stream_t* s) {
+	mybuf_clear(&s->held);
+	mybuf_clear(&s->fields);
+	mybuf_clear(&s->data);
+	free(s);
+}
+
+static uv_httpd_h2_stream_t* stream_new(uv_httpd_h2_t* h2, uint32_t id) {
+	// a stream is created per request, only the inline buffers that are used get touched
+	uv_httpd_h2_stream_t* s;
+	if (!QUEUE_EMPTY(&h2->spare)) {
+		QUEUE* q = QUEUE_HEAD(&h2->spare);
+		QUEUE_REMOVE(q);
+		h2->nspare--;
+		s = QUEUE_DATA(q, uv_httpd_h2_stream_t, node);
+	} else {
+		s = malloc(sizeof(*s));
+		if (!s) return NULL;
+	}
+	memset(s, 0, offsetof(uv_httpd_h2_stream_t, held));
+	s->h2 = h2;
+	s->id = id;
+	s->send_window = h2->peer_window;
+	s->recv_window = UV_HTTPD_H2_WINDOW;
+	s->content_length = -1;
+	mybuf_init(&s->held);
+	mybuf_init(&s->fields);
+	mybuf_init(&s->data);
+	llhttp_init(&s->parser, HTTP_RESPONSE, &h2->settings);
+	s->parser.data = s;
+	QUEUE_INIT(&s->send_node);
+	s->client = uv_httpd_h2_on_stream_open(h2->conn, s);
+	if (!s->client) {
+		stream_release(s);
+		return NULL;
+	}
+	QUEUE_INSERT_TAIL(&h2->streams, &s->node);
+	h2->nstreams++;
+	return s;
+}
+
+// no more frames of `s` are processed, the client is freed by the reaper
+static void stream_closed(uv_httpd_h2_t* h2, uv_httpd_h2_stream_t* s) {
+	if (s->closed) return;
+	s->closed = 1;
+	if (s->sending) {
+		QUEUE_REMOVE(&s->send_node);
+		s->sending = 0;
+	}
+	if (h2->patch_stream == s) h2->patch_stream = NULL;
+	QUEUE_REMOVE(&s->node);
+	QUEUE_INSERT_TAIL(&h2->closed, &s->node);
+	h2->nstreams--;
+	uv_idle_start(&h2->reaper, on_reap);
+}
+
+static void stream_error(uv_httpd_h2_t* h2, uv_httpd_h2_stream_t* s, uint32_t code) {
+	if (s->closed) return;
+	rst_stream(h2, s->id, code);
+	s->local_closed = s->remote_closed = 1;
+	uv_httpd_h2_on_reset(s->client);
+	stream_closed(h2, s);
+}
+
+static void end_stream(uv_httpd_h2_t* h2, uv_httpd_h2_stream_t* s) {
+	if (h2->patch_stream == s) {
+		h2->out.buf[h2->patch_pos] |= FLAG_END_STREAM;
+		h2->patch_stream = NULL;
+	} else {
+		frame(h2, FRAME_DATA, FLAG_END_STREAM, s->id, NULL, 0);
+	}
+	s->local_closed = 1;
+}
+
+static void schedule(uv_httpd_h2_t* h2, uv_httpd_h2_stream_t* s) {
+	if (s->sending || s->closed || s->local_closed) return;
+	if (s->data.size > s->data_off ? s->send_window > 0 : s->response_done) {
+		QUEUE_INSERT_TAIL(&h2->sending, &s->send_node);
+		s->sending = 1;
+	}
+}
+
+// one DATA frame per stream in turn, until windows are exhausted or the socket is busy
+static void send_pending(uv_httpd_h2_t* h2) {
+	while (!QUEUE_EMPTY(&h2->sending) && !throttled(h2)) {
+		QUEUE* q = QUEUE_HEAD(&h2->sending);
+		uv_httpd_h2_stream_t* s = QUEUE_DATA(q, uv_httpd_h2_stream_t, send_node);
+		size_t left = s->data.size - s->data_off;
+		size_t n = left;
+		int end;
+
+		if (left && s->send_window <= 0) {
+			// a lower SETTINGS_INITIAL_WINDOW_SIZE took the window of the stream,
+			// a WINDOW_UPDATE or SETTINGS schedules it again
+			QUEUE_REMOVE(q);
+			s->sending = 0;
+			continue;
+		}
+		if (n > h2->peer_max_frame) n = h2->peer_max_frame;
+		if ((int64_t)n > s->send_window) n = (size_t)s->send_window;
+		if ((int64_t)n > h2->send_window) n = h2->send_window > 0 ? (size_t)h2->send_window : 0;
+		if (left && n == 0) break; // connection window, every stream waits for it
+		QUEUE_REMOVE(q);
+		s->sending = 0;
+		end = s->response_done && n == left;
+		if (frame(h2, FRAME_DATA, end ? FLAG_END_STREAM : 0, s->id, s->data.buf + s->data_off, n)) {
+			stream_error(h2, s, H2_INTERNAL_ERROR);
+			continue;
+		}
+		if (h2->patch_stream == s) h2->patch_stream = NULL;
+		s->data_off += n;
+		s->send_window -= (int64_t)n;
+		h2->send_window -= (int64_t)n;
+		if (end) s->local_closed = 1;
+		if (s->data_off == s->data.size) {
+			mybuf_clear(&s->data);
+			s->data_off = 0;
+			uv_httpd_h2_on_flushed(s->client);
+		} else {
+			schedule(h2, s);
+		}
+	}
+}
+
+static void update_window(uv_httpd_h2_t* h2, uv_httpd_h2_stream_t* s) {
+	if (s->paused || s->remote_closed || s->consumed < UV_HTTPD_H2_WINDOW / 2) return;
+	window_update(h2, s->id, (uint32_t)s->consumed);
+	s->recv_window += (int64_t)s->consumed;
+	s->consumed = 0;
+}
+
+static void deliver_held(uv_httpd_h2_t* h2, uv_httpd_h2_stream_t* s) {
+	if (s->delivering) return;
+	s->delivering = 1;
+	while (!s->paused && !s->closed && s->held_off < s->held.size) {
+		size_t n = s->held.size - s->held_off;
+		const char* at = s->held.buf + s->held_off;
+		s->held_off += n;
+		s->consumed += n;
+		uv_httpd_h2_on_data(s->client, at, n);
+	}
+	if (s->held_off == s->held.size) {
+		mybuf_clear(&s->held);
+		s->held_off = 0;
+	}
+	s->delivering = 0;
+	if (!s->paused && !s->closed && s->end_held && s->held.size == 0) {
+		s->end_held = 0;
+		uv_httpd_h2_on_end(s->client);
+	}
+}
+
+static void on_reap(uv_idle_t* idle) {
+	uv_httpd_h2_t* h2 = idle->data;
+	uv_idle_stop(idle);
+	while (!QUEUE_EMPTY(&h2->closed)) {
+		QUEUE* q = QUEUE_HEAD(&h2->closed);
+		uv_httpd_h2_stream_t* s = QUEUE_DATA(q, uv_httpd_h2_stream_t, node);
+		QUEUE_REMOVE(q);
+		uv_httpd_h2_on_stream_free(s->client);
+		if (h2->nspare < UV_HTTPD_H2_MAX_STREAMS) {
+			mybuf_clear(&s->held);
+			mybuf_clear(&s->fields);
+			mybuf_clear(&s->data);
+			QUEUE_INSERT_TAIL(&h2->spare, &s->node);
+			h2->nspare++;
+		} else {
+			stream_release(s);
+		}
+	}
+	if (h2->goaway_received && h2->nstreams == 0 && h2->conn) {
+		uv_httpd_close(h2->conn);
+	}
+}
+
+
+/*************************** response parser callback functions ****************/
+
+static int on_response_field(llhttp_t* parser, const char* at, size_t length) {
+	uv_httpd_h2_stream_t* s = parser->data;
+	return mybuf_append(&s->fields, at, length) ? HPE_USER : 0;
+}
+
+static int on_response_field_complete(llhttp_t* parser) {
+	uv_httpd_h2_stream_t* s = parser->data;
+	return mybuf_append(&s->fields, "", 1) ? HPE_USER : 0;
+}
+
+static int on_response_headers_complete(llhttp_t* parser) {
+	uv_httpd_h2_stream_t* s = parser->data;
+	uv_httpd_h2_t* h2 = s->h2;
+	mybuf_t* b = &h2->encoded;
+	const char* p = s->fields.buf;
+	const char* end = p + s->fields.size;
+	int status = parser->status_code;
+	size_t off = 0, pos;
+
+	b->size = 0;
+	if (uv_httpd_hpack_encode_status(b, status)) return HPE_USER;
+	while (p < end) {
+		const char* name = p;
+		size_t name_len = strlen(name);
+		const char* value = name + name_len + 1;
+		size_t value_len = strlen(value);
+		p = value + value_len + 1;
+		if (is_connection_header(name, name_len)) continue;
+		if (uv_httpd_hpack_encode(b, name, name_len, value, value_len)) return HPE_USER;
+	}
+	mybuf_clear(&s->fields);
+
+	// HEADERS and CONTINUATION, nothing else in between
+	pos = h2->out.size + 4;
+	do {
+		size_t n = b->size - off < h2->peer_max_frame ? b->size - off : h2->peer_max_frame;
+		if (frame(h2, off ? FRAME_CONTINUATION : FRAME_HEADERS, off + n == b->size ? FLAG_END_HEADERS : 0,
+				  s->id, b->buf + off, n)) {
+			return HPE_USER;
+		}
+		off += n;
+	} while (off < b->size);
+	if (status >= 200) {
+		h2->patch_stream = s;
+		h2->patch_pos = pos;
+	}
+	mybuf_clear(b);
+	return s->head_request && status >= 200 ? 1 : 0;
+}
+
+static int on_response_body(llhttp_t* parser, const char* at, size_t length) {
+	uv_httpd_h2_stream_t* s = parser->data;
+	if (s->data_off && s->data_off >= s->data.size / 2) {
+		memmove(s->data.buf, s->data.buf + s->data_off, s->data.size - s->data_off);
+		s->data.size -= s->data_off;
+		s->data_off = 0;
+	}
+	if (mybuf_append(&s->data, at, length)) return HPE_USER;
+	schedule(s->h2, s);
+	return 0;
+}
+
+static int on_response_complete(llhttp_t* parser) {
+	uv_httpd_h2_stream_t* s = parser->data;
+	if (parser->status_code < 200) {
+		// interim, the final response follows
+		return 0;
+	}
+	s->response_done = 1;
+	if (s->data.size == s->data_off) {
+		end_stream(s->h2, s);
+	} else {
+		schedule(s->h2, s);
+	}
+	// anything after the response is dropped
+	return HPE_PAUSED;
+}
+
+
+/*************************** frame handlers ****************/
+
+// return a connection error code, 0 for success
+static int apply_settings(uv_httpd_h2_t* h2, const uint8_t* p, size_t len) {
+	size_t i;
+	QUEUE* q;
+
+	if (len % 6) return H2_FRAME_SIZE_ERROR;
+	for (i = 0; i < len; i += 6) {
+		int id = p[i] << 8 | p[i + 1];
+		uint32_t value = get32(p + i + 2);
+		switch (id) {
+		case SETTINGS_ENABLE_PUSH:
+			if (value > 1) return H2_PROTOCOL_ERROR;
+			break;
+		case SETTINGS_INITIAL_WINDOW_SIZE:
+			if (value > MAX_WINDOW) return H2_FLOW_CONTROL_ERROR;
+			QUEUE_FOREACH(q, &h2->streams) {
+				uv_httpd_h2_stream_t* s = QUEUE_DATA(q, uv_httpd_h2_stream_t, node);
+				s->send_window += (int64_t)value - h2->peer_window;
+				if (s->send_window > MAX_WINDOW) return H2_FLOW_CONTROL_ERROR;
+				schedule(h2, s);
+			}
+			h2->peer_window = value;
+			break;
+		case SETTINGS_MAX_FRAME_SIZE:
+			if (value < DEFAULT_MAX_FRAME || value > 0xffffff) return H2_PROTOCOL_ERROR;
+			h2->peer_max_frame = value;
+			break;
+		default:
+			// the encoder never indexes, SETTINGS_HEADER_TABLE_SIZE does not matter
+			break;
+		}
+	}
+	return 0;
+}
+
+static int b64_value(char c) {
+	if (c >= 'A' && c <= 'Z') return c - 'A';
+	if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+	if (c >= '0' && c <= '9') return c - '0' + 52;
+	if (c == '-' || c == '+') return 62;
+	if (c == '_' || c == '/') return 63;
+	return -1;
+}
+
+// `HTTP2-Settings` is the base64url payload of SETTINGS, acknowledged implicitly
+static int apply_upgrade_settings(uv_httpd_h2_t* h2, const char* s, size_t len) {
+	uint8_t payload[MAX_UPGRADE_SETTINGS / 4 * 3];
+	uint32_t acc = 0;
+	size_t i, n = 0;
+	int bits = 0;
+
+	while (len && s[len - 1] == '=') len--;
+	if (len > MAX_UPGRADE_SETTINGS) return H2_PROTOCOL_ERROR;
+	for (i = 0; i < len; i++) {
+		int v = b64_value(s[i]);
+		if (v < 0) return H2_PROTOCOL_ERROR;
+		acc = acc << 6 | (uint32_t)v;
+		bits += 6;
+		if (bits >= 8) {
+			bits -= 8;
+			payload[n++] = (uint8_t)(acc >> bits);
+		}
+	}
+	return apply_settings(h2, payload, n);
+}
+
+// `content-length`, digits only and no more than INT64_MAX, return -1 if it is not
+static int parse_length(const char* p, size_t len, int64_t* value) {
+	int64_t v = 0;
+	size_t i;
+
+	if (len == 0) return -1;
+	for (i = 0; i < len; i++) {
+		if (p[i] < '0' || p[i] > '9' || v > (INT64_MAX - (p[i] - '0')) / 10) return -1;
+		v = v * 10 + (p[i] - '0');
+	}
+	*value = v;
+	return 0;
+}
+
+// the request body ends after `received` bytes, another content-length makes it malformed
+static int length_mismatch(uv_httpd_h2_stream_t* s) {
+	return s->content_length >= 0 && s->received != (uint64_t)s->content_length;
+}
+
+static int on_header(void* data, const char* name, size_t name_len, const char* value, size_t value_len) {
+	header_ctx_t* ctx = data;
+	uv_httpd_h2_stream_t* s = ctx->stream;
+
+	if (!s || s->closed || ctx->trailers || ctx->malformed) return 0;
+	if (name_len && name[0] == ':') {
+		if (ctx->regular) {
+			ctx->malformed = 1;
+		} else if (0 == string0_ncmp(":method", name, name_len)) {
+			ctx->has_method = 1;
+			s->head_request = 0 == string0_ncmp("HEAD", value, value_len);
+		} else if (0 == string0_ncmp(":path", name, name_len)) {
+			ctx->has_path = value_len > 0;
+		} else if (string0_ncmp(":scheme", name, name_len) && string0_ncmp(":authority", name, name_len)) {
+			ctx->malformed = 1;
+		}
+	} else {
+		ctx->regular = 1;
+		if (is_connection_header(name, name_len)
+			|| (0 == string0_ncmp("te", name, name_len) && string0_ncmp("trailers", value, value_len))) {
+			ctx->malformed = 1;
+		} else if (0 == string0_ncmp("content-length", name, name_len)) {
+			int64_t length;
+			// repeated, it must be the same
+			if (parse_length(value, value_len, &length) || (s->content_length >= 0 && s->content_length != length)) {
+				ctx->malformed = 1;
+			} else {
+				s->content_length = length;
+			}
+		}
+	}
+	if (ctx->malformed) return 0;
+	uv_httpd_h2_on_header(s->client, name, name_len, value, value_len);
+	return 0;
+}
+
+static void remote_end(uv_httpd_h2_stream_t* s) {
+	s->remote_closed = 1;
+	if (s->paused || s->held.size) {
+		s->end_held = 1;
+	} else {
+		uv_httpd_h2_on_end(s->client);
+	}
+}
+
+static int end_headers(uv_httpd_h2_t* h2) {
+	uint32_t id = h2->block_stream;
+	int end = h2->block_end_stream;
+	uv_httpd_h2_stream_t* s = find_stream(h2, id);
+	header_ctx_t ctx;
+
+	memset(&ctx, 0, sizeof(ctx));
+	h2->block_stream = 0;
+	if (s) {
+		ctx.stream = s;
+		ctx.trailers = 1;
+	} else if (!(id & 1)) {
+		return H2_PROTOCOL_ERROR;
+	} else if (id > h2->last_stream_id) {
+		h2->last_stream_id = id;
+		if (h2->goaway_sent || h2->goaway_received) {
+			// ignored, but decoded for the dynamic table
+		} else if (h2->nstreams >= UV_HTTPD_H2_MAX_STREAMS || !(ctx.stream = stream_new(h2, id))) {
+			rst_stream(h2, id, H2_REFUSED_STREAM);
+		}
+	}
+	// else a closed stream, e.g. reset by us
+	if (uv_httpd_hpack_decode(&h2->decoder, (const uint8_t*)h2->block.buf, h2->block.size, on_header, &ctx)) {
+		return H2_COMPRESSION_ERROR;
+	}
+	mybuf_clear(&h2->block);
+	if (!s) s = ctx.stream;
+	if (!s || s->closed) return 0;
+
+	if (ctx.trailers) {
+		if (!end || s->remote_closed || length_mismatch(s)) {
+			stream_error(h2, s, H2_PROTOCOL_ERROR);
+		} else {
+			remote_end(s);
+		}
+		return 0;
+	}
+	if (ctx.malformed || !ctx.has_method || !ctx.has_path || (end && length_mismatch(s))) {
+		stream_error(h2, s, H2_PROTOCOL_ERROR);
+		return 0;
+	}
+	if (end) s->remote_closed = 1;
+	if (uv_httpd_h2_on_headers_done(s->client) == -1) {
+		stream_error(h2, s, H2_CANCEL);
+	} else if (end && !s->closed) {
+		uv_httpd_h2_on_end(s->client);
+	}
+	return 0;
+}
+
+static int on_headers_frame(uv_httpd_h2_t* h2, uint8_t flags, uint32_t id, const uint8_t* p, size_t len) {
+	size_t pad = 0;
+
+	if (id == 0) return H2_PROTOCOL_ERROR;
+	if (flags & FLAG_PADDED) {
+		if (len < 1) return H2_FRAME_SIZE_ERROR;
+		pad = p[0];
+		p++;
+		len--;
+	}
+	if (flags & FLAG_PRIORITY) {
+		// ignored
+		if (len < 5) return H2_FRAME_SIZE_ERROR;
+		p += 5;
+		len -= 5;
+	}
+	if (pad > len) return H2_PROTOCOL_ERROR;
+	len -= pad;
+	h2->block.size = 0;
+	if (mybuf_append(&h2->block, (const char*)p, len)) return H2_INTERNAL_ERROR;
+	h2->block_stream = id;
+	h2->block_end_stream = flags & FLAG_END_STREAM;
+	return flags & FLAG_END_HEADERS ? end_headers(h2) : 0;
+}
+
+static int on_continuation(uv_httpd_h2_t* h2, uint8_t flags, uint32_t id, const uint8_t* p, size_t len) {
+	if (id == 0 || id != h2->block_stream) return H2_PROTOCOL_ERROR;
+	if (h2->block.size + len > MAX_HEADER_BLOCK) return H2_ENHANCE_YOUR_CALM;
+	if (mybuf_append(&h2->block, (const char*)p, len)) return H2_INTERNAL_ERROR;
+	return flags & FLAG_END_HEADERS ? end_headers(h2) : 0;
+}
+
+static int on_data(uv_httpd_h2_t* h2, uint8_t flags, uint32_t id, const uint8_t* p, size_t len) {
+	uv_httpd_h2_stream_t* s;
+	size_t data_len = len;
+
+	if (id == 0) return H2_PROTOCOL_ERROR;
+	if (flags & FLAG_PADDED) {
+		if (len < 1 || p[0] >= len) return H2_PROTOCOL_ERROR;
+		data_len = len - 1 - p[0];
+		p++;
+	}
+	// the whole frame counts, padding included
+	if ((int64_t)len > h2->recv_window) return H2_FLOW_CONTROL_ERROR;
+	h2->recv_window -= (int64_t)len;
+	if (h2->recv_window < UV_HTTPD_H2_WINDOW / 2) {
+		window_update(h2, 0, (uint32_t)(UV_HTTPD_H2_WINDOW - h2->recv_window));
+		h2->recv_window = UV_HTTPD_H2_WINDOW;
+	}
+
+	s = find_stream(h2, id);
+	if (!s) return id > h2->last_stream_id ? H2_PROTOCOL_ERROR : 0;
+	if (s->remote_closed) {
+		stream_error(h2, s, H2_STREAM_CLOSED);
+		return 0;
+	}
+	if ((int64_t)len > s->recv_window) {
+		stream_error(h2, s, H2_FLOW_CONTROL_ERROR);
+		return 0;
+	}
+	s->recv_window -= (int64_t)len;
+	s->consumed += len - data_len;
+	s->received += data_len;
+	if ((s->content_length >= 0 && s->received > (uint64_t)s->content_length)
+		|| ((flags & FLAG_END_STREAM) && length_mismatch(s))) {
+		// malformed, not delivered
+		stream_error(h2, s, H2_PROTOCOL_ERROR);
+		return 0;
+	}
+	if (s->paused || s->held.size) {
+		if (mybuf_append(&s->held, (const char*)p, data_len)) {
+			stream_error(h2, s, H2_INTERNAL_ERROR);
+			return 0;
+		}
+	} else if (data_len) {
+		s->consumed += data_len;
+		uv_httpd_h2_on_data(s->client, (const char*)p, data_len);
+	}
+	if ((flags & FLAG_END_STREAM) && !s->closed) {
+		remote_end(s);
+	}
+	if (!s->closed) update_window(h2, s);
+	return 0;
+}
+
+static int on_rst_stream(uv_httpd_h2_t* h2, uint32_t id, const uint8_t* p, size_t len) {
+	uv_httpd_h2_stream_t* s;
+
+	if (id == 0) return H2_PROTOCOL_ERROR;
+	if (len != 4) return H2_FRAME_SIZE_ERROR;
+	s = find_stream(h2, id);
+	if (!s) return id > h2->last_stream_id ? H2_PROTOCOL_ERROR : 0;
+	uvlog_debug("h2 stream %u reset: %u", id, get32(p));
+	s->local_closed = s->remote_closed = 1;
+	uv_httpd_h2_on_reset(s->client);
+	stream_closed(h2, s);
+	return 0;
+}
+
+static int on_settings(uv_httpd_h2_t* h2, uint8_t flags, uint32_t id, const uint8_t* p, size_t len) {
+	int r;
+
+	if (id) return H2_PROTOCOL_ERROR;
+	if (flags & FLAG_ACK) {
+		return len ? H2_FRAME_SIZE_ERROR : 0;
+	}
+	if ((r = apply_settings(h2, p, len))) return r;
+	frame(h2, FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0);
+	return 0;
+}
+
+static int on_window_update(uv_httpd_h2_t* h2, uint32_t id, const uint8_t* p, size_t len) {
+	uint32_t increment;
+	uv_httpd_h2_stream_t* s;
+
+	if (len != 4) return H2_FRAME_SIZE_ERROR;
+	increment = get32(p) & MAX_WINDOW;
+	if (id == 0) {
+		if (increment == 0) return H2_PROTOCOL_ERROR;
+		if (h2->send_window + increment > MAX_WINDOW) return H2_FLOW_CONTROL_ERROR;
+		h2->send_window += increment;
+		return 0;
+	}
+	s = find_stream(h2, id);
+	if (!s) return id > h2->last_stream_id ? H2_PROTOCOL_ERROR : 0;
+	if (increment == 0) {
+		stream_error(h2, s, H2_PROTOCOL_ERROR);
+	} else if (s->send_window + increment > MAX_WINDOW) {
+		stream_error(h2, s, H2_FLOW_CONTROL_ERROR);
+	} else {
+		s->send_window += increment;
+		schedule(h2, s);
+	}
+	return 0;
+}
+
+// return a connection error code, 0 for success
+static int on_frame(uv_httpd_h2_t* h2, uint8_t type, uint8_t flags, uint32_t id, const uint8_t* p, size_t len) {
+	if (h2->block_stream && type != FRAME_CONTINUATION) return H2_PROTOCOL_ERROR;
+
+	switch (type) {
+	case FRAME_DATA:
+		return on_data(h2, flags, id, p, len);
+	case FRAME_HEADERS:
+		return on_headers_frame(h2, flags, id, p, len);
+	case FRAME_PRIORITY:
+		// ignored
+		if (id == 0) return H2_PROTOCOL_ERROR;
+		if (len != 5) rst_stream(h2, id, H2_FRAME_SIZE_ERROR);
+		return 0;
+	case FRAME_RST_STREAM:
+		return on_rst_stream(h2, id, p, len);
+	case FRAME_SETTINGS:
+		return on_settings(h2, flags, id, p, len);
+	case FRAME_PUSH_PROMISE:
+		return H2_PROTOCOL_ERROR;
+	case FRAME_PING:
+		if (id) return H2_PROTOCOL_ERROR;
+		if (len != 8) return H2_FRAME_SIZE_ERROR;
+		if (!(flags & FLAG_ACK)) frame(h2, FRAME_PING, FLAG_ACK, 0, p, 8);
+		return 0;
+	case FRAME_GOAWAY:
+		if (id) return H2_PROTOCOL_ERROR;
+		if (len < 8) return H2_FRAME_SIZE_ERROR;
+		// its last stream id limits the streams we open, none without server push.
+		// new streams of the peer are ignored, see end_headers, the connection is
+		// closed when the open ones are done, see on_reap and uv_httpd_h2_feed
+		uvlog_debug("h2 goaway received: %u", get32(p + 4));
+		h2->goaway_received = 1;
+		return 0;
+	case FRAME_WINDOW_UPDATE:
+		return on_window_update(h2, id, p, len);
+	case FRAME_CONTINUATION:
+		return on_continuation(h2, flags, id, p, len);
+	default:
+		// unknown types are ignored
+		return 0;
+	}
+}
+
+
+/*************************** public functions ****************/
+
+int uv_httpd_h2_create(uv_httpd_h2_t** h2, uv_httpd_client_t* conn, const char* settings, size_t len) {
+	uv_httpd_h2_t* h = calloc(1, sizeof(*h));
+	uint8_t payload[12];
+	int r;
+
+	if (!h) return UV_ENOMEM;
+	h->conn = conn;
+	h->preface_left = UV_HTTPD_H2_PREFACE_LEN;
+	h->send_window = h->recv_window = h->peer_window = DEFAULT_WINDOW;
+	h->peer_max_frame = DEFAULT_MAX_FRAME;
+	mybuf_init(&h->out);
+	mybuf_init(&h->block);
+	mybuf_init(&h->encoded);
+	QUEUE_INIT(&h->streams);
+	QUEUE_INIT(&h->closed);
+	QUEUE_INIT(&h->spare);
+	QUEUE_INIT(&h->sending);
+	if (settings && apply_upgrade_settings(h, settings, len)) {
+		free(h);
+		return UV_EPROTO;
+	}
+	if ((r = uv_httpd_hpack_init(&h->decoder, UV_HTTPD_HPACK_TABLE_SIZE))) {
+		free(h);
+		return r;
+	}
+	llhttp_settings_init(&h->settings);
+	h->settings.on_header_field = on_response_field;
+	h->settings.on_header_field_complete = on_response_field_complete;
+	h->settings.on_header_value = on_response_field;
+	h->settings.on_header_value_complete = on_response_field_complete;
+	h->settings.on_headers_complete = on_response_headers_complete;
+	h->settings.on_body = on_response_body;
+	h->settings.on_message_complete = on_response_complete;
+	uv_idle_init(uv_httpd_client_server(conn)->tcp.loop, &h->reaper);
+	h->reaper.data = h;
+
+	payload[0] = 0;
+	payload[1] = SETTINGS_MAX_CONCURRENT_STREAMS;
+	put32(payload + 2, UV_HTTPD_H2_MAX_STREAMS);
+	payload[6] = 0;
+	payload[7] = SETTINGS_INITIAL_WINDOW_SIZE;
+	put32(payload + 8, UV_HTTPD_H2_WINDOW);
+	frame(h, FRAME_SETTINGS, 0, 0, payload, sizeof(payload));
+	// SETTINGS can't change the window of the connection
+	window_update(h, 0, UV_HTTPD_H2_WINDOW - DEFAULT_WINDOW);
+	h->recv_window = UV_HTTPD_H2_WINDOW;
+	flush(h);
+	*h2 = h;
+	return 0;
+}
+
+static void on_reaper_closed(uv_handle_t* handle) {
+	uv_httpd_h2_t* h2 = handle->data;
+	while (!QUEUE_EMPTY(&h2->spare)) {
+		QUEUE* q = QUEUE_HEAD(&h2->spare);
+		QUEUE_REMOVE(q);
+		free(QUEUE_DATA(q, uv_httpd_h2_stream_t, node));
+	}
+	uv_httpd_hpack_free(&h2->decoder);
+	mybuf_clear(&h2->out);
+	mybuf_clear(&h2->block);
+	mybuf_clear(&h2->encoded);
+	free(h2);
+}
+
+void uv_httpd_h2_free(uv_httpd_h2_t* h2) {
+	h2->conn = NULL;
+	while (!QUEUE_EMPTY(&h2->streams)) {
+		uv_httpd_h2_stream_t* s = QUEUE_DATA(QUEUE_HEAD(&h2->streams), uv_httpd_h2_stream_t, node);
+		uv_httpd_h2_on_reset(s->client);
+		stream_closed(h2, s);
+	}
+	on_reap(&h2->reaper);
+	uv_close((uv_handle_t*)&h2->reaper, on_reaper_closed);
+}
+
+uv_httpd_client_t* uv_httpd_h2_upgrade(uv_httpd_h2_t* h2, int head_request) {
+	uv_httpd_h2_stream_t* s = stream_new(h2, 1);
+	if (!s) return NULL;
+	h2->last_stream_id = 1;
+	s->remote_closed = 1;
+	s->head_request = head_request;
+	return s->client;
+}
+
+int uv_httpd_h2_feed(uv_httpd_h2_t* h2, const char* data, size_t len, size_t* consumed) {
+	const uint8_t* p = (const uint8_t*)data;
+	size_t off = 0;
+
+	if (h2->preface_left) {
+		size_t n = len < h2->preface_left ? len : h2->preface_left;
+		if (memcmp(data, UV_HTTPD_H2_PREFACE + UV_HTTPD_H2_PREFACE_LEN - h2->preface_left, n)) {
+			connection_error(h2, H2_PROTOCOL_ERROR);
+		}
+		h2->preface_left -= n;
+		off = n;
+	}
+	h2->feeding = 1;
+	while (!h2->dead && len - off >= FRAME_HEADER_LEN) {
+		size_t frame_len = (size_t)p[off] << 16 | (size_t)p[off + 1] << 8 | p[off + 2];
+		int r;
+		if (frame_len > DEFAULT_MAX_FRAME) {
+			connection_error(h2, H2_FRAME_SIZE_ERROR);
+			break;
+		}
+		if (len - off < FRAME_HEADER_LEN + frame_len) break;
+		r = on_frame(h2, p[off + 3], p[off + 4], get32(p + off + 5) & MAX_WINDOW, p + off + FRAME_HEADER_LEN, frame_len);
+		off += FRAME_HEADER_LEN + frame_len;
+		if (r) connection_error(h2, (uint32_t)r);
+	}
+	if (!h2->dead) send_pending(h2);
+	h2->feeding = 0;
+	flush(h2);
+	*consumed = off;
+	if (h2->dead) return UV_EPROTO;
+	// no more streams after GOAWAY of the peer
+	return h2->goaway_received && h2->nstreams == 0 ? UV_EOF : 0;
+}
+
+int uv_httpd_h2_write(uv_httpd_h2_t* h2, uv_httpd_h2_stream_t* stream, const char* data, size_t len) {
+	enum llhttp_errno r;
+
+	if (stream->closed || stream->response_done) return UV_EINVAL;
+	r = llhttp_execute(&stream->parser, data, len);
+	if (r != HPE_OK && r != HPE_PAUSED) {
+		uvlog_warn("h2 stream %u bad response: %s %s", stream->id,
+				   llhttp_errno_name(r), stream->parser.reason);
+		stream_error(h2, stream, H2_INTERNAL_ERROR);
+		flush(h2);
+		return UV_EINVAL;
+	}
+	send_pending(h2);
+	flush(h2);
+	return 0;
+}
+
+void uv_httpd_h2_close_stream(uv_httpd_h2_t* h2, uv_httpd_h2_stream_t* stream) {
+	if (stream->closed) return;
+	if (!stream->response_done && stream->data.size == stream->data_off) {
+		// a response delimited by the end of the connection
+		llhttp_finish(&stream->parser);
+	}
+	if (!stream->local_closed) {
+		if (stream->response_done && stream->data.size == stream->data_off) {
+			end_stream(h2, stream);
+		} else {
+			rst_stream(h2, stream->id, H2_CANCEL);
+		}
+	} else if (!stream->remote_closed) {
+		// the response is complete, the rest of the request is not needed
+		rst_stream(h2, stream->id, H2_NO_ERROR);
+	}
+	stream->local_closed = stream->remote_closed = 1;
+	stream_closed(h2, stream);
+	flush(h2);
+}
+
+void uv_httpd_h2_reading(uv_httpd_h2_t* h2, uv_httpd_h2_stream_t* stream, int want) {
+	if (stream->closed) return;
+	stream->paused = !want;
+	if (want) {
+		deliver_held(h2, stream);
+		if (!stream->closed) update_window(h2, stream);
+		flush(h2);
+	}
+}
+
+size_t uv_httpd_h2_queue_size(uv_httpd_h2_stream_t* stream) {
+	return stream->data.size - stream->data_off;
+}
+
+void uv_httpd_h2_on_written(uv_httpd_h2_t* h2) {
+	if (QUEUE_EMPTY(&h2->sending) || h2->dead) return;
+	send_pending(h2);
+	flush(h2);
+}
+
+void uv_httpd_h2_goaway(uv_httpd_h2_t* h2) {
+	goaway(h2, H2_NO_ERROR);
+	flush(h2);
+}
+
+int uv_httpd_h2_streams(uv_httpd_h2_t* h2) {
+	return h2->nstreams;
+}
@@ -0,0 +1,84 @@
+#ifndef __UV_HTTPD_H2_H__
+#define __UV_HTTPD_H2_H__
+
+#pragma once
+
+#include "uv_httpd.h"
+
+// HTTP/2 over cleartext TCP (h2c), RFC 9113.
+// each stream is served as a `uv_httpd_client_t` of its own, so `on_request`,
+// `on_headers` and the rest of the API work unchanged: responses are written as
+// HTTP/1.1 and converted to HEADERS and DATA frames.
+// enabled by `server->h2c`, both with prior knowledge and by `Upgrade: h2c`.
+// internal to uv_httpd, users do not call these.
+
+#define UV_HTTPD_H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define UV_HTTPD_H2_PREFACE_LEN 24
+
+#ifndef UV_HTTPD_H2_MAX_STREAMS
+#define UV_HTTPD_H2_MAX_STREAMS 100 // SETTINGS_MAX_CONCURRENT_STREAMS
+#endif
+
+#ifndef UV_HTTPD_H2_WINDOW
+#define UV_HTTPD_H2_WINDOW (256 * 1024) // receive window of a stream and of the connection
+#endif
+
+#ifndef UV_HTTPD_H2_WRITE_HIGH
+#define UV_HTTPD_H2_WRITE_HIGH (256 * 1024) // stop framing DATA while the socket has more queued
+#endif
+
+typedef struct uv_httpd_h2_s uv_httpd_h2_t;
+typedef struct uv_httpd_h2_stream_s uv_httpd_h2_stream_t;
+
+/*************************** session, called by uv_httpd.c ****************/
+
+// start a session on `conn` and send our SETTINGS.
+// `settings` is the base64url `HTTP2-Settings` header of an upgrade, or NULL.
+// return 0 for success, otherwise it is `uv_errno_t`
+int uv_httpd_h2_create(uv_httpd_h2_t** h2, uv_httpd_client_t* conn, const char* settings, size_t len);
+// the connection is closed, abort open streams
+void uv_httpd_h2_free(uv_httpd_h2_t* h2);
+// the upgraded request becomes stream 1, return its client or NULL if out of memory
+uv_httpd_client_t* uv_httpd_h2_upgrade(uv_httpd_h2_t* h2, int head_request);
+// process the client preface and frames, a partial frame at the end is not consumed.
+// return 0 for success, otherwise the connection should be closed after GOAWAY is flushed,
+// or after a GOAWAY of the peer if no stream is open. with open ones it is closed by
+// `uv_httpd_close` when they are done
+int uv_httpd_h2_feed(uv_httpd_h2_t* h2, const char* data, size_t len, size_t* consumed);
+// convert a piece of the HTTP/1.1 response of `stream`
+int uv_httpd_h2_write(uv_httpd_h2_t* h2, uv_httpd_h2_stream_t* stream, const char* data, size_t len);
+// the application is done with `stream`, the response is ended by END_STREAM,
+// or RST_STREAM if it is incomplete or not framed yet.
+// the client is freed later by `uv_httpd_h2_on_stream_free`
+void uv_httpd_h2_close_stream(uv_httpd_h2_t* h2, uv_httpd_h2_stream_t* stream);
+// flow control of the request body, the stream window is not updated while stopped
+void uv_httpd_h2_reading(uv_httpd_h2_t* h2, uv_httpd_h2_stream_t* stream, int want);
+// response bytes of `stream` not framed yet
+size_t uv_httpd_h2_queue_size(uv_httpd_h2_stream_t* stream);
+// a write of the connection is done, frame more DATA if it was throttled
+void uv_httpd_h2_on_written(uv_httpd_h2_t* h2);
+// refuse new streams, e.g. draining
+void uv_httpd_h2_goaway(uv_httpd_h2_t* h2);
+// open streams
+int uv_httpd_h2_streams(uv_httpd_h2_t* h2);
+
+/*************************** streams, implemented by uv_httpd.c ****************/
+
+// a new stream, return its client or NULL to refuse it
+uv_httpd_client_t* uv_httpd_h2_on_stream_open(uv_httpd_client_t* conn, uv_httpd_h2_stream_t* stream);
+// a request header field, pseudo-header fields included, `content-length` is valid.
+// return nonzero if the request is rejected
+int uv_httpd_h2_on_header(uv_httpd_client_t* client, const char* name, size_t name_len, const char* value, size_t value_len);
+// return -1 to reset the stream
+int uv_httpd_h2_on_headers_done(uv_httpd_client_t* client);
+void uv_httpd_h2_on_data(uv_httpd_client_t* client, const char* data, size_t len);
+void uv_httpd_h2_on_end(uv_httpd_client_t* client);
+// response data written so far is framed
+void uv_httpd_h2_on_flushed(uv_httpd_client_t* client);
+// RST_STREAM received or a stream error
+void uv_httpd_h2_on_reset(uv_httpd_client_t* client);
+void uv_httpd_h2_on_stream_free(uv_httpd_client_t* client);
+// write frames to the connection
+int uv_httpd_h2_send(uv_httpd_client_t* conn, const char* data, size_t len);
+
+#endif
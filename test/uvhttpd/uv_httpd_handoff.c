@@ -0,0 +1,291 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "uv_httpd_handoff.h"
+#include "uv_log.h"
+
+#define HANDOFF_MSG 'L' // old -> new, along with the listening socket
+#define HANDOFF_ACK 'A' // new -> old, listening on the received socket
+
+typedef struct {
+	uv_pipe_t pipe; // listening unix socket
+	uv_pipe_t peer; // connected replacement
+	uv_write_t write_req;
+	uv_httpd_server_t* server;
+	uint64_t timeout;
+	uv_httpd_done_t on_drained;
+	int handles; // initialized and not closed yet
+	int done;
+	char path[256];
+	char pipe_path[256]; // of `server->pipe` while handing off, "" if none
+	char buf[16];
+}handoff_server_t;
+
+typedef struct {
+	uv_pipe_t pipe;
+	uv_connect_t connect_req;
+	uv_write_t write_req;
+	uv_httpd_server_t* server;
+	uv_httpd_done_t cb;
+	int done;
+	char buf[16];
+}handoff_client_t;
+
+static char handoff_msg[] = { HANDOFF_MSG };
+static char handoff_ack[] = { HANDOFF_ACK };
+
+/*************************** old process ****************/
+
+static int handoff_listen(handoff_server_t* h);
+
+static void on_handoff_handle_closed(uv_handle_t* handle) {
+	handoff_server_t* h = handle->data;
+	if (--h->handles) return;
+	if (!h->done) {
+		// replacement failed, wait for another one
+		int r = handoff_listen(h);
+		warn_on_uv_err(r, "handoff listen");
+		if (h->handles) return; // freed when closed
+	}
+	free(h);
+}
+
+static void close_peer(handoff_server_t* h) {
+	if (!uv_is_closing((uv_handle_t*)&h->peer)) {
+		uv_close((uv_handle_t*)&h->peer, on_handoff_handle_closed);
+	}
+}
+
+static void on_server_pipe_closed(uv_handle_t* handle) {
+	free(handle);
+}
+
+// the unix socket listener of the server can not be handed off, closing it in the new
+// process would remove the socket file from under it. closing unlinks it right now,
+// so the replacement can bind its own on the same path.
+static void release_server_pipe(handoff_server_t* h) {
+	size_t len = sizeof(h->pipe_path);
+	h->pipe_path[0] = '\0';
+	if (!h->server->pipe) return;
+	if (uv_pipe_getsockname(h->server->pipe, h->pipe_path, &len) || len == sizeof(h->pipe_path)) {
+		h->pipe_path[0] = '\0';
+	} else {
+		h->pipe_path[len] = '\0';
+	}
+	uv_close((uv_handle_t*)h->server->pipe, on_server_pipe_closed);
+	h->server->pipe = NULL;
+}
+
+// replacement failed, serve the unix socket again
+static void restore_server_pipe(handoff_server_t* h) {
+	int r;
+	if (!h->pipe_path[0]) return;
+	r = uv_httpd_listen_pipe(h->server, h->pipe_path);
+	warn_on_uv_err(r, "listen pipe again");
+	h->pipe_path[0] = '\0';
+}
+
+static void on_peer_alloc(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
+	handoff_server_t* h = handle->data;
+	*buf = uv_buf_init(h->buf, sizeof(h->buf));
+}
+
+static void on_peer_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
+	handoff_server_t* h = stream->data;
+
+	if (nread == 0) return;
+	if (nread < 0 || buf->base[0] != HANDOFF_ACK) {
+		// replacement died before listening, keep serving
+		uvlog_warn("handoff failed: %s", nread < 0 ? uv_err_name((int)nread) : "bad ack");
+		restore_server_pipe(h);
+		close_peer(h);
+		return;
+	}
+
+	uvlog_info("listening socket handed off, draining");
+	h->done = 1;
+	close_peer(h);
+	uv_httpd_drain(h->server, h->timeout, h->on_drained);
+}
+
+static void on_handle_written(uv_write_t* req, int status) {
+	handoff_server_t* h = req->data;
+	if (status) {
+		warn_on_uv_err(status, "send listening socket");
+		restore_server_pipe(h);
+		close_peer(h);
+	}
+}
+
+static void on_replacement(uv_stream_t* stream, int status) {
+	handoff_server_t* h = stream->data;
+	uv_buf_t buf;
+	int r;
+
+	if (status) {
+		warn_on_uv_err(status, "handoff connection");
+		return;
+	}
+
+	uv_pipe_init(stream->loop, &h->peer, 1);
+	h->peer.data = h;
+	h->handles++;
+	r = uv_accept(stream, (uv_stream_t*)&h->peer);
+	if (r) {
+		warn_on_uv_err(r, "uv_accept");
+		close_peer(h);
+		return;
+	}
+
+	// one replacement at a time. closing unlinks the socket file right now,
+	// so the replacement can bind its own on the same path.
+	uv_close((uv_handle_t*)&h->pipe, on_handoff_handle_closed);
+	release_server_pipe(h);
+
+	buf = uv_buf_init(handoff_msg, sizeof(handoff_msg));
+	h->write_req.data = h;
+	r = uv_write2(&h->write_req, (uv_stream_t*)&h->peer, &buf, 1,
+				  (uv_stream_t*)&h->server->tcp, on_handle_written);
+	if (r) {
+		warn_on_uv_err(r, "uv_write2");
+		restore_server_pipe(h);
+		close_peer(h);
+		return;
+	}
+	uv_read_start((uv_stream_t*)&h->peer, on_peer_alloc, on_peer_read);
+}
+
+static int handoff_listen(handoff_server_t* h) {
+	uv_loop_t* loop = h->server->tcp.loop;
+	uv_fs_t req;
+	int r;
+
+	r = uv_pipe_init(loop, &h->pipe, 0);
+	if (r) return r;
+	h->pipe.data = h;
+	h->handles++;
+
+#ifndef _WIN32
+	// stale socket file left by a crashed process
+	uv_fs_unlink(loop, &req, h->path, NULL);
+	uv_fs_req_cleanup(&req);
+#else
+	(void)req;
+#endif
+
+	r = uv_pipe_bind(&h->pipe, h->path);
+	if (r == 0) {
+		r = uv_listen((uv_stream_t*)&h->pipe, 1, on_replacement);
+	}
+	if (r) {
+		// do not relisten in the close callback
+		h->done = 1;
+		uv_close((uv_handle_t*)&h->pipe, on_handoff_handle_closed);
+	}
+	return r;
+}
+
+int uv_httpd_handoff_serve(uv_httpd_server_t* server, const char* path, uint64_t timeout, uv_httpd_done_t on_drained) {
+	handoff_server_t* h;
+	int r;
+
+	if (strlen(path) >= sizeof(h->path)) return UV_ENAMETOOLONG;
+	h = calloc(1, sizeof(*h));
+	if (!h) return UV_ENOMEM;
+	h->server = server;
+	h->timeout = timeout;
+	h->on_drained = on_drained;
+	strcpy(h->path, path);
+	r = handoff_listen(h);
+	if (r && h->handles == 0) {
+		free(h);
+	}
+	return r;
+}
+
+
+/*************************** new process ****************/
+
+static void on_handoff_client_closed(uv_handle_t* handle) {
+	free(handle->data);
+}
+
+static void handoff_client_done(handoff_client_t* c, int status) {
+	if (c->done) return;
+	c->done = 1;
+	uv_close((uv_handle_t*)&c->pipe, on_handoff_client_closed);
+	c->cb(c->server, status);
+}
+
+static void on_ack_written(uv_write_t* req, int status) {
+	handoff_client_t* c = req->data;
+	warn_on_uv_err(status, "write handoff ack");
+	// we are listening already, the old process keeps serving if ack lost
+	handoff_client_done(c, 0);
+}
+
+static void on_fetch_alloc(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
+	handoff_client_t* c = handle->data;
+	*buf = uv_buf_init(c->buf, sizeof(c->buf));
+}
+
+static void on_fetch_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
+	handoff_client_t* c = stream->data;
+	uv_buf_t ack;
+	int r;
+
+	if (nread == 0) return;
+	if (nread < 0) {
+		handoff_client_done(c, (int)nread);
+		return;
+	}
+	if (!uv_pipe_pending_count(&c->pipe) || uv_pipe_pending_type(&c->pipe) != UV_TCP) {
+		handoff_client_done(c, UV_EPROTO);
+		return;
+	}
+
+	uv_read_stop(stream);
+	r = uv_accept(stream, (uv_stream_t*)&c->server->tcp);
+	if (r == 0) {
+		r = uv_httpd_listen_bound(c->server);
+	}
+	if (r) {
+		handoff_client_done(c, r);
+		return;
+	}
+
+	ack = uv_buf_init(handoff_ack, sizeof(handoff_ack));
+	c->write_req.data = c;
+	r = uv_write(&c->write_req, stream, &ack, 1, on_ack_written);
+	if (r) {
+		warn_on_uv_err(r, "write handoff ack");
+		handoff_client_done(c, 0);
+	}
+}
+
+static void on_handoff_connected(uv_connect_t* req, int status) {
+	handoff_client_t* c = req->data;
+	if (status) {
+		handoff_client_done(c, status);
+		return;
+	}
+	uv_read_start((uv_stream_t*)&c->pipe, on_fetch_alloc, on_fetch_read);
+}
+
+int uv_httpd_handoff_fetch(uv_httpd_server_t* server, const char* path, uv_httpd_done_t cb) {
+	int r;
+	handoff_client_t* c = calloc(1, sizeof(*c));
+	if (!c) return UV_ENOMEM;
+	c->server = server;
+	c->cb = cb;
+
+	r = uv_pipe_init(server->tcp.loop, &c->pipe, 1);
+	if (r) {
+		free(c);
+		return r;
+	}
+	c->pipe.data = c;
+	c->connect_req.data = c;
+	uv_pipe_connect(&c->connect_req, &c->pipe, path, on_handoff_connected);
+	return 0;
+}
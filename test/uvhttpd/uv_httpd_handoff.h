@@ -0,0 +1,34 @@
+#ifndef __UV_HTTPD_HANDOFF_H__
+#define __UV_HTTPD_HANDOFF_H__
+
+#pragma once
+
+#include "uv_httpd.h"
+
+// hot restart:
+// the running process serves its listening socket on a unix socket (named pipe on windows).
+// a replacement process connects to it and receives the listening socket by `uv_write2`,
+// then acks. after the ack the old process drains by `uv_httpd_drain`.
+// the listening socket is never closed during the handoff, so no connection is refused.
+// a unix socket listener of `uv_httpd_listen_pipe` is closed when the replacement connects,
+// and bound again by the replacement, connections to it in between are refused.
+
+#ifdef _WIN32
+#define UV_HTTPD_HANDOFF_PATH "\\\\?\\pipe\\uvhttpd.sock"
+#else
+#define UV_HTTPD_HANDOFF_PATH "/tmp/uvhttpd.sock"
+#endif
+
+// old process: wait for a replacement on `path`, after handoff drain with `timeout` ms
+// and call `on_drained`.
+// return 0 for success, otherwise it is uv_errno_t
+int uv_httpd_handoff_serve(uv_httpd_server_t* server, const char* path, uint64_t timeout, uv_httpd_done_t on_drained);
+
+// new process: fetch the listening socket from the process serving on `path`.
+// `cb` gets 0 if `server` is listening on the received socket, otherwise the caller
+// should fallback to `uv_httpd_listen`. either way a unix socket is up to the caller
+// to listen on in `cb`.
+// return 0 for success, otherwise it is uv_errno_t
+int uv_httpd_handoff_fetch(uv_httpd_server_t* server, const char* path, uv_httpd_done_t cb);
+
+#endif
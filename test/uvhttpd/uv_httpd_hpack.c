@@ -0,0 +1,507 @@
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
+#include "uv_httpd_hpack.h"
+
+#define ENTRY_OVERHEAD 32
+#define STATIC_TABLE_SIZE 61
+
+// RFC 7541 appendix A and B
+static const struct { const char* name; const char* value; } static_table[] = {
+	{ ":authority", "" },
+	{ ":method", "GET" },
+	{ ":method", "POST" },
+	{ ":path", "/" },
+	{ ":path", "/index.html" },
+	{ ":scheme", "http" },
+	{ ":scheme", "https" },
+	{ ":status", "200" },
+	{ ":status", "204" },
+	{ ":status", "206" },
+	{ ":status", "304" },
+	{ ":status", "400" },
+	{ ":status", "404" },
+	{ ":status", "500" },
+	{ "accept-charset", "" },
+	{ "accept-encoding", "gzip, deflate" },
+	{ "accept-language", "" },
+	{ "accept-ranges", "" },
+	{ "accept", "" },
+	{ "access-control-allow-origin", "" },
+	{ "age", "" },
+	{ "allow", "" },
+	{ "authorization", "" },
+	{ "cache-control", "" },
+	{ "content-disposition", "" },
+	{ "content-encoding", "" },
+	{ "content-language", "" },
+	{ "content-length", "" },
+	{ "content-location", "" },
+	{ "content-range", "" },
+	{ "content-type", "" },
+	{ "cookie", "" },
+	{ "date", "" },
+	{ "etag", "" },
+	{ "expect", "" },
+	{ "expires", "" },
+	{ "from", "" },
+	{ "host", "" },
+	{ "if-match", "" },
+	{ "if-modified-since", "" },
+	{ "if-none-match", "" },
+	{ "if-range", "" },
+	{ "if-unmodified-since", "" },
+	{ "last-modified", "" },
+	{ "link", "" },
+	{ "location", "" },
+	{ "max-forwards", "" },
+	{ "proxy-authenticate", "" },
+	{ "proxy-authorization", "" },
+	{ "range", "" },
+	{ "referer", "" },
+	{ "refresh", "" },
+	{ "retry-after", "" },
+	{ "server", "" },
+	{ "set-cookie", "" },
+	{ "strict-transport-security", "" },
+	{ "transfer-encoding", "" },
+	{ "user-agent", "" },
+	{ "vary", "" },
+	{ "via", "" },
+	{ "www-authenticate", "" },
+};
+static const uint32_t huff_codes[257] = {
+	0x00001ff8, 0x007fffd8, 0x0fffffe2, 0x0fffffe3, 0x0fffffe4, 0x0fffffe5,
+	0x0fffffe6, 0x0fffffe7, 0x0fffffe8, 0x00ffffea, 0x3ffffffc, 0x0fffffe9,
+	0x0fffffea, 0x3ffffffd, 0x0fffffeb, 0x0fffffec, 0x0fffffed, 0x0fffffee,
+	0x0fffffef, 0x0ffffff0, 0x0ffffff1, 0x0ffffff2, 0x3ffffffe, 0x0ffffff3,
+	0x0ffffff4, 0x0ffffff5, 0x0ffffff6, 0x0ffffff7, 0x0ffffff8, 0x0ffffff9,
+	0x0ffffffa, 0x0ffffffb, 0x00000014, 0x000003f8, 0x000003f9, 0x00000ffa,
+	0x00001ff9, 0x00000015, 0x000000f8, 0x000007fa, 0x000003fa, 0x000003fb,
+	0x000000f9, 0x000007fb, 0x000000fa, 0x00000016, 0x00000017, 0x00000018,
+	0x00000000, 0x00000001, 0x00000002, 0x00000019, 0x0000001a, 0x0000001b,
+	0x0000001c, 0x0000001d, 0x0000001e, 0x0000001f, 0x0000005c, 0x000000fb,
+	0x00007ffc, 0x00000020, 0x00000ffb, 0x000003fc, 0x00001ffa, 0x00000021,
+	0x0000005d, 0x0000005e, 0x0000005f, 0x00000060, 0x00000061, 0x00000062,
+	0x00000063, 0x00000064, 0x00000065, 0x00000066, 0x00000067, 0x00000068,
+	0x00000069, 0x0000006a, 0x0000006b, 0x0000006c, 0x0000006d, 0x0000006e,
+	0x0000006f, 0x00000070, 0x00000071, 0x00000072, 0x000000fc, 0x00000073,
+	0x000000fd, 0x00001ffb, 0x0007fff0, 0x00001ffc, 0x00003ffc, 0x00000022,
+	0x00007ffd, 0x00000003, 0x00000023, 0x00000004, 0x00000024, 0x00000005,
+	0x00000025, 0x00000026, 0x00000027, 0x00000006, 0x00000074, 0x00000075,
+	0x00000028, 0x00000029, 0x0000002a, 0x00000007, 0x0000002b, 0x00000076,
+	0x0000002c, 0x00000008, 0x00000009, 0x0000002d, 0x00000077, 0x00000078,
+	0x00000079, 0x0000007a, 0x0000007b, 0x00007ffe, 0x000007fc, 0x00003ffd,
+	0x00001ffd, 0x0ffffffc, 0x000fffe6, 0x003fffd2, 0x000fffe7, 0x000fffe8,
+	0x003fffd3, 0x003fffd4, 0x003fffd5, 0x007fffd9, 0x003fffd6, 0x007fffda,
+	0x007fffdb, 0x007fffdc, 0x007fffdd, 0x007fffde, 0x00ffffeb, 0x007fffdf,
+	0x00ffffec, 0x00ffffed, 0x003fffd7, 0x007fffe0, 0x00ffffee, 0x007fffe1,
+	0x007fffe2, 0x007fffe3, 0x007fffe4, 0x001fffdc, 0x003fffd8, 0x007fffe5,
+	0x003fffd9, 0x007fffe6, 0x007fffe7, 0x00ffffef, 0x003fffda, 0x001fffdd,
+	0x000fffe9, 0x003fffdb, 0x003fffdc, 0x007fffe8, 0x007fffe9, 0x001fffde,
+	0x007fffea, 0x003fffdd, 0x003fffde, 0x00fffff0, 0x001fffdf, 0x003fffdf,
+	0x007fffeb, 0x007fffec, 0x001fffe0, 0x001fffe1, 0x003fffe0, 0x001fffe2,
+	0x007fffed, 0x003fffe1, 0x007fffee, 0x007fffef, 0x000fffea, 0x003fffe2,
+	0x003fffe3, 0x003fffe4, 0x007ffff0, 0x003fffe5, 0x003fffe6, 0x007ffff1,
+	0x03ffffe0, 0x03ffffe1, 0x000fffeb, 0x0007fff1, 0x003fffe7, 0x007ffff2,
+	0x003fffe8, 0x01ffffec, 0x03ffffe2, 0x03ffffe3, 0x03ffffe4, 0x07ffffde,
+	0x07ffffdf, 0x03ffffe5, 0x00fffff1, 0x01ffffed, 0x0007fff2, 0x001fffe3,
+	0x03ffffe6, 0x07ffffe0, 0x07ffffe1, 0x03ffffe7, 0x07ffffe2, 0x00fffff2,
+	0x001fffe4, 0x001fffe5, 0x03ffffe8, 0x03ffffe9, 0x0ffffffd, 0x07ffffe3,
+	0x07ffffe4, 0x07ffffe5, 0x000fffec, 0x00fffff3, 0x000fffed, 0x001fffe6,
+	0x003fffe9, 0x001fffe7, 0x001fffe8, 0x007ffff3, 0x003fffea, 0x003fffeb,
+	0x01ffffee, 0x01ffffef, 0x00fffff4, 0x00fffff5, 0x03ffffea, 0x007ffff4,
+	0x03ffffeb, 0x07ffffe6, 0x03ffffec, 0x03ffffed, 0x07ffffe7, 0x07ffffe8,
+	0x07ffffe9, 0x07ffffea, 0x07ffffeb, 0x0ffffffe, 0x07ffffec, 0x07ffffed,
+	0x07ffffee, 0x07ffffef, 0x07fffff0, 0x03ffffee, 0x3fffffff,
+};
+static const uint8_t huff_lens[257] = {
+	13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+	28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+	6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+	5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+	13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+	15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+	6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+	20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+	24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+	22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+	21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+	26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+	19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+	20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+	26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+	30,
+};
+static const uint16_t huff_syms[257] = {
+	48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37, 45, 46, 47, 51,
+	52, 53, 54, 55, 56, 57, 61, 65, 95, 98, 100, 102, 103, 104, 108, 109,
+	110, 112, 114, 117, 58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+	77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89, 106, 107, 113, 118,
+	119, 120, 121, 122, 38, 42, 44, 59, 88, 90, 33, 34, 40, 41, 63, 39,
+	43, 124, 35, 62, 0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+	195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161, 167, 172, 176, 177,
+	179, 209, 216, 217, 227, 229, 230, 129, 132, 133, 134, 136, 146, 154, 156, 160,
+	163, 164, 169, 170, 173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+	233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150, 151, 152, 155, 157,
+	158, 165, 166, 168, 174, 175, 180, 182, 183, 188, 191, 197, 231, 239, 9, 142,
+	144, 145, 148, 159, 171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+	200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211,
+	212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254,
+	2, 3, 4, 5, 6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+	21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220, 249, 10, 13, 22,
+	256,
+};
+static const uint32_t huff_first[31] = {
+	0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000014, 0x0000005c,
+	0x000000f8, 0x00000000, 0x000003f8, 0x000007fa, 0x00000ffa, 0x00001ff8, 0x00003ffc, 0x00007ffc,
+	0x00000000, 0x00000000, 0x00000000, 0x0007fff0, 0x000fffe6, 0x001fffdc, 0x003fffd2, 0x007fffd8,
+	0x00ffffea, 0x01ffffec, 0x03ffffe0, 0x07ffffde, 0x0fffffe2, 0x00000000, 0x3ffffffc,
+};
+static const uint16_t huff_index[31] = {
+	0, 0, 0, 0, 0, 0, 10, 36, 68, 0, 74, 79, 82, 84, 90, 92,
+	0, 0, 0, 95, 98, 106, 119, 145, 174, 186, 190, 205, 224, 0, 253,
+};
+static const uint16_t huff_count[31] = {
+	0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3,
+	0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4,
+};
+
+// code lengths in use, shortest first
+static const uint8_t huff_lengths[] = { 5, 6, 7, 8, 10, 11, 12, 13, 14, 15, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 30 };
+
+static int to_lower(int c) {
+	return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+/*************************** integers and strings ****************/
+
+// RFC 7541 5.1, return bytes used, 0 if truncated or too large
+static size_t decode_int(const uint8_t* p, const uint8_t* end, int prefix, size_t* value) {
+	size_t max = ((size_t)1 << prefix) - 1;
+	size_t v, i;
+	int shift = 0;
+
+	if (p >= end) return 0;
+	v = *p & max;
+	if (v < max) {
+		*value = v;
+		return 1;
+	}
+	for (i = 1; p + i < end && shift <= 21; i++) {
+		v += (size_t)(p[i] & 0x7f) << shift;
+		shift += 7;
+		if (!(p[i] & 0x80)) {
+			*value = v;
+			return i + 1;
+		}
+	}
+	return 0;
+}
+
+static int encode_int(mybuf_t* out, int prefix, uint8_t flags, size_t value) {
+	uint8_t buf[16];
+	size_t max = ((size_t)1 << prefix) - 1, n = 0;
+
+	if (value < max) {
+		buf[n++] = flags | (uint8_t)value;
+	} else {
+		buf[n++] = flags | (uint8_t)max;
+		value -= max;
+		while (value >= 0x80) {
+			buf[n++] = (uint8_t)(value | 0x80);
+			value >>= 7;
+		}
+		buf[n++] = (uint8_t)value;
+	}
+	return mybuf_append(out, (const char*)buf, n);
+}
+
+// return decoded length, or -1 for invalid code or padding
+static int huff_decode(const uint8_t* src, size_t len, char* dst) {
+	uint64_t acc = 0;
+	int bits = 0, o = 0;
+	size_t i, l;
+
+	for (i = 0; i < len; i++) {
+		acc = (acc << 8) | src[i];
+		bits += 8;
+		for (;;) {
+			int found = 0;
+			for (l = 0; l < sizeof(huff_lengths) && huff_lengths[l] <= bits; l++) {
+				int n = huff_lengths[l];
+				uint32_t code = (uint32_t)(acc >> (bits - n)) & (uint32_t)(((uint64_t)1 << n) - 1);
+				if (code - huff_first[n] < huff_count[n]) {
+					uint16_t sym = huff_syms[huff_index[n] + code - huff_first[n]];
+					if (sym == 256) return -1; // EOS
+					dst[o++] = (char)sym;
+					bits -= n;
+					found = 1;
+					break;
+				}
+			}
+			if (!found) {
+				if (bits >= 30) return -1;
+				break; // need more bits
+			}
+		}
+	}
+	// padding is the most significant bits of EOS, all ones and shorter than a byte
+	if (bits > 7 || (acc & (((uint64_t)1 << bits) - 1)) != (((uint64_t)1 << bits) - 1)) return -1;
+	return o;
+}
+
+static size_t huff_encoded_len(const char* s, size_t len, int lower) {
+	size_t bits = 0, i;
+	for (i = 0; i < len; i++) {
+		bits += huff_lens[(uint8_t)(lower ? to_lower(s[i]) : s[i])];
+	}
+	return (bits + 7) / 8;
+}
+
+static void huff_encode(const char* s, size_t len, int lower, uint8_t* dst) {
+	uint64_t acc = 0;
+	int bits = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		uint8_t c = (uint8_t)(lower ? to_lower(s[i]) : s[i]);
+		acc = (acc << huff_lens[c]) | huff_codes[c];
+		bits += huff_lens[c];
+		while (bits >= 8) {
+			*dst++ = (uint8_t)(acc >> (bits - 8));
+			bits -= 8;
+		}
+	}
+	if (bits) {
+		*dst = (uint8_t)((acc << (8 - bits)) | (0xff >> bits));
+	}
+}
+
+// huffman coded if shorter
+static int encode_string(mybuf_t* out, const char* s, size_t len, int lower) {
+	size_t hlen = huff_encoded_len(s, len, lower);
+	if (hlen < len) {
+		if (encode_int(out, 7, 0x80, hlen) || mybuf_reserve(out, hlen)) return -1;
+		huff_encode(s, len, lower, (uint8_t*)out->buf + out->size);
+		out->size += hlen;
+	} else {
+		size_t i;
+		if (encode_int(out, 7, 0, len) || mybuf_append(out, s, len)) return -1;
+		if (lower) {
+			for (i = out->size - len; i < out->size; i++) {
+				out->buf[i] = (char)to_lower(out->buf[i]);
+			}
+		}
+	}
+	return 0;
+}
+
+#define NOT_IN_SCRATCH ((size_t)-1)
+
+// read a string literal at `*p` into `*s`.
+// huffman coded ones are decoded into `hp->scratch` at `*scratch_offset`, `*s` is not set then
+// since the scratch may move while reading the next string.
+static int read_string(uv_httpd_hpack_t* hp, const uint8_t** p, const uint8_t* end,
+					   const char** s, size_t* len, size_t* scratch_offset) {
+	int huffman = (**p & 0x80) != 0;
+	size_t n = decode_int(*p, end, 7, len);
+	int r;
+
+	if (n == 0 || *len > (size_t)(end - *p - n)) return UV_EPROTO;
+	*p += n;
+	if (!huffman) {
+		*s = (const char*)*p;
+		*scratch_offset = NOT_IN_SCRATCH;
+		*p += *len;
+		return 0;
+	}
+	// at most 8 symbols from 5 bytes
+	if (mybuf_reserve(&hp->scratch, *len * 8 / 5 + 1)) return UV_ENOMEM;
+	r = huff_decode(*p, *len, hp->scratch.buf + hp->scratch.size);
+	if (r < 0) return UV_EPROTO;
+	*scratch_offset = hp->scratch.size;
+	hp->scratch.size += (size_t)r;
+	*p += *len;
+	*len = (size_t)r;
+	return 0;
+}
+
+/*************************** dynamic table ****************/
+
+static uv_httpd_hpack_entry_t* entry_at(uv_httpd_hpack_t* hp, size_t k) {
+	// k = 0 is the newest
+	return &hp->entries[(hp->head + hp->capacity - k) % hp->capacity];
+}
+
+static void evict(uv_httpd_hpack_t* hp, size_t max_size) {
+	while (hp->n && hp->size > max_size) {
+		uv_httpd_hpack_entry_t* e = entry_at(hp, hp->n - 1);
+		hp->size -= e->name_len + e->value_len + ENTRY_OVERHEAD;
+		free(e->data);
+		e->data = NULL;
+		hp->n--;
+	}
+}
+
+// take `data` of `name_len + value_len` bytes, return 1 if added, 0 if larger than the table
+static int add_entry(uv_httpd_hpack_t* hp, char* data, size_t name_len, size_t value_len) {
+	size_t size = name_len + value_len + ENTRY_OVERHEAD;
+	uv_httpd_hpack_entry_t* e;
+
+	if (size > hp->max_size) {
+		evict(hp, 0);
+		return 0;
+	}
+	evict(hp, hp->max_size - size);
+	hp->head = (hp->head + 1) % hp->capacity;
+	e = &hp->entries[hp->head];
+	e->data = data;
+	e->name_len = name_len;
+	e->value_len = value_len;
+	hp->n++;
+	hp->size += size;
+	return 1;
+}
+
+static int lookup(uv_httpd_hpack_t* hp, size_t index, const char** name, size_t* name_len,
+				  const char** value, size_t* value_len) {
+	if (index == 0) return UV_EPROTO;
+	if (index <= STATIC_TABLE_SIZE) {
+		*name = static_table[index - 1].name;
+		*name_len = strlen(*name);
+		*value = static_table[index - 1].value;
+		*value_len = strlen(*value);
+		return 0;
+	}
+	index -= STATIC_TABLE_SIZE + 1;
+	if (index >= hp->n) return UV_EPROTO;
+	*name = entry_at(hp, index)->data;
+	*name_len = entry_at(hp, index)->name_len;
+	*value = *name + *name_len;
+	*value_len = entry_at(hp, index)->value_len;
+	return 0;
+}
+
+/*************************** public functions ****************/
+
+int uv_httpd_hpack_init(uv_httpd_hpack_t* hp, size_t max_size) {
+	memset(hp, 0, sizeof(*hp));
+	// every entry takes at least 32 bytes
+	hp->capacity = max_size / ENTRY_OVERHEAD + 1;
+	hp->entries = calloc(hp->capacity, sizeof(uv_httpd_hpack_entry_t));
+	if (!hp->entries) return UV_ENOMEM;
+	hp->max_size = hp->settings_max_size = max_size;
+	mybuf_init(&hp->scratch);
+	return 0;
+}
+
+void uv_httpd_hpack_free(uv_httpd_hpack_t* hp) {
+	if (!hp->entries) return;
+	evict(hp, 0);
+	free(hp->entries);
+	hp->entries = NULL;
+	mybuf_clear(&hp->scratch);
+}
+
+int uv_httpd_hpack_decode(uv_httpd_hpack_t* hp, const uint8_t* block, size_t len, uv_httpd_hpack_cb cb, void* data) {
+	const uint8_t* p = block;
+	const uint8_t* end = block + len;
+	int leading = 1; // size updates are only allowed at the beginning
+	int r = 0;
+
+	while (p < end && r == 0) {
+		const char *name, *value;
+		size_t name_len, value_len, index, n;
+		size_t name_scratch = NOT_IN_SCRATCH, value_scratch = NOT_IN_SCRATCH;
+		int indexing;
+
+		hp->scratch.size = 0;
+		if (*p & 0x80) {
+			// indexed field
+			n = decode_int(p, end, 7, &index);
+			if (n == 0 || lookup(hp, index, &name, &name_len, &value, &value_len)) return UV_EPROTO;
+			p += n;
+			r = cb(data, name, name_len, value, value_len);
+			leading = 0;
+			continue;
+		}
+		if ((*p & 0xe0) == 0x20) {
+			// dynamic table size update
+			n = decode_int(p, end, 5, &index);
+			if (n == 0 || !leading || index > hp->settings_max_size) return UV_EPROTO;
+			p += n;
+			hp->max_size = index;
+			evict(hp, hp->max_size);
+			continue;
+		}
+
+		// literal, with incremental indexing or not
+		leading = 0;
+		indexing = (*p & 0x40) != 0;
+		n = decode_int(p, end, indexing ? 6 : 4, &index);
+		if (n == 0) return UV_EPROTO;
+		p += n;
+		if (index) {
+			const char* ignored;
+			size_t ignored_len;
+			if (lookup(hp, index, &name, &name_len, &ignored, &ignored_len)) return UV_EPROTO;
+		} else if ((r = read_string(hp, &p, end, &name, &name_len, &name_scratch))) {
+			return r;
+		}
+		if ((r = read_string(hp, &p, end, &value, &value_len, &value_scratch))) return r;
+		if (name_scratch != NOT_IN_SCRATCH) name = hp->scratch.buf + name_scratch;
+		if (value_scratch != NOT_IN_SCRATCH) value = hp->scratch.buf + value_scratch;
+
+		if (indexing) {
+			// copy before evicting, the name may refer to an entry to be evicted
+			char* e = malloc(name_len + value_len + 1);
+			if (!e) return UV_ENOMEM;
+			memcpy(e, name, name_len);
+			memcpy(e + name_len, value, value_len);
+			r = cb(data, e, name_len, e + name_len, value_len);
+			if (!add_entry(hp, e, name_len, value_len)) {
+				free(e);
+			}
+		} else {
+			r = cb(data, name, name_len, value, value_len);
+		}
+	}
+	return r;
+}
+
+int uv_httpd_hpack_encode_status(mybuf_t* out, int status) {
+	char digits[4];
+	size_t i;
+
+	for (i = 7; i < 14; i++) {
+		if (atoi(static_table[i].value) == status) {
+			return encode_int(out, 7, 0x80, i + 1);
+		}
+	}
+	if (status < 100 || status > 999) return UV_EINVAL;
+	digits[0] = (char)('0' + status / 100);
+	digits[1] = (char)('0' + status / 10 % 10);
+	digits[2] = (char)('0' + status % 10);
+	// literal without indexing, name `:status` of index 8
+	if (encode_int(out, 4, 0, 8) || encode_int(out, 7, 0, 3) || mybuf_append(out, digits, 3)) return UV_ENOMEM;
+	return 0;
+}
+
+int uv_httpd_hpack_encode(mybuf_t* out, const char* name, size_t name_len, const char* value, size_t value_len) {
+	size_t i, j;
+
+	// regular header names of the static table, from `accept-charset`
+	for (i = 14; i < STATIC_TABLE_SIZE; i++) {
+		const char* s = static_table[i].name;
+		for (j = 0; j < name_len && s[j] && s[j] == to_lower(name[j]); j++);
+		if (j == name_len && s[j] == '\0') break;
+	}
+	if (i < STATIC_TABLE_SIZE) {
+		if (encode_int(out, 4, 0, i + 1)) return -1;
+	} else if (encode_int(out, 4, 0, 0) || encode_string(out, name, name_len, 1)) {
+		return -1;
+	}
+	return encode_string(out, value, value_len, 0);
+}
@@ -0,0 +1,49 @@
+#ifndef __UV_HTTPD_HPACK_H__
+#define __UV_HTTPD_HPACK_H__
+
+#pragma once
+
+#include <stdint.h>
+#include "mybuf.h"
+
+// HPACK (RFC 7541) header compression for HTTP/2.
+// the decoder keeps the dynamic table of the peer's encoder.
+// the encoder never indexes, so it has no state: static table names and
+// huffman coded strings are used where they are shorter.
+
+#ifndef UV_HTTPD_HPACK_TABLE_SIZE
+#define UV_HTTPD_HPACK_TABLE_SIZE 4096 // SETTINGS_HEADER_TABLE_SIZE default
+#endif
+
+typedef struct {
+	char* data; // name followed by value
+	size_t name_len, value_len;
+}uv_httpd_hpack_entry_t;
+
+typedef struct {
+	uv_httpd_hpack_entry_t* entries; // ring, newest at `head`
+	size_t capacity, head, n;
+	size_t size; // RFC 7541 4.1, 32 bytes overhead per entry
+	size_t max_size; // current, changed by dynamic table size update
+	size_t settings_max_size; // upper bound of `max_size`
+	mybuf_t scratch; // huffman decoded strings
+}uv_httpd_hpack_t;
+
+// a decoded header field, strings are only valid in this call.
+// return nonzero to stop decoding
+typedef int(*uv_httpd_hpack_cb)(void* data, const char* name, size_t name_len, const char* value, size_t value_len);
+
+// return 0 for success, otherwise it is `uv_errno_t`
+int uv_httpd_hpack_init(uv_httpd_hpack_t* hp, size_t max_size);
+void uv_httpd_hpack_free(uv_httpd_hpack_t* hp);
+// decode a whole header block.
+// return 0 for success, UV_EPROTO for a compression error, or what `cb` returned
+int uv_httpd_hpack_decode(uv_httpd_hpack_t* hp, const uint8_t* block, size_t len, uv_httpd_hpack_cb cb, void* data);
+
+// append `:status`
+int uv_httpd_hpack_encode_status(mybuf_t* out, int status);
+// append a header field, `name` is lowercased.
+// return 0 for success, -1 if out of memory
+int uv_httpd_hpack_encode(mybuf_t* out, const char* name, size_t name_len, const char* value, size_t value_len);
+
+#endif
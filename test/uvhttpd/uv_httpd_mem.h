@@ -0,0 +1,41 @@
+#ifndef __UV_HTTPD_MEM_H__
+#define __UV_HTTPD_MEM_H__
+
+#pragma once
+
+#include "uv_httpd.h"
+#include "mybuf.h"
+
+// in-memory connections, for benchmarks and tests without sockets.
+// request bytes are fed through the same `on_alloc`/`on_read` path as a socket,
+// and responses written by `uv_httpd_write_response` are appended to an output buffer.
+// everything runs on the calling thread, the loop is only needed to close the connection
+// and for asynchronous responses.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct uv_httpd_mem_s uv_httpd_mem_t;
+
+// a connection of `server` without a socket.
+// return 0 for success, otherwise it is `uv_errno_t`
+int uv_httpd_mem_create(uv_httpd_mem_t** mem, uv_httpd_server_t* server);
+// close the connection if still open, it is freed by the loop
+void uv_httpd_mem_free(uv_httpd_mem_t* mem);
+// feed `len` bytes as reads of at most `fragment` bytes, 0 for as much as `on_alloc` gives.
+// stops early if the connection stops reading, e.g. waiting for a deferred response,
+// or is closing. return bytes fed
+size_t uv_httpd_mem_feed(uv_httpd_mem_t* mem, const char* data, size_t len, size_t fragment);
+// the peer closed the connection
+void uv_httpd_mem_eof(uv_httpd_mem_t* mem);
+// responses written so far, the caller may consume it, e.g. set `size` to 0
+mybuf_t* uv_httpd_mem_output(uv_httpd_mem_t* mem);
+// the connection is closing or closed
+int uv_httpd_mem_closed(uv_httpd_mem_t* mem);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,276 @@
+#include <stdlib.h>
+#include <string.h>
+#include "uv_httpd_multipart.h"
+
+enum {
+	MP_PREAMBLE, // before the first boundary, ignored
+	MP_DELIM_TAIL, // after a boundary, `--` or transport padding and CRLF
+	MP_DELIM_DASH, // second `-` of the closing boundary
+	MP_DELIM_LF,
+	MP_HEADERS,
+	MP_DATA,
+	MP_EPILOGUE, // after the closing boundary, ignored
+	MP_ERROR,
+};
+
+struct uv_httpd_multipart_s {
+	int state;
+	size_t matched; // delimiter bytes matched at the end of last input
+	size_t delim_len;
+	char delim[4 + UV_HTTPD_MULTIPART_MAX_BOUNDARY]; // CRLF "--" boundary
+	size_t head_len;
+	char head[UV_HTTPD_MULTIPART_MAX_HEADERS]; // CRLF and headers of current part
+	on_part_t on_part;
+	on_part_data_t on_part_data;
+	void* data;
+};
+
+static int is_space(char c) {
+	return c == ' ' || c == '\t';
+}
+
+// parse one `key=value` of `; key=value; ...` in a header value, quotes of value are removed.
+// return the end of the parameter, `key_len` is 0 if there is no more parameter
+static const char* next_param(const char* p, const char* end, const char** key, size_t* key_len,
+							  const char** value, size_t* value_len) {
+	*key_len = *value_len = 0;
+	while (p < end && (*p == ';' || is_space(*p))) p++;
+	*key = p;
+	while (p < end && *p != '=' && *p != ';' && !is_space(*p)) p++;
+	*key_len = (size_t)(p - *key);
+	while (p < end && is_space(*p)) p++;
+	if (p == end || *p != '=') return p;
+	p++;
+	while (p < end && is_space(*p)) p++;
+	if (p < end && *p == '"') {
+		*value = ++p;
+		while (p < end && *p != '"') {
+			if (*p == '\\' && p + 1 < end) p++;
+			p++;
+		}
+		*value_len = (size_t)(p - *value);
+		if (p < end) p++;
+	} else {
+		*value = p;
+		while (p < end && *p != ';' && !is_space(*p)) p++;
+		*value_len = (size_t)(p - *value);
+	}
+	return p;
+}
+
+// scan for the delimiter in MP_PREAMBLE or MP_DATA state, data before it is passed to `on_part_data`.
+// return bytes consumed, `mp->matched` is `mp->delim_len` if the delimiter is found.
+static size_t scan_delim(uv_httpd_multipart_t* mp, const char* at, size_t len) {
+	int emit = mp->state == MP_DATA;
+	size_t i = 0, start;
+	const char* cr;
+
+	if (mp->matched) {
+		// delimiter split across inputs
+		while (mp->matched < mp->delim_len && i < len && at[i] == mp->delim[mp->matched]) {
+			mp->matched++;
+			i++;
+		}
+		if (mp->matched == mp->delim_len || i == len) return i;
+		// the boundary has no CR, so nothing in the matched prefix starts another delimiter
+		if (emit) mp->on_part_data(mp, mp->delim, mp->matched);
+		mp->matched = 0;
+	}
+
+	// memchr is vectorized in most libc, CR is rare in most data and
+	// a candidate is checked by a single memcmp
+	start = i;
+	while (i < len && (cr = memchr(at + i, '\r', len - i))) {
+		size_t k = (size_t)(cr - at);
+		size_t n = len - k < mp->delim_len ? len - k : mp->delim_len;
+		if (memcmp(cr, mp->delim, n) == 0) {
+			if (emit && k > start) mp->on_part_data(mp, at + start, k - start);
+			mp->matched = n;
+			return k + n;
+		}
+		i = k + 1;
+	}
+	if (emit && len > start) mp->on_part_data(mp, at + start, len - start);
+	return len;
+}
+
+static void parse_part_headers(uv_httpd_multipart_t* mp, size_t end) {
+	uv_httpd_multipart_part_t part;
+	const char* base = mp->head;
+	const char* p = base + 2; // CRLF after the boundary
+	const char* stop = base + end + 2; // keep CRLF of the last line
+
+	memset(&part, 0, sizeof(part));
+	part.base = base;
+	part.headers.offset = 2;
+	part.headers.len = end;
+
+	while (p < stop) {
+		const char* eol = memchr(p, '\r', (size_t)(stop - p));
+		const char* colon = memchr(p, ':', (size_t)(eol - p));
+		const char* v;
+		const char* vend = eol;
+		if (colon) {
+			v = colon + 1;
+			while (v < vend && is_space(*v)) v++;
+			while (vend > v && is_space(vend[-1])) vend--;
+			if (0 == string0_nicmp("Content-Disposition", p, (size_t)(colon - p))) {
+				const char *key, *value = NULL;
+				size_t key_len, value_len;
+				const char* q = memchr(v, ';', (size_t)(vend - v));
+				while (q && q < vend) {
+					q = next_param(q, vend, &key, &key_len, &value, &value_len);
+					if (key_len == 0) break;
+					if (0 == string0_nicmp("name", key, key_len)) {
+						part.name.offset = (size_t)(value - base);
+						part.name.len = value_len;
+					} else if (0 == string0_nicmp("filename", key, key_len)) {
+						part.filename.offset = (size_t)(value - base);
+						part.filename.len = value_len;
+					}
+				}
+			} else if (0 == string0_nicmp("Content-Type", p, (size_t)(colon - p))) {
+				part.content_type.offset = (size_t)(v - base);
+				part.content_type.len = (size_t)(vend - v);
+			}
+		}
+		p = eol + 2;
+	}
+	mp->on_part(mp, &part);
+}
+
+// buffer headers of a part until the empty line.
+// return bytes consumed
+static size_t read_headers(uv_httpd_multipart_t* mp, const char* at, size_t len) {
+	size_t old = mp->head_len;
+	size_t n = sizeof(mp->head) - old < len ? sizeof(mp->head) - old : len;
+	size_t i = old >= 3 ? old - 3 : 0; // the empty line may be split across inputs
+
+	memcpy(mp->head + old, at, n);
+	mp->head_len += n;
+	for (; i + 4 <= mp->head_len; i++) {
+		const char* cr = memchr(mp->head + i, '\r', mp->head_len - 3 - i);
+		if (!cr) break;
+		i = (size_t)(cr - mp->head);
+		if (memcmp(cr, "\r\n\r\n", 4) == 0) {
+			parse_part_headers(mp, i);
+			mp->state = MP_DATA;
+			return i + 4 - old;
+		}
+	}
+	if (mp->head_len == sizeof(mp->head)) {
+		mp->state = MP_ERROR;
+	}
+	return n;
+}
+
+int uv_httpd_multipart_boundary(const uv_httpd_request_t* req, const char** boundary, size_t* len) {
+	const uv_httpd_string_t* ct = uv_httpd_header(req, "Content-Type");
+	const char *p, *end, *key, *value = NULL;
+	size_t key_len, value_len;
+
+	if (!ct || ct->len < 10 || string_nicmp("multipart/", 10, req->base + ct->offset, 10)) {
+		return UV_EINVAL;
+	}
+	p = memchr(req->base + ct->offset, ';', ct->len);
+	end = req->base + ct->offset + ct->len;
+	while (p && p < end) {
+		p = next_param(p, end, &key, &key_len, &value, &value_len);
+		if (key_len == 0) break;
+		if (0 == string0_nicmp("boundary", key, key_len)) {
+			if (value_len == 0 || value_len > UV_HTTPD_MULTIPART_MAX_BOUNDARY
+				|| memchr(value, '\r', value_len)) {
+				return UV_EINVAL;
+			}
+			*boundary = value;
+			*len = value_len;
+			return 0;
+		}
+	}
+	return UV_EINVAL;
+}
+
+int uv_httpd_multipart_create(uv_httpd_multipart_t** mp, const char* boundary, size_t len,
+							  on_part_t on_part, on_part_data_t on_part_data, void* data) {
+	uv_httpd_multipart_t* m;
+
+	if (len == 0 || len > UV_HTTPD_MULTIPART_MAX_BOUNDARY || memchr(boundary, '\r', len)) {
+		return UV_EINVAL;
+	}
+	m = malloc(sizeof(*m));
+	if (!m) return UV_ENOMEM;
+	m->state = MP_PREAMBLE;
+	memcpy(m->delim, "\r\n--", 4);
+	memcpy(m->delim + 4, boundary, len);
+	m->delim_len = len + 4;
+	// the first boundary has no leading CRLF, pretend it is matched already
+	m->matched = 2;
+	m->head_len = 0;
+	m->on_part = on_part;
+	m->on_part_data = on_part_data;
+	m->data = data;
+	*mp = m;
+	return 0;
+}
+
+void uv_httpd_multipart_free(uv_httpd_multipart_t* mp) {
+	free(mp);
+}
+
+int uv_httpd_multipart_execute(uv_httpd_multipart_t* mp, const char* at, size_t len) {
+	size_t i = 0;
+
+	while (i < len) {
+		switch (mp->state) {
+		case MP_PREAMBLE:
+		case MP_DATA:
+			i += scan_delim(mp, at + i, len - i);
+			if (mp->matched == mp->delim_len) {
+				if (mp->state == MP_DATA) {
+					mp->on_part_data(mp, NULL, 0);
+				}
+				mp->matched = 0;
+				mp->state = MP_DELIM_TAIL;
+			}
+			break;
+		case MP_DELIM_TAIL:
+			if (at[i] == '-') {
+				mp->state = MP_DELIM_DASH;
+			} else if (at[i] == '\r') {
+				mp->state = MP_DELIM_LF;
+			} else if (!is_space(at[i])) {
+				mp->state = MP_ERROR;
+			}
+			i++;
+			break;
+		case MP_DELIM_DASH:
+			mp->state = at[i++] == '-' ? MP_EPILOGUE : MP_ERROR;
+			break;
+		case MP_DELIM_LF:
+			if (at[i++] != '\n') {
+				mp->state = MP_ERROR;
+				break;
+			}
+			memcpy(mp->head, "\r\n", 2);
+			mp->head_len = 2;
+			mp->state = MP_HEADERS;
+			break;
+		case MP_HEADERS:
+			i += read_headers(mp, at + i, len - i);
+			break;
+		case MP_EPILOGUE:
+			return 0;
+		default:
+			return UV_EPROTO;
+		}
+	}
+	return mp->state == MP_ERROR ? UV_EPROTO : 0;
+}
+
+int uv_httpd_multipart_finish(uv_httpd_multipart_t* mp) {
+	return mp->state == MP_EPILOGUE ? 0 : UV_EPROTO;
+}
+
+void* uv_httpd_multipart_data(uv_httpd_multipart_t* mp) {
+	return mp->data;
+}
@@ -0,0 +1,46 @@
+#ifndef __UV_HTTPD_MULTIPART_H__
+#define __UV_HTTPD_MULTIPART_H__
+
+#pragma once
+
+#include "uv_httpd.h"
+
+// incremental multipart/form-data parser:
+// feed the request body piece by piece, e.g. from `uv_httpd_stream_body`,
+// part data is passed to `on_part_data` without copying.
+
+#ifndef UV_HTTPD_MULTIPART_MAX_HEADERS
+#define UV_HTTPD_MULTIPART_MAX_HEADERS 4096 // bytes of headers of a part
+#endif
+
+#define UV_HTTPD_MULTIPART_MAX_BOUNDARY 70 // RFC 2046
+
+typedef struct uv_httpd_multipart_s uv_httpd_multipart_t;
+
+typedef struct {
+	const char* base; // base address for offset/len
+	uv_httpd_string_t headers; // raw header lines
+	uv_httpd_string_t name; // from Content-Disposition
+	uv_httpd_string_t filename; // from Content-Disposition, empty if not a file
+	uv_httpd_string_t content_type;
+}uv_httpd_multipart_part_t;
+
+// a part begins, `part` is only valid in this call
+typedef void(*on_part_t)(uv_httpd_multipart_t* mp, const uv_httpd_multipart_part_t* part);
+// data of current part, `len` is 0 at the end of the part
+typedef void(*on_part_data_t)(uv_httpd_multipart_t* mp, const char* at, size_t len);
+
+// find the boundary in the `Content-Type` header of `req`
+// return 0 for success, UV_EINVAL if not multipart or no valid boundary
+int uv_httpd_multipart_boundary(const uv_httpd_request_t* req, const char** boundary, size_t* len);
+// return 0 for success, otherwise it is `uv_errno_t`
+int uv_httpd_multipart_create(uv_httpd_multipart_t** mp, const char* boundary, size_t len,
+							  on_part_t on_part, on_part_data_t on_part_data, void* data);
+void uv_httpd_multipart_free(uv_httpd_multipart_t* mp);
+// return 0 for success, UV_EPROTO if malformed. data after the last part is ignored
+int uv_httpd_multipart_execute(uv_httpd_multipart_t* mp, const char* at, size_t len);
+// end of the body, return UV_EPROTO if the last boundary is not seen
+int uv_httpd_multipart_finish(uv_httpd_multipart_t* mp);
+void* uv_httpd_multipart_data(uv_httpd_multipart_t* mp);
+
+#endif
@@ -0,0 +1,373 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "uv_httpd_prefork.h"
+#include "mybuf.h"
+#include "uv_log.h"
+
+#define WORKER_RESTART_DELAY 1000 // ms
+#define WORKER_STATS_INTERVAL 1000 // ms
+
+typedef struct {
+	uv_process_t process;
+	uv_pipe_t pipe; // ipc pipe, it is the worker's stdin
+	uv_timer_t restart_timer;
+	uv_write_t write_req;
+	uv_httpd_master_t* master;
+	int id;
+	int alive;
+	int closing; // handles not closed yet
+	mybuf_t rbuf;
+	uv_httpd_stats_t stats; // latest reported
+}worker_t;
+
+struct uv_httpd_master_s {
+	uv_loop_t* loop;
+	uv_tcp_t tcp;
+	char exepath[1024];
+	char** args;
+	int nworkers;
+	int stopping;
+	uv_httpd_stats_t retired; // totals of exited workers
+	worker_t workers[UV_HTTPD_MAX_WORKERS];
+};
+
+// master writes this byte along with the listening socket
+static char handle_msg[] = "L";
+
+static int spawn_worker(worker_t* worker);
+
+
+/*************************** master ****************/
+
+static void on_worker_alloc(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
+	worker_t* worker = handle->data;
+	mybuf_reserve(&worker->rbuf, sizeof(uv_httpd_stats_t));
+	buf->base = worker->rbuf.buf + worker->rbuf.size;
+#ifdef _WIN32
+	buf->len = (ULONG)mybuf_space(&worker->rbuf);
+#else
+	buf->len = mybuf_space(&worker->rbuf);
+#endif
+}
+
+static void on_worker_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
+	worker_t* worker = stream->data;
+	size_t consumed = 0;
+
+	if (nread <= 0) {
+		// EOF is handled in `on_worker_exit`
+		return;
+	}
+
+	worker->rbuf.size += (size_t)nread;
+	while (worker->rbuf.size - consumed >= sizeof(uv_httpd_stats_t)) {
+		memcpy(&worker->stats, worker->rbuf.buf + consumed, sizeof(uv_httpd_stats_t));
+		consumed += sizeof(uv_httpd_stats_t);
+	}
+	memmove(worker->rbuf.buf, worker->rbuf.buf + consumed, worker->rbuf.size - consumed);
+	worker->rbuf.size -= consumed;
+}
+
+static void on_handle_sent(uv_write_t* req, int status) {
+	worker_t* worker = req->data;
+	warn_on_uv_err(status, "send listening socket to worker");
+	if (status == 0) {
+		uvlog_debug("worker %d got listening socket", worker->id);
+	} else if (worker->alive) {
+		// useless without it, `on_worker_exit` spawns another
+		uv_process_kill(&worker->process, SIGTERM);
+	}
+}
+
+static void on_restart_timer(uv_timer_t* timer) {
+	worker_t* worker = timer->data;
+	if (worker->master->stopping) return;
+	int r = spawn_worker(worker);
+	if (r) {
+		warn_on_uv_err(r, "respawn worker");
+		uv_timer_start(&worker->restart_timer, on_restart_timer, WORKER_RESTART_DELAY, 0);
+	}
+}
+
+static void on_worker_handle_closed(uv_handle_t* handle) {
+	worker_t* worker = handle->data;
+	if (--worker->closing == 0 && !worker->master->stopping) {
+		uv_timer_start(&worker->restart_timer, on_restart_timer, WORKER_RESTART_DELAY, 0);
+	}
+}
+
+static void on_worker_exit(uv_process_t* process, int64_t exit_status, int term_signal) {
+	worker_t* worker = process->data;
+	uv_httpd_master_t* master = worker->master;
+
+	uvlog_warn("worker %d pid=%d exited, status=%d signal=%d",
+			   worker->id, process->pid, (int)exit_status, term_signal);
+
+	master->retired.connections += worker->stats.connections;
+	master->retired.requests += worker->stats.requests;
+	master->retired.limited += worker->stats.limited;
+	master->retired.rejected += worker->stats.rejected;
+	memset(&worker->stats, 0, sizeof(worker->stats));
+	mybuf_clear(&worker->rbuf);
+
+	worker->alive = 0;
+	worker->closing = 2;
+	uv_close((uv_handle_t*)&worker->process, on_worker_handle_closed);
+	uv_close((uv_handle_t*)&worker->pipe, on_worker_handle_closed);
+}
+
+static char** make_worker_env(int id) {
+	uv_env_item_t* items;
+	int count, i;
+	char** env;
+
+	if (uv_os_environ(&items, &count)) return NULL;
+	env = calloc((size_t)count + 2, sizeof(char*));
+	fatal_if_null(env);
+	for (i = 0; i < count; i++) {
+		size_t len = strlen(items[i].name) + strlen(items[i].value) + 2;
+		env[i] = malloc(len);
+		fatal_if_null(env[i]);
+		snprintf(env[i], len, "%s=%s", items[i].name, items[i].value);
+	}
+	env[i] = malloc(sizeof(UV_HTTPD_WORKER_ENV) + 16);
+	fatal_if_null(env[i]);
+	snprintf(env[i], sizeof(UV_HTTPD_WORKER_ENV) + 16, "%s=%d", UV_HTTPD_WORKER_ENV, id);
+	uv_os_free_environ(items, count);
+	return env;
+}
+
+static void free_worker_env(char** env) {
+	for (char** p = env; *p; p++) {
+		free(*p);
+	}
+	free(env);
+}
+
+// return 0 once the process runs, a failed handoff of the socket included,
+// otherwise it is `uv_errno_t` and the handles are closing
+static int spawn_worker(worker_t* worker) {
+	uv_httpd_master_t* master = worker->master;
+	uv_process_options_t options;
+	uv_stdio_container_t stdio[3];
+	uv_buf_t buf;
+	int r;
+
+	r = uv_pipe_init(master->loop, &worker->pipe, 1);
+	if (r) return r;
+	worker->pipe.data = worker;
+
+	memset(&options, 0, sizeof(options));
+	stdio[0].flags = UV_CREATE_PIPE | UV_READABLE_PIPE | UV_WRITABLE_PIPE;
+	stdio[0].data.stream = (uv_stream_t*)&worker->pipe;
+	stdio[1].flags = UV_INHERIT_FD;
+	stdio[1].data.fd = 1;
+	stdio[2].flags = UV_INHERIT_FD;
+	stdio[2].data.fd = 2;
+	options.stdio = stdio;
+	options.stdio_count = 3;
+	options.file = master->exepath;
+	options.args = master->args;
+	options.env = make_worker_env(worker->id);
+	options.exit_cb = on_worker_exit;
+
+	worker->process.data = worker;
+	r = uv_spawn(master->loop, &worker->process, &options);
+	if (options.env) free_worker_env(options.env);
+	if (r) {
+		// process handle must be closed even if spawn failed
+		uv_close((uv_handle_t*)&worker->process, NULL);
+		uv_close((uv_handle_t*)&worker->pipe, NULL);
+		return r;
+	}
+	worker->alive = 1;
+	uvlog_info("worker %d spawned, pid=%d", worker->id, worker->process.pid);
+
+	mybuf_init(&worker->rbuf);
+	uv_read_start((uv_stream_t*)&worker->pipe, on_worker_alloc, on_worker_read);
+
+	buf = uv_buf_init(handle_msg, 1);
+	worker->write_req.data = worker;
+	r = uv_write2(&worker->write_req, (uv_stream_t*)&worker->pipe, &buf, 1,
+				  (uv_stream_t*)&master->tcp, on_handle_sent);
+	if (r) {
+		// the worker is running, its handles are closed and it is spawned again
+		// by `on_worker_exit`, not by the caller
+		warn_on_uv_err(r, "send listening socket to worker");
+		uv_process_kill(&worker->process, SIGTERM);
+	}
+	return 0;
+}
+
+int uv_httpd_is_worker() {
+	char buf[16];
+	size_t len = sizeof(buf);
+	return uv_os_getenv(UV_HTTPD_WORKER_ENV, buf, &len) == 0;
+}
+
+int uv_httpd_master_create(uv_httpd_master_t** master, uv_loop_t* loop, int nworkers, char** args) {
+	uv_httpd_master_t* m;
+	size_t len;
+	int r;
+
+	if (nworkers <= 0 || nworkers > UV_HTTPD_MAX_WORKERS) return UV_EINVAL;
+
+	m = calloc(1, sizeof(*m));
+	if (!m) return UV_ENOMEM;
+
+	len = sizeof(m->exepath);
+	r = uv_exepath(m->exepath, &len);
+	if (r) goto failed;
+
+	r = uv_tcp_init(loop, &m->tcp);
+	if (r) goto failed;
+	m->tcp.data = m;
+	m->loop = loop;
+	m->args = args;
+	m->args[0] = m->exepath;
+	m->nworkers = nworkers;
+	for (int i = 0; i < nworkers; i++) {
+		worker_t* worker = &m->workers[i];
+		worker->master = m;
+		worker->id = i;
+		uv_timer_init(loop, &worker->restart_timer);
+		worker->restart_timer.data = worker;
+		mybuf_init(&worker->rbuf);
+	}
+
+	*master = m;
+	return 0;
+
+failed:
+	free(m);
+	return r;
+}
+
+int uv_httpd_master_listen(uv_httpd_master_t* master, const char* ip, int port) {
+	struct sockaddr_storage addr;
+	int r;
+
+	if (strchr(ip, ':')) {
+		r = uv_ip6_addr(ip, port, (struct sockaddr_in6*)&addr);
+	} else {
+		r = uv_ip4_addr(ip, port, (struct sockaddr_in*)&addr);
+	}
+	if (r) return r;
+
+	// workers call `listen` on it, master never accepts.
+	r = uv_tcp_bind(&master->tcp, (const struct sockaddr*)&addr, 0);
+	if (r) return r;
+
+	for (int i = 0; i < master->nworkers; i++) {
+		r = spawn_worker(&master->workers[i]);
+		if (r) return r;
+	}
+	return 0;
+}
+
+void uv_httpd_master_stats(uv_httpd_master_t* master, uv_httpd_stats_t* stats) {
+	*stats = master->retired;
+	for (int i = 0; i < master->nworkers; i++) {
+		stats->connections += master->workers[i].stats.connections;
+		stats->active += master->workers[i].stats.active;
+		stats->requests += master->workers[i].stats.requests;
+		stats->limited += master->workers[i].stats.limited;
+		stats->rejected += master->workers[i].stats.rejected;
+		stats->memory += master->workers[i].stats.memory;
+	}
+}
+
+void uv_httpd_master_stop(uv_httpd_master_t* master) {
+	master->stopping = 1;
+	for (int i = 0; i < master->nworkers; i++) {
+		worker_t* worker = &master->workers[i];
+		if (worker->alive) {
+			uv_process_kill(&worker->process, SIGTERM);
+		}
+		uv_close((uv_handle_t*)&worker->restart_timer, NULL);
+	}
+	uv_close((uv_handle_t*)&master->tcp, NULL);
+}
+
+void uv_httpd_master_free(uv_httpd_master_t* master) {
+	if (!master) return;
+	for (int i = 0; i < master->nworkers; i++) {
+		mybuf_clear(&master->workers[i].rbuf);
+	}
+	free(master);
+}
+
+
+/*************************** worker ****************/
+
+static uv_pipe_t worker_ipc;
+static uv_timer_t worker_stats_timer;
+static char worker_ipc_buf[64];
+
+struct stats_write_req_t {
+	uv_write_t req;
+	uv_httpd_stats_t stats;
+};
+
+static void on_stats_written(uv_write_t* req, int status) {
+	free(req->data);
+}
+
+static void on_stats_timer(uv_timer_t* timer) {
+	uv_httpd_server_t* server = timer->data;
+	struct stats_write_req_t* wr = malloc(sizeof(*wr));
+	fatal_if_null(wr);
+	wr->stats = server->stats;
+	wr->req.data = wr;
+	uv_buf_t buf = uv_buf_init((char*)&wr->stats, sizeof(wr->stats));
+	if (uv_write(&wr->req, (uv_stream_t*)&worker_ipc, &buf, 1, on_stats_written)) {
+		free(wr);
+	}
+}
+
+static void on_ipc_alloc(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
+	buf->base = worker_ipc_buf;
+	buf->len = sizeof(worker_ipc_buf);
+}
+
+static void on_ipc_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
+	uv_httpd_server_t* server = stream->data;
+	int r;
+
+	if (nread < 0) {
+		uvlog_warn("master is gone, worker stopping: %s", uv_err_name((int)nread));
+		uv_close((uv_handle_t*)&worker_stats_timer, NULL);
+		uv_close((uv_handle_t*)stream, NULL);
+		uv_httpd_stop(server);
+		return;
+	}
+
+	while (uv_pipe_pending_count(&worker_ipc) > 0) {
+		if (uv_pipe_pending_type(&worker_ipc) != UV_TCP) {
+			uvlog_warn("unexpected handle type from master");
+			break;
+		}
+		r = uv_accept(stream, (uv_stream_t*)&server->tcp);
+		fatal_on_uv_err(r, "accept listening socket from master");
+		r = uv_httpd_listen_bound(server);
+		fatal_on_uv_err(r, "uv_httpd_listen_bound");
+	}
+}
+
+int uv_httpd_worker_start(uv_httpd_server_t* server) {
+	uv_loop_t* loop = server->tcp.loop;
+	int r;
+
+	r = uv_pipe_init(loop, &worker_ipc, 1);
+	if (r) return r;
+	r = uv_pipe_open(&worker_ipc, 0);
+	if (r) return r;
+	worker_ipc.data = server;
+	r = uv_read_start((uv_stream_t*)&worker_ipc, on_ipc_alloc, on_ipc_read);
+	if (r) return r;
+
+	uv_timer_init(loop, &worker_stats_timer);
+	worker_stats_timer.data = server;
+	return uv_timer_start(&worker_stats_timer, on_stats_timer, WORKER_STATS_INTERVAL, WORKER_STATS_INTERVAL);
+}
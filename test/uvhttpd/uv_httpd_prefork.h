@@ -0,0 +1,44 @@
+#ifndef __UV_HTTPD_PREFORK_H__
+#define __UV_HTTPD_PREFORK_H__
+
+#pragma once
+
+#include "uv_httpd.h"
+
+// prefork mode:
+// the master binds the listening socket, spawns N copies of the current
+// executable as workers and passes the socket to each of them over an IPC
+// `uv_pipe_t` by `uv_write2`. workers are restarted when they exit, and they
+// report their `uv_httpd_stats_t` to the master periodically.
+
+#ifndef UV_HTTPD_MAX_WORKERS
+#define UV_HTTPD_MAX_WORKERS 64
+#endif
+
+// environment variable set on the worker processes, its value is the worker id
+#define UV_HTTPD_WORKER_ENV "UV_HTTPD_WORKER"
+
+typedef struct uv_httpd_master_s uv_httpd_master_t;
+
+// return 1 if current process is spawned by a master
+int uv_httpd_is_worker();
+
+// return 0 for success, otherwise it is `uv_errno_t`
+// `args` is the argv passed to the workers, args[0] is ignored and replaced by
+// the current executable path. it must be valid until the master is freed.
+int uv_httpd_master_create(uv_httpd_master_t** master, uv_loop_t* loop, int nworkers, char** args);
+// bind `ip:port` and spawn workers
+// return 0 for success, otherwise it is uv_errno_t
+int uv_httpd_master_listen(uv_httpd_master_t* master, const char* ip, int port);
+// sum of the latest stats reported by all workers
+void uv_httpd_master_stats(uv_httpd_master_t* master, uv_httpd_stats_t* stats);
+// kill all workers and close the listening socket
+void uv_httpd_master_stop(uv_httpd_master_t* master);
+void uv_httpd_master_free(uv_httpd_master_t* master);
+
+// worker side: receive the listening socket from the master, then serve it by `server`.
+// the worker stops when the master goes away.
+// return 0 for success, otherwise it is uv_errno_t
+int uv_httpd_worker_start(uv_httpd_server_t* server);
+
+#endif
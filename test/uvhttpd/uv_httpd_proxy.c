@@ -0,0 +1,678 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "uv_httpd_proxy.h"
+#include "mybuf.h"
+#include "uv_log.h"
+
+#define PROXY_READ_BUFF_SIZE 65536
+#define PROXY_HIGH_WATER (256 * 1024) // stop reading the other side when write queue exceeds
+#define PROXY_LOW_WATER (64 * 1024)
+#define PROXY_REPLAY_MAX (64 * 1024) // request bytes kept to send again if a pooled connection was stale
+
+#define BAD_GATEWAY \
+  "HTTP/1.1 502 Bad Gateway\r\n" \
+  "Content-Type: text/plain\r\n" \
+  "Content-Length: 12\r\n" \
+  "\r\n" \
+  "bad gateway\n"
+#define GATEWAY_TIMEOUT \
+  "HTTP/1.1 504 Gateway Timeout\r\n" \
+  "Content-Type: text/plain\r\n" \
+  "Content-Length: 16\r\n" \
+  "\r\n" \
+  "gateway timeout\n"
+
+typedef struct upstream_s upstream_t;
+
+typedef struct {
+	uv_tcp_t tcp;
+	uv_connect_t connect_req;
+	uv_timer_t timer; // connect, then the response while a client is attached
+	llhttp_t parser; // HTTP_RESPONSE
+	upstream_t* upstream;
+	uv_httpd_client_t* client; // NULL when idle
+	QUEUE node; // in upstream->idle
+	mybuf_t pending; // written before connected
+	mybuf_t replay; // written on a pooled connection before any response byte, see conn_retry
+	mybuf_t head; // response headers
+	char status[64]; // response reason phrase
+	size_t status_len;
+	size_t field_mark; // start of current header in `head`
+	llhttp_method_t method;
+	int connected;
+	int idle;
+	int closing;
+	int in_field;
+	int skip_header; // hop-by-hop header, not forwarded
+	int chunked_request;
+	int chunked_response; // to the client, the upstream's may be delimited by EOF
+	int request_done; // whole request written
+	int head_sent;
+	int client_paused; // client read stopped by us
+	int retry; // an idempotent request on a pooled connection, it may be sent again on a new one
+}upstream_conn_t;
+
+struct upstream_s {
+	struct sockaddr_storage addr;
+	char name[64];
+	int active; // connections serving clients
+	int nidle;
+	QUEUE idle;
+};
+
+struct uv_httpd_proxy_s {
+	uv_loop_t* loop;
+	llhttp_settings_t settings;
+	int nupstreams;
+	int next; // rotates the ties
+	upstream_t upstreams[UV_HTTPD_PROXY_MAX_UPSTREAMS];
+	char rbuf[PROXY_READ_BUFF_SIZE]; // shared by all upstream reads
+};
+
+struct conn_write_req_t {
+	uv_write_t req;
+	uv_buf_t buf;
+};
+
+// not forwarded, these are about a single connection
+static const char* hop_by_hop_headers[] = {
+	"Connection", "Keep-Alive", "Proxy-Connection", "TE", "Trailer",
+	"Transfer-Encoding", "Upgrade", "Expect", NULL,
+};
+
+static void conn_close(upstream_conn_t* conn);
+static void conn_fail(upstream_conn_t* conn, int err);
+static upstream_conn_t* conn_new(uv_httpd_proxy_t* proxy, upstream_t* u);
+static void on_conn_alloc(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf);
+static void on_conn_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf);
+static void on_conn_timeout(uv_timer_t* timer);
+
+
+/*************************** helper functions ****************/
+
+static int is_hop_by_hop(const char* name, size_t len) {
+	for (const char** p = hop_by_hop_headers; *p; p++) {
+		if (0 == string0_nicmp(*p, name, len)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// safe to send again if the upstream may have handled it already, as uv_http_client does
+static int is_idempotent(llhttp_method_t method) {
+	return method == HTTP_GET || method == HTTP_HEAD;
+}
+
+// (re)start waiting for the upstream, a request is in flight
+static void conn_wait_response(upstream_conn_t* conn) {
+	uv_timer_start(&conn->timer, on_conn_timeout, UV_HTTPD_PROXY_RESPONSE_TIMEOUT, 0);
+}
+
+// client caught up, resume reading upstream
+static void on_client_flushed(uv_httpd_client_t* client) {
+	upstream_conn_t* conn = uv_httpd_client_get_data(client);
+	if (conn && !conn->closing) {
+		uv_read_start((uv_stream_t*)&conn->tcp, on_conn_alloc, on_conn_read);
+		conn_wait_response(conn);
+	}
+}
+
+// write to client, stop reading upstream if the client is slow
+static void client_write(upstream_conn_t* conn, char* data, size_t len) {
+	uv_httpd_client_t* client = conn->client;
+	uv_httpd_write_response(client, data, len);
+	if (uv_httpd_write_queue_size(client) > PROXY_HIGH_WATER) {
+		// the upstream is not late, the client is
+		uv_read_stop((uv_stream_t*)&conn->tcp);
+		uv_timer_stop(&conn->timer);
+		uv_httpd_on_flushed(client, on_client_flushed);
+	}
+}
+
+// write a body chunk to client, framed if the response is chunked
+static void client_write_body(upstream_conn_t* conn, const char* at, size_t len) {
+	mybuf_t buf;
+	mybuf_init(&buf);
+	if (conn->chunked_response) {
+		if (len) {
+			mybuf_cat_printf(&buf, "%zx\r\n", len);
+			mybuf_append(&buf, at, len);
+			mybuf_append(&buf, "\r\n", 2);
+		} else {
+			mybuf_append(&buf, "0\r\n\r\n", 5);
+		}
+	} else {
+		mybuf_append(&buf, at, len);
+	}
+	if (buf.size) {
+		client_write(conn, buf.buf, buf.size);
+	}
+	mybuf_clear(&buf);
+}
+
+static void on_conn_write(uv_write_t* req, int status) {
+	struct conn_write_req_t* wr = req->data;
+	upstream_conn_t* conn = (upstream_conn_t*)req->handle;
+	free(wr->buf.base);
+	free(wr);
+	if (conn->closing) return;
+	if (status) {
+		if (conn->client) conn_fail(conn, status);
+		return;
+	}
+	if (conn->client_paused && conn->tcp.write_queue_size < PROXY_LOW_WATER) {
+		conn->client_paused = 0;
+		if (conn->client) uv_httpd_read_start(conn->client);
+	}
+}
+
+// write to upstream, queued until connected
+static void conn_write(upstream_conn_t* conn, const char* data, size_t len) {
+	struct conn_write_req_t* wr;
+
+	if (conn->retry) {
+		if (conn->replay.size + len > PROXY_REPLAY_MAX) {
+			// too much of the body to keep
+			conn->retry = 0;
+			mybuf_clear(&conn->replay);
+		} else {
+			mybuf_append(&conn->replay, data, len);
+		}
+	}
+	if (!conn->connected) {
+		mybuf_append(&conn->pending, data, len);
+		return;
+	}
+
+	wr = malloc(sizeof(*wr));
+	fatal_if_null(wr);
+	wr->buf.base = malloc(len);
+	fatal_if_null(wr->buf.base);
+	memcpy(wr->buf.base, data, len);
+#ifdef _WIN32
+	wr->buf.len = (ULONG)len;
+#else
+	wr->buf.len = len;
+#endif
+	wr->req.data = wr;
+	if (uv_write(&wr->req, (uv_stream_t*)&conn->tcp, &wr->buf, 1, on_conn_write)) {
+		free(wr->buf.base);
+		free(wr);
+		return;
+	}
+	if (conn->client) {
+		// a slow upload is not a late upstream
+		conn_wait_response(conn);
+	}
+	if (conn->client && conn->tcp.write_queue_size > PROXY_HIGH_WATER) {
+		conn->client_paused = 1;
+		uv_httpd_read_stop(conn->client);
+	}
+}
+
+// conn no longer serves a client
+static void conn_detach(upstream_conn_t* conn) {
+	if (!conn->client) return;
+	if (conn->client_paused) {
+		uv_httpd_read_start(conn->client);
+		conn->client_paused = 0;
+	}
+	uv_httpd_client_set_data(conn->client, NULL);
+	conn->client = NULL;
+	conn->upstream->active--;
+}
+
+// a pooled connection failed before any response byte, e.g. closed by the upstream
+// while the request was on its way: send the request again once, on a new connection.
+// return nonzero if retried
+static int conn_retry(upstream_conn_t* conn) {
+	uv_httpd_client_t* client = conn->client;
+	upstream_conn_t* fresh;
+
+	if (!conn->retry || !client) return 0;
+	fresh = conn_new(conn->tcp.data, conn->upstream);
+	if (!fresh) return 0;
+	uvlog_debug("upstream %s: stale pooled connection, retrying", conn->upstream->name);
+	fresh->client = client;
+	fresh->method = conn->method;
+	fresh->chunked_request = conn->chunked_request;
+	fresh->request_done = conn->request_done;
+	fresh->client_paused = conn->client_paused;
+	uv_httpd_client_set_data(client, fresh);
+	conn_write(fresh, conn->replay.buf, conn->replay.size);
+	// `active` moves to the new connection with the client
+	conn->client = NULL;
+	conn->client_paused = 0;
+	conn_close(conn);
+	return 1;
+}
+
+// upstream failed: 502, or 504 if it timed out, if nothing sent yet,
+// otherwise the response is truncated and client must be closed
+static void conn_fail(upstream_conn_t* conn, int err) {
+	uv_httpd_client_t* client = conn->client;
+	int head_sent = conn->head_sent;
+
+	// a late upstream may still be working on the request
+	if (err != UV_ETIMEDOUT && conn_retry(conn)) return;
+	uvlog_warn("upstream %s: %s", conn->upstream->name, uv_err_name(err));
+	conn_detach(conn);
+	conn_close(conn);
+	if (!client) return;
+	if (head_sent) {
+		uv_httpd_close(client);
+	} else if (err == UV_ETIMEDOUT) {
+		uv_httpd_write_response(client, GATEWAY_TIMEOUT, sizeof(GATEWAY_TIMEOUT) - 1);
+	} else {
+		uv_httpd_write_response(client, BAD_GATEWAY, sizeof(BAD_GATEWAY) - 1);
+	}
+	uv_httpd_response_done(client);
+}
+
+static void on_timer_closed(uv_handle_t* handle) {
+	upstream_conn_t* conn = handle->data;
+	mybuf_clear(&conn->pending);
+	mybuf_clear(&conn->replay);
+	mybuf_clear(&conn->head);
+	free(conn);
+}
+
+static void on_conn_closed(uv_handle_t* handle) {
+	upstream_conn_t* conn = (upstream_conn_t*)handle;
+	uv_close((uv_handle_t*)&conn->timer, on_timer_closed);
+}
+
+static void conn_close(upstream_conn_t* conn) {
+	if (conn->closing) return;
+	conn->closing = 1;
+	if (conn->idle) {
+		QUEUE_REMOVE(&conn->node);
+		conn->upstream->nidle--;
+		conn->idle = 0;
+	}
+	uv_timer_stop(&conn->timer);
+	uv_close((uv_handle_t*)&conn->tcp, on_conn_closed);
+}
+
+// response done, back to the pool if possible
+static void conn_release(upstream_conn_t* conn, int keep_alive) {
+	upstream_t* u = conn->upstream;
+	conn_detach(conn);
+	uv_timer_stop(&conn->timer);
+	if (keep_alive && conn->request_done && u->nidle < UV_HTTPD_PROXY_MAX_IDLE) {
+		conn->idle = 1;
+		u->nidle++;
+		QUEUE_INSERT_HEAD(&u->idle, &conn->node);
+		// read stopped if the client was slow, an idle connection reads to see it closed
+		uv_read_start((uv_stream_t*)&conn->tcp, on_conn_alloc, on_conn_read);
+	} else {
+		conn_close(conn);
+	}
+}
+
+
+/*************************** upstream response ****************/
+
+static int on_response_begin(llhttp_t* parser) {
+	upstream_conn_t* conn = parser->data;
+	mybuf_clear(&conn->head);
+	conn->status_len = 0;
+	conn->head_sent = 0;
+	conn->in_field = 0;
+	return 0;
+}
+
+static int on_response_status(llhttp_t* parser, const char* at, size_t length) {
+	upstream_conn_t* conn = parser->data;
+	size_t n = sizeof(conn->status) - 1 - conn->status_len;
+	if (n > length) n = length;
+	memcpy(conn->status + conn->status_len, at, n);
+	conn->status_len += n;
+	return 0;
+}
+
+static int on_response_header_field(llhttp_t* parser, const char* at, size_t length) {
+	upstream_conn_t* conn = parser->data;
+	if (!conn->in_field) {
+		conn->field_mark = conn->head.size;
+		conn->in_field = 1;
+	}
+	mybuf_append(&conn->head, at, length);
+	return 0;
+}
+
+static int on_response_header_field_complete(llhttp_t* parser) {
+	upstream_conn_t* conn = parser->data;
+	conn->in_field = 0;
+	conn->skip_header = is_hop_by_hop(conn->head.buf + conn->field_mark, conn->head.size - conn->field_mark);
+	mybuf_append(&conn->head, ": ", 2);
+	return 0;
+}
+
+static int on_response_header_value(llhttp_t* parser, const char* at, size_t length) {
+	upstream_conn_t* conn = parser->data;
+	if (!conn->skip_header) {
+		mybuf_append(&conn->head, at, length);
+	}
+	return 0;
+}
+
+static int on_response_header_value_complete(llhttp_t* parser) {
+	upstream_conn_t* conn = parser->data;
+	if (conn->skip_header) {
+		conn->head.size = conn->field_mark;
+	} else {
+		mybuf_append(&conn->head, "\r\n", 2);
+	}
+	return 0;
+}
+
+static int on_response_headers_complete(llhttp_t* parser) {
+	upstream_conn_t* conn = parser->data;
+	mybuf_t buf;
+
+	if (!conn->client) return -1;
+
+	// a body delimited by the end of the upstream connection is chunked,
+	// the client connection is kept alive
+	conn->chunked_response = (parser->flags & F_CHUNKED) != 0
+		|| (conn->method != HTTP_HEAD && llhttp_message_needs_eof(parser));
+	mybuf_init(&buf);
+	mybuf_cat_printf(&buf, "HTTP/1.1 %d %.*s\r\n", parser->status_code, (int)conn->status_len, conn->status);
+	mybuf_append(&buf, conn->head.buf, conn->head.size);
+	if (conn->chunked_response) {
+		mybuf_append(&buf, "Transfer-Encoding: chunked\r\n", 28);
+	}
+	mybuf_append(&buf, "\r\n", 2);
+	client_write(conn, buf.buf, buf.size);
+	mybuf_clear(&buf);
+	conn->head_sent = 1;
+
+	// response to HEAD has no body
+	return conn->method == HTTP_HEAD ? 1 : 0;
+}
+
+static int on_response_body(llhttp_t* parser, const char* at, size_t length) {
+	upstream_conn_t* conn = parser->data;
+	if (!conn->client) return -1;
+	client_write_body(conn, at, length);
+	return 0;
+}
+
+static int on_response_complete(llhttp_t* parser) {
+	upstream_conn_t* conn = parser->data;
+	uv_httpd_client_t* client = conn->client;
+
+	if (!client) return -1;
+	if (conn->chunked_response && conn->method != HTTP_HEAD) {
+		client_write_body(conn, NULL, 0);
+	}
+	// detach before `uv_httpd_response_done`, it may parse the next pipelined request
+	conn_release(conn, llhttp_should_keep_alive(parser));
+	uv_httpd_response_done(client);
+	return HPE_PAUSED;
+}
+
+static void setup_response_settings(llhttp_settings_t* settings) {
+	llhttp_settings_init(settings);
+	settings->on_message_begin = on_response_begin;
+	settings->on_status = on_response_status;
+	settings->on_header_field = on_response_header_field;
+	settings->on_header_field_complete = on_response_header_field_complete;
+	settings->on_header_value = on_response_header_value;
+	settings->on_header_value_complete = on_response_header_value_complete;
+	settings->on_headers_complete = on_response_headers_complete;
+	settings->on_body = on_response_body;
+	settings->on_message_complete = on_response_complete;
+}
+
+
+/*************************** upstream connection ****************/
+
+static void on_conn_alloc(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
+	uv_httpd_proxy_t* proxy = handle->data;
+	buf->base = proxy->rbuf;
+	buf->len = sizeof(proxy->rbuf);
+}
+
+static void on_conn_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
+	upstream_conn_t* conn = (upstream_conn_t*)stream;
+	enum llhttp_errno r;
+
+	if (nread == 0) return;
+	if (nread < 0) {
+		if (!conn->client) {
+			// idle connection closed by upstream
+			conn_close(conn);
+			return;
+		}
+		// response without length ends at EOF
+		if (nread == UV_EOF) {
+			llhttp_finish(&conn->parser);
+			if (!conn->client) return;
+		}
+		conn_fail(conn, (int)nread);
+		return;
+	}
+
+	if (!conn->client) {
+		// nothing expected on an idle connection
+		conn_close(conn);
+		return;
+	}
+
+	if (conn->retry) {
+		// the connection is alive, the request is not sent again
+		conn->retry = 0;
+		mybuf_clear(&conn->replay);
+	}
+	conn_wait_response(conn);
+	r = llhttp_execute(&conn->parser, buf->base, (size_t)nread);
+	if (r == HPE_PAUSED) {
+		// paused by on_response_complete
+		llhttp_resume(&conn->parser);
+	} else if (r != HPE_OK) {
+		uvlog_warn("upstream %s parse error: %s %s", conn->upstream->name,
+				   llhttp_errno_name(r), conn->parser.reason);
+		conn_fail(conn, UV_EPROTO);
+	}
+}
+
+static void on_conn_timeout(uv_timer_t* timer) {
+	upstream_conn_t* conn = timer->data;
+	uvlog_warn("upstream %s: no %s in %d ms", conn->upstream->name, conn->connected ? "response" : "connection",
+			   conn->connected ? UV_HTTPD_PROXY_RESPONSE_TIMEOUT : UV_HTTPD_PROXY_CONNECT_TIMEOUT);
+	conn_fail(conn, UV_ETIMEDOUT);
+}
+
+static void on_conn_connected(uv_connect_t* req, int status) {
+	upstream_conn_t* conn = req->data;
+
+	if (status) {
+		if (status != UV_ECANCELED) conn_fail(conn, status);
+		return;
+	}
+	conn->connected = 1;
+	conn_wait_response(conn);
+	uv_read_start((uv_stream_t*)&conn->tcp, on_conn_alloc, on_conn_read);
+	if (conn->pending.size) {
+		conn_write(conn, conn->pending.buf, conn->pending.size);
+		mybuf_clear(&conn->pending);
+	}
+}
+
+static upstream_conn_t* conn_new(uv_httpd_proxy_t* proxy, upstream_t* u) {
+	upstream_conn_t* conn = calloc(1, sizeof(*conn));
+	fatal_if_null(conn);
+	conn->upstream = u;
+	mybuf_init(&conn->pending);
+	mybuf_init(&conn->replay);
+	mybuf_init(&conn->head);
+	uv_tcp_init(proxy->loop, &conn->tcp);
+	uv_tcp_nodelay(&conn->tcp, 1);
+	conn->tcp.data = proxy;
+	uv_timer_init(proxy->loop, &conn->timer);
+	conn->timer.data = conn;
+	llhttp_init(&conn->parser, HTTP_RESPONSE, &proxy->settings);
+	conn->parser.data = conn;
+	conn->connect_req.data = conn;
+	int r = uv_tcp_connect(&conn->connect_req, &conn->tcp, (const struct sockaddr*)&u->addr, on_conn_connected);
+	if (r) {
+		warn_on_uv_err(r, "uv_tcp_connect");
+		conn_close(conn);
+		return NULL;
+	}
+	uv_timer_start(&conn->timer, on_conn_timeout, UV_HTTPD_PROXY_CONNECT_TIMEOUT, 0);
+	return conn;
+}
+
+// least connections in use, ties rotated
+static upstream_t* pick_upstream(uv_httpd_proxy_t* proxy) {
+	upstream_t* best = NULL;
+	for (int i = 0; i < proxy->nupstreams; i++) {
+		upstream_t* u = &proxy->upstreams[(proxy->next + i) % proxy->nupstreams];
+		if (!best || u->active < best->active) {
+			best = u;
+		}
+	}
+	proxy->next++;
+	return best;
+}
+
+static upstream_conn_t* get_conn(uv_httpd_proxy_t* proxy, upstream_t* u, llhttp_method_t method) {
+	if (!QUEUE_EMPTY(&u->idle)) {
+		QUEUE* q = QUEUE_HEAD(&u->idle);
+		upstream_conn_t* conn = QUEUE_DATA(q, upstream_conn_t, node);
+		QUEUE_REMOVE(q);
+		u->nidle--;
+		conn->idle = 0;
+		// a POST may have reached the upstream before it closed, it is not sent twice
+		conn->retry = is_idempotent(method);
+		conn_wait_response(conn);
+		return conn;
+	}
+	return conn_new(proxy, u);
+}
+
+
+/*************************** client request ****************/
+
+static void on_client_body(uv_httpd_client_t* client, const char* at, size_t len) {
+	upstream_conn_t* conn = uv_httpd_client_get_data(client);
+	if (!conn) return; // responded already, drop the rest
+
+	if (len == 0) {
+		if (conn->chunked_request) {
+			conn_write(conn, "0\r\n\r\n", 5);
+		}
+		conn->request_done = 1;
+		return;
+	}
+
+	if (conn->chunked_request) {
+		mybuf_t buf;
+		mybuf_init(&buf);
+		mybuf_cat_printf(&buf, "%zx\r\n", len);
+		mybuf_append(&buf, at, len);
+		mybuf_append(&buf, "\r\n", 2);
+		conn_write(conn, buf.buf, buf.size);
+		mybuf_clear(&buf);
+	} else {
+		conn_write(conn, at, len);
+	}
+}
+
+static void on_client_abort(uv_httpd_client_t* client) {
+	upstream_conn_t* conn = uv_httpd_client_get_data(client);
+	if (!conn) return;
+	// response half way, the connection can't be reused
+	conn_detach(conn);
+	conn_close(conn);
+}
+
+int uv_httpd_proxy_pass(uv_httpd_proxy_t* proxy, uv_httpd_client_t* client, uv_httpd_request_t* req) {
+	upstream_t* u = pick_upstream(proxy);
+	upstream_conn_t* conn;
+	const uv_httpd_string_t* te;
+	mybuf_t head;
+
+	if (!u) return UV_ENOENT;
+	conn = get_conn(proxy, u, req->method);
+	if (!conn) return UV_ECONNREFUSED;
+
+	u->active++;
+	conn->client = client;
+	conn->method = req->method;
+	conn->request_done = 0;
+	conn->head_sent = 0;
+	conn->client_paused = 0;
+	te = uv_httpd_header(req, "Transfer-Encoding");
+	conn->chunked_request = te != NULL;
+	uv_httpd_client_set_data(client, conn);
+	uv_httpd_stream_body(client, on_client_body, on_client_abort);
+
+	mybuf_init(&head);
+	mybuf_cat_printf(&head, "%s %.*s HTTP/1.1\r\n", llhttp_method_name(req->method),
+					 (int)req->url.len, req->base + req->url.offset);
+	for (size_t i = 0; i < req->headers.n; i++) {
+		const uv_httpd_header_t* h = &req->headers.headers[i];
+		if (is_hop_by_hop(req->base + h->key.offset, h->key.len)) continue;
+		mybuf_append(&head, req->base + h->key.offset, h->key.len);
+		mybuf_append(&head, ": ", 2);
+		mybuf_append(&head, req->base + h->value.offset, h->value.len);
+		mybuf_append(&head, "\r\n", 2);
+	}
+	if (conn->chunked_request) {
+		mybuf_append(&head, "Transfer-Encoding: chunked\r\n", 28);
+	}
+	mybuf_cat_printf(&head, "X-Forwarded-For: %s\r\nConnection: keep-alive\r\n\r\n", uv_httpd_client_ip(client));
+	conn_write(conn, head.buf, head.size);
+	mybuf_clear(&head);
+	return 0;
+}
+
+
+/*************************** public functions ****************/
+
+int uv_httpd_proxy_create(uv_httpd_proxy_t** proxy, uv_loop_t* loop) {
+	uv_httpd_proxy_t* p = calloc(1, sizeof(*p));
+	if (!p) return UV_ENOMEM;
+	p->loop = loop;
+	setup_response_settings(&p->settings);
+	*proxy = p;
+	return 0;
+}
+
+int uv_httpd_proxy_add_upstream(uv_httpd_proxy_t* proxy, const char* ip, int port) {
+	upstream_t* u;
+	int r;
+
+	if (proxy->nupstreams == UV_HTTPD_PROXY_MAX_UPSTREAMS) return UV_ENOSPC;
+	u = &proxy->upstreams[proxy->nupstreams];
+	if (strchr(ip, ':')) {
+		r = uv_ip6_addr(ip, port, (struct sockaddr_in6*)&u->addr);
+		snprintf(u->name, sizeof(u->name), "[%s]:%d", ip, port);
+	} else {
+		r = uv_ip4_addr(ip, port, (struct sockaddr_in*)&u->addr);
+		snprintf(u->name, sizeof(u->name), "%s:%d", ip, port);
+	}
+	if (r) return r;
+	QUEUE_INIT(&u->idle);
+	proxy->nupstreams++;
+	return 0;
+}
+
+void uv_httpd_proxy_close(uv_httpd_proxy_t* proxy) {
+	for (int i = 0; i < proxy->nupstreams; i++) {
+		upstream_t* u = &proxy->upstreams[i];
+		while (!QUEUE_EMPTY(&u->idle)) {
+			conn_close(QUEUE_DATA(QUEUE_HEAD(&u->idle), upstream_conn_t, node));
+		}
+	}
+}
+
+void uv_httpd_proxy_free(uv_httpd_proxy_t* proxy) {
+	free(proxy);
+}
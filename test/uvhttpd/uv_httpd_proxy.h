@@ -0,0 +1,47 @@
+#ifndef __UV_HTTPD_PROXY_H__
+#define __UV_HTTPD_PROXY_H__
+
+#pragma once
+
+#include "uv_httpd.h"
+
+// reverse proxy:
+// requests are forwarded to the upstream with least connections in use,
+// over keep-alive connections pooled per upstream. a GET or HEAD failing on a pooled connection
+// before any response byte is sent again once on a new one, the upstream may have closed it,
+// other methods are answered 502 as they may have been handled.
+// 504 if the upstream does not connect in time, or is silent too long while a request is in flight.
+// bodies are streamed both ways, nothing is buffered as a whole.
+
+#ifndef UV_HTTPD_PROXY_MAX_UPSTREAMS
+#define UV_HTTPD_PROXY_MAX_UPSTREAMS 16
+#endif
+
+#ifndef UV_HTTPD_PROXY_MAX_IDLE
+#define UV_HTTPD_PROXY_MAX_IDLE 32 // idle connections kept per upstream
+#endif
+
+#ifndef UV_HTTPD_PROXY_CONNECT_TIMEOUT
+#define UV_HTTPD_PROXY_CONNECT_TIMEOUT 5000 // ms
+#endif
+
+#ifndef UV_HTTPD_PROXY_RESPONSE_TIMEOUT
+#define UV_HTTPD_PROXY_RESPONSE_TIMEOUT 30000 // ms without a byte to or from the upstream while a request is in flight
+#endif
+
+typedef struct uv_httpd_proxy_s uv_httpd_proxy_t;
+
+// return 0 for success, otherwise it is `uv_errno_t`
+int uv_httpd_proxy_create(uv_httpd_proxy_t** proxy, uv_loop_t* loop);
+// `ip` is an ipv4 or ipv6 address.
+// return 0 for success, otherwise it is `uv_errno_t`
+int uv_httpd_proxy_add_upstream(uv_httpd_proxy_t* proxy, const char* ip, int port);
+// forward the request, call it in `on_headers`.
+// the response is deferred, and the body is streamed to the upstream.
+// return 0 for success, otherwise it is `uv_errno_t`
+int uv_httpd_proxy_pass(uv_httpd_proxy_t* proxy, uv_httpd_client_t* client, uv_httpd_request_t* req);
+// close pooled connections, free the proxy after the loop ends
+void uv_httpd_proxy_close(uv_httpd_proxy_t* proxy);
+void uv_httpd_proxy_free(uv_httpd_proxy_t* proxy);
+
+#endif
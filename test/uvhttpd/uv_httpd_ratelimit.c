@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <string.h>
+#include "uv_httpd_ratelimit.h"
+
+#define RATELIMIT_MIN_CAPACITY 1024 // must be power of 2
+#define RATELIMIT_MAX_LOAD(cap) ((cap) / 4 * 3)
+#define TOKEN_UNIT 1000 // tokens are kept in 1/1000
+
+typedef struct {
+	uint64_t hi, lo;
+	uint32_t stamp; // loop time in ms of last update, 0 for empty slot
+	uint32_t tokens; // in 1/TOKEN_UNIT
+}bucket_t;
+
+struct uv_httpd_ratelimit_s {
+	bucket_t* table;
+	size_t capacity; // power of 2
+	size_t used; // non-empty slots
+	uint32_t rate; // tokens per second, also 1/TOKEN_UNIT tokens per ms
+	uint32_t burst; // in 1/TOKEN_UNIT
+	uint32_t ttl; // ms to refill an empty bucket, buckets untouched longer are full
+};
+
+static size_t hash_key(uint64_t hi, uint64_t lo) {
+	uint64_t h = hi * 0x9E3779B97F4A7C15ULL ^ lo * 0xC2B2AE3D27D4EB4FULL;
+	h ^= h >> 32;
+	return (size_t)h;
+}
+
+static bucket_t* find_slot(bucket_t* table, size_t mask, uint64_t hi, uint64_t lo) {
+	size_t i = hash_key(hi, lo) & mask;
+	while (table[i].stamp && (table[i].hi != hi || table[i].lo != lo)) {
+		i = (i + 1) & mask;
+	}
+	return &table[i];
+}
+
+// drop expired entries, grow if still crowded
+static int rebuild(uv_httpd_ratelimit_t* rl, uint32_t now) {
+	size_t live = 0, capacity = rl->capacity, i;
+	bucket_t* table;
+
+	for (i = 0; i < rl->capacity; i++) {
+		if (rl->table[i].stamp && (uint32_t)(now - rl->table[i].stamp) < rl->ttl) {
+			live++;
+		}
+	}
+	while (live * 2 > capacity) {
+		capacity *= 2;
+	}
+
+	table = calloc(capacity, sizeof(bucket_t));
+	if (!table) return UV_ENOMEM;
+	for (i = 0; i < rl->capacity; i++) {
+		bucket_t* b = &rl->table[i];
+		if (b->stamp && (uint32_t)(now - b->stamp) < rl->ttl) {
+			*find_slot(table, capacity - 1, b->hi, b->lo) = *b;
+		}
+	}
+	free(rl->table);
+	rl->table = table;
+	rl->capacity = capacity;
+	rl->used = live;
+	return 0;
+}
+
+void uv_httpd_addr_key(const struct sockaddr* addr, uv_httpd_addr_key_t* key) {
+	static const unsigned char v4mapped[12] = { 0,0,0,0,0,0,0,0,0,0,0xff,0xff };
+	uint32_t v4;
+
+	if (addr->sa_family == AF_INET6) {
+		const unsigned char* a = ((const struct sockaddr_in6*)addr)->sin6_addr.s6_addr;
+		if (memcmp(a, v4mapped, sizeof(v4mapped))) {
+			memcpy(&key->hi, a, 8);
+			key->lo = 0;
+			return;
+		}
+		memcpy(&v4, a + 12, 4);
+	} else if (addr->sa_family == AF_INET) {
+		memcpy(&v4, &((const struct sockaddr_in*)addr)->sin_addr, 4);
+	} else {
+		// unix domain socket etc. share one bucket
+		v4 = 0;
+	}
+	key->hi = 0;
+	key->lo = 0xffff00000000ULL | v4;
+}
+
+int uv_httpd_ratelimit_create(uv_httpd_ratelimit_t** rl, unsigned int rate, unsigned int burst) {
+	uv_httpd_ratelimit_t* r;
+
+	// keep `tokens + elapsed * rate` in uint32_t
+	if (rate == 0 || burst == 0 || rate > UINT32_MAX / 4 || burst > UINT32_MAX / TOKEN_UNIT / 4) return UV_EINVAL;
+	r = calloc(1, sizeof(*r));
+	if (!r) return UV_ENOMEM;
+	r->capacity = RATELIMIT_MIN_CAPACITY;
+	r->table = calloc(r->capacity, sizeof(bucket_t));
+	if (!r->table) {
+		free(r);
+		return UV_ENOMEM;
+	}
+	r->rate = rate;
+	r->burst = burst * TOKEN_UNIT;
+	r->ttl = (r->burst + r->rate - 1) / r->rate;
+	*rl = r;
+	return 0;
+}
+
+void uv_httpd_ratelimit_free(uv_httpd_ratelimit_t* rl) {
+	if (!rl) return;
+	free(rl->table);
+	free(rl);
+}
+
+int uv_httpd_ratelimit_take(uv_httpd_ratelimit_t* rl, const uv_httpd_addr_key_t* key, uint64_t now) {
+	uint32_t now32 = (uint32_t)now | 1; // 0 marks empty slot
+	size_t mask = rl->capacity - 1;
+	size_t i = hash_key(key->hi, key->lo) & mask;
+	bucket_t* reuse = NULL;
+	bucket_t* b;
+
+	for (;;) {
+		b = &rl->table[i];
+		if (!b->stamp) break;
+		if (b->hi == key->hi && b->lo == key->lo) {
+			uint32_t elapsed = now32 - b->stamp;
+			if (elapsed >= rl->ttl) {
+				b->tokens = rl->burst;
+			} else {
+				uint32_t tokens = b->tokens + elapsed * rl->rate;
+				b->tokens = tokens > rl->burst ? rl->burst : tokens;
+			}
+			b->stamp = now32;
+			if (b->tokens < TOKEN_UNIT) return 0;
+			b->tokens -= TOKEN_UNIT;
+			return 1;
+		}
+		if (!reuse && (uint32_t)(now32 - b->stamp) >= rl->ttl) {
+			reuse = b;
+		}
+		i = (i + 1) & mask;
+	}
+
+	// new address, the bucket starts full
+	if (!reuse && rl->used + 1 >= rl->capacity) {
+		// rebuild failed, no room left
+		return 1;
+	}
+	if (!reuse) {
+		reuse = b;
+		rl->used++;
+	}
+	reuse->hi = key->hi;
+	reuse->lo = key->lo;
+	reuse->stamp = now32;
+	reuse->tokens = rl->burst - TOKEN_UNIT;
+	if (rl->used > RATELIMIT_MAX_LOAD(rl->capacity)) {
+		// fails only if out of memory, keep the crowded table then
+		rebuild(rl, now32);
+	}
+	return 1;
+}
+
+size_t uv_httpd_ratelimit_size(uv_httpd_ratelimit_t* rl) {
+	return rl->used;
+}
@@ -0,0 +1,38 @@
+#ifndef __UV_HTTPD_RATELIMIT_H__
+#define __UV_HTTPD_RATELIMIT_H__
+
+#pragma once
+
+#include <uv.h>
+
+// per client address token buckets, kept in an open addressing hash table.
+// a bucket refilled to full is the same as no bucket, so such entries are
+// overwritten lazily by new addresses and dropped when the table is rebuilt.
+// a take costs tens of ns while the addresses in use fit the cpu cache. with 1M of them
+// the table is 48 MB and a take is a cache miss, 90-150 ns here, see ratelimitbench.c.
+
+typedef struct uv_httpd_ratelimit_s uv_httpd_ratelimit_t;
+
+// binary client address, ipv4 is mapped to ::ffff:a.b.c.d,
+// ipv6 is truncated to /64 since a single host usually owns the whole prefix.
+typedef struct {
+	uint64_t hi, lo;
+}uv_httpd_addr_key_t;
+
+void uv_httpd_addr_key(const struct sockaddr* addr, uv_httpd_addr_key_t* key);
+// key of the peer address of a connection, computed on accept.
+// also a cheap key for per-address state other than the rate limit, e.g. access logs
+struct uv_httpd_client_s;
+const uv_httpd_addr_key_t* uv_httpd_client_addr_key(struct uv_httpd_client_s* client);
+
+// `rate` tokens per second, at most `burst` tokens saved.
+// return 0 for success, otherwise it is `uv_errno_t`
+int uv_httpd_ratelimit_create(uv_httpd_ratelimit_t** rl, unsigned int rate, unsigned int burst);
+void uv_httpd_ratelimit_free(uv_httpd_ratelimit_t* rl);
+// take a token from `key`'s bucket, `now` is loop time in ms.
+// return 1 if allowed, 0 if the bucket is empty
+int uv_httpd_ratelimit_take(uv_httpd_ratelimit_t* rl, const uv_httpd_addr_key_t* key, uint64_t now);
+// addresses in the table, including expired ones not evicted yet
+size_t uv_httpd_ratelimit_size(uv_httpd_ratelimit_t* rl);
+
+#endif
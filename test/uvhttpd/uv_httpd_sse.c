@@ -0,0 +1,304 @@
+#include <stdlib.h>
+#include <string.h>
+#include "uv_httpd_sse.h"
+#include "mybuf.h"
+#include "uv_log.h"
+
+#define SSE_HEAD "HTTP/1.1 200 OK\r\n" \
+	"Content-Type: text/event-stream\r\n" \
+	"Cache-Control: no-cache, no-transform\r\n"
+
+#define CHUNK_HEAD_MAX 10 // hex length of a chunk and CRLF
+#define HEARTBEAT_CHUNKED "3\r\n:\n\n\r\n"
+#define HEARTBEAT_RAW ":\n\n"
+#define LAST_CHUNK "0\r\n\r\n"
+
+struct uv_httpd_sse_stream_s {
+	uv_httpd_sse_t* sse;
+	uv_httpd_client_t* client;
+	QUEUE node; // sse->streams
+	uint64_t last_write; // uv_now
+	int chunked; // otherwise delimited by the end of the connection, HTTP/1.0
+	uv_httpd_sse_on_close_t on_close;
+	void* data;
+};
+
+struct uv_httpd_sse_s {
+	uv_loop_t* loop;
+	uint64_t heartbeat; // ms
+	uv_timer_t timer;
+	QUEUE streams; // by the last write, the oldest first
+	uv_httpd_sse_stats_t stats;
+	mybuf_t buf; // an event being formatted for one stream
+};
+
+
+/*************************** events ****************/
+
+// a line of `name` and `value`, `value` has no line breaks
+static void append_line(mybuf_t* buf, const char* name, size_t name_len, const char* value, size_t len) {
+	if (mybuf_reserve(buf, name_len + len + 1)) return;
+	memcpy(buf->buf + buf->size, name, name_len);
+	memcpy(buf->buf + buf->size + name_len, value, len);
+	buf->size += name_len + len;
+	buf->buf[buf->size++] = '\n';
+}
+
+// end the event in `buf` by a blank line and the chunk by CRLF,
+// write the chunk head before it. return the offset of the chunk head
+static size_t end_chunk(mybuf_t* buf) {
+	static const char hex[] = "0123456789abcdef";
+	size_t payload, off = CHUNK_HEAD_MAX;
+
+	mybuf_append(buf, "\n\r\n", 3);
+	buf->buf[--off] = '\n';
+	buf->buf[--off] = '\r';
+	payload = buf->size - CHUNK_HEAD_MAX - 2;
+	do {
+		buf->buf[--off] = hex[payload & 15];
+		payload >>= 4;
+	} while (payload);
+	return off;
+}
+
+// format an event into `buf` after CHUNK_HEAD_MAX bytes left for the chunk head.
+// return the offset of the chunk head
+static size_t format_event(mybuf_t* buf, const char* event, const char* id, const char* data, size_t len) {
+	const char* end = data + len;
+	const char* p;
+
+	buf->size = CHUNK_HEAD_MAX;
+	if (event) append_line(buf, "event: ", 7, event, strlen(event));
+	if (id) append_line(buf, "id: ", 4, id, strlen(id));
+	for (;;) {
+		for (p = data; p < end && *p != '\n' && *p != '\r'; p++);
+		append_line(buf, "data: ", 6, data, p - data);
+		if (p == end) break;
+		data = p + (p[0] == '\r' && p + 1 < end && p[1] == '\n' ? 2 : 1);
+	}
+	return end_chunk(buf);
+}
+
+// keep the order of `sse->streams` by the last write
+static void touch(uv_httpd_sse_stream_t* stream) {
+	stream->last_write = uv_now(stream->sse->loop);
+	QUEUE_REMOVE(&stream->node);
+	QUEUE_INSERT_TAIL(&stream->sse->streams, &stream->node);
+}
+
+// the connection is closed if the reader is too slow,
+// `stream` is freed by `on_abort` after this returns
+static int stream_write(uv_httpd_sse_stream_t* stream, const char* data, size_t len) {
+	uv_httpd_sse_t* sse = stream->sse;
+	touch(stream);
+	if (uv_httpd_write_queue_size(stream->client) > UV_HTTPD_SSE_MAX_QUEUE) {
+		sse->stats.dropped++;
+		uvlog_warn("sse %s: more than %d bytes not written, closed", uv_httpd_client_ip(stream->client),
+				   UV_HTTPD_SSE_MAX_QUEUE);
+		uv_httpd_abort(stream->client);
+		return UV_ENOBUFS;
+	}
+	return uv_httpd_write_response(stream->client, (char*)data, len);
+}
+
+// the chunk of `buf` at `off`, or the event in it without chunk framing
+static int write_chunk(uv_httpd_sse_stream_t* stream, mybuf_t* buf, size_t off) {
+	if (stream->chunked) {
+		return stream_write(stream, buf->buf + off, buf->size - off);
+	}
+	return stream_write(stream, buf->buf + CHUNK_HEAD_MAX, buf->size - CHUNK_HEAD_MAX - 2);
+}
+
+
+/*************************** heartbeat ****************/
+
+static void on_heartbeat(uv_timer_t* timer);
+
+// wake when the oldest stream is due
+static void arm(uv_httpd_sse_t* sse) {
+	uv_httpd_sse_stream_t* head;
+	uint64_t now, due;
+
+	if (QUEUE_EMPTY(&sse->streams)) {
+		uv_timer_stop(&sse->timer);
+		return;
+	}
+	// streams written since are due later, it wakes early at worst
+	if (uv_is_active((uv_handle_t*)&sse->timer)) return;
+	head = QUEUE_DATA(QUEUE_HEAD(&sse->streams), uv_httpd_sse_stream_t, node);
+	now = uv_now(sse->loop);
+	due = head->last_write + sse->heartbeat;
+	uv_timer_start(&sse->timer, on_heartbeat, due > now ? due - now : 0, 0);
+}
+
+static void on_heartbeat(uv_timer_t* timer) {
+	uv_httpd_sse_t* sse = timer->data;
+	uint64_t now = uv_now(sse->loop);
+	uint64_t idle = sse->heartbeat - sse->heartbeat / 8;
+	uv_httpd_sse_stream_t* stream;
+	QUEUE due;
+
+	sse->stats.wakeups++;
+	// streams idle long enough are moved out first, each goes back to the tail
+	QUEUE_INIT(&due);
+	while (!QUEUE_EMPTY(&sse->streams)) {
+		stream = QUEUE_DATA(QUEUE_HEAD(&sse->streams), uv_httpd_sse_stream_t, node);
+		if (now - stream->last_write < idle) break;
+		QUEUE_REMOVE(&stream->node);
+		QUEUE_INSERT_TAIL(&due, &stream->node);
+	}
+	while (!QUEUE_EMPTY(&due)) {
+		stream = QUEUE_DATA(QUEUE_HEAD(&due), uv_httpd_sse_stream_t, node);
+		sse->stats.heartbeats++;
+		if (stream->chunked) {
+			stream_write(stream, HEARTBEAT_CHUNKED, sizeof(HEARTBEAT_CHUNKED) - 1);
+		} else {
+			stream_write(stream, HEARTBEAT_RAW, sizeof(HEARTBEAT_RAW) - 1);
+		}
+	}
+	arm(sse);
+}
+
+
+/*************************** streams ****************/
+
+static void free_stream(uv_httpd_sse_stream_t* stream) {
+	uv_httpd_sse_t* sse = stream->sse;
+	QUEUE_REMOVE(&stream->node);
+	sse->stats.streams--;
+	free(stream);
+	arm(sse);
+}
+
+static void on_abort(uv_httpd_client_t* client) {
+	uv_httpd_sse_stream_t* stream = uv_httpd_client_get_data(client);
+	if (stream->on_close) {
+		stream->on_close(stream);
+	}
+	uv_httpd_client_set_data(client, NULL);
+	free_stream(stream);
+}
+
+int uv_httpd_sse_start(uv_httpd_sse_t* sse, uv_httpd_client_t* client, uv_httpd_request_t* req,
+					   uv_httpd_sse_on_close_t on_close, void* data, uv_httpd_sse_stream_t** stream) {
+	static const char chunked[] = SSE_HEAD "Transfer-Encoding: chunked\r\n\r\n";
+	// HTTP/1.0 without Content-Length ends with the connection, no header needed.
+	// `Connection: close` is inserted by write_response while draining
+	static const char unframed[] = SSE_HEAD "\r\n";
+	uv_httpd_sse_stream_t* s;
+	int r;
+
+	s = calloc(1, sizeof(*s));
+	if (!s) return UV_ENOMEM;
+	s->sse = sse;
+	s->client = client;
+	s->on_close = on_close;
+	s->data = data;
+	s->chunked = !(req->version.len == 3 && 0 == memcmp(req->base + req->version.offset, "1.0", 3));
+	if (s->chunked) {
+		r = uv_httpd_write_response(client, (char*)chunked, sizeof(chunked) - 1);
+	} else {
+		r = uv_httpd_write_response(client, (char*)unframed, sizeof(unframed) - 1);
+	}
+	if (r) {
+		free(s);
+		return r;
+	}
+	uv_httpd_defer_response(client, on_abort);
+	uv_httpd_client_set_data(client, s);
+	s->last_write = uv_now(sse->loop);
+	QUEUE_INSERT_TAIL(&sse->streams, &s->node);
+	sse->stats.streams++;
+	sse->stats.opened++;
+	arm(sse);
+	*stream = s;
+	return 0;
+}
+
+void uv_httpd_sse_end(uv_httpd_sse_stream_t* stream) {
+	uv_httpd_client_t* client = stream->client;
+	if (stream->chunked) {
+		uv_httpd_write_response(client, LAST_CHUNK, sizeof(LAST_CHUNK) - 1);
+	} else {
+		uv_httpd_close(client);
+	}
+	uv_httpd_client_set_data(client, NULL);
+	free_stream(stream);
+	uv_httpd_response_done(client);
+}
+
+int uv_httpd_sse_send(uv_httpd_sse_stream_t* stream, const char* event, const char* id, const char* data, size_t len) {
+	mybuf_t* buf = &stream->sse->buf;
+	stream->sse->stats.events++;
+	return write_chunk(stream, buf, format_event(buf, event, id, data, len));
+}
+
+void uv_httpd_sse_broadcast(uv_httpd_sse_t* sse, const char* event, const char* id, const char* data, size_t len) {
+	mybuf_t buf;
+	size_t off;
+	QUEUE pending;
+
+	if (QUEUE_EMPTY(&sse->streams)) return;
+	// not `sse->buf`: a stream closed by a write calls `on_close`, which may send or broadcast
+	mybuf_init(&buf);
+	off = format_event(&buf, event, id, data, len);
+	// each stream goes back to the tail of `sse->streams` when written
+	QUEUE_MOVE(&sse->streams, &pending);
+	while (!QUEUE_EMPTY(&pending)) {
+		sse->stats.events++;
+		write_chunk(QUEUE_DATA(QUEUE_HEAD(&pending), uv_httpd_sse_stream_t, node), &buf, off);
+	}
+	mybuf_clear(&buf);
+}
+
+int uv_httpd_sse_comment(uv_httpd_sse_stream_t* stream, const char* text) {
+	mybuf_t* buf = &stream->sse->buf;
+	buf->size = CHUNK_HEAD_MAX;
+	append_line(buf, ":", 1, text, strlen(text));
+	return write_chunk(stream, buf, end_chunk(buf));
+}
+
+void* uv_httpd_sse_data(uv_httpd_sse_stream_t* stream) {
+	return stream->data;
+}
+
+uv_httpd_client_t* uv_httpd_sse_client(uv_httpd_sse_stream_t* stream) {
+	return stream->client;
+}
+
+
+/*************************** hub ****************/
+
+static void on_closed(uv_handle_t* handle) {
+	uv_httpd_sse_t* sse = handle->data;
+	mybuf_clear(&sse->buf);
+	free(sse);
+}
+
+int uv_httpd_sse_create(uv_httpd_sse_t** sse, uv_loop_t* loop, uint64_t heartbeat) {
+	uv_httpd_sse_t* s = calloc(1, sizeof(*s));
+	int r;
+	if (!s) return UV_ENOMEM;
+	s->loop = loop;
+	s->heartbeat = heartbeat ? heartbeat : UV_HTTPD_SSE_HEARTBEAT;
+	if ((r = uv_timer_init(loop, &s->timer))) {
+		free(s);
+		return r;
+	}
+	s->timer.data = s;
+	QUEUE_INIT(&s->streams);
+	mybuf_init(&s->buf);
+	*sse = s;
+	return 0;
+}
+
+void uv_httpd_sse_free(uv_httpd_sse_t* sse) {
+	while (!QUEUE_EMPTY(&sse->streams)) {
+		uv_httpd_sse_end(QUEUE_DATA(QUEUE_HEAD(&sse->streams), uv_httpd_sse_stream_t, node));
+	}
+	uv_close((uv_handle_t*)&sse->timer, on_closed);
+}
+
+void uv_httpd_sse_stats(uv_httpd_sse_t* sse, uv_httpd_sse_stats_t* stats) {
+	*stats = sse->stats;
+}
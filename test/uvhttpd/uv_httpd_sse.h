@@ -0,0 +1,73 @@
+#ifndef __UV_HTTPD_SSE_H__
+#define __UV_HTTPD_SSE_H__
+
+#pragma once
+
+#include "uv_httpd.h"
+
+// server-sent events: a request answered by `uv_httpd_sse_start` gets the head of a
+// `text/event-stream` once, then the response stays open for events until
+// `uv_httpd_sse_end` or the client goes away. chunked for HTTP/1.1, delimited by the end
+// of the connection for HTTP/1.0, a DATA frame per write for HTTP/2.
+// a stream that wrote nothing for `heartbeat` ms gets a comment line, so proxies and
+// load balancers don't time it out. streams are kept in the order of their last write,
+// one timer of the hub sends heartbeats to all those due, up to an eighth of `heartbeat`
+// early, so the timer wakes at most about 8 times per `heartbeat` however many streams.
+// a stream with more than UV_HTTPD_SSE_MAX_QUEUE bytes not written yet is closed,
+// a slow reader must not buffer events without bound.
+// the request is not read while the response is open, a client gone away is seen by
+// the next write, at the latest by the heartbeat.
+// the stream owns `uv_httpd_client_get_data` of its client, it has its own `data`.
+
+#ifndef UV_HTTPD_SSE_HEARTBEAT
+#define UV_HTTPD_SSE_HEARTBEAT 15000 // ms
+#endif
+
+#ifndef UV_HTTPD_SSE_MAX_QUEUE
+#define UV_HTTPD_SSE_MAX_QUEUE (1024 * 1024) // bytes pending per stream
+#endif
+
+typedef struct uv_httpd_sse_s uv_httpd_sse_t;
+typedef struct uv_httpd_sse_stream_s uv_httpd_sse_stream_t;
+
+// the connection of `stream` closed, the stream is freed after it returns
+typedef void(*uv_httpd_sse_on_close_t)(uv_httpd_sse_stream_t* stream);
+
+typedef struct {
+	uint64_t streams; // open
+	uint64_t opened;
+	uint64_t events; // written to a stream, a broadcast counts once per stream
+	uint64_t heartbeats;
+	uint64_t dropped; // streams closed for UV_HTTPD_SSE_MAX_QUEUE
+	uint64_t wakeups; // of the heartbeat timer
+}uv_httpd_sse_stats_t;
+
+// `heartbeat` ms, 0 for UV_HTTPD_SSE_HEARTBEAT.
+// return 0 for success, otherwise it is `uv_errno_t`
+int uv_httpd_sse_create(uv_httpd_sse_t** sse, uv_loop_t* loop, uint64_t heartbeat);
+// end all streams, the hub is freed by the loop
+void uv_httpd_sse_free(uv_httpd_sse_t* sse);
+
+// answer `req` of `client` in `on_request` by an event stream.
+// `on_close` is optional, not called for a stream ended by `uv_httpd_sse_end`.
+// return 0 for success, otherwise it is `uv_errno_t`
+int uv_httpd_sse_start(uv_httpd_sse_t* sse, uv_httpd_client_t* client, uv_httpd_request_t* req,
+					   uv_httpd_sse_on_close_t on_close, void* data, uv_httpd_sse_stream_t** stream);
+// finish the response, a connection kept alive goes on with its next request.
+// not after `on_close`
+void uv_httpd_sse_end(uv_httpd_sse_stream_t* stream);
+
+// an event, `event` and `id` are optional and must not contain line breaks.
+// `data` is split into `data:` lines at CR, LF or CRLF.
+// return 0 for success, otherwise it is `uv_errno_t`
+int uv_httpd_sse_send(uv_httpd_sse_stream_t* stream, const char* event, const char* id, const char* data, size_t len);
+// the same event to every stream of `sse`, formatted once
+void uv_httpd_sse_broadcast(uv_httpd_sse_t* sse, const char* event, const char* id, const char* data, size_t len);
+// a comment line, ignored by the browser, e.g. a heartbeat. must not contain line breaks
+int uv_httpd_sse_comment(uv_httpd_sse_stream_t* stream, const char* text);
+
+void* uv_httpd_sse_data(uv_httpd_sse_stream_t* stream);
+uv_httpd_client_t* uv_httpd_sse_client(uv_httpd_sse_stream_t* stream);
+void uv_httpd_sse_stats(uv_httpd_sse_t* sse, uv_httpd_sse_stats_t* stats);
+
+#endif
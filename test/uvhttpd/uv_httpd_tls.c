@@ -0,0 +1,233 @@
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include "uv_httpd_tls.h"
+#include "uv_log.h"
+
+#define SESSION_ID_CONTEXT "uv_httpd"
+#define TICKET_KEYS_LEN 80
+#define RECORD_SIZE (16 * 1024) // max plaintext of a record
+
+struct uv_httpd_tls_s {
+	SSL_CTX* ctx;
+	uv_httpd_tls_stats_t stats;
+	// reads of all connections, consumed in on_read before the next one
+	char rbuf[UV_HTTPD_TLS_READ_SIZE];
+};
+
+struct uv_httpd_tls_conn_s {
+	uv_httpd_tls_t* tls;
+	uv_httpd_client_t* client;
+	SSL* ssl; // owns both BIOs
+	BIO* rbio; // ciphertext from the socket
+	BIO* wbio; // ciphertext to the socket
+	int handshaken;
+	int failed; // a fatal error, SSL_shutdown must not be called
+	int shutdown; // close_notify sent
+};
+
+
+/*************************** helper functions ****************/
+
+// errors caused by clients are common, e.g. a scanner or an untrusted certificate
+static void log_errors(const char* what) {
+	char msg[256];
+	unsigned long e;
+	while ((e = ERR_get_error()) != 0) {
+		ERR_error_string_n(e, msg, sizeof(msg));
+		uvlog_debug("tls %s: %s", what, msg);
+	}
+}
+
+// send everything written to `wbio` as one write
+static int flush(uv_httpd_tls_conn_t* conn) {
+	char* data;
+	long len = BIO_get_mem_data(conn->wbio, &data);
+	int r = 0;
+	if (len > 0) {
+		r = uv_httpd_tls_send(conn->client, data, (size_t)len);
+		// the memory is kept for the next write
+		(void)BIO_reset(conn->wbio);
+	}
+	return r;
+}
+
+// the server's preference, `h2` only if h2c is enabled
+static int on_alpn(SSL* ssl, const unsigned char** out, unsigned char* outlen,
+				   const unsigned char* in, unsigned int inlen, void* arg) {
+	static const unsigned char h2[] = "\x02h2\x08http/1.1";
+	static const unsigned char h1[] = "\x08http/1.1";
+	uv_httpd_tls_conn_t* conn = SSL_get_app_data(ssl);
+	int h2c = uv_httpd_client_server(conn->client)->h2c;
+	(void)arg;
+
+	if (SSL_select_next_proto((unsigned char**)out, outlen, h2c ? h2 : h1,
+							  h2c ? sizeof(h2) - 1 : sizeof(h1) - 1, in, inlen) != OPENSSL_NPN_NEGOTIATED) {
+		return SSL_TLSEXT_ERR_NOACK;
+	}
+	return SSL_TLSEXT_ERR_OK;
+}
+
+
+/*************************** public functions ****************/
+
+int uv_httpd_tls_create(uv_httpd_tls_t** tls, const char* cert_file, const char* key_file) {
+	uv_httpd_tls_t* t = calloc(1, sizeof(*t));
+	if (!t) return UV_ENOMEM;
+	t->ctx = SSL_CTX_new(TLS_server_method());
+	if (!t->ctx) {
+		free(t);
+		return UV_ENOMEM;
+	}
+	if (SSL_CTX_use_certificate_chain_file(t->ctx, cert_file) != 1
+		|| SSL_CTX_use_PrivateKey_file(t->ctx, key_file, SSL_FILETYPE_PEM) != 1
+		|| SSL_CTX_check_private_key(t->ctx) != 1) {
+		unsigned long e = ERR_peek_last_error();
+		uvlog_error("tls: cannot load %s and %s: %s", cert_file, key_file, ERR_reason_error_string(e));
+		ERR_clear_error();
+		SSL_CTX_free(t->ctx);
+		free(t);
+		return UV_EINVAL;
+	}
+	SSL_CTX_set_min_proto_version(t->ctx, TLS1_2_VERSION);
+	SSL_CTX_set_options(t->ctx, SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE);
+	// session ids of TLS 1.2 clients without tickets, tickets are stateless
+	SSL_CTX_set_session_cache_mode(t->ctx, SSL_SESS_CACHE_SERVER);
+	SSL_CTX_sess_set_cache_size(t->ctx, UV_HTTPD_TLS_CACHE_SIZE);
+	SSL_CTX_set_timeout(t->ctx, UV_HTTPD_TLS_SESSION_TIMEOUT);
+	SSL_CTX_set_session_id_context(t->ctx, (const unsigned char*)SESSION_ID_CONTEXT, sizeof(SESSION_ID_CONTEXT) - 1);
+	SSL_CTX_set_alpn_select_cb(t->ctx, on_alpn, NULL);
+	*tls = t;
+	return 0;
+}
+
+void uv_httpd_tls_free(uv_httpd_tls_t* tls) {
+	SSL_CTX_free(tls->ctx);
+	free(tls);
+}
+
+int uv_httpd_tls_set_ticket_keys(uv_httpd_tls_t* tls, const void* keys, size_t len) {
+	if (len != TICKET_KEYS_LEN) return UV_EINVAL;
+	return SSL_CTX_set_tlsext_ticket_keys(tls->ctx, (void*)keys, (long)len) == 1 ? 0 : UV_EINVAL;
+}
+
+void uv_httpd_tls_stats(uv_httpd_tls_t* tls, uv_httpd_tls_stats_t* stats) {
+	*stats = tls->stats;
+	stats->cache_hits = (uint64_t)SSL_CTX_sess_hits(tls->ctx);
+	stats->cache_misses = (uint64_t)SSL_CTX_sess_misses(tls->ctx);
+	stats->cache_entries = (uint64_t)SSL_CTX_sess_number(tls->ctx);
+}
+
+
+/*************************** connections ****************/
+
+int uv_httpd_tls_conn_create(uv_httpd_tls_conn_t** conn, uv_httpd_tls_t* tls, uv_httpd_client_t* client) {
+	uv_httpd_tls_conn_t* c = calloc(1, sizeof(*c));
+	if (!c) return UV_ENOMEM;
+	c->tls = tls;
+	c->client = client;
+	c->ssl = SSL_new(tls->ctx);
+	c->rbio = BIO_new(BIO_s_mem());
+	c->wbio = BIO_new(BIO_s_mem());
+	if (!c->ssl || !c->rbio || !c->wbio) {
+		SSL_free(c->ssl);
+		BIO_free(c->rbio);
+		BIO_free(c->wbio);
+		free(c);
+		return UV_ENOMEM;
+	}
+	// an empty BIO means more data is needed, not the end
+	BIO_set_mem_eof_return(c->rbio, -1);
+	BIO_set_mem_eof_return(c->wbio, -1);
+	SSL_set_bio(c->ssl, c->rbio, c->wbio);
+	SSL_set_app_data(c->ssl, c);
+	SSL_set_accept_state(c->ssl);
+	*conn = c;
+	return 0;
+}
+
+void uv_httpd_tls_conn_free(uv_httpd_tls_conn_t* conn) {
+	if (conn->handshaken && !conn->failed) {
+		// otherwise SSL_free drops the session from the cache, as if the connection broke.
+		// clients often close keep-alive connections without close_notify
+		SSL_set_shutdown(conn->ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+	}
+	SSL_free(conn->ssl);
+	free(conn);
+}
+
+uv_buf_t uv_httpd_tls_read_buf(uv_httpd_tls_conn_t* conn) {
+	return uv_buf_init(conn->tls->rbuf, sizeof(conn->tls->rbuf));
+}
+
+int uv_httpd_tls_read(uv_httpd_tls_conn_t* conn, const char* data, size_t len, mybuf_t* out) {
+	uv_httpd_tls_t* tls = conn->tls;
+	int n = 0, e, r;
+
+	if (conn->failed) return UV_EPROTO;
+	ERR_clear_error();
+	if (BIO_write(conn->rbio, data, (int)len) != (int)len) return UV_ENOMEM;
+	if (!conn->handshaken) {
+		n = SSL_do_handshake(conn->ssl);
+		if (n != 1) {
+			e = SSL_get_error(conn->ssl, n);
+			// the next flight, or an alert
+			r = flush(conn);
+			if (e == SSL_ERROR_WANT_READ) return r;
+			tls->stats.failed++;
+			conn->failed = 1;
+			log_errors("handshake");
+			return UV_EPROTO;
+		}
+		conn->handshaken = 1;
+		tls->stats.handshakes++;
+		if (SSL_session_reused(conn->ssl)) {
+			tls->stats.resumed++;
+		}
+	}
+	// decrypted straight into the buffer the parser reads
+	for (;;) {
+		if (mybuf_reserve(out, RECORD_SIZE)) return UV_ENOMEM;
+		n = SSL_read(conn->ssl, out->buf + out->size, (int)mybuf_space(out));
+		if (n <= 0) break;
+		out->size += (size_t)n;
+		tls->stats.bytes_in += (uint64_t)n;
+	}
+	e = SSL_get_error(conn->ssl, n);
+	// the last handshake flight, session tickets, key updates
+	r = flush(conn);
+	if (e == SSL_ERROR_WANT_READ) return r;
+	if (e == SSL_ERROR_ZERO_RETURN) return UV_EOF;
+	conn->failed = 1;
+	log_errors("read");
+	return UV_EPROTO;
+}
+
+int uv_httpd_tls_write(uv_httpd_tls_conn_t* conn, const uv_buf_t* bufs, unsigned int nbufs) {
+	unsigned int i;
+	int n;
+
+	if (conn->failed || conn->shutdown) return UV_EPIPE;
+	ERR_clear_error();
+	for (i = 0; i < nbufs; i++) {
+		if (bufs[i].len == 0) continue;
+		// a memory BIO takes everything, no partial writes
+		n = SSL_write(conn->ssl, bufs[i].base, (int)bufs[i].len);
+		if (n <= 0) {
+			conn->failed = 1;
+			log_errors("write");
+			return UV_EPROTO;
+		}
+		conn->tls->stats.bytes_out += (uint64_t)n;
+	}
+	return flush(conn);
+}
+
+int uv_httpd_tls_shutdown(uv_httpd_tls_conn_t* conn) {
+	if (!conn->handshaken || conn->failed || conn->shutdown) return 0;
+	conn->shutdown = 1;
+	ERR_clear_error();
+	SSL_shutdown(conn->ssl);
+	return BIO_ctrl_pending(conn->wbio) > 0 && flush(conn) == 0;
+}
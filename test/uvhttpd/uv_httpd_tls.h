@@ -0,0 +1,77 @@
+#ifndef __UV_HTTPD_TLS_H__
+#define __UV_HTTPD_TLS_H__
+
+#pragma once
+
+#include "uv_httpd.h"
+#include "mybuf.h"
+
+// TLS termination with OpenSSL memory BIOs, see `server->tls`.
+// connections accepted on `server->tcp` are TLS, those of `server->pipe` stay plain
+// for a local proxy. socket reads of all connections share one ciphertext buffer,
+// plaintext is decrypted into the connection buffer the parser reads, and each
+// response is encrypted into a single write.
+// sessions are resumed by tickets, or by the session cache shared by all connections
+// of the server. ALPN offers `h2` if `server->h2c`.
+
+#ifndef UV_HTTPD_TLS_CACHE_SIZE
+#define UV_HTTPD_TLS_CACHE_SIZE 20480 // sessions in the server side cache
+#endif
+
+#ifndef UV_HTTPD_TLS_SESSION_TIMEOUT
+#define UV_HTTPD_TLS_SESSION_TIMEOUT 3600 // seconds a session can be resumed
+#endif
+
+#ifndef UV_HTTPD_TLS_READ_SIZE
+#define UV_HTTPD_TLS_READ_SIZE (64 * 1024) // the shared ciphertext buffer
+#endif
+
+typedef struct uv_httpd_tls_s uv_httpd_tls_t;
+typedef struct uv_httpd_tls_conn_s uv_httpd_tls_conn_t;
+
+typedef struct {
+	uint64_t handshakes; // completed, resumed ones included
+	uint64_t resumed; // by a ticket or the session cache
+	uint64_t failed; // handshakes failed
+	uint64_t cache_hits; // session ids found in the server side cache
+	uint64_t cache_misses;
+	uint64_t cache_entries;
+	uint64_t bytes_in; // plaintext decrypted
+	uint64_t bytes_out; // plaintext encrypted
+}uv_httpd_tls_stats_t;
+
+// `cert_file` is a PEM certificate chain, `key_file` the PEM private key.
+// return 0 for success, otherwise it is `uv_errno_t`
+int uv_httpd_tls_create(uv_httpd_tls_t** tls, const char* cert_file, const char* key_file);
+// free after all connections are closed
+void uv_httpd_tls_free(uv_httpd_tls_t* tls);
+// ticket keys shared with servers in other processes, e.g. prefork workers or the next
+// instance of a hot restart, so they resume the sessions of each other.
+// 80 bytes: 16 of key name, 32 of HMAC secret and 32 of AES key. random by default.
+// return 0 for success, otherwise it is `uv_errno_t`
+int uv_httpd_tls_set_ticket_keys(uv_httpd_tls_t* tls, const void* keys, size_t len);
+void uv_httpd_tls_stats(uv_httpd_tls_t* tls, uv_httpd_tls_stats_t* stats);
+
+/*************************** connections, called by uv_httpd.c ****************/
+
+// return 0 for success, otherwise it is `uv_errno_t`
+int uv_httpd_tls_conn_create(uv_httpd_tls_conn_t** conn, uv_httpd_tls_t* tls, uv_httpd_client_t* client);
+void uv_httpd_tls_conn_free(uv_httpd_tls_conn_t* conn);
+// the shared buffer to read ciphertext into, it is consumed by `uv_httpd_tls_read` before the next read
+uv_buf_t uv_httpd_tls_read_buf(uv_httpd_tls_conn_t* conn);
+// feed ciphertext, append decrypted data to `out`. handshake messages are answered by
+// `uv_httpd_tls_send`. return 0 for success, otherwise it is `uv_errno_t`, e.g. UV_EPROTO
+int uv_httpd_tls_read(uv_httpd_tls_conn_t* conn, const char* data, size_t len, mybuf_t* out);
+// encrypt `bufs` into one write by `uv_httpd_tls_send`.
+// return 0 for success, otherwise it is `uv_errno_t`
+int uv_httpd_tls_write(uv_httpd_tls_conn_t* conn, const uv_buf_t* bufs, unsigned int nbufs);
+// send close_notify once the handshake is done.
+// return 1 if it is written now, 0 if already sent or not needed
+int uv_httpd_tls_shutdown(uv_httpd_tls_conn_t* conn);
+
+/*************************** implemented by uv_httpd.c ****************/
+
+// write ciphertext to the socket
+int uv_httpd_tls_send(uv_httpd_client_t* client, const char* data, size_t len);
+
+#endif
@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
+#include "uv_httpd_trace.h"
+
+#ifdef UV_HTTPD_TRACE
+
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+typedef struct trace_ring_s {
+	struct trace_ring_s* next; // in `rings`
+	uint32_t thread; // 1 for the first thread traced
+	uint64_t n; // events written, the last UV_HTTPD_TRACE_EVENTS are kept
+	uv_httpd_trace_event_t events[UV_HTTPD_TRACE_EVENTS];
+}trace_ring_t;
+
+static THREAD_LOCAL trace_ring_t* ring; // of this thread, lives until exit
+static trace_ring_t* rings;
+static uint32_t nrings;
+static uv_mutex_t rings_mutex;
+static uv_once_t rings_once = UV_ONCE_INIT;
+
+static void rings_init(void) {
+	if (uv_mutex_init(&rings_mutex)) abort();
+}
+
+static trace_ring_t* ring_new(void) {
+	trace_ring_t* r = malloc(sizeof(*r));
+	if (!r) return NULL;
+	r->n = 0;
+	uv_once(&rings_once, rings_init);
+	uv_mutex_lock(&rings_mutex);
+	r->thread = ++nrings;
+	r->next = rings;
+	rings = r;
+	uv_mutex_unlock(&rings_mutex);
+	return r;
+}
+
+void uv_httpd_trace(uv_httpd_trace_name_t name, char phase, const void* id, int32_t arg) {
+	uv_httpd_trace_event_t* e;
+	if (!ring && !(ring = ring_new())) return;
+	e = &ring->events[ring->n++ & (UV_HTTPD_TRACE_EVENTS - 1)];
+	e->ts = uv_hrtime();
+	e->id = (uint64_t)(uintptr_t)id;
+	e->arg = arg;
+	e->name = (uint16_t)name;
+	e->phase = phase;
+	e->reserved = 0;
+}
+
+int uv_httpd_trace_dump(mybuf_t* out) {
+	trace_ring_t* r;
+	uint32_t n;
+	int failed;
+
+	uv_once(&rings_once, rings_init);
+	uv_mutex_lock(&rings_mutex);
+	failed = mybuf_append(out, UV_HTTPD_TRACE_MAGIC, 8) || mybuf_append(out, (const char*)&nrings, 4);
+	for (r = rings; r && !failed; r = r->next) {
+		uint64_t written = r->n;
+		uint64_t first = written > UV_HTTPD_TRACE_EVENTS ? written - UV_HTTPD_TRACE_EVENTS : 0;
+		// the ring wraps at most once between `first` and `written`
+		size_t start = (size_t)(first & (UV_HTTPD_TRACE_EVENTS - 1));
+		size_t head = (size_t)(written - first) < UV_HTTPD_TRACE_EVENTS - start
+			? (size_t)(written - first) : UV_HTTPD_TRACE_EVENTS - start;
+
+		n = (uint32_t)(written - first);
+		failed = mybuf_append(out, (const char*)&r->thread, 4)
+			|| mybuf_append(out, (const char*)&n, 4)
+			|| mybuf_append(out, (const char*)&r->events[start], head * sizeof(uv_httpd_trace_event_t))
+			|| mybuf_append(out, (const char*)r->events, (n - head) * sizeof(uv_httpd_trace_event_t));
+	}
+	uv_mutex_unlock(&rings_mutex);
+	return failed ? UV_ENOMEM : 0;
+}
+
+#else
+
+void uv_httpd_trace(uv_httpd_trace_name_t name, char phase, const void* id, int32_t arg) {
+}
+
+int uv_httpd_trace_dump(mybuf_t* out) {
+	return UV_ENOTSUP;
+}
+
+#endif
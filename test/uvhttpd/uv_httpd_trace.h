@@ -0,0 +1,83 @@
+#ifndef __UV_HTTPD_TRACE_H__
+#define __UV_HTTPD_TRACE_H__
+
+#pragma once
+
+#include <stdint.h>
+#include "mybuf.h"
+
+// trace points of uv_httpd, compiled in only if `UV_HTTPD_TRACE` is defined,
+// e.g. `make CFLAGS=-DUV_HTTPD_TRACE`, otherwise they are nothing.
+// each thread records fixed size events into a ring of its own, the oldest are
+// overwritten. `uv_httpd_trace_dump` serializes the rings, and `trace2json`
+// converts them to the Chrome trace event format, for chrome://tracing or Perfetto.
+
+#ifndef UV_HTTPD_TRACE_EVENTS
+#define UV_HTTPD_TRACE_EVENTS (64 * 1024) // events of a ring, must be power of 2
+#endif
+
+#define UV_HTTPD_TRACE_MAGIC "UVTRACE1"
+
+// name, trace name, name of `arg`
+#define UV_HTTPD_TRACE_MAP(XX) \
+	XX(CONNECTION, "connection", "") /* async, accepted to closed */ \
+	XX(REQUEST, "request", "keep_alive") /* async, message begin to finished */ \
+	XX(ACCEPT, "accept", "") \
+	XX(READ, "read", "nread") \
+	XX(PARSE, "parse", "bytes") \
+	XX(ON_HEADERS, "on_headers", "") \
+	XX(ON_REQUEST, "on_request", "") \
+	XX(ON_BODY, "on_body", "len") \
+	XX(ON_FLUSHED, "on_flushed", "") \
+	XX(ON_ABORT, "on_abort", "") \
+	XX(ON_DRAINED, "on_drained", "status") \
+	XX(WRITE, "write", "len") \
+	XX(ON_WRITE, "on_write", "status") \
+	XX(CLOSE, "close", "force") \
+	XX(ON_METHOD, "on_method", "len") /* llhttp callbacks registered only when tracing */ \
+	XX(ON_CHUNK_HEADER, "on_chunk_header", "size") \
+	XX(ON_CHUNK_EXTENSION, "on_chunk_extension", "len") \
+	XX(ON_CHUNK_COMPLETE, "on_chunk_complete", "") \
+	XX(ON_RESET, "on_reset", "")
+
+typedef enum {
+#define XX(name, str, arg) UV_HTTPD_TRACE_##name,
+	UV_HTTPD_TRACE_MAP(XX)
+#undef XX
+	UV_HTTPD_TRACE_MAX,
+}uv_httpd_trace_name_t;
+
+typedef struct {
+	uint64_t ts; // uv_hrtime
+	uint64_t id; // the client, or the server
+	int32_t arg;
+	uint16_t name; // uv_httpd_trace_name_t
+	char phase; // Chrome trace phase, 'B'/'E' on the thread, 'b'/'e' async by `id`, 'i' instant
+	uint8_t reserved;
+}uv_httpd_trace_event_t;
+
+// dump format, in host byte order:
+// UV_HTTPD_TRACE_MAGIC, uint32_t rings, then each ring:
+// uint32_t thread, uint32_t n, n events, the oldest first
+
+// record an event on the ring of the calling thread, use the macros below
+void uv_httpd_trace(uv_httpd_trace_name_t name, char phase, const void* id, int32_t arg);
+// append the rings to `out`. rings of other threads may be caught in the middle of a write.
+// return 0 for success, UV_ENOTSUP if not compiled with `UV_HTTPD_TRACE`, or UV_ENOMEM
+int uv_httpd_trace_dump(mybuf_t* out);
+
+#ifdef UV_HTTPD_TRACE
+#define UV_HTTPD_TRACE_BEGIN(name, id, arg) uv_httpd_trace(UV_HTTPD_TRACE_##name, 'B', (id), (int32_t)(arg))
+#define UV_HTTPD_TRACE_END(name, id, arg) uv_httpd_trace(UV_HTTPD_TRACE_##name, 'E', (id), (int32_t)(arg))
+#define UV_HTTPD_TRACE_ASYNC_BEGIN(name, id, arg) uv_httpd_trace(UV_HTTPD_TRACE_##name, 'b', (id), (int32_t)(arg))
+#define UV_HTTPD_TRACE_ASYNC_END(name, id, arg) uv_httpd_trace(UV_HTTPD_TRACE_##name, 'e', (id), (int32_t)(arg))
+#define UV_HTTPD_TRACE_INSTANT(name, id, arg) uv_httpd_trace(UV_HTTPD_TRACE_##name, 'i', (id), (int32_t)(arg))
+#else
+#define UV_HTTPD_TRACE_BEGIN(name, id, arg)
+#define UV_HTTPD_TRACE_END(name, id, arg)
+#define UV_HTTPD_TRACE_ASYNC_BEGIN(name, id, arg)
+#define UV_HTTPD_TRACE_ASYNC_END(name, id, arg)
+#define UV_HTTPD_TRACE_INSTANT(name, id, arg)
+#endif
+
+#endif
@@ -0,0 +1,136 @@
+#include <stdint.h>
+#include <string.h>
+#include "uv_httpd_url.h"
+
+#define ONES 0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+
+// nonzero if any byte of `v` is `c`
+static uint64_t has_byte(uint64_t v, unsigned char c) {
+	uint64_t x = v ^ (ONES * c);
+	return (x - ONES) & ~x & HIGHS;
+}
+
+// return the position of the first `%`, or `+` if `form`, from `i`, `len` if none.
+// 8 bytes at a time, urls are mostly plain text without escapes.
+static size_t skip_plain(const char* s, size_t i, size_t len, int form) {
+	uint64_t v;
+	for (; i + 8 <= len; i += 8) {
+		memcpy(&v, s + i, 8);
+		if (has_byte(v, '%') || (form && has_byte(v, '+'))) break;
+	}
+	for (; i < len; i++) {
+		if (s[i] == '%' || (form && s[i] == '+')) break;
+	}
+	return i;
+}
+
+static int hex_value(char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+void uv_httpd_url_parse(const uv_httpd_request_t* req, uv_httpd_url_t* url) {
+	const char* base = req->base + req->url.offset;
+	size_t len = req->url.len, i = 0, end;
+	const char* p;
+
+	memset(url, 0, sizeof(*url));
+	if (len && base[0] != '/' && (p = memchr(base, ':', len)) && (size_t)(p - base) + 3 <= len
+		&& p[1] == '/' && p[2] == '/') {
+		// absolute form, e.g. to a proxy
+		i = (size_t)(p - base) + 3;
+		while (i < len && base[i] != '/' && base[i] != '?' && base[i] != '#') i++;
+	}
+
+	p = memchr(base + i, '#', len - i);
+	end = p ? (size_t)(p - base) : len;
+	if (p) {
+		url->fragment.offset = req->url.offset + end + 1;
+		url->fragment.len = len - end - 1;
+	}
+	p = memchr(base + i, '?', end - i);
+	if (p) {
+		url->query.offset = req->url.offset + (size_t)(p - base) + 1;
+		url->query.len = end - (size_t)(p - base) - 1;
+		end = (size_t)(p - base);
+	}
+	url->path.offset = req->url.offset + i;
+	url->path.len = end - i;
+}
+
+void uv_httpd_query_init(uv_httpd_query_iter_t* iter, const uv_httpd_request_t* req, const uv_httpd_url_t* url) {
+	iter->base = req->base;
+	iter->pos = url->query.offset;
+	iter->end = url->query.offset + url->query.len;
+}
+
+int uv_httpd_query_next(uv_httpd_query_iter_t* iter, uv_httpd_string_t* key, uv_httpd_string_t* value) {
+	while (iter->pos < iter->end) {
+		const char* start = iter->base + iter->pos;
+		const char* amp = memchr(start, '&', iter->end - iter->pos);
+		size_t len = amp ? (size_t)(amp - start) : iter->end - iter->pos;
+		const char* eq = memchr(start, '=', len);
+		size_t offset = iter->pos;
+
+		iter->pos += len + (amp ? 1 : 0);
+		if (len == 0) continue;
+		key->offset = offset;
+		if (eq) {
+			key->len = (size_t)(eq - start);
+			value->offset = offset + key->len + 1;
+			value->len = len - key->len - 1;
+		} else {
+			key->len = len;
+			value->offset = offset + len;
+			value->len = 0;
+		}
+		return 1;
+	}
+	return 0;
+}
+
+int uv_httpd_query_get(const uv_httpd_request_t* req, const uv_httpd_url_t* url,
+					   const char* key, uv_httpd_string_t* value) {
+	uv_httpd_query_iter_t iter;
+	uv_httpd_string_t k;
+
+	uv_httpd_query_init(&iter, req, url);
+	while (uv_httpd_query_next(&iter, &k, value)) {
+		if (0 == string0_ncmp(key, req->base + k.offset, k.len)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+size_t uv_httpd_percent_decode(char* s, size_t len, int form) {
+	size_t i = skip_plain(s, 0, len, form);
+	size_t o = i;
+
+	while (i < len) {
+		size_t next;
+		int hi, lo;
+		if (s[i] == '+') {
+			s[o++] = ' ';
+			i++;
+		} else if (i + 2 < len && (hi = hex_value(s[i + 1])) >= 0 && (lo = hex_value(s[i + 2])) >= 0) {
+			s[o++] = (char)(hi << 4 | lo);
+			i += 3;
+		} else {
+			s[o++] = s[i++];
+		}
+		// move the plain run that follows
+		next = skip_plain(s, i, len, form);
+		memmove(s + o, s + i, next - i);
+		o += next - i;
+		i = next;
+	}
+	return o;
+}
+
+void uv_httpd_decode(uv_httpd_request_t* req, uv_httpd_string_t* str, int form) {
+	str->len = uv_httpd_percent_decode((char*)req->base + str->offset, str->len, form);
+}
@@ -0,0 +1,39 @@
+#ifndef __UV_HTTPD_URL_H__
+#define __UV_HTTPD_URL_H__
+
+#pragma once
+
+#include "uv_httpd.h"
+
+// url components and query parameters as views into `req->base`, nothing is copied.
+
+typedef struct {
+	uv_httpd_string_t path; // without scheme and authority of an absolute url
+	uv_httpd_string_t query; // without `?`
+	uv_httpd_string_t fragment; // without `#`
+}uv_httpd_url_t;
+
+typedef struct {
+	const char* base;
+	size_t pos, end;
+}uv_httpd_query_iter_t;
+
+void uv_httpd_url_parse(const uv_httpd_request_t* req, uv_httpd_url_t* url);
+
+// iterate `key=value` pairs of the query, empty pairs are skipped,
+// `value` is empty if there is no `=`. keys and values are not decoded.
+void uv_httpd_query_init(uv_httpd_query_iter_t* iter, const uv_httpd_request_t* req, const uv_httpd_url_t* url);
+// return 1 if a pair is found, 0 at the end
+int uv_httpd_query_next(uv_httpd_query_iter_t* iter, uv_httpd_string_t* key, uv_httpd_string_t* value);
+// find the first value of raw `key`, return 1 if found, otherwise 0
+int uv_httpd_query_get(const uv_httpd_request_t* req, const uv_httpd_url_t* url,
+					   const char* key, uv_httpd_string_t* value);
+
+// percent-decode `s` in place, `+` is decoded to space if `form`.
+// invalid escapes are kept as is. return the decoded length
+size_t uv_httpd_percent_decode(char* s, size_t len, int form);
+// decode `str` of `req` in place, `str->len` is updated.
+// the request buffer is modified, other strings are not affected.
+void uv_httpd_decode(uv_httpd_request_t* req, uv_httpd_string_t* str, int form);
+
+#endif
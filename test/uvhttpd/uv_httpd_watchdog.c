@@ -0,0 +1,247 @@
+#include <stdlib.h>
+#include <string.h>
+#include "uv_httpd_watchdog.h"
+#include "uv_log.h"
+
+// the loop thread publishes `running` and `polling` before bumping `seq`,
+// the watchdog thread reads `seq` first
+#ifdef _MSC_VER
+// the fields are volatile, their accesses are acquire and release by /volatile:ms,
+// the default on x86 and x64
+#define LOAD_ACQUIRE(p) (*(p))
+#define STORE_RELEASE(p, v) (*(p) = (v))
+#else
+#define LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+
+#define NS_PER_MS 1000000
+
+struct uv_httpd_watchdog_s {
+	uv_loop_t* loop;
+	uv_prepare_t prepare;
+	uv_check_t check;
+	int closed; // handles closed
+	uint64_t threshold; // ns
+	uint64_t last_prepare; // hrtime
+	uint64_t last_idle; // uv_metrics_idle_time
+	// written by the loop thread only, read by the watchdog thread.
+	// `seq` changes on every beat and every callback entered or left.
+	volatile unsigned int seq;
+	volatile int polling; // between prepare and check
+	const char* volatile running; // uv_httpd callback, NULL if none
+	// the watchdog thread, `offenders` and `stop` are guarded by `mutex`
+	uv_thread_t thread;
+	uv_mutex_t mutex;
+	uv_cond_t cond;
+	int stop;
+	uv_httpd_watchdog_stats_t stats; // offenders are kept by the watchdog thread
+};
+
+
+/*************************** watchdog thread ****************/
+
+static void add_offender(uv_httpd_watchdog_t* wd, const char* name, uint64_t ms) {
+	uv_httpd_watchdog_stats_t* stats = &wd->stats;
+	uv_httpd_watchdog_offender_t* o = NULL;
+	size_t i;
+
+	for (i = 0; i < stats->n_offenders; i++) {
+		if (strcmp(stats->offenders[i].name, name) == 0) {
+			o = &stats->offenders[i];
+			break;
+		}
+	}
+	if (!o) {
+		if (stats->n_offenders < UV_HTTPD_WATCHDOG_OFFENDERS) {
+			o = &stats->offenders[stats->n_offenders++];
+		} else {
+			// replace the mildest one
+			o = &stats->offenders[0];
+			for (i = 1; i < stats->n_offenders; i++) {
+				if (stats->offenders[i].max_ms < o->max_ms) {
+					o = &stats->offenders[i];
+				}
+			}
+			if (o->max_ms >= ms) return;
+		}
+		memset(o, 0, sizeof(*o));
+		o->name = name;
+	}
+	o->stalls++;
+	o->total_ms += ms;
+	if (ms > o->max_ms) {
+		o->max_ms = ms;
+	}
+	stats->stalls++;
+}
+
+static void watch(void* arg) {
+	uv_httpd_watchdog_t* wd = arg;
+	uint64_t interval = wd->threshold / 4;
+	uint64_t since = uv_hrtime(), now, ms = 0; // `last_seq` is first seen
+	unsigned int seq, last_seq = LOAD_ACQUIRE(&wd->seq);
+	const char* blocked = NULL; // reported stall in progress
+	const char* ended; // stall to log
+	const char* running;
+	int polling, stop, started;
+
+	do {
+		uv_mutex_lock(&wd->mutex);
+		if (!wd->stop) {
+			uv_cond_timedwait(&wd->cond, &wd->mutex, interval);
+		}
+		stop = wd->stop;
+		now = uv_hrtime();
+		seq = LOAD_ACQUIRE(&wd->seq);
+		polling = LOAD_ACQUIRE(&wd->polling);
+		running = LOAD_ACQUIRE(&wd->running);
+		ended = NULL;
+		started = 0;
+		if (seq != last_seq || (polling && !running)) {
+			if (blocked) {
+				ms = (now - since) / NS_PER_MS;
+				add_offender(wd, blocked, ms);
+				ended = blocked;
+				blocked = NULL;
+			}
+			last_seq = seq;
+			since = now;
+		} else if (!blocked && now - since >= wd->threshold) {
+			blocked = running ? running : "loop";
+			started = 1;
+		}
+		uv_mutex_unlock(&wd->mutex);
+
+		if (ended) {
+			uvlog_warn("uv_httpd loop was blocked for %llums in %s", (unsigned long long)ms, ended);
+		}
+		if (started) {
+			uvlog_warn("uv_httpd loop is blocked in %s", blocked);
+		}
+	} while (!stop);
+}
+
+
+/*************************** loop ****************/
+
+static void on_prepare(uv_prepare_t* handle) {
+	uv_httpd_watchdog_t* wd = handle->data;
+	uv_httpd_watchdog_stats_t* stats = &wd->stats;
+	uint64_t now = uv_hrtime();
+	uint64_t idle = uv_metrics_idle_time(wd->loop);
+	uint64_t lag, ms;
+	int bucket = 0;
+
+	if (wd->last_prepare) {
+		lag = now - wd->last_prepare - (idle - wd->last_idle);
+		stats->iterations++;
+		stats->busy_ns += lag;
+		stats->idle_ns += idle - wd->last_idle;
+		if (lag > stats->lag_max_ns) {
+			stats->lag_max_ns = lag;
+		}
+		for (ms = lag / NS_PER_MS; ms && bucket < UV_HTTPD_WATCHDOG_BUCKETS - 1; ms >>= 1) {
+			bucket++;
+		}
+		stats->lag[bucket]++;
+	}
+	wd->last_prepare = now;
+	wd->last_idle = idle;
+	STORE_RELEASE(&wd->polling, 1);
+	STORE_RELEASE(&wd->seq, wd->seq + 1);
+}
+
+static void on_check(uv_check_t* handle) {
+	uv_httpd_watchdog_t* wd = handle->data;
+	STORE_RELEASE(&wd->polling, 0);
+	STORE_RELEASE(&wd->seq, wd->seq + 1);
+}
+
+static void on_closed(uv_handle_t* handle) {
+	uv_httpd_watchdog_t* wd = handle->data;
+	if (++wd->closed == 2) {
+		free(wd);
+	}
+}
+
+int uv_httpd_watchdog_create(uv_httpd_watchdog_t** wd, uv_loop_t* loop, uint64_t threshold) {
+	int r;
+	uv_httpd_watchdog_t* w = calloc(1, sizeof(*w));
+	if (!w) return UV_ENOMEM;
+	w->loop = loop;
+	w->threshold = (threshold ? threshold : 1) * NS_PER_MS;
+	// idle time is accounted from now on
+	r = uv_loop_configure(loop, UV_METRICS_IDLE_TIME);
+	if (r) {
+		free(w);
+		return r;
+	}
+	if ((r = uv_mutex_init(&w->mutex))) {
+		free(w);
+		return r;
+	}
+	if ((r = uv_cond_init(&w->cond))) {
+		uv_mutex_destroy(&w->mutex);
+		free(w);
+		return r;
+	}
+	uv_prepare_init(loop, &w->prepare);
+	uv_check_init(loop, &w->check);
+	w->prepare.data = w->check.data = w;
+	uv_prepare_start(&w->prepare, on_prepare);
+	uv_check_start(&w->check, on_check);
+	uv_unref((uv_handle_t*)&w->prepare);
+	uv_unref((uv_handle_t*)&w->check);
+	if ((r = uv_thread_create(&w->thread, watch, w))) {
+		uv_cond_destroy(&w->cond);
+		uv_mutex_destroy(&w->mutex);
+		uv_close((uv_handle_t*)&w->prepare, on_closed);
+		uv_close((uv_handle_t*)&w->check, on_closed);
+		return r;
+	}
+	*wd = w;
+	return 0;
+}
+
+void uv_httpd_watchdog_free(uv_httpd_watchdog_t* wd) {
+	uv_mutex_lock(&wd->mutex);
+	wd->stop = 1;
+	uv_cond_signal(&wd->cond);
+	uv_mutex_unlock(&wd->mutex);
+	uv_thread_join(&wd->thread);
+	uv_cond_destroy(&wd->cond);
+	uv_mutex_destroy(&wd->mutex);
+	uv_close((uv_handle_t*)&wd->prepare, on_closed);
+	uv_close((uv_handle_t*)&wd->check, on_closed);
+}
+
+void uv_httpd_watchdog_stats(uv_httpd_watchdog_t* wd, uv_httpd_watchdog_stats_t* stats) {
+	size_t i, j;
+	uv_mutex_lock(&wd->mutex);
+	*stats = wd->stats;
+	uv_mutex_unlock(&wd->mutex);
+	// few of them, insertion sort by the longest stall
+	for (i = 1; i < stats->n_offenders; i++) {
+		uv_httpd_watchdog_offender_t o = stats->offenders[i];
+		for (j = i; j > 0 && stats->offenders[j - 1].max_ms < o.max_ms; j--) {
+			stats->offenders[j] = stats->offenders[j - 1];
+		}
+		stats->offenders[j] = o;
+	}
+}
+
+const char* uv_httpd_watchdog_enter(uv_httpd_watchdog_t* wd, const char* name) {
+	const char* prev;
+	if (!wd) return NULL;
+	prev = wd->running;
+	STORE_RELEASE(&wd->running, name);
+	STORE_RELEASE(&wd->seq, wd->seq + 1);
+	return prev;
+}
+
+void uv_httpd_watchdog_leave(uv_httpd_watchdog_t* wd, const char* prev) {
+	if (!wd) return;
+	STORE_RELEASE(&wd->running, prev);
+	STORE_RELEASE(&wd->seq, wd->seq + 1);
+}
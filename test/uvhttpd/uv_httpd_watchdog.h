@@ -0,0 +1,62 @@
+#ifndef __UV_HTTPD_WATCHDOG_H__
+#define __UV_HTTPD_WATCHDOG_H__
+
+#pragma once
+
+#include <uv.h>
+
+// event loop lag watchdog, see `server->watchdog`.
+// a `uv_prepare_t`/`uv_check_t` pair beats around the poll phase, and uv_httpd marks
+// the callback it is running, e.g. `on_request`. a watchdog thread samples both every
+// `threshold / 4` ms: if neither changed for `threshold` ms while not idle in poll,
+// the loop is blocked, a warning is logged and the stall is attributed to the callback,
+// or to "loop" outside of uv_httpd callbacks, e.g. a timer of the application.
+// callbacks of other handles in the poll phase look idle.
+// stalls are measured by sampling, accurate to about `threshold / 4` ms.
+// the lag of every loop iteration, the time it did not wait in poll, goes to a histogram.
+
+#ifndef UV_HTTPD_WATCHDOG_THRESHOLD
+#define UV_HTTPD_WATCHDOG_THRESHOLD 100 // ms
+#endif
+
+// bucket 0 is under 1ms, bucket i is [2^(i-1), 2^i) ms, the last one has the rest
+#define UV_HTTPD_WATCHDOG_BUCKETS 12
+// the worst offenders kept, by the longest stall
+#define UV_HTTPD_WATCHDOG_OFFENDERS 8
+
+typedef struct uv_httpd_watchdog_s uv_httpd_watchdog_t;
+
+typedef struct {
+	const char* name; // the callback blocking the loop, or "loop"
+	uint64_t stalls;
+	uint64_t total_ms;
+	uint64_t max_ms;
+}uv_httpd_watchdog_offender_t;
+
+typedef struct {
+	uint64_t iterations;
+	uint64_t busy_ns; // loop time outside of poll waits
+	uint64_t idle_ns;
+	uint64_t lag_max_ns; // the longest iteration
+	uint64_t lag[UV_HTTPD_WATCHDOG_BUCKETS];
+	uint64_t stalls; // lags over the threshold seen by the watchdog thread
+	size_t n_offenders;
+	uv_httpd_watchdog_offender_t offenders[UV_HTTPD_WATCHDOG_OFFENDERS]; // the longest stall first
+}uv_httpd_watchdog_stats_t;
+
+// start watching `loop`, the handles do not keep it alive.
+// return 0 for success, otherwise it is `uv_errno_t`
+int uv_httpd_watchdog_create(uv_httpd_watchdog_t** wd, uv_loop_t* loop, uint64_t threshold);
+// stop the thread, freed when the handles are closed
+void uv_httpd_watchdog_free(uv_httpd_watchdog_t* wd);
+// call it on the loop thread
+void uv_httpd_watchdog_stats(uv_httpd_watchdog_t* wd, uv_httpd_watchdog_stats_t* stats);
+
+/*************************** attribution, called by uv_httpd.c ****************/
+
+// `name` is running, until `uv_httpd_watchdog_leave` with the returned name.
+// `name` must be a string literal, `wd` may be NULL
+const char* uv_httpd_watchdog_enter(uv_httpd_watchdog_t* wd, const char* name);
+void uv_httpd_watchdog_leave(uv_httpd_watchdog_t* wd, const char* prev);
+
+#endif
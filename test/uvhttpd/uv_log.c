@@ -17,13 +17,22 @@ uv_log_level_t uv_log_get_level() {
 static void log_raw(uv_log_level_t level, const char* msg) {
 	size_t off;
 	uv_timeval64_t now;
+	time_t sec;
+	struct tm tm;
 	char buf[64];
 	const char* c = "ADIWEF";
 
 	if (level < g_level || level > uv_log_level_fatal) return;
 	
 	uv_gettimeofday(&now);
-	off = strftime(buf, sizeof(buf), "%b %d %H:%M:%S.", localtime(&now.tv_sec));
+	sec = (time_t)now.tv_sec;
+	// called from other threads too, `localtime` shares its result
+#ifdef _WIN32
+	localtime_s(&tm, &sec);
+#else
+	localtime_r(&sec, &tm);
+#endif
+	off = strftime(buf, sizeof(buf), "%b %d %H:%M:%S.", &tm);
 	snprintf(buf + off, sizeof(buf) - off, "%03d", (int)(now.tv_usec / 1000));
 	fprintf(stdout, "%s %c %s\n", buf, c[level], msg);
 }